@@ -0,0 +1,191 @@
+/*
+ * bench-ack-burst: measure how fast the encoder processes a burst of
+ * Section Acknowledgements arriving on the decoder stream.
+ *
+ * The encoder is loaded with header blocks that reference unacknowledged
+ * dynamic table entries, so that they are all at risk.  Then all of them
+ * are acknowledged in a single decoder stream chunk (or, with -1, one
+ * instruction per lsqpack_enc_decoder_in() call).
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef WIN32
+#include <getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "lsqpack.h"
+#include "lsxpack_header.h"
+
+unsigned char *
+lsqpack_enc_int (unsigned char *dst, unsigned char *const end, uint64_t value,
+                                                        unsigned prefix_bits);
+
+static void
+usage (const char *name)
+{
+    fprintf(stderr,
+"Usage: %s [options]\n"
+"\n"
+"Options:\n"
+"   -n NUMBER   Number of Section Acknowledgements in a burst.  Defaults\n"
+"                 to 1000.\n"
+"   -r NUMBER   Number of bursts.  Defaults to 100.\n"
+"   -t NUMBER   Dynamic table size.  Defaults to 65536.\n"
+"   -1          Feed one instruction per lsqpack_enc_decoder_in() call.\n"
+"\n"
+"   -h          Print this help screen and exit\n"
+    , name);
+}
+
+
+/* Encode `n_streams' header blocks, each inserting a new entry, and write
+ * the Section Acknowledgements for all of them to `acks'.  The size of each
+ * instruction is written to `ack_lens'.  Returns the size of the
+ * acknowledgements.
+ */
+static size_t
+load_encoder (struct lsqpack_enc *enc, unsigned dyn_table_size,
+                unsigned n_streams, unsigned char *acks, size_t acks_sz,
+                unsigned char *ack_lens)
+{
+    unsigned char enc_buf[0x100], hdr_buf[0x100], prefix_buf[0x20];
+    unsigned char tsu_buf[LSQPACK_LONGEST_SDTC];
+    unsigned char *const acks_end = acks + acks_sz;
+    unsigned char *p, *ack;
+    size_t enc_sz, hdr_sz, tsu_buf_sz;
+    struct lsxpack_header xhdr;
+    enum lsqpack_enc_status st;
+    char line[0x40];
+    uint64_t stream_id;
+    unsigned i;
+    int len;
+
+    tsu_buf_sz = sizeof(tsu_buf);
+    if (0 != lsqpack_enc_init(enc, NULL, dyn_table_size, dyn_table_size,
+                n_streams, LSQPACK_ENC_OPT_IX_AGGR|LSQPACK_ENC_OPT_NO_MEM_GUARD,
+                tsu_buf, &tsu_buf_sz))
+    {
+        perror("lsqpack_enc_init");
+        exit(EXIT_FAILURE);
+    }
+
+    ack = acks;
+    for (i = 0; i < n_streams; ++i)
+    {
+        stream_id = i * 4;
+        if (0 != lsqpack_enc_start_header(enc, stream_id, 0))
+        {
+            fprintf(stderr, "cannot start header\n");
+            exit(EXIT_FAILURE);
+        }
+        len = snprintf(line, sizeof(line), "x-stream%u", i);
+        lsxpack_header_set_offset2(&xhdr, line, 0, 8, 8, len - 8);
+        enc_sz = sizeof(enc_buf);
+        hdr_sz = sizeof(hdr_buf);
+        st = lsqpack_enc_encode(enc, enc_buf, &enc_sz, hdr_buf, &hdr_sz,
+                                                                    &xhdr, 0);
+        if (st != LQES_OK)
+        {
+            fprintf(stderr, "cannot encode header\n");
+            exit(EXIT_FAILURE);
+        }
+        if (0 >= lsqpack_enc_end_header(enc, prefix_buf, sizeof(prefix_buf),
+                                                                        NULL))
+        {
+            fprintf(stderr, "cannot end header\n");
+            exit(EXIT_FAILURE);
+        }
+        *ack = 0x80;
+        p = lsqpack_enc_int(ack, acks_end, stream_id, 7);
+        assert(p > ack);
+        ack_lens[i] = (unsigned char) (p - ack);
+        ack = p;
+    }
+
+    return ack - acks;
+}
+
+
+int
+main (int argc, char **argv)
+{
+    unsigned n_acks = 1000, n_bursts = 100, dyn_table_size = 0x10000;
+    int opt, one_by_one = 0;
+    struct lsqpack_enc enc;
+    unsigned char *acks, *ack_lens, *p;
+    size_t acks_sz;
+    clock_t start, total;
+    unsigned i, j;
+
+    while (-1 != (opt = getopt(argc, argv, "n:r:t:1h")))
+    {
+        switch (opt)
+        {
+        case 'n':
+            n_acks = atoi(optarg);
+            break;
+        case 'r':
+            n_bursts = atoi(optarg);
+            break;
+        case 't':
+            dyn_table_size = atoi(optarg);
+            break;
+        case '1':
+            one_by_one = 1;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    acks_sz = (size_t) n_acks * LSQPACK_LONGEST_HEADER_ACK;
+    acks = malloc(acks_sz);
+    ack_lens = malloc(n_acks);
+    if (!acks || !ack_lens)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    total = 0;
+    for (i = 0; i < n_bursts; ++i)
+    {
+        acks_sz = load_encoder(&enc, dyn_table_size, n_acks,
+                            acks, (size_t) n_acks * LSQPACK_LONGEST_HEADER_ACK,
+                            ack_lens);
+        start = clock();
+        if (one_by_one)
+        {
+            for (p = acks, j = 0; j < n_acks; p += ack_lens[j++])
+                if (0 != lsqpack_enc_decoder_in(&enc, p, ack_lens[j]))
+                {
+                    fprintf(stderr, "decoder stream error\n");
+                    exit(EXIT_FAILURE);
+                }
+        }
+        else if (0 != lsqpack_enc_decoder_in(&enc, acks, acks_sz))
+        {
+            fprintf(stderr, "decoder stream error\n");
+            exit(EXIT_FAILURE);
+        }
+        total += clock() - start;
+        lsqpack_enc_cleanup(&enc);
+    }
+
+    printf("%u bursts of %u acks: %.3f usec per burst\n", n_bursts, n_acks,
+                    (double) total * 1000000 / CLOCKS_PER_SEC / n_bursts);
+
+    free(ack_lens);
+    free(acks);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,591 @@
+/*
+ * bench-codec: microbenchmarks for the integer and Huffman codecs.
+ *
+ * The strings are names and values taken from QIF files given on the
+ * command line.  Each kernel is run over three inputs with the same length
+ * distribution:
+ *
+ *  corpus      The strings themselves;
+ *  random      Random printable ASCII;
+ *  longcode    Random bytes whose Huffman codes are 28 bits or longer.
+ *
+ * The integers are the string lengths for the corpus input, log-uniformly
+ * distributed 64-bit values for the random input, and UINT64_MAX -- the
+ * longest encoding -- for the longcode input.
+ *
+ * The resumable decoders -- lsqpack_dec_int() and lsqpack_huff_decode_full()
+ * -- are also run with their input chopped into 1-, 7-, and 64-byte
+ * fragments.  Results are printed to stdout as JSON and include the
+ * LS_QPACK_USE_LARGE_TABLES setting, so that runs of different builds can
+ * be compared.
+ *
+ * This program uses library internals exported in LSQPACK_DEVEL_MODE only.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#include <getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "lsqpack.h"
+#include "lsqpack-test.h"
+#include "bench.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static void
+usage (const char *name)
+{
+    fprintf(stderr,
+"Usage: %s [options] file.qif [file.qif ...]\n"
+"\n"
+"Options:\n"
+"   -n NUMBER   Number of iterations over each input.  Defaults to 100.\n"
+"   -k NAME     Only run this kernel.  May be specified more than once.\n"
+"   -r SEED     Seed for random inputs.  Defaults to 1.\n"
+"\n"
+"   -h          Print this help screen and exit\n"
+    , name);
+}
+
+
+/* A set of strings stored back to back in a single buffer */
+struct strset
+{
+    unsigned char  *buf;
+    unsigned       *offs;       /* n_strs + 1 elements */
+    unsigned        n_strs;
+};
+
+#define STR(set, n) ((set)->buf + (set)->offs[n])
+#define STR_LEN(set, n) ((set)->offs[(n) + 1] - (set)->offs[n])
+#define SET_BYTES(set) ((set)->offs[(set)->n_strs])
+
+struct input
+{
+    const char     *name;
+    struct strset   plain;
+    struct strset   huff;       /* Huffman-encoded `plain' */
+    struct strset   ints;       /* `vals' encoded with 7-bit prefix */
+    uint64_t       *vals;
+};
+
+struct result
+{
+    const char     *kernel;
+    const char     *input;
+    unsigned        fragment;   /* Zero means whole input */
+    double          seconds;
+    unsigned long long n_items, n_bytes;
+};
+
+static unsigned s_n_iters = 100;
+static const char *s_kernels[16];
+static unsigned s_n_kernels;
+static uint64_t s_rand_state = 1;
+static volatile unsigned long long s_sink;
+static int s_first_result = 1;
+
+
+static uint64_t
+rand64 (void)
+{
+    /* xorshift64* */
+    s_rand_state ^= s_rand_state >> 12;
+    s_rand_state ^= s_rand_state << 25;
+    s_rand_state ^= s_rand_state >> 27;
+    return s_rand_state * 2685821657736338717ull;
+}
+
+
+static void
+strset_init (struct strset *set, const unsigned *lens, unsigned n_strs,
+                                                            size_t max_bytes)
+{
+    unsigned n;
+
+    set->buf = malloc(max_bytes ? max_bytes : 1);
+    set->offs = malloc((n_strs + 1) * sizeof(set->offs[0]));
+    if (!set->buf || !set->offs)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    set->n_strs = n_strs;
+    set->offs[0] = 0;
+    if (lens)
+        for (n = 0; n < n_strs; ++n)
+            set->offs[n + 1] = set->offs[n] + lens[n];
+}
+
+
+static void
+strset_cleanup (struct strset *set)
+{
+    free(set->buf);
+    free(set->offs);
+}
+
+
+enum int_kind { INTS_LENGTHS, INTS_RANDOM, INTS_MAX, };
+
+/* Fill in Huffman encodings of the plain strings and generate integers */
+static void
+input_encode (struct input *in, enum int_kind int_kind)
+{
+    const struct strset *const plain = &in->plain;
+    unsigned char *p;
+    unsigned n;
+
+    strset_init(&in->huff, NULL, plain->n_strs, SET_BYTES(plain) * 4);
+    for (n = 0; n < plain->n_strs; ++n)
+    {
+        p = qenc_huffman_enc(STR(plain, n), STR(plain, n) + STR_LEN(plain, n),
+                                                        STR(&in->huff, n));
+        in->huff.offs[n + 1] = (unsigned) (p - in->huff.buf);
+    }
+
+    in->vals = malloc(plain->n_strs * sizeof(in->vals[0]));
+    strset_init(&in->ints, NULL, plain->n_strs,
+                                    plain->n_strs * LSQPACK_UINT64_ENC_SZ);
+    if (!in->vals)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (n = 0; n < plain->n_strs; ++n)
+    {
+        switch (int_kind)
+        {
+        case INTS_LENGTHS:
+            in->vals[n] = STR_LEN(plain, n);
+            break;
+        case INTS_RANDOM:
+            in->vals[n] = rand64() >> (rand64() % 64);
+            break;
+        default:
+            in->vals[n] = UINT64_MAX;
+            break;
+        }
+        *STR(&in->ints, n) = 0;
+        p = lsqpack_enc_int(STR(&in->ints, n),
+                    in->ints.buf + plain->n_strs * LSQPACK_UINT64_ENC_SZ,
+                    in->vals[n], 7);
+        assert(p > STR(&in->ints, n));
+        in->ints.offs[n + 1] = (unsigned) (p - in->ints.buf);
+    }
+}
+
+
+static void
+input_cleanup (struct input *in)
+{
+    strset_cleanup(&in->plain);
+    strset_cleanup(&in->huff);
+    strset_cleanup(&in->ints);
+    free(in->vals);
+}
+
+
+static void
+load_corpus (struct input *in, char **paths, unsigned n_paths)
+{
+    struct bench_qif qif;
+    const struct bench_field *field;
+    unsigned *lens, n_strs, i, n;
+    size_t n_bytes;
+
+    lens = NULL;
+    n_strs = 0;
+    n_bytes = 0;
+    for (i = 0; i < n_paths; ++i)
+    {
+        bench_qif_load(&qif, paths[i]);
+        lens = realloc(lens, (n_strs + qif.n_fields * 2) * sizeof(lens[0]));
+        if (!lens)
+        {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        for (n = 0; n < qif.n_fields; ++n)
+        {
+            lens[n_strs++] = qif.fields[n].name_len;
+            lens[n_strs++] = qif.fields[n].val_len;
+            n_bytes += qif.fields[n].name_len + qif.fields[n].val_len;
+        }
+        bench_qif_cleanup(&qif);
+    }
+
+    in->name = "corpus";
+    strset_init(&in->plain, lens, n_strs, n_bytes);
+    for (n_strs = 0, i = 0; i < n_paths; ++i)
+    {
+        bench_qif_load(&qif, paths[i]);
+        for (n = 0; n < qif.n_fields; ++n)
+        {
+            field = &qif.fields[n];
+            memcpy(STR(&in->plain, n_strs++), qif.buf + field->name_offset,
+                                                            field->name_len);
+            memcpy(STR(&in->plain, n_strs++), qif.buf + field->val_offset,
+                                                            field->val_len);
+        }
+        bench_qif_cleanup(&qif);
+    }
+    free(lens);
+    input_encode(in, INTS_LENGTHS);
+}
+
+
+/* Generate strings with the same lengths as `model', drawing bytes from
+ * `alphabet'.
+ */
+static void
+gen_input (struct input *in, const char *name, const struct strset *model,
+                        const unsigned char *alphabet, unsigned alphabet_sz,
+                        enum int_kind int_kind)
+{
+    unsigned i;
+
+    in->name = name;
+    strset_init(&in->plain, NULL, model->n_strs, SET_BYTES(model));
+    memcpy(in->plain.offs, model->offs,
+                                (model->n_strs + 1) * sizeof(model->offs[0]));
+    for (i = 0; i < SET_BYTES(model); ++i)
+        in->plain.buf[i] = alphabet[ rand64() % alphabet_sz ];
+    input_encode(in, int_kind);
+}
+
+
+static int
+kernel_selected (const char *kernel)
+{
+    unsigned n;
+
+    if (s_n_kernels == 0)
+        return 1;
+    for (n = 0; n < s_n_kernels; ++n)
+        if (0 == strcmp(s_kernels[n], kernel))
+            return 1;
+    return 0;
+}
+
+
+static void
+print_result (const struct result *res)
+{
+    printf("%s\n    {\"kernel\": \"%s\", \"input\": \"%s\", \"fragment\": %u, "
+        "\"ns_per_item\": %.2f, \"ns_per_byte\": %.3f, \"mb_per_sec\": %.1f}",
+        s_first_result ? "" : ",", res->kernel, res->input, res->fragment,
+        res->seconds * 1e9 / (res->n_items ? res->n_items : 1),
+        res->seconds * 1e9 / (res->n_bytes ? res->n_bytes : 1),
+        res->seconds > 0 ? res->n_bytes / res->seconds / 1e6 : 0.);
+    s_first_result = 0;
+}
+
+
+static void
+bench_enc_int (const struct input *in)
+{
+    struct result res = { "enc_int", in->name, 0, 0, 0, 0, };
+    unsigned char buf[LSQPACK_UINT64_ENC_SZ], *p;
+    unsigned it, n;
+    double start;
+
+    start = bench_seconds();
+    for (it = 0; it < s_n_iters; ++it)
+        for (n = 0; n < in->plain.n_strs; ++n)
+        {
+            buf[0] = 0;
+            p = lsqpack_enc_int(buf, buf + sizeof(buf), in->vals[n], 7);
+            s_sink += p - buf;
+        }
+    res.seconds = bench_seconds() - start;
+    res.n_items = (unsigned long long) s_n_iters * in->plain.n_strs;
+    res.n_bytes = (unsigned long long) s_n_iters * SET_BYTES(&in->ints);
+    print_result(&res);
+}
+
+
+static void
+bench_dec_int (const struct input *in, unsigned fragment)
+{
+    struct result res = { "dec_int", in->name, fragment, 0, 0, 0, };
+    struct lsqpack_dec_int_state state;
+    const unsigned char *p, *end, *frag_end;
+    uint64_t val;
+    unsigned it, n;
+    double start;
+    int r;
+
+    start = bench_seconds();
+    for (it = 0; it < s_n_iters; ++it)
+    {
+        if (fragment == 0)
+            for (n = 0; n < in->ints.n_strs; ++n)
+            {
+                p = STR(&in->ints, n);
+                state.resume = 0;
+                r = lsqpack_dec_int(&p, p + STR_LEN(&in->ints, n), 7, &val,
+                                                                    &state);
+                assert(r == 0);
+                s_sink += val;
+            }
+        else
+        {
+            /* The stream of integers is cut into fragments without regard
+             * to integer boundaries.
+             */
+            p = in->ints.buf;
+            end = p + SET_BYTES(&in->ints);
+            state.resume = 0;
+            while (p < end)
+            {
+                frag_end = p + MIN(fragment, (unsigned) (end - p));
+                while (p < frag_end)
+                {
+                    r = lsqpack_dec_int(&p, frag_end, 7, &val, &state);
+                    if (r == 0)
+                    {
+                        s_sink += val;
+                        state.resume = 0;
+                    }
+                    else
+                    {
+                        assert(r == -1);
+                        p = frag_end;
+                    }
+                }
+            }
+        }
+    }
+    res.seconds = bench_seconds() - start;
+    res.n_items = (unsigned long long) s_n_iters * in->ints.n_strs;
+    res.n_bytes = (unsigned long long) s_n_iters * SET_BYTES(&in->ints);
+    print_result(&res);
+}
+
+
+static void
+bench_huffman_enc (const struct input *in, unsigned char *dst)
+{
+    struct result res = { "huffman_enc", in->name, 0, 0, 0, 0, };
+    const struct strset *const set = &in->plain;
+    unsigned it, n;
+    double start;
+
+    start = bench_seconds();
+    for (it = 0; it < s_n_iters; ++it)
+        for (n = 0; n < set->n_strs; ++n)
+            s_sink += qenc_huffman_enc(STR(set, n),
+                                    STR(set, n) + STR_LEN(set, n), dst) - dst;
+    res.seconds = bench_seconds() - start;
+    res.n_items = (unsigned long long) s_n_iters * set->n_strs;
+    res.n_bytes = (unsigned long long) s_n_iters * SET_BYTES(set);
+    print_result(&res);
+}
+
+
+static void
+bench_enc_str_size (const struct input *in)
+{
+    struct result res = { "enc_str_size", in->name, 0, 0, 0, 0, };
+    const struct strset *const set = &in->plain;
+    unsigned it, n;
+    double start;
+
+    start = bench_seconds();
+    for (it = 0; it < s_n_iters; ++it)
+        for (n = 0; n < set->n_strs; ++n)
+            s_sink += qenc_enc_str_size(STR(set, n), STR_LEN(set, n));
+    res.seconds = bench_seconds() - start;
+    res.n_items = (unsigned long long) s_n_iters * set->n_strs;
+    res.n_bytes = (unsigned long long) s_n_iters * SET_BYTES(set);
+    print_result(&res);
+}
+
+
+#if LS_QPACK_USE_LARGE_TABLES
+static void
+bench_huff_decode_fast (const struct input *in, unsigned char *dst,
+                                                                int dst_len)
+{
+    struct result res = { "huff_decode_fast", in->name, 0, 0, 0, 0, };
+    const struct strset *const set = &in->huff;
+    struct lsqpack_huff_decode_state state;
+    struct huff_decode_retval rv;
+    unsigned it, n, n_src_full;
+    double start;
+
+    start = bench_seconds();
+    for (it = 0; it < s_n_iters; ++it)
+        for (n = 0; n < set->n_strs; ++n)
+        {
+            state.resume = 0;
+            rv = huff_decode_fast(STR(set, n), STR_LEN(set, n), dst, dst_len,
+                                                    &state, 1, &n_src_full);
+            assert(rv.status == HUFF_DEC_OK);
+            s_sink += rv.n_dst;
+        }
+    res.seconds = bench_seconds() - start;
+    res.n_items = (unsigned long long) s_n_iters * set->n_strs;
+    res.n_bytes = (unsigned long long) s_n_iters * SET_BYTES(set);
+    print_result(&res);
+}
+#endif
+
+
+static void
+bench_huff_decode_full (const struct input *in, unsigned fragment,
+                                            unsigned char *dst, int dst_len)
+{
+    struct result res = { "huff_decode_full", in->name, fragment, 0, 0, 0, };
+    const struct strset *const set = &in->huff;
+    struct lsqpack_huff_decode_state state;
+    struct huff_decode_retval rv;
+    unsigned it, n, off, len, n_dst;
+    double start;
+
+    start = bench_seconds();
+    for (it = 0; it < s_n_iters; ++it)
+        for (n = 0; n < set->n_strs; ++n)
+        {
+            state.resume = 0;
+            len = fragment ? fragment : STR_LEN(set, n);
+            off = 0;
+            n_dst = 0;
+            do
+            {
+                len = MIN(len, STR_LEN(set, n) - off);
+                rv = lsqpack_huff_decode_full(STR(set, n) + off, len,
+                            dst + n_dst, dst_len - n_dst, &state,
+                            off + len == STR_LEN(set, n));
+                off += rv.n_src;
+                n_dst += rv.n_dst;
+            }
+            while (rv.status == HUFF_DEC_END_SRC);
+            assert(rv.status == HUFF_DEC_OK);
+            s_sink += n_dst;
+        }
+    res.seconds = bench_seconds() - start;
+    res.n_items = (unsigned long long) s_n_iters * set->n_strs;
+    res.n_bytes = (unsigned long long) s_n_iters * SET_BYTES(set);
+    print_result(&res);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    static const unsigned fragments[] = { 0, 1, 7, 64, };
+    unsigned char printable[0x7F - 0x20], longcode[0x100];
+    unsigned n_longcode, max_len, dst_sz, i, f;
+    struct input inputs[3];
+    unsigned char *dst;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "n:k:r:h")))
+    {
+        switch (opt)
+        {
+        case 'n':
+            s_n_iters = atoi(optarg);
+            break;
+        case 'k':
+            if (s_n_kernels < sizeof(s_kernels) / sizeof(s_kernels[0]))
+                s_kernels[s_n_kernels++] = optarg;
+            break;
+        case 'r':
+            s_rand_state = strtoull(optarg, NULL, 10);
+            if (s_rand_state == 0)
+                s_rand_state = 1;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < sizeof(printable); ++i)
+        printable[i] = (unsigned char) (0x20 + i);
+    /* Select long codes by encoding each byte separately: a code of 28 bits
+     * or more takes at least four bytes.
+     */
+    for (n_longcode = 0, i = 0; i < 0x100; ++i)
+    {
+        unsigned char byte = (unsigned char) i;
+        if (qenc_enc_str_size(&byte, 1) >= 4)
+            longcode[n_longcode++] = byte;
+    }
+    assert(n_longcode > 0);
+
+    load_corpus(&inputs[0], argv + optind, (unsigned) (argc - optind));
+    gen_input(&inputs[1], "random", &inputs[0].plain, printable,
+                                            sizeof(printable), INTS_RANDOM);
+    gen_input(&inputs[2], "longcode", &inputs[0].plain, longcode, n_longcode,
+                                                                INTS_MAX);
+
+    max_len = 0;
+    for (i = 0; i < inputs[0].plain.n_strs; ++i)
+        if (STR_LEN(&inputs[0].plain, i) > max_len)
+            max_len = STR_LEN(&inputs[0].plain, i);
+    /* Huffman output may be up to 30/8 of input size, plus padding that
+     * the encoder writes a word at a time.
+     */
+    dst_sz = max_len * 4 + 16;
+    dst = malloc(dst_sz);
+    if (!dst)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("{\n"
+           "  \"large_tables\": %d,\n"
+           "  \"strings\": %u,\n"
+           "  \"string_bytes\": %u,\n"
+           "  \"iterations\": %u,\n"
+           "  \"results\": [", LS_QPACK_USE_LARGE_TABLES,
+           inputs[0].plain.n_strs, SET_BYTES(&inputs[0].plain), s_n_iters);
+
+    for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i)
+    {
+        if (kernel_selected("enc_int"))
+            bench_enc_int(&inputs[i]);
+        if (kernel_selected("dec_int"))
+            for (f = 0; f < sizeof(fragments) / sizeof(fragments[0]); ++f)
+                bench_dec_int(&inputs[i], fragments[f]);
+        if (kernel_selected("huffman_enc"))
+            bench_huffman_enc(&inputs[i], dst);
+        if (kernel_selected("enc_str_size"))
+            bench_enc_str_size(&inputs[i]);
+#if LS_QPACK_USE_LARGE_TABLES
+        if (kernel_selected("huff_decode_fast"))
+            bench_huff_decode_fast(&inputs[i], dst, dst_sz);
+#endif
+        if (kernel_selected("huff_decode_full"))
+            for (f = 0; f < sizeof(fragments) / sizeof(fragments[0]); ++f)
+                bench_huff_decode_full(&inputs[i], fragments[f], dst,
+                                                                    dst_sz);
+    }
+    printf("\n  ]\n}\n");
+
+    for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i)
+        input_cleanup(&inputs[i]);
+    free(dst);
+    exit(EXIT_SUCCESS);
+}
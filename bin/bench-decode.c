@@ -0,0 +1,468 @@
+/*
+ * bench-decode: measure decoder throughput over a file produced by
+ * interop-encode.
+ *
+ * The encoded file is loaded into memory once.  It is then decoded -n times
+ * for each combination of table size, number of risked streams, maximum
+ * read size, and decoder options.  Results are printed to stdout as JSON.
+ *
+ * The table size and number of risked streams must be at least as large
+ * as those used to produce the file.
+ */
+
+#if defined(__FreeBSD__) || defined(__DragonFly__) || defined(__NetBSD__)
+#include <sys/endian.h>
+#define bswap_32 bswap32
+#define bswap_64 bswap64
+#elif defined(__OpenBSD__)
+#define bswap_32 swap32
+#define bswap_64 swap64
+#elif defined(__APPLE__)
+#include <libkern/OSByteOrder.h>
+#define bswap_32 OSSwapInt32
+#define bswap_64 OSSwapInt64
+#elif defined(WIN32)
+#define bswap_32 _byteswap_ulong
+#define bswap_64 _byteswap_uint64
+#else
+#include <byteswap.h>
+#endif
+
+#include <assert.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#include <getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "lsqpack.h"
+#include "lsxpack_header.h"
+#include "bench.h"
+
+#define MAX_LIST 16
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static void
+usage (const char *name)
+{
+    fprintf(stderr,
+"Usage: %s [options] -i input\n"
+"\n"
+"Options:\n"
+"   -i FILE     Input file in the format produced by interop-encode.\n"
+"   -n NUMBER   Number of iterations per configuration.  Defaults to 10.\n"
+"   -t LIST     Comma-separated list of dynamic table sizes.  Defaults to\n"
+"                 %u.\n"
+"   -s LIST     Comma-separated list of maximum risked streams.  Defaults\n"
+"                 to %u.\n"
+"   -m LIST     Comma-separated list of maximum read sizes; 0 means that\n"
+"                 the whole header block is passed at once.  Defaults to 0.\n"
+"   -O LIST     Comma-separated list of decoder option sets.  Each set is\n"
+"                 a combination of letters H (HTTP/1.x), N (name hash),\n"
+"                 and V (name/value hash); `-' means no options.  Defaults\n"
+"                 to -,NV.\n"
+"   -B          Delay each encoder stream chunk until after the following\n"
+"                 header block to exercise the blocked header block path.\n"
+"\n"
+"   -h          Print this help screen and exit\n"
+    , name, LSQPACK_DEF_DYN_TABLE_SIZE, LSQPACK_DEF_MAX_RISKED_STREAMS);
+}
+
+
+struct record
+{
+    uint64_t                stream_id;     /* Zero means encoder stream */
+    const unsigned char    *buf;
+    size_t                  size;
+    size_t                  off;
+};
+
+
+struct config
+{
+    unsigned                dyn_table_size;
+    unsigned                max_risked_streams;
+    unsigned                max_read_size;
+    enum lsqpack_dec_opts   dec_opts;
+    const char             *opts_str;
+};
+
+
+struct result
+{
+    double                  seconds;
+    long long               allocs;
+    unsigned long long      n_hblocks;
+    unsigned long long      n_fields;
+    unsigned long long      n_bytes;    /* Decoded names and values */
+};
+
+
+/* Only one header field is being decoded at a time */
+static char s_xhdr_buf[0x10000];
+static struct lsxpack_header s_xhdr;
+static unsigned long long s_n_fields, s_n_bytes;
+
+
+static struct lsxpack_header *
+prepare_decode (void *hblock_ctx, struct lsxpack_header *xhdr, size_t space)
+{
+    if (space > sizeof(s_xhdr_buf))
+        return NULL;
+    if (xhdr)
+    {
+        xhdr->val_len = space;
+        return xhdr;
+    }
+    lsxpack_header_prepare_decode(&s_xhdr, s_xhdr_buf, 0, space);
+    return &s_xhdr;
+}
+
+
+static int
+process_header (void *hblock_ctx, struct lsxpack_header *xhdr)
+{
+    ++s_n_fields;
+    s_n_bytes += xhdr->name_len + xhdr->val_len;
+    return 0;
+}
+
+
+static const struct lsqpack_dec_hset_if hset_if = {
+    .dhi_unblocked      = NULL,
+    .dhi_prepare_decode = prepare_decode,
+    .dhi_process_header = process_header,
+};
+
+
+/* Returns 1 if header block is done, 0 if blocked */
+static int
+read_hblock (struct lsqpack_dec *dec, struct record *rec,
+                                                    const struct config *cfg)
+{
+    unsigned char dec_buf[LSQPACK_LONGEST_HEADER_ACK];
+    enum lsqpack_read_header_status rhs;
+    const unsigned char *p;
+    size_t dec_buf_sz, max_read;
+
+    max_read = cfg->max_read_size ? cfg->max_read_size : SIZE_MAX;
+    do
+    {
+        p = rec->buf + rec->off;
+        dec_buf_sz = sizeof(dec_buf);
+        if (rec->off == 0)
+            rhs = lsqpack_dec_header_in(dec, rec, rec->stream_id, rec->size,
+                        &p, MIN(max_read, rec->size), dec_buf, &dec_buf_sz);
+        else
+            rhs = lsqpack_dec_header_read(dec, rec, &p,
+                        MIN(max_read, rec->size - rec->off), dec_buf,
+                        &dec_buf_sz);
+        rec->off = p - rec->buf;
+    }
+    while (rhs == LQRHS_NEED);
+
+    if (rhs == LQRHS_DONE)
+        return 1;
+    if (rhs == LQRHS_BLOCKED)
+        return 0;
+    fprintf(stderr, "stream %"PRIu64": header block error\n", rec->stream_id);
+    exit(EXIT_FAILURE);
+}
+
+
+static void
+run_once (struct record *recs, const unsigned *order, unsigned n_recs,
+                            const struct config *cfg, struct result *res)
+{
+    struct lsqpack_dec dec;
+    struct record *rec;
+    unsigned n, n_done, n_hblocks;
+    long long allocs;
+    double start;
+
+    for (n = 0; n < n_recs; ++n)
+        recs[n].off = 0;
+
+    lsqpack_dec_init(&dec, NULL, cfg->dyn_table_size, cfg->max_risked_streams,
+                        &hset_if, cfg->dec_opts | LSQPACK_DEC_OPT_DEFER_UNBLOCKED);
+
+    n_done = 0;
+    n_hblocks = 0;
+    s_n_fields = 0;
+    s_n_bytes = 0;
+    allocs = bench_allocs();
+    start = bench_seconds();
+    for (n = 0; n < n_recs; ++n)
+    {
+        rec = &recs[ order[n] ];
+        if (rec->stream_id == 0)
+        {
+            if (0 != lsqpack_dec_enc_in(&dec, rec->buf, rec->size))
+            {
+                fprintf(stderr, "encoder stream error\n");
+                exit(EXIT_FAILURE);
+            }
+            while ((rec = lsqpack_dec_next_unblocked(&dec)))
+                n_done += read_hblock(&dec, rec, cfg);
+        }
+        else
+        {
+            ++n_hblocks;
+            n_done += read_hblock(&dec, rec, cfg);
+        }
+    }
+    res->seconds += bench_seconds() - start;
+    if (allocs >= 0)
+        res->allocs += bench_allocs() - allocs;
+
+    if (n_done != n_hblocks)
+    {
+        fprintf(stderr, "%u header blocks remain blocked\n",
+                                                        n_hblocks - n_done);
+        exit(EXIT_FAILURE);
+    }
+    res->n_hblocks += n_hblocks;
+    res->n_fields += s_n_fields;
+    res->n_bytes += s_n_bytes;
+
+    lsqpack_dec_cleanup(&dec);
+}
+
+
+static int
+parse_opts (const char *str, enum lsqpack_dec_opts *opts)
+{
+    *opts = 0;
+    for ( ; *str && *str != ','; ++str)
+        switch (*str)
+        {
+        case 'H': *opts |= LSQPACK_DEC_OPT_HTTP1X;          break;
+        case 'N': *opts |= LSQPACK_DEC_OPT_HASH_NAME;       break;
+        case 'V': *opts |= LSQPACK_DEC_OPT_HASH_NAMEVAL;    break;
+        case '-':                                           break;
+        default:
+            return -1;
+        }
+    return 0;
+}
+
+
+/* Split file into records.  Empty records are skipped. */
+static struct record *
+load_records (const unsigned char *buf, size_t buf_sz, unsigned *n_recs)
+{
+    struct record *recs = NULL;
+    unsigned n_alloc = 0;
+    uint64_t stream_id;
+    uint32_t size;
+    size_t off;
+
+    *n_recs = 0;
+    for (off = 0; off < buf_sz; off += size)
+    {
+        if (buf_sz - off < sizeof(stream_id) + sizeof(size))
+        {
+            fprintf(stderr, "truncated record at offset %zu\n", off);
+            exit(EXIT_FAILURE);
+        }
+        memcpy(&stream_id, buf + off, sizeof(stream_id));
+        off += sizeof(stream_id);
+        memcpy(&size, buf + off, sizeof(size));
+        off += sizeof(size);
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+        stream_id = bswap_64(stream_id);
+        size = bswap_32(size);
+#endif
+        if (size > buf_sz - off)
+        {
+            fprintf(stderr, "truncated record at offset %zu\n", off);
+            exit(EXIT_FAILURE);
+        }
+        if (size == 0)
+            continue;
+        if (*n_recs >= n_alloc)
+        {
+            n_alloc = n_alloc ? n_alloc * 2 : 256;
+            recs = realloc(recs, n_alloc * sizeof(recs[0]));
+            if (!recs)
+            {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        recs[*n_recs].stream_id = stream_id;
+        recs[*n_recs].buf = buf + off;
+        recs[*n_recs].size = size;
+        recs[*n_recs].off = 0;
+        ++*n_recs;
+    }
+
+    if (*n_recs == 0)
+    {
+        fprintf(stderr, "no records found\n");
+        exit(EXIT_FAILURE);
+    }
+    return recs;
+}
+
+
+int
+main (int argc, char **argv)
+{
+    const char *in_path = NULL;
+    const char *opts_list = "-,NV";
+    unsigned n_iters = 10;
+    unsigned table_sizes[MAX_LIST] = { LSQPACK_DEF_DYN_TABLE_SIZE, },
+             risked_streams[MAX_LIST] = { LSQPACK_DEF_MAX_RISKED_STREAMS, },
+             read_sizes[MAX_LIST] = { 0, };
+    unsigned n_table_sizes = 1, n_risked_streams = 1, n_read_sizes = 1;
+    const char *opts_strs[MAX_LIST];
+    unsigned n_opts_strs;
+    char *file_buf;
+    size_t file_sz;
+    struct record *recs;
+    unsigned *order;
+    unsigned n_recs, pending;
+    struct config cfg;
+    struct result res;
+    unsigned t, s, m, o, i, first;
+    size_t in_bytes;
+    const char *p;
+    double hblocks, fields;
+    int opt, delay_enc = 0;
+
+    while (-1 != (opt = getopt(argc, argv, "i:n:t:s:m:O:Bh")))
+    {
+        switch (opt)
+        {
+        case 'i':
+            in_path = optarg;
+            break;
+        case 'n':
+            n_iters = atoi(optarg);
+            break;
+        case 't':
+            n_table_sizes = bench_parse_list(optarg, table_sizes, MAX_LIST);
+            break;
+        case 's':
+            n_risked_streams = bench_parse_list(optarg, risked_streams,
+                                                                    MAX_LIST);
+            break;
+        case 'm':
+            n_read_sizes = bench_parse_list(optarg, read_sizes, MAX_LIST);
+            break;
+        case 'O':
+            opts_list = optarg;
+            break;
+        case 'B':
+            delay_enc = 1;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!in_path || n_iters == 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    n_opts_strs = 0;
+    for (p = opts_list; n_opts_strs < MAX_LIST; ++p)
+    {
+        if (0 != parse_opts(p, &cfg.dec_opts))
+        {
+            fprintf(stderr, "invalid option set in `%s'\n", opts_list);
+            exit(EXIT_FAILURE);
+        }
+        opts_strs[n_opts_strs++] = p;
+        p += strcspn(p, ",");
+        if (*p == '\0')
+            break;
+    }
+
+    file_buf = bench_read_file(in_path, &file_sz);
+    recs = load_records((unsigned char *) file_buf, file_sz, &n_recs);
+    order = malloc(n_recs * sizeof(order[0]));
+    if (!order)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    /* The same reordering as the one interop-decode does by default */
+    pending = UINT_MAX;
+    in_bytes = 0;
+    for (i = 0, t = 0; i < n_recs; ++i)
+    {
+        in_bytes += recs[i].size;
+        if (delay_enc && recs[i].stream_id == 0)
+        {
+            if (pending != UINT_MAX)
+                order[t++] = pending;
+            pending = i;
+        }
+        else
+            order[t++] = i;
+    }
+    if (pending != UINT_MAX)
+        order[t++] = pending;
+    assert(t == n_recs);
+
+    printf("{\n"
+           "  \"file\": \"%s\",\n"
+           "  \"records\": %u,\n"
+           "  \"iterations\": %u,\n"
+           "  \"results\": [", in_path, n_recs, n_iters);
+    first = 1;
+    for (t = 0; t < n_table_sizes; ++t)
+      for (s = 0; s < n_risked_streams; ++s)
+        for (m = 0; m < n_read_sizes; ++m)
+          for (o = 0; o < n_opts_strs; ++o)
+          {
+            cfg.dyn_table_size = table_sizes[t];
+            cfg.max_risked_streams = risked_streams[s];
+            cfg.max_read_size = read_sizes[m];
+            cfg.opts_str = opts_strs[o];
+            (void) parse_opts(opts_strs[o], &cfg.dec_opts);
+            memset(&res, 0, sizeof(res));
+            for (i = 0; i < n_iters; ++i)
+                run_once(recs, order, n_recs, &cfg, &res);
+            hblocks = (double) res.n_hblocks;
+            fields = res.n_fields ? (double) res.n_fields : 1.;
+            printf("%s\n    {\"table_size\": %u, \"risked_streams\": %u, "
+                "\"max_read_size\": %u, \"opts\": \"%.*s\", "
+                "\"headers_per_sec\": %.0f, \"ns_per_field\": %.1f, "
+                "\"bytes_per_field\": %.2f, \"ratio\": %.4f, ",
+                first ? "" : ",",
+                cfg.dyn_table_size, cfg.max_risked_streams, cfg.max_read_size,
+                (int) strcspn(cfg.opts_str, ","), cfg.opts_str,
+                res.seconds > 0 ? hblocks / res.seconds : 0.,
+                res.seconds * 1e9 / fields,
+                (double) in_bytes * n_iters / fields,
+                res.n_bytes ? (double) in_bytes * n_iters / res.n_bytes : 0.);
+            if (bench_allocs() >= 0)
+                printf("\"allocs_per_op\": %.3f}",
+                                    hblocks ? (double) res.allocs / hblocks : 0.);
+            else
+                printf("\"allocs_per_op\": null}");
+            first = 0;
+          }
+    printf("\n  ]\n}\n");
+
+    free(order);
+    free(recs);
+    free(file_buf);
+    exit(EXIT_SUCCESS);
+}
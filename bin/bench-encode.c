@@ -0,0 +1,336 @@
+/*
+ * bench-encode: measure encoder throughput over a QIF file.
+ *
+ * The QIF file is loaded into memory once.  It is then encoded -n times for
+ * each combination of table size, number of risked streams, acknowledgement
+ * mode, and encoder options.  Results are printed to stdout as JSON.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#include <getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "lsqpack.h"
+#include "lsxpack_header.h"
+#include "bench.h"
+
+#define MAX_LIST 16
+
+unsigned char *
+lsqpack_enc_int (unsigned char *dst, unsigned char *const end, uint64_t value,
+                                                        unsigned prefix_bits);
+
+static void
+usage (const char *name)
+{
+    fprintf(stderr,
+"Usage: %s [options] -i input.qif\n"
+"\n"
+"Options:\n"
+"   -i FILE     Input QIF or BQIF file.\n"
+"   -n NUMBER   Number of iterations per configuration.  Defaults to 10.\n"
+"   -t LIST     Comma-separated list of dynamic table sizes.  Defaults to\n"
+"                 0,4096,65536.\n"
+"   -s LIST     Comma-separated list of maximum risked streams.  Defaults\n"
+"                 to 0,100.\n"
+"   -a LIST     Comma-separated list of acknowledgement modes: 0 means\n"
+"                 header blocks are never acknowledged, 1 means they are\n"
+"                 acknowledged immediately.  Defaults to 0,1.\n"
+"   -O LIST     Comma-separated list of encoder option sets.  Each set is\n"
+"                 a combination of letters S (server), D (no dup), A\n"
+"                 (aggressive indexing), F (frequency sketch), and M (no\n"
+"                 memory guard); `-' means no options.  Defaults to -,A.\n"
+"\n"
+"   -h          Print this help screen and exit\n"
+    , name);
+}
+
+
+struct config
+{
+    unsigned                dyn_table_size;
+    unsigned                max_risked_streams;
+    unsigned                ack_mode;
+    enum lsqpack_enc_opts   enc_opts;
+    const char             *opts_str;
+};
+
+
+struct result
+{
+    double                  seconds;
+    long long               allocs;
+    size_t                  out_bytes;
+};
+
+
+static void
+feed_decoder_stream (struct lsqpack_enc *enc, unsigned char first_byte,
+                                        uint64_t value, unsigned prefix_bits)
+{
+    unsigned char cmd[16], *end;
+
+    cmd[0] = first_byte;
+    end = lsqpack_enc_int(cmd, cmd + sizeof(cmd), value, prefix_bits);
+    assert(end > cmd);
+    if (0 != lsqpack_enc_decoder_in(enc, cmd, end - cmd))
+    {
+        fprintf(stderr, "decoder stream error\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+static void
+run_once (const struct bench_qif *qif, const struct config *cfg,
+            unsigned char *enc_buf, unsigned char *hea_buf, size_t buf_sz,
+            struct result *res)
+{
+    struct lsqpack_enc enc;
+    struct lsxpack_header xhdr;
+    const struct bench_field *field;
+    unsigned char tsu_buf[LSQPACK_LONGEST_SDTC];
+    unsigned char pref_buf[LSQPACK_LONGEST_HEADER_ACK + 0x20];
+    size_t tsu_buf_sz, enc_off, hea_off, enc_sz, hea_sz;
+    unsigned block, n, saved_ins_count;
+    enum lsqpack_enc_status st;
+    ssize_t pref_sz;
+    long long allocs;
+    double start;
+
+    tsu_buf_sz = sizeof(tsu_buf);
+    if (0 != lsqpack_enc_init(&enc, NULL, cfg->dyn_table_size,
+                cfg->dyn_table_size, cfg->max_risked_streams, cfg->enc_opts,
+                tsu_buf, &tsu_buf_sz))
+    {
+        perror("lsqpack_enc_init");
+        exit(EXIT_FAILURE);
+    }
+
+    saved_ins_count = 0;
+    allocs = bench_allocs();
+    start = bench_seconds();
+    for (block = 0; block < qif->n_hblocks; ++block)
+    {
+        if (0 != lsqpack_enc_start_header(&enc, block + 1, 0))
+        {
+            fprintf(stderr, "cannot start header\n");
+            exit(EXIT_FAILURE);
+        }
+        enc_off = 0;
+        hea_off = 0;
+        for (n = qif->hblocks[block]; n < qif->hblocks[block + 1]; ++n)
+        {
+            field = &qif->fields[n];
+            lsxpack_header_set_offset2(&xhdr, qif->buf + field->name_offset,
+                        0, field->name_len,
+                        field->val_offset - field->name_offset, field->val_len);
+            enc_sz = buf_sz - enc_off;
+            hea_sz = buf_sz - hea_off;
+            st = lsqpack_enc_encode(&enc, enc_buf + enc_off, &enc_sz,
+                                    hea_buf + hea_off, &hea_sz, &xhdr, 0);
+            if (st != LQES_OK)
+            {
+                fprintf(stderr, "cannot encode header: %d\n", (int) st);
+                exit(EXIT_FAILURE);
+            }
+            enc_off += enc_sz;
+            hea_off += hea_sz;
+        }
+        pref_sz = lsqpack_enc_end_header(&enc, pref_buf, sizeof(pref_buf),
+                                                                        NULL);
+        if (pref_sz <= 0)
+        {
+            fprintf(stderr, "cannot end header\n");
+            exit(EXIT_FAILURE);
+        }
+        res->out_bytes += enc_off + hea_off + pref_sz;
+        if (cfg->ack_mode)
+        {
+            if (!(2 == pref_sz && pref_buf[0] == 0 && pref_buf[1] == 0))
+                feed_decoder_stream(&enc, 0x80, block + 1, 7);
+            if (enc.qpe_ins_count > saved_ins_count)
+            {
+                feed_decoder_stream(&enc, 0x00,
+                                    enc.qpe_ins_count - saved_ins_count, 6);
+                saved_ins_count = enc.qpe_ins_count;
+            }
+        }
+    }
+    res->seconds += bench_seconds() - start;
+    if (allocs >= 0)
+        res->allocs += bench_allocs() - allocs;
+
+    lsqpack_enc_cleanup(&enc);
+}
+
+
+static int
+parse_opts (const char *str, enum lsqpack_enc_opts *opts)
+{
+    *opts = 0;
+    for ( ; *str && *str != ','; ++str)
+        switch (*str)
+        {
+        case 'S': *opts |= LSQPACK_ENC_OPT_SERVER;          break;
+        case 'D': *opts |= LSQPACK_ENC_OPT_NO_DUP;          break;
+        case 'A': *opts |= LSQPACK_ENC_OPT_IX_AGGR;         break;
+        case 'F': *opts |= LSQPACK_ENC_OPT_FREQ_SKETCH;     break;
+        case 'M': *opts |= LSQPACK_ENC_OPT_NO_MEM_GUARD;    break;
+        case '-':                                           break;
+        default:
+            return -1;
+        }
+    return 0;
+}
+
+
+int
+main (int argc, char **argv)
+{
+    const char *in_path = NULL;
+    const char *opts_list = "-,A";
+    unsigned n_iters = 10;
+    unsigned table_sizes[MAX_LIST] = { 0, 4096, 65536, },
+             risked_streams[MAX_LIST] = { 0, 100, },
+             ack_modes[MAX_LIST] = { 0, 1, };
+    unsigned n_table_sizes = 3, n_risked_streams = 2, n_ack_modes = 2;
+    const char *opts_strs[MAX_LIST];
+    unsigned n_opts_strs;
+    struct bench_qif qif;
+    struct config cfg;
+    struct result res;
+    unsigned char *enc_buf, *hea_buf;
+    size_t buf_sz, block_sz;
+    unsigned t, s, a, o, i, n, first;
+    const char *p;
+    double hblocks, fields;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "i:n:t:s:a:O:h")))
+    {
+        switch (opt)
+        {
+        case 'i':
+            in_path = optarg;
+            break;
+        case 'n':
+            n_iters = atoi(optarg);
+            break;
+        case 't':
+            n_table_sizes = bench_parse_list(optarg, table_sizes, MAX_LIST);
+            break;
+        case 's':
+            n_risked_streams = bench_parse_list(optarg, risked_streams,
+                                                                    MAX_LIST);
+            break;
+        case 'a':
+            n_ack_modes = bench_parse_list(optarg, ack_modes, MAX_LIST);
+            break;
+        case 'O':
+            opts_list = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!in_path || n_iters == 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    n_opts_strs = 0;
+    for (p = opts_list; n_opts_strs < MAX_LIST; ++p)
+    {
+        if (0 != parse_opts(p, &cfg.enc_opts))
+        {
+            fprintf(stderr, "invalid option set in `%s'\n", opts_list);
+            exit(EXIT_FAILURE);
+        }
+        opts_strs[n_opts_strs++] = p;
+        p += strcspn(p, ",");
+        if (*p == '\0')
+            break;
+    }
+
+    bench_qif_load(&qif, in_path);
+
+    /* Encoded header block cannot be much larger than its input: each
+     * string is at most its length plus a few bytes of integer prefix.
+     */
+    buf_sz = 0;
+    for (n = 0; n < qif.n_hblocks; ++n)
+    {
+        block_sz = 32 * (qif.hblocks[n + 1] - qif.hblocks[n]);
+        for (i = qif.hblocks[n]; i < qif.hblocks[n + 1]; ++i)
+            block_sz += qif.fields[i].name_len + qif.fields[i].val_len;
+        if (block_sz > buf_sz)
+            buf_sz = block_sz;
+    }
+    enc_buf = malloc(buf_sz);
+    hea_buf = malloc(buf_sz);
+    if (!enc_buf || !hea_buf)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    hblocks = (double) qif.n_hblocks * n_iters;
+    fields = (double) qif.n_fields * n_iters;
+
+    printf("{\n"
+           "  \"file\": \"%s\",\n"
+           "  \"header_blocks\": %u,\n"
+           "  \"fields\": %u,\n"
+           "  \"iterations\": %u,\n"
+           "  \"results\": [", in_path, qif.n_hblocks, qif.n_fields, n_iters);
+    first = 1;
+    for (t = 0; t < n_table_sizes; ++t)
+      for (s = 0; s < n_risked_streams; ++s)
+        for (a = 0; a < n_ack_modes; ++a)
+          for (o = 0; o < n_opts_strs; ++o)
+          {
+            cfg.dyn_table_size = table_sizes[t];
+            cfg.max_risked_streams = risked_streams[s];
+            cfg.ack_mode = ack_modes[a];
+            cfg.opts_str = opts_strs[o];
+            (void) parse_opts(opts_strs[o], &cfg.enc_opts);
+            memset(&res, 0, sizeof(res));
+            for (i = 0; i < n_iters; ++i)
+                run_once(&qif, &cfg, enc_buf, hea_buf, buf_sz, &res);
+            printf("%s\n    {\"table_size\": %u, \"risked_streams\": %u, "
+                "\"ack_mode\": %u, \"opts\": \"%.*s\", "
+                "\"headers_per_sec\": %.0f, \"ns_per_field\": %.1f, "
+                "\"bytes_per_field\": %.2f, \"ratio\": %.4f, ",
+                first ? "" : ",",
+                cfg.dyn_table_size, cfg.max_risked_streams, cfg.ack_mode,
+                (int) strcspn(cfg.opts_str, ","), cfg.opts_str,
+                res.seconds > 0 ? hblocks / res.seconds : 0.,
+                res.seconds * 1e9 / fields,
+                (double) res.out_bytes / fields,
+                (double) res.out_bytes / ((double) qif.raw_bytes * n_iters));
+            if (bench_allocs() >= 0)
+                printf("\"allocs_per_op\": %.3f}", (double) res.allocs / hblocks);
+            else
+                printf("\"allocs_per_op\": null}");
+            first = 0;
+          }
+    printf("\n  ]\n}\n");
+
+    free(hea_buf);
+    free(enc_buf);
+    bench_qif_cleanup(&qif);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,496 @@
+/*
+ * bench-memory: measure per-connection memory footprint.
+ *
+ * For each table size, -c encoder/decoder pairs are created and each pair
+ * is driven with -b header blocks of QIF traffic: the encoder stream and
+ * header blocks are fed to the decoder and the decoder's Section
+ * Acknowledgements are fed back to the encoder.  Memory held by each part
+ * of the encoder and decoder state is then reported, along with allocator
+ * overhead and RSS.
+ *
+ * To check for fragmentation, the connections are then churned -r times:
+ * in each round, about half of them are torn down and replaced by new ones,
+ * and every connection is driven with one more header block.
+ *
+ * Results are printed to stdout as JSON.  Allocator statistics are only
+ * available with glibc and RSS only on Linux; otherwise they are null.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#include <getopt.h>
+#else
+#include <unistd.h>
+#endif
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#include <malloc.h>
+#define HAVE_MALLINFO2 1
+#endif
+
+#include "lsqpack.h"
+#include "lsxpack_header.h"
+#include "bench.h"
+
+#define MAX_LIST 16
+
+static void
+usage (const char *name)
+{
+    fprintf(stderr,
+"Usage: %s [options] -i input.qif\n"
+"\n"
+"Options:\n"
+"   -i FILE     Input QIF or BQIF file.\n"
+"   -c NUMBER   Number of connections.  Defaults to 10000.\n"
+"   -t LIST     Comma-separated list of dynamic table sizes.  Defaults to\n"
+"                 4096,16384,65536.\n"
+"   -s NUMBER   Maximum risked streams.  Defaults to 100.\n"
+"   -b NUMBER   Number of header blocks to drive each connection with.\n"
+"                 Defaults to 16.\n"
+"   -r NUMBER   Number of churn rounds.  Defaults to 10.\n"
+"\n"
+"   -h          Print this help screen and exit\n"
+    , name);
+}
+
+
+struct conn
+{
+    struct lsqpack_enc      enc;
+    struct lsqpack_dec      dec;
+    uint64_t                next_stream_id;
+    unsigned                next_hblock;
+};
+
+
+/* Memory in bytes, summed over all connections */
+struct footprint
+{
+    size_t      enc_table, enc_buckets, enc_hist, enc_hinfo;
+    size_t      dec_table, dec_ringbuf, dec_read_ctx, dec_other;
+};
+
+
+struct heap
+{
+    long long   in_use;         /* -1 if not available */
+    long long   free;           /* Free bytes held by the allocator */
+    long long   rss;
+};
+
+
+static const struct bench_qif *s_qif;
+static unsigned s_dyn_table_size, s_max_risked_streams = 100;
+static unsigned char *s_enc_buf, *s_hea_buf;
+static size_t s_buf_sz;
+
+/* Only one header field is being decoded at a time */
+static char s_xhdr_buf[0x10000];
+static struct lsxpack_header s_xhdr;
+
+
+static struct lsxpack_header *
+prepare_decode (void *hblock_ctx, struct lsxpack_header *xhdr, size_t space)
+{
+    if (space > sizeof(s_xhdr_buf))
+        return NULL;
+    if (xhdr)
+    {
+        xhdr->val_len = space;
+        return xhdr;
+    }
+    lsxpack_header_prepare_decode(&s_xhdr, s_xhdr_buf, 0, space);
+    return &s_xhdr;
+}
+
+
+static int
+process_header (void *hblock_ctx, struct lsxpack_header *xhdr)
+{
+    return 0;
+}
+
+
+static const struct lsqpack_dec_hset_if hset_if = {
+    .dhi_unblocked      = NULL,
+    .dhi_prepare_decode = prepare_decode,
+    .dhi_process_header = process_header,
+};
+
+
+static void
+heap_measure (struct heap *heap)
+{
+#if HAVE_MALLINFO2
+    struct mallinfo2 mi;
+
+    mi = mallinfo2();
+    heap->in_use = (long long) (mi.uordblks + mi.hblkhd);
+    heap->free = (long long) mi.fordblks;
+#else
+    heap->in_use = -1;
+    heap->free = -1;
+#endif
+
+    heap->rss = -1;
+#ifdef __linux__
+    {
+        FILE *statm;
+        unsigned long size, resident;
+
+        statm = fopen("/proc/self/statm", "r");
+        if (statm)
+        {
+            if (2 == fscanf(statm, "%lu %lu", &size, &resident))
+                heap->rss = (long long) resident * sysconf(_SC_PAGESIZE);
+            (void) fclose(statm);
+        }
+    }
+#endif
+}
+
+
+static void
+conn_init (struct conn *conn, unsigned first_hblock)
+{
+    unsigned char tsu_buf[LSQPACK_LONGEST_SDTC];
+    size_t tsu_buf_sz;
+
+    tsu_buf_sz = sizeof(tsu_buf);
+    if (0 != lsqpack_enc_init(&conn->enc, NULL, s_dyn_table_size,
+                s_dyn_table_size, s_max_risked_streams, 0, tsu_buf,
+                &tsu_buf_sz))
+    {
+        perror("lsqpack_enc_init");
+        exit(EXIT_FAILURE);
+    }
+    lsqpack_dec_init(&conn->dec, NULL, s_dyn_table_size, s_max_risked_streams,
+                                    &hset_if, LSQPACK_DEC_OPT_DEFER_UNBLOCKED);
+    conn->next_stream_id = 0;
+    conn->next_hblock = first_hblock % s_qif->n_hblocks;
+}
+
+
+static void
+conn_cleanup (struct conn *conn)
+{
+    lsqpack_enc_cleanup(&conn->enc);
+    lsqpack_dec_cleanup(&conn->dec);
+}
+
+
+/* Encode next header block, pass it to the decoder, and pass decoder's
+ * acknowledgement back to the encoder.
+ */
+static void
+conn_drive (struct conn *conn)
+{
+    const struct bench_qif *const qif = s_qif;
+    const struct bench_field *field;
+    unsigned char dec_buf[LSQPACK_LONGEST_HEADER_ACK];
+    unsigned char *hblock;
+    const unsigned char *p;
+    struct lsxpack_header xhdr;
+    size_t enc_off, hea_off, enc_sz, hea_sz, dec_buf_sz, pref_max;
+    enum lsqpack_read_header_status rhs;
+    ssize_t pref_sz;
+    unsigned n;
+
+    if (0 != lsqpack_enc_start_header(&conn->enc, conn->next_stream_id, 0))
+    {
+        fprintf(stderr, "cannot start header\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Header block data goes after space reserved for the prefix */
+    pref_max = lsqpack_enc_header_block_prefix_size(&conn->enc);
+    enc_off = 0;
+    hea_off = pref_max;
+    for (n = qif->hblocks[conn->next_hblock];
+                                n < qif->hblocks[conn->next_hblock + 1]; ++n)
+    {
+        field = &qif->fields[n];
+        lsxpack_header_set_offset2(&xhdr, qif->buf + field->name_offset,
+                    0, field->name_len,
+                    field->val_offset - field->name_offset, field->val_len);
+        enc_sz = s_buf_sz - enc_off;
+        hea_sz = s_buf_sz - hea_off;
+        if (LQES_OK != lsqpack_enc_encode(&conn->enc, s_enc_buf + enc_off,
+                            &enc_sz, s_hea_buf + hea_off, &hea_sz, &xhdr, 0))
+        {
+            fprintf(stderr, "cannot encode header\n");
+            exit(EXIT_FAILURE);
+        }
+        enc_off += enc_sz;
+        hea_off += hea_sz;
+    }
+
+    pref_sz = lsqpack_enc_end_header(&conn->enc, s_hea_buf, pref_max, NULL);
+    if (pref_sz <= 0)
+    {
+        fprintf(stderr, "cannot end header\n");
+        exit(EXIT_FAILURE);
+    }
+    hblock = s_hea_buf + pref_max - pref_sz;
+    memmove(hblock, s_hea_buf, pref_sz);
+
+    if (enc_off && 0 != lsqpack_dec_enc_in(&conn->dec, s_enc_buf, enc_off))
+    {
+        fprintf(stderr, "encoder stream error\n");
+        exit(EXIT_FAILURE);
+    }
+
+    p = hblock;
+    dec_buf_sz = sizeof(dec_buf);
+    rhs = lsqpack_dec_header_in(&conn->dec, conn, conn->next_stream_id,
+                hea_off - (hblock - s_hea_buf), &p,
+                hea_off - (hblock - s_hea_buf), dec_buf, &dec_buf_sz);
+    if (rhs != LQRHS_DONE)
+    {
+        fprintf(stderr, "header block error\n");
+        exit(EXIT_FAILURE);
+    }
+    if (dec_buf_sz
+            && 0 != lsqpack_enc_decoder_in(&conn->enc, dec_buf, dec_buf_sz))
+    {
+        fprintf(stderr, "decoder stream error\n");
+        exit(EXIT_FAILURE);
+    }
+
+    conn->next_stream_id += 4;
+    if (++conn->next_hblock >= qif->n_hblocks)
+        conn->next_hblock = 0;
+}
+
+
+static void
+measure_footprint (const struct conn *conns, unsigned n_conns,
+                                                    struct footprint *fp)
+{
+    struct lsqpack_enc_stats enc_stats;
+    struct lsqpack_dec_stats dec_stats;
+    unsigned n;
+
+    memset(fp, 0, sizeof(*fp));
+    for (n = 0; n < n_conns; ++n)
+    {
+        lsqpack_enc_get_stats(&conns[n].enc, &enc_stats);
+        fp->enc_table += enc_stats.es_table_mem;
+        fp->enc_buckets += enc_stats.es_bucket_mem;
+        fp->enc_hist += enc_stats.es_hist_mem;
+        fp->enc_hinfo += enc_stats.es_hinfo_mem;
+        lsqpack_dec_get_stats(&conns[n].dec, &dec_stats);
+        fp->dec_table += dec_stats.ds_table_mem;
+        fp->dec_ringbuf += dec_stats.ds_ringbuf_mem;
+        fp->dec_read_ctx += dec_stats.ds_hblock_mem;
+        fp->dec_other += dec_stats.ds_other_mem;
+    }
+}
+
+
+static size_t
+footprint_total (const struct footprint *fp)
+{
+    return fp->enc_table + fp->enc_buckets + fp->enc_hist + fp->enc_hinfo
+         + fp->dec_table + fp->dec_ringbuf + fp->dec_read_ctx + fp->dec_other;
+}
+
+
+static void
+print_heap_value (const char *name, long long value, double n_conns)
+{
+    if (value >= 0)
+        printf("\"%s\": %.1f", name, (double) value / n_conns);
+    else
+        printf("\"%s\": null", name);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    const char *in_path = NULL;
+    unsigned table_sizes[MAX_LIST] = { 4096, 16384, 65536, };
+    unsigned n_table_sizes = 3, n_conns = 10000, n_hblocks = 16,
+             n_rounds = 10;
+    struct bench_qif qif;
+    struct conn *conns;
+    struct footprint fp;
+    struct heap base, heap, churned;
+    size_t block_sz;
+    long long allocs, heap_overhead;
+    double nc;
+    unsigned t, n, i, round;
+    uint64_t rand_state;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "i:c:t:s:b:r:h")))
+    {
+        switch (opt)
+        {
+        case 'i':
+            in_path = optarg;
+            break;
+        case 'c':
+            n_conns = atoi(optarg);
+            break;
+        case 't':
+            n_table_sizes = bench_parse_list(optarg, table_sizes, MAX_LIST);
+            break;
+        case 's':
+            s_max_risked_streams = atoi(optarg);
+            break;
+        case 'b':
+            n_hblocks = atoi(optarg);
+            break;
+        case 'r':
+            n_rounds = atoi(optarg);
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!in_path || n_conns == 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    bench_qif_load(&qif, in_path);
+    s_qif = &qif;
+
+    s_buf_sz = 0;
+    for (n = 0; n < qif.n_hblocks; ++n)
+    {
+        block_sz = 32 * (qif.hblocks[n + 1] - qif.hblocks[n])
+                                                + LSQPACK_LONGEST_HEADER_ACK;
+        for (i = qif.hblocks[n]; i < qif.hblocks[n + 1]; ++i)
+            block_sz += qif.fields[i].name_len + qif.fields[i].val_len;
+        if (block_sz > s_buf_sz)
+            s_buf_sz = block_sz;
+    }
+    s_enc_buf = malloc(s_buf_sz);
+    s_hea_buf = malloc(s_buf_sz);
+    if (!s_enc_buf || !s_hea_buf)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("{\n"
+           "  \"file\": \"%s\",\n"
+           "  \"connections\": %u,\n"
+           "  \"hblocks_per_conn\": %u,\n"
+           "  \"churn_rounds\": %u,\n"
+           "  \"enc_struct\": %zu,\n"
+           "  \"dec_struct\": %zu,\n"
+           "  \"results\": [", in_path, n_conns, n_hblocks, n_rounds,
+           sizeof(struct lsqpack_enc), sizeof(struct lsqpack_dec));
+
+    nc = (double) n_conns;
+    for (t = 0; t < n_table_sizes; ++t)
+    {
+        s_dyn_table_size = table_sizes[t];
+        heap_measure(&base);
+        allocs = bench_allocs();
+
+        conns = calloc(n_conns, sizeof(conns[0]));
+        if (!conns)
+        {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+        for (n = 0; n < n_conns; ++n)
+        {
+            conn_init(&conns[n], n * 7);
+            for (i = 0; i < n_hblocks; ++i)
+                conn_drive(&conns[n]);
+        }
+
+        measure_footprint(conns, n_conns, &fp);
+        heap_measure(&heap);
+        if (allocs >= 0)
+            allocs = bench_allocs() - allocs;
+        /* What the allocator uses on top of what the library asked for */
+        if (heap.in_use >= 0)
+            heap_overhead = heap.in_use - base.in_use
+                        - (long long) (n_conns * sizeof(conns[0]))
+                        - (long long) footprint_total(&fp);
+        else
+            heap_overhead = -1;
+
+        printf("%s\n    {\"table_size\": %u, \"per_conn\": {"
+            "\"enc_table\": %.1f, \"enc_buckets\": %.1f, "
+            "\"enc_hist\": %.1f, \"enc_hinfo\": %.1f, "
+            "\"dec_table\": %.1f, \"dec_ringbuf\": %.1f, "
+            "\"dec_read_ctx\": %.1f, \"dec_other\": %.1f, "
+            "\"total\": %.1f, ",
+            t ? "," : "", s_dyn_table_size,
+            fp.enc_table / nc, fp.enc_buckets / nc,
+            fp.enc_hist / nc, fp.enc_hinfo / nc,
+            fp.dec_table / nc, fp.dec_ringbuf / nc,
+            fp.dec_read_ctx / nc, fp.dec_other / nc,
+            footprint_total(&fp) / nc
+                    + sizeof(struct lsqpack_enc) + sizeof(struct lsqpack_dec));
+        print_heap_value("allocator_overhead", heap_overhead, nc);
+        printf(", ");
+        print_heap_value("allocs", allocs, nc);
+        printf(", ");
+        print_heap_value("rss", heap.rss >= 0 && base.rss >= 0
+                                    ? heap.rss - base.rss : -1, nc);
+        printf("}, ");
+
+        /* Churn */
+        rand_state = 1;
+        for (round = 0; round < n_rounds; ++round)
+            for (n = 0; n < n_conns; ++n)
+            {
+                rand_state = rand_state * 6364136223846793005ull
+                                                + 1442695040888963407ull;
+                if (rand_state >> 63)
+                {
+                    conn_cleanup(&conns[n]);
+                    conn_init(&conns[n], (unsigned) (rand_state >> 32));
+                    for (i = 0; i < n_hblocks; ++i)
+                        conn_drive(&conns[n]);
+                }
+                else
+                    conn_drive(&conns[n]);
+            }
+
+        heap_measure(&churned);
+        printf("\"after_churn\": {");
+        print_heap_value("heap_in_use", churned.in_use >= 0
+                                ? churned.in_use - base.in_use : -1, nc);
+        printf(", ");
+        print_heap_value("heap_free", churned.free, nc);
+        printf(", ");
+        if (churned.in_use >= 0 && churned.in_use + churned.free > 0)
+            printf("\"fragmentation\": %.4f, ", (double) churned.free
+                                        / (churned.in_use + churned.free));
+        else
+            printf("\"fragmentation\": null, ");
+        print_heap_value("rss", churned.rss >= 0 && base.rss >= 0
+                                    ? churned.rss - base.rss : -1, nc);
+        printf("}}");
+
+        for (n = 0; n < n_conns; ++n)
+            conn_cleanup(&conns[n]);
+        free(conns);
+    }
+    printf("\n  ]\n}\n");
+
+    free(s_hea_buf);
+    free(s_enc_buf);
+    bench_qif_cleanup(&qif);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,850 @@
+/*
+ * bench-netsim: run encoder and decoder over a simulated network.
+ *
+ * An encoder and a decoder run in the same process.  Header blocks from a
+ * QIF file are sent at regular intervals, each on its own request stream.
+ * The encoder stream, the decoder stream, and the request streams are
+ * carried by a simulated network with configurable round-trip time, jitter,
+ * and packet loss:
+ *
+ *  - Data is split into packets of -m bytes.  Each packet takes RTT/2 plus
+ *    a random jitter to arrive.
+ *  - A lost packet is retransmitted 9/8 RTT after it was sent (this is the
+ *    QUIC time threshold for loss detection).  It may be lost again.
+ *  - Each stream delivers data in order, so a late packet holds up the rest
+ *    of its stream.  Different streams are independent and can overtake
+ *    each other.
+ *
+ * The decoder queues decoder stream instructions and flushes them after
+ * processing each arrival.  There is no congestion control and bandwidth is
+ * unlimited.  The simulation is deterministic: the same seed gives the same
+ * results.
+ *
+ * For each combination of table size, number of risked streams, and encoder
+ * options, the following is printed to stdout as JSON:
+ *
+ *  ratio           Encoder and header stream bytes divided by input bytes
+ *  blocked         Number of header blocks that were blocked
+ *  max_blocked     Maximum number of header blocks blocked at the same time
+ *  blocked_ms      Total time header blocks spent blocked
+ *  hol_*_ms        Head-of-line delay: time from arrival of the header block
+ *                    to it being decoded.  Mean, median, p99, and maximum.
+ *  latency_*_ms    Time from sending the header block to it being decoded
+ *  lost            Number of packets lost
+ *
+ * With -v, per-block timings are printed to stderr.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#include <getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "lsqpack.h"
+#include "lsxpack_header.h"
+#include "bench.h"
+
+#define MAX_LIST 16
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+static int s_verbose;
+
+static void
+usage (const char *name)
+{
+    fprintf(stderr,
+"Usage: %s [options] -i input.qif\n"
+"\n"
+"Options:\n"
+"   -i FILE     Input QIF or BQIF file.\n"
+"   -n NUMBER   Send the header blocks in the file this many times.\n"
+"                 Defaults to 1.\n"
+"   -t LIST     Comma-separated list of dynamic table sizes.  Defaults to\n"
+"                 0,4096,65536.\n"
+"   -s LIST     Comma-separated list of maximum risked streams.  Defaults\n"
+"                 to 0,16,100.\n"
+"   -O LIST     Comma-separated list of encoder option sets.  Each set is\n"
+"                 a combination of letters S (server), D (no dup), A\n"
+"                 (aggressive indexing), F (frequency sketch), and M (no\n"
+"                 memory guard); `-' means no options.  Defaults to -,A.\n"
+"   -r MSEC     Round-trip time in milliseconds.  Defaults to 50.\n"
+"   -j MSEC     Maximum one-way jitter in milliseconds.  Defaults to 5.\n"
+"   -l PERCENT  Packet loss in percent.  Defaults to 0.\n"
+"   -I MSEC     Interval between header blocks in milliseconds.  Defaults\n"
+"                 to 1.\n"
+"   -m BYTES    Packet payload size.  Defaults to 1200.\n"
+"   -R NUMBER   Random seed.  Defaults to 1.\n"
+"   -v          Print timings of each header block to stderr.\n"
+"\n"
+"   -h          Print this help screen and exit\n"
+    , name);
+}
+
+
+struct config
+{
+    unsigned                dyn_table_size;
+    unsigned                max_risked_streams;
+    enum lsqpack_enc_opts   enc_opts;
+    const char             *opts_str;
+};
+
+
+/* Network parameters; times are in microseconds */
+struct net
+{
+    uint64_t                rtt;
+    uint64_t                jitter;
+    double                  loss;
+    uint64_t                interval;
+    size_t                  mtu;
+    uint64_t                seed;
+};
+
+
+/* Header block in flight */
+struct hblock
+{
+    unsigned                idx;
+    uint64_t                stream_id;
+    unsigned char          *buf;
+    size_t                  sz;
+    const unsigned char    *p;      /* Next byte to give to the decoder */
+    uint64_t                sent, arrived, done;
+};
+
+
+/* Encoder or decoder stream data in flight */
+struct chunk
+{
+    unsigned char          *buf;
+    size_t                  sz;
+    size_t                  off;    /* Stream offset of the first byte */
+};
+
+
+enum event_type { EV_REQUEST, EV_HBLOCK, EV_ENC_STREAM, EV_DEC_STREAM, };
+
+struct event
+{
+    uint64_t                time;
+    uint64_t                seq;    /* Break ties in order of scheduling */
+    enum event_type         type;
+    void                   *ptr;
+    unsigned                idx;
+};
+
+
+struct sim
+{
+    const struct bench_qif *qif;
+    const struct config    *cfg;
+    const struct net       *net;
+    uint64_t                rand;
+    struct lsqpack_enc      enc;
+    struct lsqpack_dec      dec;
+
+    /* Events ordered by time: binary heap */
+    struct event           *events;
+    unsigned                n_events, n_alloc;
+    uint64_t                seq;
+
+    /* Time when last data on the encoder and decoder streams is delivered */
+    uint64_t                enc_stream_last, dec_stream_last;
+    /* Bytes sent and delivered on the encoder and decoder streams */
+    size_t                  enc_stream_sent, dec_stream_sent;
+    size_t                  enc_stream_dlvd, dec_stream_dlvd;
+
+    struct hblock          *hblocks;
+    unsigned                n_hblocks;
+    unsigned                n_blocked, max_blocked, n_ever_blocked;
+    uint64_t                blocked_time;
+    size_t                  out_bytes;
+    unsigned                n_lost;
+};
+
+
+/* xorshift64* */
+static uint64_t
+sim_rand (struct sim *sim)
+{
+    sim->rand ^= sim->rand >> 12;
+    sim->rand ^= sim->rand << 25;
+    sim->rand ^= sim->rand >> 27;
+    return sim->rand * 0x2545F4914F6CDD1DULL;
+}
+
+
+/* Uniformly distributed in [0, 1) */
+static double
+sim_rand_double (struct sim *sim)
+{
+    return (double) (sim_rand(sim) >> 11) / 9007199254740992.0;
+}
+
+
+#define EV_LESS(a, b) ((a)->time < (b)->time \
+                        || ((a)->time == (b)->time && (a)->seq < (b)->seq))
+
+static void
+sim_schedule (struct sim *sim, uint64_t time, enum event_type type,
+                                                    void *ptr, unsigned idx)
+{
+    struct event ev, tmp;
+    unsigned n, parent;
+
+    if (sim->n_events >= sim->n_alloc)
+    {
+        sim->n_alloc = sim->n_alloc ? sim->n_alloc * 2 : 64;
+        sim->events = realloc(sim->events,
+                                    sim->n_alloc * sizeof(sim->events[0]));
+        if (!sim->events)
+        {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    ev = (struct event) { time, sim->seq++, type, ptr, idx, };
+    n = sim->n_events++;
+    sim->events[n] = ev;
+    while (n > 0)
+    {
+        parent = (n - 1) / 2;
+        if (EV_LESS(&sim->events[parent], &sim->events[n]))
+            break;
+        tmp = sim->events[parent];
+        sim->events[parent] = sim->events[n];
+        sim->events[n] = tmp;
+        n = parent;
+    }
+}
+
+
+static int
+sim_next_event (struct sim *sim, struct event *ev)
+{
+    struct event tmp;
+    unsigned n, child;
+
+    if (sim->n_events == 0)
+        return 0;
+
+    *ev = sim->events[0];
+    sim->events[0] = sim->events[ --sim->n_events ];
+    n = 0;
+    while ((child = n * 2 + 1) < sim->n_events)
+    {
+        if (child + 1 < sim->n_events
+                && EV_LESS(&sim->events[child + 1], &sim->events[child]))
+            ++child;
+        if (!EV_LESS(&sim->events[child], &sim->events[n]))
+            break;
+        tmp = sim->events[child];
+        sim->events[child] = sim->events[n];
+        sim->events[n] = tmp;
+        n = child;
+    }
+    return 1;
+}
+
+
+/* Return time when the last packet carrying `sz' bytes sent at `now'
+ * arrives.
+ */
+static uint64_t
+sim_transmit (struct sim *sim, uint64_t now, size_t sz)
+{
+    const struct net *const net = sim->net;
+    uint64_t arrival, t;
+    size_t n_packets;
+
+    arrival = now;
+    for (n_packets = sz ? (sz + net->mtu - 1) / net->mtu : 1; n_packets > 0;
+                                                                --n_packets)
+    {
+        t = now;
+        while (net->loss > 0 && sim_rand_double(sim) < net->loss)
+        {
+            t += net->rtt * 9 / 8;
+            ++sim->n_lost;
+        }
+        t += net->rtt / 2;
+        if (net->jitter)
+            t += sim_rand(sim) % (net->jitter + 1);
+        arrival = MAX(arrival, t);
+    }
+    return arrival;
+}
+
+
+/* Send data on the encoder or decoder stream.  Takes ownership of `buf'. */
+static void
+sim_send_chunk (struct sim *sim, uint64_t now, enum event_type type,
+                                            unsigned char *buf, size_t sz)
+{
+    uint64_t *const last = type == EV_ENC_STREAM
+                                ? &sim->enc_stream_last : &sim->dec_stream_last;
+    size_t *const sent = type == EV_ENC_STREAM
+                                ? &sim->enc_stream_sent : &sim->dec_stream_sent;
+    struct chunk *chunk;
+    uint64_t arrival;
+
+    chunk = malloc(sizeof(*chunk));
+    if (!chunk)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    chunk->buf = buf;
+    chunk->sz = sz;
+    chunk->off = *sent;
+    *sent += sz;
+    arrival = sim_transmit(sim, now, sz);
+    *last = MAX(*last, arrival);
+    sim_schedule(sim, *last, type, chunk, 0);
+}
+
+
+static unsigned char *
+sim_dup (const unsigned char *buf, size_t sz)
+{
+    unsigned char *copy;
+
+    copy = malloc(sz ? sz : 1);
+    if (!copy)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, buf, sz);
+    return copy;
+}
+
+
+/* Encode header block and send it along with encoder stream output */
+static void
+sim_request (struct sim *sim, uint64_t now, unsigned idx)
+{
+    const struct bench_qif *const qif = sim->qif;
+    const unsigned qif_block = idx % qif->n_hblocks;
+    struct hblock *const hblock = &sim->hblocks[idx];
+    const struct bench_field *field;
+    struct lsxpack_header xhdr;
+    unsigned char enc_buf[0x10000], hea_buf[0x10000];
+    unsigned char pref_buf[0x20];
+    size_t enc_off, hea_off, enc_sz, hea_sz;
+    enum lsqpack_enc_status st;
+    ssize_t pref_sz;
+    unsigned n;
+
+    hblock->idx = idx;
+    hblock->stream_id = (uint64_t) idx * 4;
+    if (0 != lsqpack_enc_start_header(&sim->enc, hblock->stream_id, 0))
+    {
+        fprintf(stderr, "cannot start header\n");
+        exit(EXIT_FAILURE);
+    }
+    enc_off = 0;
+    hea_off = 0;
+    for (n = qif->hblocks[qif_block]; n < qif->hblocks[qif_block + 1]; ++n)
+    {
+        field = &qif->fields[n];
+        lsxpack_header_set_offset2(&xhdr, qif->buf + field->name_offset,
+                    0, field->name_len,
+                    field->val_offset - field->name_offset, field->val_len);
+        enc_sz = sizeof(enc_buf) - enc_off;
+        hea_sz = sizeof(hea_buf) - hea_off;
+        st = lsqpack_enc_encode(&sim->enc, enc_buf + enc_off, &enc_sz,
+                                hea_buf + hea_off, &hea_sz, &xhdr, 0);
+        if (st != LQES_OK)
+        {
+            fprintf(stderr, "cannot encode header: %d\n", (int) st);
+            exit(EXIT_FAILURE);
+        }
+        enc_off += enc_sz;
+        hea_off += hea_sz;
+    }
+    pref_sz = lsqpack_enc_end_header(&sim->enc, pref_buf, sizeof(pref_buf),
+                                                                        NULL);
+    if (pref_sz <= 0)
+    {
+        fprintf(stderr, "cannot end header\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Encoder stream data is sent before the header block that needs it */
+    if (enc_off > 0)
+        sim_send_chunk(sim, now, EV_ENC_STREAM, sim_dup(enc_buf, enc_off),
+                                                                    enc_off);
+
+    hblock->sz = (size_t) pref_sz + hea_off;
+    hblock->buf = malloc(hblock->sz);
+    if (!hblock->buf)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(hblock->buf, pref_buf, (size_t) pref_sz);
+    memcpy(hblock->buf + pref_sz, hea_buf, hea_off);
+    hblock->p = hblock->buf;
+    hblock->sent = now;
+    sim->out_bytes += enc_off + hblock->sz;
+    sim_schedule(sim, sim_transmit(sim, now, hblock->sz), EV_HBLOCK, hblock,
+                                                                        0);
+}
+
+
+/* Send queued decoder stream instructions */
+static void
+sim_flush_decoder (struct sim *sim, uint64_t now)
+{
+    unsigned char *buf;
+    size_t sz;
+    ssize_t n;
+
+    sz = lsqpack_dec_flush_size(&sim->dec);
+    if (sz == 0)
+        return;
+    buf = malloc(sz);
+    if (!buf)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    n = lsqpack_dec_flush(&sim->dec, buf, sz);
+    if (n <= 0)
+    {
+        free(buf);
+        if (n < 0)
+        {
+            fprintf(stderr, "cannot flush decoder stream\n");
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    sim_send_chunk(sim, now, EV_DEC_STREAM, buf, (size_t) n);
+}
+
+
+static void
+sim_hblock_done (struct sim *sim, uint64_t now, struct hblock *hblock)
+{
+    hblock->done = now;
+    free(hblock->buf);
+    hblock->buf = NULL;
+    if (s_verbose)
+        fprintf(stderr, "block %u: stream %"PRIu64", %zu bytes, sent %.3f, "
+            "arrived %.3f, decoded %.3f, hol %.3f ms\n", hblock->idx,
+            hblock->stream_id, hblock->sz, hblock->sent / 1000.,
+            hblock->arrived / 1000., hblock->done / 1000.,
+            (hblock->done - hblock->arrived) / 1000.);
+}
+
+
+/* Give the rest of the header block to the decoder */
+static void
+sim_decode (struct sim *sim, uint64_t now, struct hblock *hblock)
+{
+    enum lsqpack_read_header_status rhs;
+    const size_t left = hblock->buf + hblock->sz - hblock->p;
+
+    if (hblock->p == hblock->buf)
+        rhs = lsqpack_dec_header_in(&sim->dec, hblock, hblock->stream_id,
+                        hblock->sz, &hblock->p, left, NULL, NULL);
+    else
+    {
+        rhs = lsqpack_dec_header_read(&sim->dec, hblock, &hblock->p, left,
+                                                                NULL, NULL);
+        assert(sim->n_blocked > 0);
+        --sim->n_blocked;
+        sim->blocked_time += now - hblock->arrived;
+    }
+
+    switch (rhs)
+    {
+    case LQRHS_DONE:
+        sim_hblock_done(sim, now, hblock);
+        break;
+    case LQRHS_BLOCKED:
+        ++sim->n_ever_blocked;
+        ++sim->n_blocked;
+        if (sim->n_blocked > sim->max_blocked)
+            sim->max_blocked = sim->n_blocked;
+        break;
+    default:
+        fprintf(stderr, "stream %"PRIu64": cannot decode header block\n",
+                                                        hblock->stream_id);
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+static void
+sim_enc_stream_in (struct sim *sim, uint64_t now, struct chunk *chunk)
+{
+    struct hblock *hblock;
+
+    if (chunk->off != sim->enc_stream_dlvd)
+    {
+        fprintf(stderr, "encoder stream delivered out of order: offset %zu, "
+                            "expected %zu\n", chunk->off, sim->enc_stream_dlvd);
+        exit(EXIT_FAILURE);
+    }
+    sim->enc_stream_dlvd += chunk->sz;
+    if (0 != lsqpack_dec_enc_in(&sim->dec, chunk->buf, chunk->sz))
+    {
+        fprintf(stderr, "encoder stream error\n");
+        exit(EXIT_FAILURE);
+    }
+    while ((hblock = lsqpack_dec_next_unblocked(&sim->dec)))
+        sim_decode(sim, now, hblock);
+    free(chunk->buf);
+    free(chunk);
+}
+
+
+static void
+sim_dec_stream_in (struct sim *sim, struct chunk *chunk)
+{
+    if (chunk->off != sim->dec_stream_dlvd)
+    {
+        fprintf(stderr, "decoder stream delivered out of order: offset %zu, "
+                            "expected %zu\n", chunk->off, sim->dec_stream_dlvd);
+        exit(EXIT_FAILURE);
+    }
+    sim->dec_stream_dlvd += chunk->sz;
+    if (0 != lsqpack_enc_decoder_in(&sim->enc, chunk->buf, chunk->sz))
+    {
+        fprintf(stderr, "decoder stream error\n");
+        exit(EXIT_FAILURE);
+    }
+    free(chunk->buf);
+    free(chunk);
+}
+
+
+static struct lsxpack_header *
+prepare_decode (void *hblock_ctx, struct lsxpack_header *xhdr, size_t space)
+{
+    static char xhdr_buf[0x10000];
+    static struct lsxpack_header s_xhdr;
+
+    if (space > sizeof(xhdr_buf))
+        return NULL;
+    if (xhdr)
+    {
+        xhdr->val_len = space;
+        return xhdr;
+    }
+    lsxpack_header_prepare_decode(&s_xhdr, xhdr_buf, 0, space);
+    return &s_xhdr;
+}
+
+
+static int
+process_header (void *hblock_ctx, struct lsxpack_header *xhdr)
+{
+    return 0;
+}
+
+
+static const struct lsqpack_dec_hset_if hset_if = {
+    .dhi_unblocked      = NULL,
+    .dhi_prepare_decode = prepare_decode,
+    .dhi_process_header = process_header,
+};
+
+
+static int
+cmp_u64 (const void *ap, const void *bp)
+{
+    const uint64_t a = *(const uint64_t *) ap, b = *(const uint64_t *) bp;
+    return (a > b) - (a < b);
+}
+
+
+/* Print mean, median, p99, and maximum of `vals' in milliseconds */
+static void
+print_dist (const char *name, uint64_t *vals, unsigned n)
+{
+    uint64_t sum;
+    unsigned i;
+
+    qsort(vals, n, sizeof(vals[0]), cmp_u64);
+    sum = 0;
+    for (i = 0; i < n; ++i)
+        sum += vals[i];
+    printf("\"%s_mean_ms\": %.3f, \"%s_p50_ms\": %.3f, "
+        "\"%s_p99_ms\": %.3f, \"%s_max_ms\": %.3f, ",
+        name, sum / 1000. / n, name, vals[n / 2] / 1000.,
+        name, vals[(unsigned) ((n - 1) * 0.99)] / 1000.,
+        name, vals[n - 1] / 1000.);
+}
+
+
+static void
+run (const struct bench_qif *qif, const struct config *cfg,
+                                const struct net *net, unsigned n_iters)
+{
+    unsigned char tsu_buf[LSQPACK_LONGEST_SDTC];
+    size_t tsu_buf_sz;
+    struct event ev;
+    struct sim sim;
+    uint64_t *hol, *latency;
+    unsigned n;
+
+    memset(&sim, 0, sizeof(sim));
+    sim.qif = qif;
+    sim.cfg = cfg;
+    sim.net = net;
+    sim.rand = net->seed ? net->seed : 1;
+    sim.n_hblocks = qif->n_hblocks * n_iters;
+    sim.hblocks = calloc(sim.n_hblocks, sizeof(sim.hblocks[0]));
+    hol = malloc(sim.n_hblocks * sizeof(hol[0]));
+    latency = malloc(sim.n_hblocks * sizeof(latency[0]));
+    if (!sim.hblocks || !hol || !latency)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    tsu_buf_sz = sizeof(tsu_buf);
+    if (0 != lsqpack_enc_init(&sim.enc, NULL, cfg->dyn_table_size,
+                cfg->dyn_table_size, cfg->max_risked_streams, cfg->enc_opts,
+                tsu_buf, &tsu_buf_sz))
+    {
+        perror("lsqpack_enc_init");
+        exit(EXIT_FAILURE);
+    }
+    lsqpack_dec_init(&sim.dec, NULL, cfg->dyn_table_size,
+                cfg->max_risked_streams, &hset_if,
+                LSQPACK_DEC_OPT_DEFER_UNBLOCKED
+                                        | LSQPACK_DEC_OPT_QUEUE_DEC_STREAM);
+
+    if (tsu_buf_sz > 0)
+    {
+        sim.out_bytes += tsu_buf_sz;
+        sim_send_chunk(&sim, 0, EV_ENC_STREAM, sim_dup(tsu_buf, tsu_buf_sz),
+                                                                tsu_buf_sz);
+    }
+    for (n = 0; n < sim.n_hblocks; ++n)
+        sim_schedule(&sim, net->interval * n, EV_REQUEST, NULL, n);
+
+    while (sim_next_event(&sim, &ev))
+    {
+        switch (ev.type)
+        {
+        case EV_REQUEST:
+            sim_request(&sim, ev.time, ev.idx);
+            break;
+        case EV_HBLOCK:
+            ((struct hblock *) ev.ptr)->arrived = ev.time;
+            sim_decode(&sim, ev.time, ev.ptr);
+            sim_flush_decoder(&sim, ev.time);
+            break;
+        case EV_ENC_STREAM:
+            sim_enc_stream_in(&sim, ev.time, ev.ptr);
+            sim_flush_decoder(&sim, ev.time);
+            break;
+        case EV_DEC_STREAM:
+            sim_dec_stream_in(&sim, ev.ptr);
+            break;
+        }
+    }
+
+    if (sim.enc_stream_dlvd != sim.enc_stream_sent
+                                || sim.dec_stream_dlvd != sim.dec_stream_sent)
+    {
+        fprintf(stderr, "stream data lost: encoder stream %zu of %zu bytes, "
+            "decoder stream %zu of %zu bytes delivered\n",
+            sim.enc_stream_dlvd, sim.enc_stream_sent,
+            sim.dec_stream_dlvd, sim.dec_stream_sent);
+        exit(EXIT_FAILURE);
+    }
+
+    for (n = 0; n < sim.n_hblocks; ++n)
+    {
+        if (sim.hblocks[n].buf)
+        {
+            fprintf(stderr, "header block %u was never decoded\n", n);
+            exit(EXIT_FAILURE);
+        }
+        hol[n] = sim.hblocks[n].done - sim.hblocks[n].arrived;
+        latency[n] = sim.hblocks[n].done - sim.hblocks[n].sent;
+    }
+
+    printf("{\"table_size\": %u, \"risked_streams\": %u, \"opts\": \"%.*s\", "
+        "\"ratio\": %.4f, \"blocked\": %u, \"max_blocked\": %u, "
+        "\"blocked_ms\": %.3f, ",
+        cfg->dyn_table_size, cfg->max_risked_streams,
+        (int) strcspn(cfg->opts_str, ","), cfg->opts_str,
+        (double) sim.out_bytes / ((double) qif->raw_bytes * n_iters),
+        sim.n_ever_blocked, sim.max_blocked, sim.blocked_time / 1000.);
+    print_dist("hol", hol, sim.n_hblocks);
+    print_dist("latency", latency, sim.n_hblocks);
+    printf("\"lost\": %u}", sim.n_lost);
+
+    lsqpack_enc_cleanup(&sim.enc);
+    lsqpack_dec_cleanup(&sim.dec);
+    free(sim.events);
+    free(sim.hblocks);
+    free(hol);
+    free(latency);
+}
+
+
+static int
+parse_opts (const char *str, enum lsqpack_enc_opts *opts)
+{
+    *opts = 0;
+    for ( ; *str && *str != ','; ++str)
+        switch (*str)
+        {
+        case 'S': *opts |= LSQPACK_ENC_OPT_SERVER;          break;
+        case 'D': *opts |= LSQPACK_ENC_OPT_NO_DUP;          break;
+        case 'A': *opts |= LSQPACK_ENC_OPT_IX_AGGR;         break;
+        case 'F': *opts |= LSQPACK_ENC_OPT_FREQ_SKETCH;     break;
+        case 'M': *opts |= LSQPACK_ENC_OPT_NO_MEM_GUARD;    break;
+        case '-':                                           break;
+        default:
+            return -1;
+        }
+    return 0;
+}
+
+
+int
+main (int argc, char **argv)
+{
+    const char *in_path = NULL;
+    const char *opts_list = "-,A";
+    unsigned n_iters = 1;
+    unsigned table_sizes[MAX_LIST] = { 0, 4096, 65536, },
+             risked_streams[MAX_LIST] = { 0, 16, 100, };
+    unsigned n_table_sizes = 3, n_risked_streams = 3;
+    const char *opts_strs[MAX_LIST];
+    unsigned n_opts_strs;
+    struct net net = {
+        .rtt        = 50000,
+        .jitter     = 5000,
+        .loss       = 0,
+        .interval   = 1000,
+        .mtu        = 1200,
+        .seed       = 1,
+    };
+    struct bench_qif qif;
+    struct config cfg;
+    unsigned t, s, o, first;
+    const char *p;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "i:n:t:s:O:r:j:l:I:m:R:vh")))
+    {
+        switch (opt)
+        {
+        case 'i':
+            in_path = optarg;
+            break;
+        case 'n':
+            n_iters = atoi(optarg);
+            break;
+        case 't':
+            n_table_sizes = bench_parse_list(optarg, table_sizes, MAX_LIST);
+            break;
+        case 's':
+            n_risked_streams = bench_parse_list(optarg, risked_streams,
+                                                                    MAX_LIST);
+            break;
+        case 'O':
+            opts_list = optarg;
+            break;
+        case 'r':
+            net.rtt = (uint64_t) (atof(optarg) * 1000);
+            break;
+        case 'j':
+            net.jitter = (uint64_t) (atof(optarg) * 1000);
+            break;
+        case 'l':
+            net.loss = atof(optarg) / 100;
+            break;
+        case 'I':
+            net.interval = (uint64_t) (atof(optarg) * 1000);
+            break;
+        case 'm':
+            net.mtu = (size_t) atoi(optarg);
+            break;
+        case 'R':
+            net.seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'v':
+            ++s_verbose;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!in_path || n_iters == 0 || net.mtu == 0
+                                        || net.loss < 0 || net.loss >= 1)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    n_opts_strs = 0;
+    for (p = opts_list; n_opts_strs < MAX_LIST; ++p)
+    {
+        if (0 != parse_opts(p, &cfg.enc_opts))
+        {
+            fprintf(stderr, "invalid option set in `%s'\n", opts_list);
+            exit(EXIT_FAILURE);
+        }
+        opts_strs[n_opts_strs++] = p;
+        p += strcspn(p, ",");
+        if (*p == '\0')
+            break;
+    }
+
+    bench_qif_load(&qif, in_path);
+
+    printf("{\n"
+           "  \"file\": \"%s\",\n"
+           "  \"header_blocks\": %u,\n"
+           "  \"rtt_ms\": %.3f,\n"
+           "  \"jitter_ms\": %.3f,\n"
+           "  \"loss_pct\": %.3f,\n"
+           "  \"interval_ms\": %.3f,\n"
+           "  \"seed\": %"PRIu64",\n"
+           "  \"results\": [", in_path, qif.n_hblocks * n_iters,
+           net.rtt / 1000., net.jitter / 1000., net.loss * 100,
+           net.interval / 1000., net.seed);
+    first = 1;
+    for (t = 0; t < n_table_sizes; ++t)
+      for (s = 0; s < n_risked_streams; ++s)
+        for (o = 0; o < n_opts_strs; ++o)
+        {
+            cfg.dyn_table_size = table_sizes[t];
+            cfg.max_risked_streams = risked_streams[s];
+            cfg.opts_str = opts_strs[o];
+            (void) parse_opts(opts_strs[o], &cfg.enc_opts);
+            printf("%s\n    ", first ? "" : ",");
+            run(&qif, &cfg, &net, n_iters);
+            first = 0;
+        }
+    printf("\n  ]\n}\n");
+
+    bench_qif_cleanup(&qif);
+    exit(EXIT_SUCCESS);
+}
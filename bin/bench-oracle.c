@@ -0,0 +1,1113 @@
+/*
+ * bench-oracle: compare the encoder with a near-optimal offline schedule.
+ *
+ * The encoder decides online, using its history heuristic, which fields
+ * to insert into the dynamic table.  Knowing the whole QIF file up front,
+ * a much better schedule can be found.  This tool searches for one and
+ * reports how many bytes the encoder leaves on the table.
+ *
+ * The search is a beam search over the header fields in order.  A state
+ * is the contents of the dynamic table plus the cost so far.  For each
+ * field, every state is expanded three ways:
+ *
+ *  - Do not change the table.  Encode the field using the cheapest of an
+ *    exact dynamic reference, a dynamic name reference, or what an encoder
+ *    without a dynamic table would produce.
+ *  - Insert the field (with a static or dynamic name reference when there
+ *    is one), then reference it.
+ *  - Duplicate an existing copy of the field, then reference it.
+ *
+ * Inserting only pays off later, so the states are not ranked by cost
+ * alone.  Each field in the table is credited with what referencing it
+ * saves over a literal, times the number of times it occurs in the next
+ * -H fields of the input.  The -b states with the lowest cost minus credit
+ * are kept.  When the last field is done, there is no credit left and the
+ * cheapest state gives the schedule.  The search is run once per horizon
+ * and the best result is reported.
+ *
+ * This is a heuristic: the result is an upper bound on the optimum, and
+ * on some inputs the encoder may come out ahead of it.  The cost model
+ * follows what the library emits:
+ *
+ *  - Integer and string sizes are computed the way the encoder does,
+ *    Huffman coding included.  Insert costs for new names and the cost of
+ *    literals are measured by running the encoder on the field.
+ *  - Header blocks are acknowledged as soon as they are encoded.  Without
+ *    risked streams, fields inserted in a header block cannot be
+ *    referenced by that header block.
+ *  - Entries referenced by the current header block cannot be evicted.
+ *  - The header block prefix is two bytes without dynamic references and
+ *    the encoded Required Insert Count and Delta Base sizes otherwise.
+ *
+ * The encoder is run on the same input with immediate acknowledgements
+ * for each encoder option set.  Both sides count encoder stream and header
+ * block bytes; the Set Dynamic Table Capacity instruction is not counted.
+ * The results are printed to stdout as JSON; `gap' is how much larger the
+ * encoder output is than the oracle's, in percent.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#include <getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "lsqpack.h"
+#include "lsxpack_header.h"
+#include "bench.h"
+
+#define MAX_LIST 16
+
+#define COST_INF UINT64_MAX
+
+/* Entry overhead, from RFC 9204, Section 3.2.1 */
+#define ENTRY_OVERHEAD 32
+
+unsigned char *
+lsqpack_enc_int (unsigned char *dst, unsigned char *const end, uint64_t value,
+                                                        unsigned prefix_bits);
+
+int
+lsqpack_enc_enc_str (unsigned prefix_bits, unsigned char *const dst,
+    size_t dst_len, const unsigned char *str, unsigned str_len);
+
+static void
+usage (const char *name)
+{
+    fprintf(stderr,
+"Usage: %s [options] -i input.qif\n"
+"\n"
+"Options:\n"
+"   -i FILE     Input QIF or BQIF file.\n"
+"   -t LIST     Comma-separated list of dynamic table sizes.  Defaults to\n"
+"                 4096.\n"
+"   -s LIST     Comma-separated list of maximum risked streams.  Defaults\n"
+"                 to 0,100.\n"
+"   -O LIST     Comma-separated list of encoder option sets to compare.\n"
+"                 Each set is a combination of letters S (server), D (no\n"
+"                 dup), A (aggressive indexing), F (frequency sketch), and\n"
+"                 M (no memory guard); `-' means no options.  Defaults to -,A.\n"
+"   -b NUMBER   Beam width.  Defaults to 64.\n"
+"   -H LIST     Comma-separated list of look-ahead horizons, in header\n"
+"                 fields.  Defaults to 256,1024.\n"
+"\n"
+"   -h          Print this help screen and exit\n"
+    , name);
+}
+
+
+/* Unique field with its costs, which do not depend on the table */
+struct field
+{
+    uint32_t                name_id;
+    unsigned                entry_size;
+    unsigned                val_str;    /* Value string, 7-bit prefix */
+    unsigned                literal;    /* Without dynamic table */
+    unsigned                insert;     /* Insert; 0 if never inserted */
+    unsigned                saving;     /* Reference instead of literal */
+};
+
+
+struct corpus
+{
+    struct field           *fields;
+    unsigned                n_fields;   /* Unique fields */
+    uint32_t               *seq;        /* Field IDs in input order */
+    unsigned                n_seq;
+    unsigned               *hblocks;    /* Block N starts at seq[hblocks[N]] */
+    unsigned                n_hblocks;
+    /* Look-ahead state, updated as the search moves along the input */
+    unsigned               *upcoming;   /* Occurrences in the window */
+    uint32_t                shift_ids[2];
+    int64_t                 shift_deltas[2];    /* Credit change per copy */
+};
+
+
+/* FNV-1a: good enough to intern strings */
+static uint64_t
+fnv (const char *buf, size_t len, uint64_t hash)
+{
+    const unsigned char *p = (const unsigned char *) buf;
+
+    while (len-- > 0)
+        hash = (hash ^ *p++) * 0x100000001B3ull;
+    return hash;
+}
+
+
+struct intern
+{
+    uint64_t   *hashes;
+    uint32_t   *ids;
+    const char **names, **vals;
+    unsigned   *name_lens, *val_lens;
+    unsigned    n_alloc, n_ids;
+};
+
+
+/* Returns ID of the name-value pair; sets `is_new' if it was not seen */
+static uint32_t
+intern (struct intern *in, const char *name, unsigned name_len,
+                    const char *val, unsigned val_len, int *is_new)
+{
+    uint64_t hash;
+    unsigned idx, n_alloc, i;
+    struct intern old;
+
+    if (in->n_ids * 2 >= in->n_alloc)
+    {
+        old = *in;
+        n_alloc = in->n_alloc ? in->n_alloc * 2 : 1024;
+        in->hashes = calloc(n_alloc, sizeof(in->hashes[0]));
+        in->ids = malloc(n_alloc * sizeof(in->ids[0]));
+        in->names = realloc(old.names, n_alloc * sizeof(in->names[0]));
+        in->vals = realloc(old.vals, n_alloc * sizeof(in->vals[0]));
+        in->name_lens = realloc(old.name_lens, n_alloc * sizeof(unsigned));
+        in->val_lens = realloc(old.val_lens, n_alloc * sizeof(unsigned));
+        if (!in->hashes || !in->ids || !in->names || !in->vals
+                                        || !in->name_lens || !in->val_lens)
+        {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        in->n_alloc = n_alloc;
+        for (i = 0; i < old.n_alloc; ++i)
+            if (old.hashes[i])
+            {
+                for (idx = old.hashes[i] & (n_alloc - 1); in->hashes[idx];
+                                            idx = (idx + 1) & (n_alloc - 1))
+                    ;
+                in->hashes[idx] = old.hashes[i];
+                in->ids[idx] = old.ids[i];
+            }
+        free(old.hashes);
+        free(old.ids);
+    }
+
+    hash = fnv(val, val_len, fnv(name, name_len, 0xCBF29CE484222325ull)
+                                                ^ (name_len * 0x9E37ull)) | 1;
+    for (idx = hash & (in->n_alloc - 1); in->hashes[idx];
+                                        idx = (idx + 1) & (in->n_alloc - 1))
+        if (in->hashes[idx] == hash
+                && in->name_lens[ in->ids[idx] ] == name_len
+                && in->val_lens[ in->ids[idx] ] == val_len
+                && 0 == memcmp(in->names[ in->ids[idx] ], name, name_len)
+                && 0 == memcmp(in->vals[ in->ids[idx] ], val, val_len))
+        {
+            *is_new = 0;
+            return in->ids[idx];
+        }
+
+    in->hashes[idx] = hash;
+    in->ids[idx] = in->n_ids;
+    in->names[in->n_ids] = name;
+    in->vals[in->n_ids] = val;
+    in->name_lens[in->n_ids] = name_len;
+    in->val_lens[in->n_ids] = val_len;
+    *is_new = 1;
+    return in->n_ids++;
+}
+
+
+static unsigned
+int_len (uint64_t value, unsigned prefix_bits)
+{
+    unsigned char buf[16], *end;
+
+    end = lsqpack_enc_int(buf, buf + sizeof(buf), value, prefix_bits);
+    assert(end > buf);
+    return (unsigned) (end - buf);
+}
+
+
+static unsigned
+str_len (const char *str, unsigned len, unsigned prefix_bits)
+{
+    static unsigned char buf[0x30000];
+    int r;
+
+    r = lsqpack_enc_enc_str(prefix_bits, buf, sizeof(buf),
+                                        (const unsigned char *) str, len);
+    if (r <= 0)
+    {
+        fprintf(stderr, "cannot encode string of %u bytes\n", len);
+        exit(EXIT_FAILURE);
+    }
+    return (unsigned) r;
+}
+
+
+/* Encode field with fresh encoder and return the bytes written to the
+ * encoder stream and to the header block.
+ */
+static void
+measure (struct lsqpack_enc *enc, struct lsxpack_header *xhdr,
+                                        size_t *enc_sz, size_t *hea_sz)
+{
+    static unsigned char enc_buf[0x30000], hea_buf[0x30000];
+    unsigned char pref_buf[0x20];
+
+    if (0 != lsqpack_enc_start_header(enc, 1, 0))
+    {
+        fprintf(stderr, "cannot start header\n");
+        exit(EXIT_FAILURE);
+    }
+    *enc_sz = sizeof(enc_buf);
+    *hea_sz = sizeof(hea_buf);
+    if (LQES_OK != lsqpack_enc_encode(enc, enc_buf, enc_sz, hea_buf, hea_sz,
+                                                                    xhdr, 0))
+    {
+        fprintf(stderr, "cannot encode header\n");
+        exit(EXIT_FAILURE);
+    }
+    if (0 >= lsqpack_enc_end_header(enc, pref_buf, sizeof(pref_buf), NULL))
+    {
+        fprintf(stderr, "cannot end header\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+static void
+corpus_load (struct corpus *corpus, const struct bench_qif *qif)
+{
+    struct intern fields = { 0 }, names = { 0 };
+    struct lsqpack_enc zero_enc, aggr_enc;
+    struct lsxpack_header xhdr;
+    const struct bench_field *bf;
+    struct field *field;
+    unsigned char tsu_buf[LSQPACK_LONGEST_SDTC];
+    size_t tsu_sz, enc_sz, hea_sz;
+    unsigned n, n_alloc;
+    uint32_t id;
+    int is_new;
+
+    memset(corpus, 0, sizeof(*corpus));
+    corpus->seq = malloc(qif->n_fields * sizeof(corpus->seq[0]));
+    corpus->hblocks = malloc((qif->n_hblocks + 1)
+                                            * sizeof(corpus->hblocks[0]));
+    if (!corpus->seq || !corpus->hblocks)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(corpus->hblocks, qif->hblocks,
+                        (qif->n_hblocks + 1) * sizeof(corpus->hblocks[0]));
+    corpus->n_hblocks = qif->n_hblocks;
+    corpus->n_seq = qif->n_fields;
+
+    /* Literal cost is measured without dynamic table; insert cost, with an
+     * empty one that takes everything.
+     */
+    tsu_sz = 0;
+    if (0 != lsqpack_enc_init(&zero_enc, NULL, 0, 0, 0, 0, NULL, &tsu_sz))
+    {
+        perror("lsqpack_enc_init");
+        exit(EXIT_FAILURE);
+    }
+
+    n_alloc = 0;
+    for (n = 0; n < qif->n_fields; ++n)
+    {
+        bf = &qif->fields[n];
+        id = intern(&fields, qif->buf + bf->name_offset, bf->name_len,
+                        qif->buf + bf->val_offset, bf->val_len, &is_new);
+        corpus->seq[n] = id;
+        if (!is_new)
+            continue;
+        if (id >= n_alloc)
+        {
+            n_alloc = n_alloc ? n_alloc * 2 : 1024;
+            corpus->fields = realloc(corpus->fields,
+                                    n_alloc * sizeof(corpus->fields[0]));
+            if (!corpus->fields)
+            {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        field = &corpus->fields[id];
+        field->name_id = intern(&names, qif->buf + bf->name_offset,
+                                            bf->name_len, "", 0, &is_new);
+        field->entry_size = bf->name_len + bf->val_len + ENTRY_OVERHEAD;
+        field->val_str = str_len(qif->buf + bf->val_offset, bf->val_len, 7);
+
+        lsxpack_header_set_offset2(&xhdr, qif->buf + bf->name_offset, 0,
+            bf->name_len, bf->val_offset - bf->name_offset, bf->val_len);
+        measure(&zero_enc, &xhdr, &enc_sz, &hea_sz);
+        field->literal = (unsigned) hea_sz;
+
+        tsu_sz = sizeof(tsu_buf);
+        if (0 != lsqpack_enc_init(&aggr_enc, NULL, 0x10000, 0x10000, 1,
+                            LSQPACK_ENC_OPT_IX_AGGR, tsu_buf, &tsu_sz))
+        {
+            perror("lsqpack_enc_init");
+            exit(EXIT_FAILURE);
+        }
+        measure(&aggr_enc, &xhdr, &enc_sz, &hea_sz);
+        field->insert = (unsigned) enc_sz;
+        field->saving = hea_sz < field->literal
+                                    ? field->literal - (unsigned) hea_sz : 0;
+        lsqpack_enc_cleanup(&aggr_enc);
+    }
+    corpus->n_fields = fields.n_ids;
+    corpus->upcoming = malloc(corpus->n_fields
+                                        * sizeof(corpus->upcoming[0]));
+    if (!corpus->upcoming)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+
+    lsqpack_enc_cleanup(&zero_enc);
+    free(fields.hashes);
+    free(fields.ids);
+    free(fields.names);
+    free(fields.vals);
+    free(fields.name_lens);
+    free(fields.val_lens);
+    free(names.hashes);
+    free(names.ids);
+    free(names.names);
+    free(names.vals);
+    free(names.name_lens);
+    free(names.val_lens);
+}
+
+
+struct entry
+{
+    uint32_t                id;
+    uint32_t                name_id;
+};
+
+
+/* Dynamic table is a FIFO: entries[0] is the oldest.  Absolute index of
+ * entries[k] is ins_count - n_entries + 1 + k, as in the library.
+ */
+struct state
+{
+    struct entry           *entries;
+    unsigned                n_entries;
+    unsigned                size;
+    uint64_t                ins_count;
+    uint64_t                hash;       /* Of table contents */
+    uint64_t                credit;     /* Savings of entries used later */
+    uint64_t                cost;
+    uint64_t                enc_bytes, hea_bytes;
+    /* Current header block */
+    uint64_t                base;       /* Everything up to it is acked */
+    uint64_t                min_ref, max_ref;   /* 0 means none */
+};
+
+
+enum action { ACT_NONE, ACT_INSERT, ACT_DUP, N_ACTIONS };
+
+
+struct candidate
+{
+    const struct state     *parent;
+    enum action             action;
+    uint64_t                cost;
+    int64_t                 rank;       /* Cost minus credit */
+    uint64_t                hash;
+    uint64_t                ins_count;
+};
+
+
+struct params
+{
+    unsigned                capacity;
+    unsigned                max_entries;
+    unsigned                max_risked_streams;
+    unsigned                horizon;
+};
+
+
+static uint64_t
+entry_hash (uint32_t id, uint64_t abs_idx)
+{
+    uint64_t x;
+
+    x = ((uint64_t) id << 32 | (abs_idx & 0xFFFFFFFF)) + 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+
+static int
+may_reference (const struct params *params, const struct state *state,
+                                                            uint64_t abs_idx)
+{
+    return params->max_risked_streams > 0 || abs_idx <= state->base;
+}
+
+
+static unsigned
+ref_cost (const struct state *state, uint64_t abs_idx)
+{
+    if (abs_idx <= state->base)
+        return int_len(state->base - abs_idx, 6);
+    else
+        return int_len(abs_idx - state->base - 1, 4);
+}
+
+
+static unsigned
+name_ref_cost (const struct state *state, uint64_t abs_idx,
+                                                    const struct field *field)
+{
+    if (abs_idx <= state->base)
+        return int_len(state->base - abs_idx, 4) + field->val_str;
+    else
+        return int_len(abs_idx - state->base - 1, 3) + field->val_str;
+}
+
+
+static void
+note_ref (struct state *state, uint64_t abs_idx)
+{
+    if (state->min_ref == 0 || abs_idx < state->min_ref)
+        state->min_ref = abs_idx;
+    if (abs_idx > state->max_ref)
+        state->max_ref = abs_idx;
+}
+
+
+static uint64_t
+entry_credit (const struct corpus *corpus, uint32_t id)
+{
+    return (uint64_t) corpus->upcoming[id] * corpus->fields[id].saving;
+}
+
+
+/* Move the look-ahead window to the fields after `pos' and record how the
+ * credit of the affected entries changes.
+ */
+static void
+advance_window (struct corpus *corpus, unsigned horizon, unsigned pos)
+{
+    uint32_t id;
+
+    id = corpus->seq[pos];
+    --corpus->upcoming[id];
+    corpus->shift_ids[0] = id;
+    corpus->shift_deltas[0] = -(int64_t) corpus->fields[id].saving;
+
+    if (pos + horizon < corpus->n_seq)
+    {
+        id = corpus->seq[pos + horizon];
+        ++corpus->upcoming[id];
+        corpus->shift_ids[1] = id;
+        corpus->shift_deltas[1] = corpus->fields[id].saving;
+    }
+    else
+    {
+        corpus->shift_ids[1] = corpus->shift_ids[0];
+        corpus->shift_deltas[1] = 0;
+    }
+}
+
+
+static int
+has_copy (const struct state *state, unsigned from, uint32_t id)
+{
+    unsigned k;
+
+    for (k = from; k < state->n_entries; ++k)
+        if (state->entries[k].id == id)
+            return 1;
+    return 0;
+}
+
+
+/* Cost of encoding field number `pos', whose ID is `id', from `state' using
+ * `action'.  If `apply' is set, the state is updated.  Returns COST_INF if
+ * the action is not possible.  The new table hash and credit are returned
+ * via `hash_p' and `credit_p'.
+ */
+static uint64_t
+evaluate (const struct params *params, const struct corpus *corpus,
+            struct state *state, unsigned pos, uint32_t id,
+            enum action action, int apply, uint64_t *hash_p,
+            uint64_t *credit_p)
+{
+    const struct field *const field = &corpus->fields[id];
+    const uint64_t first_abs = state->ins_count - state->n_entries + 1;
+    uint64_t exact, name, hash, credit, new_abs, cost, enc_cost, hea_cost;
+    unsigned n_evict, size, k, shifted;
+
+    /* Newest copies of the field and of its name.  Credit is per field,
+     * not per entry: adjust it once for each field whose number of upcoming
+     * uses changed as the window moved.
+     */
+    exact = name = 0;
+    credit = state->credit;
+    shifted = corpus->shift_ids[0] == corpus->shift_ids[1] ? 2 : 0;
+    for (k = state->n_entries; k > 0; --k)
+    {
+        if (state->entries[k - 1].id == id && !exact)
+            exact = first_abs + k - 1;
+        if (state->entries[k - 1].name_id == field->name_id && !name)
+            name = first_abs + k - 1;
+        if (state->entries[k - 1].id == corpus->shift_ids[0]
+                                                        && !(shifted & 1))
+        {
+            credit += corpus->shift_deltas[0] + corpus->shift_deltas[1]
+                                                        * (shifted >> 1);
+            shifted |= 1;
+        }
+        if (state->entries[k - 1].id == corpus->shift_ids[1]
+                                                        && !(shifted & 2))
+        {
+            credit += corpus->shift_deltas[1];
+            shifted |= 2;
+        }
+    }
+
+    hash = state->hash;
+    n_evict = 0;
+    enc_cost = 0;
+    new_abs = 0;
+    if (action != ACT_NONE)
+    {
+        if (field->entry_size > params->capacity)
+            return COST_INF;
+        if (action == ACT_INSERT && field->insert == 0)
+            return COST_INF;
+        if (action == ACT_DUP && !exact)
+            return COST_INF;
+        /* Evict as needed, but not what this header block references */
+        size = state->size;
+        while (size + field->entry_size > params->capacity)
+        {
+            if (state->min_ref && first_abs + n_evict >= state->min_ref)
+                return COST_INF;
+            size -= corpus->fields[ state->entries[n_evict].id ].entry_size;
+            hash -= entry_hash(state->entries[n_evict].id,
+                                                        first_abs + n_evict);
+            if (!has_copy(state, n_evict + 1, state->entries[n_evict].id))
+                credit -= entry_credit(corpus, state->entries[n_evict].id);
+            ++n_evict;
+        }
+        if (exact && exact < first_abs + n_evict)
+            exact = 0;
+        if (name && name < first_abs + n_evict)
+            name = 0;
+        if (action == ACT_DUP)
+        {
+            if (!exact)     /* QPACK forbids duplicating evicted entry */
+                return COST_INF;
+            enc_cost = int_len(state->ins_count - exact, 5);
+        }
+        else
+        {
+            enc_cost = field->insert;
+            if (name && int_len(state->ins_count - name, 6) + field->val_str
+                                                                    < enc_cost)
+                enc_cost = int_len(state->ins_count - name, 6)
+                                                            + field->val_str;
+        }
+        new_abs = state->ins_count + 1;
+        hash += entry_hash(id, new_abs);
+        if (!exact)
+            credit += entry_credit(corpus, id);
+    }
+
+    /* Cheapest representation in the header block */
+    hea_cost = field->literal;
+    if (new_abs && may_reference(params, state, new_abs))
+    {
+        hea_cost = ref_cost(state, new_abs);
+        exact = new_abs;
+    }
+    else
+    {
+        if (exact && may_reference(params, state, exact)
+                                    && ref_cost(state, exact) < hea_cost)
+            hea_cost = ref_cost(state, exact);
+        else
+            exact = 0;
+        if (!exact && name && may_reference(params, state, name)
+                            && name_ref_cost(state, name, field) < hea_cost)
+            hea_cost = name_ref_cost(state, name, field);
+        else
+            name = 0;
+    }
+    cost = enc_cost + hea_cost;
+    *hash_p = hash;
+    *credit_p = credit;
+
+    if (apply)
+    {
+        if (n_evict)
+        {
+            for (k = 0; k < n_evict; ++k)
+                state->size -= corpus->fields[ state->entries[k].id ]
+                                                                .entry_size;
+            memmove(state->entries, state->entries + n_evict,
+                (state->n_entries - n_evict) * sizeof(state->entries[0]));
+            state->n_entries -= n_evict;
+        }
+        if (new_abs)
+        {
+            assert(state->n_entries < params->max_entries);
+            state->entries[ state->n_entries ].id = id;
+            state->entries[ state->n_entries ].name_id = field->name_id;
+            ++state->n_entries;
+            state->size += field->entry_size;
+            ++state->ins_count;
+        }
+        if (exact)
+            note_ref(state, exact);
+        else if (name)
+            note_ref(state, name);
+        state->hash = hash;
+        state->credit = credit;
+        state->cost += cost;
+        state->enc_bytes += enc_cost;
+        state->hea_bytes += hea_cost;
+    }
+
+    return cost;
+}
+
+
+/* Header block is done: add prefix and acknowledge everything */
+static void
+end_block (const struct params *params, struct state *state)
+{
+    uint64_t ric, delta;
+    unsigned cost;
+
+    if (state->max_ref)
+    {
+        ric = state->max_ref % (2 * params->max_entries) + 1;
+        if (state->max_ref >= state->base)
+            delta = state->max_ref - state->base;
+        else
+            delta = state->base - state->max_ref - 1;
+        cost = int_len(ric, 8) + int_len(delta, 7);
+    }
+    else
+        cost = 2;
+    state->cost += cost;
+    state->hea_bytes += cost;
+    state->base = state->ins_count;
+    state->min_ref = 0;
+    state->max_ref = 0;
+}
+
+
+static int
+candidate_cmp (const void *ap, const void *bp)
+{
+    const struct candidate *a = ap, *b = bp;
+
+    if (a->rank != b->rank)
+        return a->rank < b->rank ? -1 : 1;
+    return (a->action > b->action) - (a->action < b->action);
+}
+
+
+static struct state *
+beam_alloc (unsigned width, unsigned max_entries)
+{
+    struct state *beam;
+    unsigned n;
+
+    beam = calloc(width, sizeof(beam[0]));
+    if (!beam)
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (n = 0; n < width; ++n)
+    {
+        beam[n].entries = malloc((max_entries + 1) * sizeof(struct entry));
+        if (!beam[n].entries)
+        {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return beam;
+}
+
+
+static void
+beam_free (struct state *beam, unsigned width)
+{
+    unsigned n;
+
+    for (n = 0; n < width; ++n)
+        free(beam[n].entries);
+    free(beam);
+}
+
+
+/* Returns the cheapest final state, copied into `best' */
+static void
+search (const struct params *params, struct corpus *corpus,
+                                    unsigned width, struct state *best)
+{
+    struct state *cur, *next, *tmp;
+    struct candidate *cands;
+    struct state scratch;
+    unsigned n_cur, n_next, n_cands, block, pos, n, k;
+    enum action action;
+    uint64_t cost, hash, credit;
+
+    cur = beam_alloc(width, params->max_entries);
+    next = beam_alloc(width, params->max_entries);
+    cands = malloc(width * N_ACTIONS * sizeof(cands[0]));
+    if (!cands)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    n_cur = 1;
+    memset(corpus->upcoming, 0, corpus->n_fields
+                                            * sizeof(corpus->upcoming[0]));
+    for (pos = 0; pos < params->horizon && pos < corpus->n_seq; ++pos)
+        ++corpus->upcoming[ corpus->seq[pos] ];
+
+    for (block = 0; block < corpus->n_hblocks; ++block)
+    {
+        for (pos = corpus->hblocks[block]; pos < corpus->hblocks[block + 1];
+                                                                        ++pos)
+        {
+            advance_window(corpus, params->horizon, pos);
+            n_cands = 0;
+            for (n = 0; n < n_cur; ++n)
+                for (action = 0; action < N_ACTIONS; ++action)
+                {
+                    cost = evaluate(params, corpus, &cur[n], pos,
+                                corpus->seq[pos], action, 0, &hash, &credit);
+                    if (cost == COST_INF)
+                        continue;
+                    cands[n_cands++] = (struct candidate) {
+                        .parent     = &cur[n],
+                        .action     = action,
+                        .cost       = cur[n].cost + cost,
+                        .rank       = (int64_t) (cur[n].cost + cost)
+                                                        - (int64_t) credit,
+                        .hash       = hash,
+                        .ins_count  = cur[n].ins_count
+                                                + (action != ACT_NONE),
+                    };
+                }
+            qsort(cands, n_cands, sizeof(cands[0]), candidate_cmp);
+
+            /* Keep the cheapest of the states with the same table */
+            n_next = 0;
+            for (n = 0; n < n_cands && n_next < width; ++n)
+            {
+                for (k = 0; k < n; ++k)
+                    if (cands[k].action != N_ACTIONS
+                            && cands[k].hash == cands[n].hash
+                            && cands[k].ins_count == cands[n].ins_count)
+                        break;
+                if (k < n)
+                {
+                    cands[n].action = N_ACTIONS;    /* Skipped */
+                    continue;
+                }
+                scratch = next[n_next];
+                next[n_next] = *cands[n].parent;
+                next[n_next].entries = scratch.entries;
+                memcpy(next[n_next].entries, cands[n].parent->entries,
+                    cands[n].parent->n_entries * sizeof(struct entry));
+                (void) evaluate(params, corpus, &next[n_next], pos,
+                    corpus->seq[pos], cands[n].action, 1, &hash, &credit);
+                ++n_next;
+            }
+            for ( ; n < n_cands; ++n)
+                cands[n].action = N_ACTIONS;
+
+            tmp = cur;
+            cur = next;
+            next = tmp;
+            n_cur = n_next;
+        }
+        for (n = 0; n < n_cur; ++n)
+            end_block(params, &cur[n]);
+    }
+
+    k = 0;
+    for (n = 1; n < n_cur; ++n)
+        if (cur[n].cost < cur[k].cost)
+            k = n;
+    *best = cur[k];
+    best->entries = NULL;
+
+    beam_free(cur, width);
+    beam_free(next, width);
+    free(cands);
+}
+
+
+static int
+parse_opts (const char *str, enum lsqpack_enc_opts *opts)
+{
+    *opts = 0;
+    for ( ; *str && *str != ','; ++str)
+        switch (*str)
+        {
+        case 'S': *opts |= LSQPACK_ENC_OPT_SERVER;          break;
+        case 'D': *opts |= LSQPACK_ENC_OPT_NO_DUP;          break;
+        case 'A': *opts |= LSQPACK_ENC_OPT_IX_AGGR;         break;
+        case 'F': *opts |= LSQPACK_ENC_OPT_FREQ_SKETCH;     break;
+        case 'M': *opts |= LSQPACK_ENC_OPT_NO_MEM_GUARD;    break;
+        case '-':                                           break;
+        default:
+            return -1;
+        }
+    return 0;
+}
+
+
+static void
+feed_decoder_stream (struct lsqpack_enc *enc, unsigned char first_byte,
+                                        uint64_t value, unsigned prefix_bits)
+{
+    unsigned char cmd[16], *end;
+
+    cmd[0] = first_byte;
+    end = lsqpack_enc_int(cmd, cmd + sizeof(cmd), value, prefix_bits);
+    assert(end > cmd);
+    if (0 != lsqpack_enc_decoder_in(enc, cmd, end - cmd))
+    {
+        fprintf(stderr, "decoder stream error\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/* Run the encoder with immediate acknowledgements */
+static void
+run_encoder (const struct bench_qif *qif, const struct params *params,
+        enum lsqpack_enc_opts enc_opts, uint64_t *enc_bytes,
+        uint64_t *hea_bytes)
+{
+    static unsigned char enc_buf[0x30000], hea_buf[0x30000];
+    struct lsqpack_enc enc;
+    struct lsxpack_header xhdr;
+    const struct bench_field *field;
+    unsigned char tsu_buf[LSQPACK_LONGEST_SDTC];
+    unsigned char pref_buf[0x20];
+    size_t tsu_buf_sz, enc_sz, hea_sz;
+    unsigned block, n, saved_ins_count;
+    ssize_t pref_sz;
+
+    tsu_buf_sz = sizeof(tsu_buf);
+    if (0 != lsqpack_enc_init(&enc, NULL, params->capacity, params->capacity,
+                params->max_risked_streams, enc_opts, tsu_buf, &tsu_buf_sz))
+    {
+        perror("lsqpack_enc_init");
+        exit(EXIT_FAILURE);
+    }
+
+    *enc_bytes = 0;
+    *hea_bytes = 0;
+    saved_ins_count = 0;
+    for (block = 0; block < qif->n_hblocks; ++block)
+    {
+        if (0 != lsqpack_enc_start_header(&enc, block + 1, 0))
+        {
+            fprintf(stderr, "cannot start header\n");
+            exit(EXIT_FAILURE);
+        }
+        for (n = qif->hblocks[block]; n < qif->hblocks[block + 1]; ++n)
+        {
+            field = &qif->fields[n];
+            lsxpack_header_set_offset2(&xhdr, qif->buf + field->name_offset,
+                        0, field->name_len,
+                        field->val_offset - field->name_offset, field->val_len);
+            enc_sz = sizeof(enc_buf);
+            hea_sz = sizeof(hea_buf);
+            if (LQES_OK != lsqpack_enc_encode(&enc, enc_buf, &enc_sz,
+                                            hea_buf, &hea_sz, &xhdr, 0))
+            {
+                fprintf(stderr, "cannot encode header\n");
+                exit(EXIT_FAILURE);
+            }
+            *enc_bytes += enc_sz;
+            *hea_bytes += hea_sz;
+        }
+        pref_sz = lsqpack_enc_end_header(&enc, pref_buf, sizeof(pref_buf),
+                                                                        NULL);
+        if (pref_sz <= 0)
+        {
+            fprintf(stderr, "cannot end header\n");
+            exit(EXIT_FAILURE);
+        }
+        *hea_bytes += pref_sz;
+        if (!(2 == pref_sz && pref_buf[0] == 0 && pref_buf[1] == 0))
+            feed_decoder_stream(&enc, 0x80, block + 1, 7);
+        if (enc.qpe_ins_count > saved_ins_count)
+        {
+            feed_decoder_stream(&enc, 0x00,
+                                enc.qpe_ins_count - saved_ins_count, 6);
+            saved_ins_count = enc.qpe_ins_count;
+        }
+    }
+
+    lsqpack_enc_cleanup(&enc);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    const char *in_path = NULL;
+    const char *opts_list = "-,A";
+    unsigned table_sizes[MAX_LIST] = { 4096, },
+             risked_streams[MAX_LIST] = { 0, 100, };
+    unsigned n_table_sizes = 1, n_risked_streams = 2;
+    const char *opts_strs[MAX_LIST];
+    unsigned horizons[MAX_LIST] = { 256, 1024, };
+    unsigned n_horizons = 2;
+    unsigned n_opts_strs, width = 64;
+    struct bench_qif qif;
+    struct corpus corpus;
+    struct params params;
+    struct state best, state;
+    enum lsqpack_enc_opts enc_opts;
+    uint64_t enc_bytes, hea_bytes;
+    unsigned t, s, h, o, first, best_horizon = 0;
+    const char *p;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "i:t:s:O:b:H:h")))
+    {
+        switch (opt)
+        {
+        case 'i':
+            in_path = optarg;
+            break;
+        case 't':
+            n_table_sizes = bench_parse_list(optarg, table_sizes, MAX_LIST);
+            break;
+        case 's':
+            n_risked_streams = bench_parse_list(optarg, risked_streams,
+                                                                    MAX_LIST);
+            break;
+        case 'O':
+            opts_list = optarg;
+            break;
+        case 'b':
+            width = atoi(optarg);
+            break;
+        case 'H':
+            n_horizons = bench_parse_list(optarg, horizons, MAX_LIST);
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!in_path || width == 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    n_opts_strs = 0;
+    for (p = opts_list; n_opts_strs < MAX_LIST; ++p)
+    {
+        if (0 != parse_opts(p, &enc_opts))
+        {
+            fprintf(stderr, "invalid option set in `%s'\n", opts_list);
+            exit(EXIT_FAILURE);
+        }
+        opts_strs[n_opts_strs++] = p;
+        p += strcspn(p, ",");
+        if (*p == '\0')
+            break;
+    }
+
+    bench_qif_load(&qif, in_path);
+    corpus_load(&corpus, &qif);
+
+    printf("{\n"
+           "  \"file\": \"%s\",\n"
+           "  \"header_blocks\": %u,\n"
+           "  \"fields\": %u,\n"
+           "  \"unique_fields\": %u,\n"
+           "  \"raw_bytes\": %zu,\n"
+           "  \"beam\": %u,\n"
+           "  \"results\": [", in_path, qif.n_hblocks, qif.n_fields,
+           corpus.n_fields, qif.raw_bytes, width);
+    first = 1;
+    for (t = 0; t < n_table_sizes; ++t)
+        for (s = 0; s < n_risked_streams; ++s)
+        {
+            params.capacity = table_sizes[t];
+            params.max_entries = table_sizes[t] / ENTRY_OVERHEAD;
+            params.max_risked_streams = risked_streams[s];
+            memset(&best, 0, sizeof(best));
+            best.cost = COST_INF;
+            for (h = 0; h < n_horizons; ++h)
+            {
+                params.horizon = horizons[h];
+                search(&params, &corpus, width, &state);
+                if (state.cost < best.cost)
+                {
+                    best = state;
+                    best_horizon = horizons[h];
+                }
+            }
+            if (best.cost == COST_INF)
+            {
+                fprintf(stderr, "no encoding found for table size %u and "
+                    "%u risked streams\n", params.capacity,
+                    params.max_risked_streams);
+                exit(EXIT_FAILURE);
+            }
+            printf("%s\n    {\"table_size\": %u, \"risked_streams\": %u,\n"
+                "     \"oracle\": {\"bytes\": %"PRIu64", \"enc_bytes\": "
+                "%"PRIu64", \"hea_bytes\": %"PRIu64", \"ratio\": %.4f, "
+                "\"inserts\": %"PRIu64", \"horizon\": %u},\n"
+                "     \"encoder\": [",
+                first ? "" : ",", params.capacity, params.max_risked_streams,
+                best.cost, best.enc_bytes, best.hea_bytes,
+                (double) best.cost / qif.raw_bytes, best.ins_count,
+                best_horizon);
+            for (o = 0; o < n_opts_strs; ++o)
+            {
+                (void) parse_opts(opts_strs[o], &enc_opts);
+                run_encoder(&qif, &params, enc_opts, &enc_bytes, &hea_bytes);
+                printf("%s\n       {\"opts\": \"%.*s\", \"bytes\": %"PRIu64", "
+                    "\"enc_bytes\": %"PRIu64", \"hea_bytes\": %"PRIu64", "
+                    "\"ratio\": %.4f, \"gap\": %.2f}",
+                    o ? "," : "", (int) strcspn(opts_strs[o], ","),
+                    opts_strs[o], enc_bytes + hea_bytes, enc_bytes,
+                    hea_bytes,
+                    (double) (enc_bytes + hea_bytes) / qif.raw_bytes,
+                    best.cost ? ((double) (enc_bytes + hea_bytes)
+                                / (double) best.cost - 1) * 100 : 0.);
+            }
+            printf("\n     ]}");
+            first = 0;
+        }
+    printf("\n  ]\n}\n");
+
+    free(corpus.fields);
+    free(corpus.seq);
+    free(corpus.hblocks);
+    free(corpus.upcoming);
+    bench_qif_cleanup(&qif);
+    return 0;
+}
@@ -0,0 +1,453 @@
+/*
+ * bench-pareto: find encoder settings that trade compression for CPU best.
+ *
+ * Each QIF or BQIF file in the corpus is encoded with every combination of
+ * table size, number of risked streams, acknowledgement mode, and encoder
+ * option set.  For each combination, two costs are measured over the whole
+ * corpus:
+ *
+ *  bytes           Encoder stream and header block bytes, prefixes included
+ *  ns_per_field    CPU time per header field.  Each file is encoded -n
+ *                    times and the fastest run is used, which filters out
+ *                    most of the scheduling noise.
+ *
+ * A combination is on the Pareto frontier if no other combination is at
+ * least as good in both costs and better in one.  All results and then the
+ * frontier, ordered from best compression to least CPU, are printed to
+ * stdout as JSON.
+ *
+ * Encoder options are given as letters; see parse_opts() below.  A new
+ * encoder heuristic becomes part of the sweep by adding its letter there.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#include <getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "lsqpack.h"
+#include "lsxpack_header.h"
+#include "bench.h"
+
+#define MAX_LIST 16
+
+unsigned char *
+lsqpack_enc_int (unsigned char *dst, unsigned char *const end, uint64_t value,
+                                                        unsigned prefix_bits);
+
+static void
+usage (const char *name)
+{
+    fprintf(stderr,
+"Usage: %s [options] file...\n"
+"\n"
+"Files are QIF or BQIF.\n"
+"\n"
+"Options:\n"
+"   -n NUMBER   Number of runs per file and configuration.  The fastest\n"
+"                 run is used.  Defaults to 5.\n"
+"   -t LIST     Comma-separated list of dynamic table sizes.  Defaults to\n"
+"                 0,1024,4096,16384,65536.\n"
+"   -s LIST     Comma-separated list of maximum risked streams.  Defaults\n"
+"                 to 0,16,100.\n"
+"   -a LIST     Comma-separated list of acknowledgement modes: 0 means\n"
+"                 header blocks are never acknowledged, 1 means they are\n"
+"                 acknowledged immediately.  Defaults to 0,1.\n"
+"   -O LIST     Comma-separated list of encoder option sets.  Each set is\n"
+"                 a combination of letters S (server), D (no dup), A\n"
+"                 (aggressive indexing), F (frequency sketch), and M (no\n"
+"                 memory guard); `-' means no options.  Defaults to all\n"
+"                 combinations of S, D, and A.\n"
+"   -F          Only print the frontier.\n"
+"\n"
+"   -h          Print this help screen and exit\n"
+    , name);
+}
+
+
+struct config
+{
+    unsigned                dyn_table_size;
+    unsigned                max_risked_streams;
+    unsigned                ack_mode;
+    enum lsqpack_enc_opts   enc_opts;
+    const char             *opts_str;
+};
+
+
+struct point
+{
+    struct config           cfg;
+    uint64_t                bytes;
+    uint64_t                nsec;
+    int                     on_frontier;
+};
+
+
+static void
+feed_decoder_stream (struct lsqpack_enc *enc, unsigned char first_byte,
+                                        uint64_t value, unsigned prefix_bits)
+{
+    unsigned char cmd[16], *end;
+
+    cmd[0] = first_byte;
+    end = lsqpack_enc_int(cmd, cmd + sizeof(cmd), value, prefix_bits);
+    assert(end > cmd);
+    if (0 != lsqpack_enc_decoder_in(enc, cmd, end - cmd))
+    {
+        fprintf(stderr, "decoder stream error\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/* Encode the file once.  Returns the number of bytes produced and sets
+ * `nsec' to the time it took.
+ */
+static uint64_t
+run_once (const struct bench_qif *qif, const struct config *cfg,
+            unsigned char *enc_buf, unsigned char *hea_buf, size_t buf_sz,
+            uint64_t *nsec)
+{
+    struct lsqpack_enc enc;
+    struct lsxpack_header xhdr;
+    const struct bench_field *field;
+    unsigned char tsu_buf[LSQPACK_LONGEST_SDTC];
+    unsigned char pref_buf[LSQPACK_LONGEST_HEADER_ACK + 0x20];
+    size_t tsu_buf_sz, enc_off, hea_off, enc_sz, hea_sz;
+    unsigned block, n, saved_ins_count;
+    enum lsqpack_enc_status st;
+    ssize_t pref_sz;
+    uint64_t start, bytes;
+
+    tsu_buf_sz = sizeof(tsu_buf);
+    if (0 != lsqpack_enc_init(&enc, NULL, cfg->dyn_table_size,
+                cfg->dyn_table_size, cfg->max_risked_streams, cfg->enc_opts,
+                tsu_buf, &tsu_buf_sz))
+    {
+        perror("lsqpack_enc_init");
+        exit(EXIT_FAILURE);
+    }
+
+    bytes = tsu_buf_sz;
+    saved_ins_count = 0;
+    start = bench_nsec();
+    for (block = 0; block < qif->n_hblocks; ++block)
+    {
+        if (0 != lsqpack_enc_start_header(&enc, block + 1, 0))
+        {
+            fprintf(stderr, "cannot start header\n");
+            exit(EXIT_FAILURE);
+        }
+        enc_off = 0;
+        hea_off = 0;
+        for (n = qif->hblocks[block]; n < qif->hblocks[block + 1]; ++n)
+        {
+            field = &qif->fields[n];
+            lsxpack_header_set_offset2(&xhdr, qif->buf + field->name_offset,
+                        0, field->name_len,
+                        field->val_offset - field->name_offset, field->val_len);
+            enc_sz = buf_sz - enc_off;
+            hea_sz = buf_sz - hea_off;
+            st = lsqpack_enc_encode(&enc, enc_buf + enc_off, &enc_sz,
+                                    hea_buf + hea_off, &hea_sz, &xhdr, 0);
+            if (st != LQES_OK)
+            {
+                fprintf(stderr, "cannot encode header: %d\n", (int) st);
+                exit(EXIT_FAILURE);
+            }
+            enc_off += enc_sz;
+            hea_off += hea_sz;
+        }
+        pref_sz = lsqpack_enc_end_header(&enc, pref_buf, sizeof(pref_buf),
+                                                                        NULL);
+        if (pref_sz <= 0)
+        {
+            fprintf(stderr, "cannot end header\n");
+            exit(EXIT_FAILURE);
+        }
+        bytes += enc_off + hea_off + pref_sz;
+        if (cfg->ack_mode)
+        {
+            if (!(2 == pref_sz && pref_buf[0] == 0 && pref_buf[1] == 0))
+                feed_decoder_stream(&enc, 0x80, block + 1, 7);
+            if (enc.qpe_ins_count > saved_ins_count)
+            {
+                feed_decoder_stream(&enc, 0x00,
+                                    enc.qpe_ins_count - saved_ins_count, 6);
+                saved_ins_count = enc.qpe_ins_count;
+            }
+        }
+    }
+    *nsec = bench_nsec() - start;
+
+    lsqpack_enc_cleanup(&enc);
+    return bytes;
+}
+
+
+static int
+parse_opts (const char *str, enum lsqpack_enc_opts *opts)
+{
+    *opts = 0;
+    for ( ; *str && *str != ','; ++str)
+        switch (*str)
+        {
+        case 'S': *opts |= LSQPACK_ENC_OPT_SERVER;          break;
+        case 'D': *opts |= LSQPACK_ENC_OPT_NO_DUP;          break;
+        case 'A': *opts |= LSQPACK_ENC_OPT_IX_AGGR;         break;
+        case 'F': *opts |= LSQPACK_ENC_OPT_FREQ_SKETCH;     break;
+        case 'M': *opts |= LSQPACK_ENC_OPT_NO_MEM_GUARD;    break;
+        case '-':                                           break;
+        default:
+            return -1;
+        }
+    return 0;
+}
+
+
+/* Order by bytes, then by time */
+static int
+point_cmp (const void *ap, const void *bp)
+{
+    const struct point *a = *(const struct point *const *) ap,
+                       *b = *(const struct point *const *) bp;
+
+    if (a->bytes != b->bytes)
+        return a->bytes < b->bytes ? -1 : 1;
+    if (a->nsec != b->nsec)
+        return a->nsec < b->nsec ? -1 : 1;
+    return 0;
+}
+
+
+/* Mark points on the frontier.  Once the points are sorted by bytes, a
+ * point is on the frontier if it is faster than every point before it.
+ * Returns the number of points on the frontier; `sorted' is left in order.
+ */
+static unsigned
+find_frontier (struct point *points, unsigned n_points, struct point **sorted)
+{
+    uint64_t best_nsec;
+    unsigned n, n_frontier;
+
+    for (n = 0; n < n_points; ++n)
+        sorted[n] = &points[n];
+    qsort(sorted, n_points, sizeof(sorted[0]), point_cmp);
+
+    n_frontier = 0;
+    best_nsec = UINT64_MAX;
+    for (n = 0; n < n_points; ++n)
+        if (sorted[n]->nsec < best_nsec)
+        {
+            best_nsec = sorted[n]->nsec;
+            sorted[n]->on_frontier = 1;
+            ++n_frontier;
+        }
+    return n_frontier;
+}
+
+
+static void
+print_point (const struct point *point, double fields, double raw_bytes,
+                                                                    int first)
+{
+    printf("%s\n    {\"table_size\": %u, \"risked_streams\": %u, "
+        "\"ack_mode\": %u, \"opts\": \"%.*s\", \"bytes\": %"PRIu64", "
+        "\"ratio\": %.4f, \"ns_per_field\": %.1f, \"frontier\": %s}",
+        first ? "" : ",",
+        point->cfg.dyn_table_size, point->cfg.max_risked_streams,
+        point->cfg.ack_mode,
+        (int) strcspn(point->cfg.opts_str, ","), point->cfg.opts_str,
+        point->bytes, (double) point->bytes / raw_bytes,
+        (double) point->nsec / fields,
+        point->on_frontier ? "true" : "false");
+}
+
+
+int
+main (int argc, char **argv)
+{
+    const char *opts_list = "-,S,D,A,SD,SA,DA,SDA";
+    unsigned n_iters = 5;
+    unsigned table_sizes[MAX_LIST] = { 0, 1024, 4096, 16384, 65536, },
+             risked_streams[MAX_LIST] = { 0, 16, 100, },
+             ack_modes[MAX_LIST] = { 0, 1, };
+    unsigned n_table_sizes = 5, n_risked_streams = 3, n_ack_modes = 2;
+    const char *opts_strs[MAX_LIST];
+    unsigned n_opts_strs, n_files, n_points, n_frontier;
+    struct bench_qif *qifs;
+    struct point *points, *point, **sorted;
+    struct config cfg;
+    unsigned char *enc_buf, *hea_buf;
+    size_t buf_sz, block_sz;
+    unsigned t, s, a, o, f, i, n, first;
+    uint64_t bytes, nsec, best_nsec;
+    const char *p;
+    double fields, raw_bytes;
+    int opt, frontier_only = 0;
+
+    while (-1 != (opt = getopt(argc, argv, "n:t:s:a:O:Fh")))
+    {
+        switch (opt)
+        {
+        case 'n':
+            n_iters = atoi(optarg);
+            break;
+        case 't':
+            n_table_sizes = bench_parse_list(optarg, table_sizes, MAX_LIST);
+            break;
+        case 's':
+            n_risked_streams = bench_parse_list(optarg, risked_streams,
+                                                                    MAX_LIST);
+            break;
+        case 'a':
+            n_ack_modes = bench_parse_list(optarg, ack_modes, MAX_LIST);
+            break;
+        case 'O':
+            opts_list = optarg;
+            break;
+        case 'F':
+            frontier_only = 1;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    n_files = argc - optind;
+    if (n_files == 0 || n_iters == 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    n_opts_strs = 0;
+    for (p = opts_list; n_opts_strs < MAX_LIST; ++p)
+    {
+        if (0 != parse_opts(p, &cfg.enc_opts))
+        {
+            fprintf(stderr, "invalid option set in `%s'\n", opts_list);
+            exit(EXIT_FAILURE);
+        }
+        opts_strs[n_opts_strs++] = p;
+        p += strcspn(p, ",");
+        if (*p == '\0')
+            break;
+    }
+
+    qifs = malloc(n_files * sizeof(qifs[0]));
+    if (!qifs)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Strings may be Huffman-encoded into the buffer before the encoder
+     * finds that the plain form is shorter, and a Huffman code is at most
+     * 30 bits long.  Add a few bytes of integer prefix per field.
+     */
+    buf_sz = 0;
+    fields = 0;
+    raw_bytes = 0;
+    for (f = 0; f < n_files; ++f)
+    {
+        bench_qif_load(&qifs[f], argv[optind + f]);
+        for (n = 0; n < qifs[f].n_hblocks; ++n)
+        {
+            block_sz = 32 * (qifs[f].hblocks[n + 1] - qifs[f].hblocks[n]);
+            for (i = qifs[f].hblocks[n]; i < qifs[f].hblocks[n + 1]; ++i)
+                block_sz += 4 * (qifs[f].fields[i].name_len
+                                            + qifs[f].fields[i].val_len);
+            if (block_sz > buf_sz)
+                buf_sz = block_sz;
+        }
+        fields += qifs[f].n_fields;
+        raw_bytes += qifs[f].raw_bytes;
+    }
+    enc_buf = malloc(buf_sz);
+    hea_buf = malloc(buf_sz);
+    points = calloc(n_table_sizes * n_risked_streams * n_ack_modes
+                                            * n_opts_strs, sizeof(points[0]));
+    sorted = malloc(n_table_sizes * n_risked_streams * n_ack_modes
+                                            * n_opts_strs * sizeof(sorted[0]));
+    if (!enc_buf || !hea_buf || !points || !sorted)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    n_points = 0;
+    for (t = 0; t < n_table_sizes; ++t)
+      for (s = 0; s < n_risked_streams; ++s)
+        for (a = 0; a < n_ack_modes; ++a)
+          for (o = 0; o < n_opts_strs; ++o)
+          {
+            point = &points[n_points++];
+            point->cfg.dyn_table_size = table_sizes[t];
+            point->cfg.max_risked_streams = risked_streams[s];
+            point->cfg.ack_mode = ack_modes[a];
+            point->cfg.opts_str = opts_strs[o];
+            (void) parse_opts(opts_strs[o], &point->cfg.enc_opts);
+            for (f = 0; f < n_files; ++f)
+            {
+                best_nsec = UINT64_MAX;
+                bytes = 0;
+                for (i = 0; i < n_iters; ++i)
+                {
+                    bytes = run_once(&qifs[f], &point->cfg, enc_buf, hea_buf,
+                                                            buf_sz, &nsec);
+                    if (nsec < best_nsec)
+                        best_nsec = nsec;
+                }
+                point->bytes += bytes;
+                point->nsec += best_nsec;
+            }
+          }
+
+    n_frontier = find_frontier(points, n_points, sorted);
+
+    printf("{\n"
+           "  \"files\": %u,\n"
+           "  \"fields\": %.0f,\n"
+           "  \"raw_bytes\": %.0f,\n"
+           "  \"iterations\": %u,\n"
+           "  \"configurations\": %u,\n", n_files, fields, raw_bytes, n_iters,
+           n_points);
+    if (!frontier_only)
+    {
+        printf("  \"results\": [");
+        for (n = 0; n < n_points; ++n)
+            print_point(&points[n], fields, raw_bytes, n == 0);
+        printf("\n  ],\n");
+    }
+    printf("  \"frontier\": [");
+    first = 1;
+    for (n = 0; n < n_points; ++n)
+        if (sorted[n]->on_frontier)
+        {
+            print_point(sorted[n], fields, raw_bytes, first);
+            first = 0;
+        }
+    printf("\n  ],\n"
+           "  \"frontier_size\": %u\n"
+           "}\n", n_frontier);
+
+    for (f = 0; f < n_files; ++f)
+        bench_qif_cleanup(&qifs[f]);
+    free(qifs);
+    free(points);
+    free(sorted);
+    free(enc_buf);
+    free(hea_buf);
+    return 0;
+}
@@ -0,0 +1,774 @@
+/*
+ * bench-stress: per-call latency under adversarial peer behavior.
+ *
+ * Each scenario drives the encoder or the decoder into a worst case and
+ * records how long each library call takes.  Median, p99, p999, and maximum
+ * latencies are printed to stdout as JSON.
+ *
+ * Encoder scenarios:
+ *
+ *  unacked_hinfos      Thousands of header blocks, all at risk, are never
+ *                        acknowledged.  Then they are acknowledged in random
+ *                        order, one Section Acknowledgement per call.
+ *  unacked_hinfos_nmg  Same with LSQPACK_ENC_OPT_NO_MEM_GUARD.
+ *  draining_table      The table is full of entries referenced by unacked
+ *                        header blocks: nothing can be evicted, and old
+ *                        entries are requested again.
+ *  capacity_flip       Table capacity changes between the maximum and a
+ *                        small value before each encoded field.
+ *
+ * Decoder scenarios:
+ *
+ *  max_blocked         Maximum number of blocked header blocks, unblocked
+ *                        one encoder stream chunk at a time.
+ *  byte_by_byte        Encoder stream and header blocks are fed one byte
+ *                        per call.
+ *  long_huffman        Header values made up of the longest Huffman codes.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#include <getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "lsqpack.h"
+#include "lsxpack_header.h"
+#include "bench.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define TABLE_SIZE 0x10000
+
+unsigned char *
+lsqpack_enc_int (unsigned char *dst, unsigned char *const end, uint64_t value,
+                                                        unsigned prefix_bits);
+
+static void
+usage (const char *name)
+{
+    fprintf(stderr,
+"Usage: %s [options]\n"
+"\n"
+"Options:\n"
+"   -n NUMBER   Scenario size: number of header blocks.  Defaults to 5000.\n"
+"   -S NAME     Only run this scenario.  May be specified more than once.\n"
+"\n"
+"   -h          Print this help screen and exit\n"
+    , name);
+}
+
+
+/* Latency samples of a single call type */
+struct lat
+{
+    uint32_t   *samples;    /* In nanoseconds */
+    unsigned    n, nalloc;
+};
+
+/* Encoded header block along with the encoder stream it depends on */
+struct rec
+{
+    unsigned char  *enc;
+    size_t          enc_sz;
+    unsigned char  *hblock;
+    size_t          hblock_sz;
+    uint64_t        stream_id;
+    size_t          off;        /* Decoder progress */
+};
+
+static unsigned s_n = 5000;
+static const char *s_scenarios[16];
+static unsigned s_n_scenarios;
+static int s_first_result = 1;
+
+static unsigned char s_enc_buf[0x10000], s_hea_buf[0x10000];
+static char s_field_buf[0x2000];
+
+
+static void
+lat_add (struct lat *lat, uint64_t start)
+{
+    uint64_t ns;
+
+    ns = bench_nsec() - start;
+    if (lat->n >= lat->nalloc)
+    {
+        lat->nalloc = lat->nalloc ? lat->nalloc * 2 : 1024;
+        lat->samples = realloc(lat->samples,
+                                    lat->nalloc * sizeof(lat->samples[0]));
+        if (!lat->samples)
+        {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    lat->samples[ lat->n++ ] = ns > UINT32_MAX ? UINT32_MAX : (uint32_t) ns;
+}
+
+
+static int
+cmp_uint32 (const void *ap, const void *bp)
+{
+    uint32_t a = *(const uint32_t *) ap, b = *(const uint32_t *) bp;
+    return (a > b) - (a < b);
+}
+
+
+static uint32_t
+lat_quantile (const struct lat *lat, double q)
+{
+    unsigned idx;
+
+    idx = (unsigned) (q * lat->n);
+    if (idx >= lat->n)
+        idx = lat->n - 1;
+    return lat->samples[idx];
+}
+
+
+/* Print results and free samples */
+static void
+lat_report (const char *scenario, const char *call, struct lat *lat)
+{
+    if (lat->n == 0)
+        return;
+    qsort(lat->samples, lat->n, sizeof(lat->samples[0]), cmp_uint32);
+    printf("%s\n    {\"scenario\": \"%s\", \"call\": \"%s\", \"calls\": %u, "
+        "\"p50_ns\": %"PRIu32", \"p99_ns\": %"PRIu32", "
+        "\"p999_ns\": %"PRIu32", \"max_ns\": %"PRIu32"}",
+        s_first_result ? "" : ",", scenario, call, lat->n,
+        lat_quantile(lat, 0.5), lat_quantile(lat, 0.99),
+        lat_quantile(lat, 0.999), lat->samples[lat->n - 1]);
+    s_first_result = 0;
+    free(lat->samples);
+    memset(lat, 0, sizeof(*lat));
+}
+
+
+static int
+scenario_selected (const char *scenario)
+{
+    unsigned n;
+
+    if (s_n_scenarios == 0)
+        return 1;
+    for (n = 0; n < s_n_scenarios; ++n)
+        if (0 == strcmp(s_scenarios[n], scenario))
+            return 1;
+    return 0;
+}
+
+
+/* Synthesize header field `name-id' with value of `val_len' bytes */
+static void
+make_field (struct lsxpack_header *xhdr, const char *name, unsigned id,
+                                                            unsigned val_len)
+{
+    int name_len;
+
+    name_len = snprintf(s_field_buf, sizeof(s_field_buf), "%s-%u", name, id);
+    assert(name_len > 0 && name_len + val_len <= sizeof(s_field_buf));
+    memset(s_field_buf + name_len, 'a' + id % 26, val_len);
+    lsxpack_header_set_offset2(xhdr, s_field_buf, 0, name_len, name_len,
+                                                                    val_len);
+}
+
+
+static void
+enc_init (struct lsqpack_enc *enc, unsigned max_risked_streams,
+                                                enum lsqpack_enc_opts opts)
+{
+    unsigned char tsu_buf[LSQPACK_LONGEST_SDTC];
+    size_t tsu_buf_sz;
+
+    tsu_buf_sz = sizeof(tsu_buf);
+    if (0 != lsqpack_enc_init(enc, NULL, TABLE_SIZE, TABLE_SIZE,
+                            max_risked_streams, opts, tsu_buf, &tsu_buf_sz))
+    {
+        perror("lsqpack_enc_init");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+static void
+feed_decoder_stream (struct lsqpack_enc *enc, unsigned char first_byte,
+                        uint64_t value, unsigned prefix_bits, struct lat *lat)
+{
+    unsigned char cmd[16], *end;
+    uint64_t start;
+
+    cmd[0] = first_byte;
+    end = lsqpack_enc_int(cmd, cmd + sizeof(cmd), value, prefix_bits);
+    assert(end > cmd);
+    start = bench_nsec();
+    if (0 != lsqpack_enc_decoder_in(enc, cmd, end - cmd))
+    {
+        fprintf(stderr, "decoder stream error\n");
+        exit(EXIT_FAILURE);
+    }
+    if (lat)
+        lat_add(lat, start);
+}
+
+
+/* Encode header block made up of `n_fields' fields produced by `gen'.  If
+ * `rec' is not NULL, the encoder stream and the header block are saved to
+ * it.  The encode() and end_header() calls are timed.  Returns true if the
+ * header block references the dynamic table and must be acknowledged.
+ */
+static int
+enc_block (struct lsqpack_enc *enc, uint64_t stream_id, unsigned n_fields,
+        void (*gen)(struct lsxpack_header *, unsigned idx, void *), void *ctx,
+        struct lat *lat_encode, struct lat *lat_end, struct rec *rec)
+{
+    unsigned char pref_buf[0x20];
+    struct lsxpack_header xhdr;
+    size_t enc_off, hea_off, enc_sz, hea_sz;
+    ssize_t pref_sz;
+    uint64_t start;
+    unsigned n;
+
+    if (0 != lsqpack_enc_start_header(enc, stream_id, 0))
+    {
+        fprintf(stderr, "cannot start header\n");
+        exit(EXIT_FAILURE);
+    }
+    enc_off = 0;
+    hea_off = 0;
+    for (n = 0; n < n_fields; ++n)
+    {
+        gen(&xhdr, n, ctx);
+        enc_sz = sizeof(s_enc_buf) - enc_off;
+        hea_sz = sizeof(s_hea_buf) - hea_off;
+        start = bench_nsec();
+        if (LQES_OK != lsqpack_enc_encode(enc, s_enc_buf + enc_off, &enc_sz,
+                                    s_hea_buf + hea_off, &hea_sz, &xhdr, 0))
+        {
+            fprintf(stderr, "cannot encode header\n");
+            exit(EXIT_FAILURE);
+        }
+        if (lat_encode)
+            lat_add(lat_encode, start);
+        enc_off += enc_sz;
+        hea_off += hea_sz;
+    }
+    start = bench_nsec();
+    pref_sz = lsqpack_enc_end_header(enc, pref_buf, sizeof(pref_buf), NULL);
+    if (pref_sz <= 0)
+    {
+        fprintf(stderr, "cannot end header\n");
+        exit(EXIT_FAILURE);
+    }
+    if (lat_end)
+        lat_add(lat_end, start);
+
+    if (rec)
+    {
+        rec->stream_id = stream_id;
+        rec->enc_sz = enc_off;
+        rec->hblock_sz = pref_sz + hea_off;
+        rec->enc = malloc(rec->enc_sz + 1);
+        rec->hblock = malloc(rec->hblock_sz);
+        if (!rec->enc || !rec->hblock)
+        {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(rec->enc, s_enc_buf, enc_off);
+        memcpy(rec->hblock, pref_buf, pref_sz);
+        memcpy(rec->hblock + pref_sz, s_hea_buf, hea_off);
+        rec->off = 0;
+    }
+
+    /* Non-zero Required Insert Count */
+    return pref_buf[0] != 0;
+}
+
+
+static void
+recs_free (struct rec *recs, unsigned n_recs)
+{
+    unsigned n;
+
+    for (n = 0; n < n_recs; ++n)
+    {
+        free(recs[n].enc);
+        free(recs[n].hblock);
+    }
+    free(recs);
+}
+
+
+static struct rec *
+recs_alloc (unsigned n_recs)
+{
+    struct rec *recs;
+
+    recs = calloc(n_recs, sizeof(recs[0]));
+    if (!recs)
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    return recs;
+}
+
+
+/* Field generators.  `ctx' points to block number. */
+
+/* A field shared by all header blocks and a unique one */
+static void
+gen_common_and_unique (struct lsxpack_header *xhdr, unsigned idx, void *ctx)
+{
+    if (idx == 0)
+        make_field(xhdr, "x-common", 0, 20);
+    else
+        make_field(xhdr, "x-unique", *(unsigned *) ctx, 20);
+}
+
+
+/* Unique field every block, or, every other block, a field from a while
+ * ago that is likely to be draining.
+ */
+static void
+gen_unique_or_old (struct lsxpack_header *xhdr, unsigned idx, void *ctx)
+{
+    unsigned block = *(unsigned *) ctx;
+
+    if ((block & 1) && block > 64)
+        make_field(xhdr, "x-field", block - 64, 40);
+    else
+        make_field(xhdr, "x-field", block, 40);
+}
+
+
+/* Several fields, some repeated */
+static void
+gen_mixed (struct lsxpack_header *xhdr, unsigned idx, void *ctx)
+{
+    unsigned block = *(unsigned *) ctx;
+
+    if (idx < 4)
+        make_field(xhdr, "x-repeated", idx, 30);
+    else
+        make_field(xhdr, "x-new", block * 8 + idx, 10 + idx * 20);
+}
+
+
+static void
+scenario_unacked_hinfos (const char *scenario, enum lsqpack_enc_opts opts)
+{
+    struct lat lat_encode = { 0 }, lat_end = { 0 }, lat_ack = { 0 };
+    struct lsqpack_enc enc;
+    unsigned *order, block, n, n_order, tmp;
+    uint64_t rand_state;
+
+    order = malloc(s_n * sizeof(order[0]));
+    if (!order)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Only header blocks that reference the dynamic table are acknowledged */
+    enc_init(&enc, s_n + 1, opts | LSQPACK_ENC_OPT_IX_AGGR);
+    n_order = 0;
+    for (block = 0; block < s_n; ++block)
+        if (enc_block(&enc, block, 2, gen_common_and_unique, &block,
+                                            &lat_encode, &lat_end, NULL))
+            order[n_order++] = block;
+
+    rand_state = 1;
+    for (n = n_order - 1; n > 0 && n < n_order; --n)
+    {
+        rand_state = rand_state * 6364136223846793005ull
+                                                + 1442695040888963407ull;
+        block = (unsigned) ((rand_state >> 33) % (n + 1));
+        tmp = order[n];
+        order[n] = order[block];
+        order[block] = tmp;
+    }
+    for (n = 0; n < n_order; ++n)
+        feed_decoder_stream(&enc, 0x80, order[n], 7, &lat_ack);
+    free(order);
+
+    lat_report(scenario, "encode", &lat_encode);
+    lat_report(scenario, "end_header", &lat_end);
+    lat_report(scenario, "decoder_in", &lat_ack);
+    lsqpack_enc_cleanup(&enc);
+}
+
+
+static void
+scenario_draining_table (const char *scenario)
+{
+    struct lat lat_encode = { 0 }, lat_end = { 0 };
+    struct lsqpack_enc enc;
+    unsigned block;
+
+    enc_init(&enc, s_n + 1, LSQPACK_ENC_OPT_IX_AGGR);
+    for (block = 0; block < s_n; ++block)
+        enc_block(&enc, block, 1, gen_unique_or_old, &block,
+                                                &lat_encode, &lat_end, NULL);
+    lat_report(scenario, "encode", &lat_encode);
+    lat_report(scenario, "end_header", &lat_end);
+    lsqpack_enc_cleanup(&enc);
+}
+
+
+static void
+scenario_capacity_flip (const char *scenario)
+{
+    struct lat lat_encode = { 0 }, lat_cap = { 0 };
+    unsigned char tsu_buf[LSQPACK_LONGEST_SDTC];
+    size_t tsu_buf_sz;
+    struct lsqpack_enc enc;
+    unsigned block, saved_ins_count;
+    uint64_t start;
+
+    enc_init(&enc, 0, LSQPACK_ENC_OPT_IX_AGGR);
+    saved_ins_count = 0;
+    for (block = 0; block < s_n; ++block)
+    {
+        tsu_buf_sz = sizeof(tsu_buf);
+        start = bench_nsec();
+        if (0 != lsqpack_enc_set_max_capacity(&enc,
+                        block & 1 ? TABLE_SIZE : 256, tsu_buf, &tsu_buf_sz))
+        {
+            perror("lsqpack_enc_set_max_capacity");
+            exit(EXIT_FAILURE);
+        }
+        lat_add(&lat_cap, start);
+        enc_block(&enc, block, 8, gen_mixed, &block, &lat_encode, NULL, NULL);
+        /* Acknowledge everything so that entries can be evicted */
+        if (enc.qpe_ins_count > saved_ins_count)
+        {
+            feed_decoder_stream(&enc, 0x00, enc.qpe_ins_count
+                                                - saved_ins_count, 6, NULL);
+            saved_ins_count = enc.qpe_ins_count;
+        }
+    }
+    lat_report(scenario, "set_max_capacity", &lat_cap);
+    lat_report(scenario, "encode", &lat_encode);
+    lsqpack_enc_cleanup(&enc);
+}
+
+
+/* Only one header field is being decoded at a time */
+static char s_xhdr_buf[0x10000];
+static struct lsxpack_header s_xhdr;
+
+
+static struct lsxpack_header *
+prepare_decode (void *hblock_ctx, struct lsxpack_header *xhdr, size_t space)
+{
+    if (space > sizeof(s_xhdr_buf))
+        return NULL;
+    if (xhdr)
+    {
+        xhdr->val_len = space;
+        return xhdr;
+    }
+    lsxpack_header_prepare_decode(&s_xhdr, s_xhdr_buf, 0, space);
+    return &s_xhdr;
+}
+
+
+static int
+process_header (void *hblock_ctx, struct lsxpack_header *xhdr)
+{
+    return 0;
+}
+
+
+static const struct lsqpack_dec_hset_if hset_if = {
+    .dhi_unblocked      = NULL,
+    .dhi_prepare_decode = prepare_decode,
+    .dhi_process_header = process_header,
+};
+
+
+/* Feed header block up to `max_read' bytes per call.  Returns 1 when done,
+ * 0 when blocked.
+ */
+static int
+dec_hblock (struct lsqpack_dec *dec, struct rec *rec, size_t max_read,
+                                                            struct lat *lat)
+{
+    unsigned char dec_buf[LSQPACK_LONGEST_HEADER_ACK];
+    enum lsqpack_read_header_status rhs;
+    const unsigned char *p;
+    size_t dec_buf_sz;
+    uint64_t start;
+
+    do
+    {
+        p = rec->hblock + rec->off;
+        dec_buf_sz = sizeof(dec_buf);
+        start = bench_nsec();
+        if (rec->off == 0)
+            rhs = lsqpack_dec_header_in(dec, rec, rec->stream_id,
+                        rec->hblock_sz, &p, MIN(max_read, rec->hblock_sz),
+                        dec_buf, &dec_buf_sz);
+        else
+            rhs = lsqpack_dec_header_read(dec, rec, &p,
+                        MIN(max_read, rec->hblock_sz - rec->off), dec_buf,
+                        &dec_buf_sz);
+        lat_add(lat, start);
+        rec->off = p - rec->hblock;
+    }
+    while (rhs == LQRHS_NEED);
+
+    if (rhs == LQRHS_DONE)
+        return 1;
+    if (rhs == LQRHS_BLOCKED)
+        return 0;
+    fprintf(stderr, "stream %"PRIu64": header block error\n", rec->stream_id);
+    exit(EXIT_FAILURE);
+}
+
+
+static void
+dec_enc_in (struct lsqpack_dec *dec, const unsigned char *buf, size_t sz,
+                                            size_t max_read, struct lat *lat)
+{
+    uint64_t start;
+    size_t n;
+
+    while (sz > 0)
+    {
+        n = MIN(sz, max_read);
+        start = bench_nsec();
+        if (0 != lsqpack_dec_enc_in(dec, buf, n))
+        {
+            fprintf(stderr, "encoder stream error\n");
+            exit(EXIT_FAILURE);
+        }
+        lat_add(lat, start);
+        buf += n;
+        sz -= n;
+    }
+}
+
+
+static void
+scenario_max_blocked (const char *scenario)
+{
+    struct lat lat_header_in = { 0 }, lat_enc_in = { 0 },
+               lat_header_read = { 0 };
+    struct lsqpack_enc enc;
+    struct lsqpack_dec dec;
+    struct rec *recs, *rec;
+    unsigned block, n_done;
+
+    /* Each header block references the entry inserted for it */
+    recs = recs_alloc(s_n);
+    enc_init(&enc, s_n, LSQPACK_ENC_OPT_IX_AGGR);
+    for (block = 0; block < s_n; ++block)
+        enc_block(&enc, block, 2, gen_common_and_unique, &block, NULL, NULL,
+                                                                &recs[block]);
+    lsqpack_enc_cleanup(&enc);
+
+    lsqpack_dec_init(&dec, NULL, TABLE_SIZE, s_n, &hset_if,
+                                            LSQPACK_DEC_OPT_DEFER_UNBLOCKED);
+    n_done = 0;
+    for (block = 0; block < s_n; ++block)
+        n_done += dec_hblock(&dec, &recs[block], SIZE_MAX, &lat_header_in);
+    for (block = 0; block < s_n; ++block)
+    {
+        dec_enc_in(&dec, recs[block].enc, recs[block].enc_sz, SIZE_MAX,
+                                                                &lat_enc_in);
+        while ((rec = lsqpack_dec_next_unblocked(&dec)))
+            n_done += dec_hblock(&dec, rec, SIZE_MAX, &lat_header_read);
+    }
+    assert(n_done == s_n);
+    lsqpack_dec_cleanup(&dec);
+    recs_free(recs, s_n);
+
+    lat_report(scenario, "header_in", &lat_header_in);
+    lat_report(scenario, "enc_in", &lat_enc_in);
+    lat_report(scenario, "header_read", &lat_header_read);
+}
+
+
+static void
+scenario_byte_by_byte (const char *scenario)
+{
+    struct lat lat_header = { 0 }, lat_enc_in = { 0 };
+    struct lsqpack_enc enc;
+    struct lsqpack_dec dec;
+    struct rec *recs;
+    unsigned block, saved_ins_count;
+
+    recs = recs_alloc(s_n);
+    enc_init(&enc, 100, 0);
+    saved_ins_count = 0;
+    for (block = 0; block < s_n; ++block)
+    {
+        enc_block(&enc, block, 8, gen_mixed, &block, NULL, NULL,
+                                                                &recs[block]);
+        if (enc.qpe_ins_count > saved_ins_count)
+        {
+            feed_decoder_stream(&enc, 0x00, enc.qpe_ins_count
+                                                - saved_ins_count, 6, NULL);
+            saved_ins_count = enc.qpe_ins_count;
+        }
+    }
+    lsqpack_enc_cleanup(&enc);
+
+    lsqpack_dec_init(&dec, NULL, TABLE_SIZE, 100, &hset_if,
+                                            LSQPACK_DEC_OPT_DEFER_UNBLOCKED);
+    for (block = 0; block < s_n; ++block)
+    {
+        dec_enc_in(&dec, recs[block].enc, recs[block].enc_sz, 1, &lat_enc_in);
+        if (!dec_hblock(&dec, &recs[block], 1, &lat_header))
+        {
+            fprintf(stderr, "unexpected blocked header block\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    lsqpack_dec_cleanup(&dec);
+    recs_free(recs, s_n);
+
+    lat_report(scenario, "header_in_read", &lat_header);
+    lat_report(scenario, "enc_in", &lat_enc_in);
+}
+
+
+/* Header block with a single literal field whose value is `n_codes'
+ * newlines, Huffman-encoded.  The newline has one of the longest codes,
+ * 30 bits.
+ */
+static size_t
+make_long_huffman_hblock (unsigned char *buf, size_t buf_sz, unsigned n_codes)
+{
+    const uint32_t code = 0x3ffffffc;
+    const unsigned code_len = 30;
+    unsigned char *p, *end;
+    uint64_t bits;
+    unsigned n_bits, n, val_sz;
+
+    val_sz = (n_codes * code_len + 7) / 8;
+    end = buf + buf_sz;
+    p = buf;
+    *p++ = 0;                           /* Required Insert Count */
+    *p++ = 0;                           /* Base */
+    *p++ = 0x20 | 1;                    /* Literal name, length 1 */
+    *p++ = 'x';
+    *p = 0x80;                          /* Huffman */
+    p = lsqpack_enc_int(p, end, val_sz, 7);
+    assert(p > buf && (size_t) (end - p) >= val_sz);
+
+    bits = 0;
+    n_bits = 0;
+    for (n = 0; n < n_codes; ++n)
+    {
+        bits = (bits << code_len) | code;
+        n_bits += code_len;
+        while (n_bits >= 8)
+        {
+            n_bits -= 8;
+            *p++ = (unsigned char) (bits >> n_bits);
+        }
+    }
+    if (n_bits)                         /* Pad with EOS prefix */
+        *p++ = (unsigned char) ((bits << (8 - n_bits))
+                                            | ((1u << (8 - n_bits)) - 1));
+    return p - buf;
+}
+
+
+static void
+scenario_long_huffman (const char *scenario)
+{
+    struct lat lat_header = { 0 }, lat_header_1 = { 0 };
+    struct lsqpack_dec dec;
+    struct rec rec;
+    unsigned block;
+
+    rec.hblock = malloc(0x4000);
+    if (!rec.hblock)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    rec.hblock_sz = make_long_huffman_hblock(rec.hblock, 0x4000, 4000);
+    lsqpack_dec_init(&dec, NULL, TABLE_SIZE, 100, &hset_if, 0);
+    for (block = 0; block < s_n; ++block)
+    {
+        rec.stream_id = block;
+        rec.off = 0;
+        /* Byte-by-byte decoding is slow: do it for one block in 16 */
+        if (block % 16 == 15)
+            dec_hblock(&dec, &rec, 1, &lat_header_1);
+        else
+            dec_hblock(&dec, &rec, SIZE_MAX, &lat_header);
+    }
+    lsqpack_dec_cleanup(&dec);
+    free(rec.hblock);
+
+    lat_report(scenario, "header_in", &lat_header);
+    lat_report(scenario, "header_in_read_1", &lat_header_1);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "n:S:h")))
+    {
+        switch (opt)
+        {
+        case 'n':
+            s_n = atoi(optarg);
+            break;
+        case 'S':
+            if (s_n_scenarios < sizeof(s_scenarios) / sizeof(s_scenarios[0]))
+                s_scenarios[s_n_scenarios++] = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (s_n == 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("{\n"
+           "  \"n\": %u,\n"
+           "  \"results\": [", s_n);
+    if (scenario_selected("unacked_hinfos"))
+        scenario_unacked_hinfos("unacked_hinfos", 0);
+    if (scenario_selected("unacked_hinfos_nmg"))
+        scenario_unacked_hinfos("unacked_hinfos_nmg",
+                                            LSQPACK_ENC_OPT_NO_MEM_GUARD);
+    if (scenario_selected("draining_table"))
+        scenario_draining_table("draining_table");
+    if (scenario_selected("capacity_flip"))
+        scenario_capacity_flip("capacity_flip");
+    if (scenario_selected("max_blocked"))
+        scenario_max_blocked("max_blocked");
+    if (scenario_selected("byte_by_byte"))
+        scenario_byte_by_byte("byte_by_byte");
+    if (scenario_selected("long_huffman"))
+        scenario_long_huffman("long_huffman");
+    printf("\n  ]\n}\n");
+
+    exit(EXIT_SUCCESS);
+}
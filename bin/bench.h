@@ -0,0 +1,360 @@
+/*
+ * bench.h -- helpers shared by the bench-* programs
+ *
+ * Each benchmark includes this file exactly once.
+ */
+
+#ifndef LSQPACK_BENCH_H
+#define LSQPACK_BENCH_H 1
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "bqif.h"
+
+/* Allocation counting.  When the benchmark is linked with
+ * `-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc' (see bin/CMakeLists.txt),
+ * every allocation made by the statically linked library goes through the
+ * wrappers below.  Otherwise, allocations cannot be counted and
+ * bench_allocs() returns -1.
+ */
+#if LSQPACK_BENCH_WRAP_MALLOC
+static unsigned long long s_bench_n_allocs;
+
+void *__real_malloc (size_t);
+void *__real_calloc (size_t, size_t);
+void *__real_realloc (void *, size_t);
+
+void *
+__wrap_malloc (size_t size)
+{
+    ++s_bench_n_allocs;
+    return __real_malloc(size);
+}
+
+void *
+__wrap_calloc (size_t nmemb, size_t size)
+{
+    ++s_bench_n_allocs;
+    return __real_calloc(nmemb, size);
+}
+
+void *
+__wrap_realloc (void *ptr, size_t size)
+{
+    ++s_bench_n_allocs;
+    return __real_realloc(ptr, size);
+}
+
+static inline long long
+bench_allocs (void)
+{
+    return (long long) s_bench_n_allocs;
+}
+#else
+static inline long long
+bench_allocs (void)
+{
+    return -1;
+}
+#endif
+
+
+static inline double
+bench_seconds (void)
+{
+    return (double) clock() / CLOCKS_PER_SEC;
+}
+
+
+/* Wall-clock time in nanoseconds, for timing individual calls */
+static inline uint64_t
+bench_nsec (void)
+{
+#if defined(CLOCK_MONOTONIC) && !defined(WIN32)
+    struct timespec ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+#else
+    return (uint64_t) clock() * (1000000000 / CLOCKS_PER_SEC);
+#endif
+}
+
+
+/* Read whole file into memory.  The buffer is NUL-terminated. */
+static inline char *
+bench_read_file (const char *path, size_t *size)
+{
+    FILE *in;
+    char *buf;
+    size_t nread, alloced;
+
+    in = fopen(path, "rb");
+    if (!in)
+    {
+        fprintf(stderr, "cannot open `%s' for reading: %s\n", path,
+                                                            strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    alloced = 0x10000;
+    buf = malloc(alloced);
+    *size = 0;
+    while (buf)
+    {
+        nread = fread(buf + *size, 1, alloced - *size - 1, in);
+        *size += nread;
+        if (*size + 1 < alloced)
+            break;
+        alloced *= 2;
+        buf = realloc(buf, alloced);
+    }
+    if (!buf)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    if (ferror(in))
+    {
+        fprintf(stderr, "error reading `%s'\n", path);
+        exit(EXIT_FAILURE);
+    }
+    (void) fclose(in);
+    buf[*size] = '\0';
+    return buf;
+}
+
+
+/* A QIF or BQIF file preloaded into memory.  Header blocks are ranges in
+ * the `fields' array: block N comprises fields hblocks[N] up to
+ * hblocks[N + 1].  Offsets are from the start of `buf'.  BQIF files are
+ * mapped and used in place.
+ */
+struct bench_field
+{
+    unsigned    name_offset;
+    unsigned    name_len;
+    unsigned    val_offset;
+    unsigned    val_len;
+};
+
+struct bench_qif
+{
+    char                *buf;
+    size_t               buf_sz;
+    struct bench_field  *fields;
+    unsigned             n_fields;
+    unsigned            *hblocks;   /* n_hblocks + 1 elements */
+    unsigned             n_hblocks;
+    size_t               raw_bytes; /* Sum of names and values */
+    int                  mapped;    /* `buf' is mapped */
+};
+
+
+/* Map file if it is BQIF.  Returns 0 if it is not. */
+static inline int
+bench_bqif_load (struct bench_qif *qif, const char *path)
+{
+#ifndef WIN32
+    struct bqif bqif;
+    struct stat st;
+    const unsigned char *p;
+    const char *name, *val;
+    unsigned list, n, n_fields, name_len, val_len;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (0 != fstat(fd, &st) || st.st_size < BQIF_HEADER_SZ)
+    {
+        (void) close(fd);
+        return 0;
+    }
+    map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    (void) close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+    if (!bqif_is_bqif(map, (size_t) st.st_size))
+    {
+        (void) munmap(map, (size_t) st.st_size);
+        return 0;
+    }
+    if (0 != bqif_init(&bqif, map, (size_t) st.st_size)
+                                                    || bqif.n_lists == 0)
+    {
+        fprintf(stderr, "%s: malformed BQIF file\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    qif->buf = map;
+    qif->buf_sz = (size_t) st.st_size;
+    qif->mapped = 1;
+    qif->fields = malloc(bqif.n_fields * sizeof(qif->fields[0]) + 1);
+    qif->hblocks = malloc((bqif.n_lists + 1) * sizeof(qif->hblocks[0]));
+    if (!qif->fields || !qif->hblocks)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (list = 0; list < bqif.n_lists; ++list)
+    {
+        qif->hblocks[ qif->n_hblocks++ ] = qif->n_fields;
+        p = bqif_list(&bqif, list, &n_fields);
+        for (n = 0; n < n_fields; ++n)
+        {
+            p = bqif_field_raw(p, &name, &name_len, &val, &val_len);
+            qif->fields[ qif->n_fields ].name_offset
+                                        = (unsigned) (name - qif->buf);
+            qif->fields[ qif->n_fields ].name_len = name_len;
+            qif->fields[ qif->n_fields ].val_offset
+                                        = (unsigned) (val - qif->buf);
+            qif->fields[ qif->n_fields ].val_len = val_len;
+            qif->raw_bytes += name_len + val_len;
+            ++qif->n_fields;
+        }
+    }
+    qif->hblocks[ qif->n_hblocks ] = qif->n_fields;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+
+static inline void
+bench_qif_load (struct bench_qif *qif, const char *path)
+{
+    char *line, *end, *tab;
+    unsigned n_alloc_fields, n_alloc_blocks, lineno;
+    int in_block;
+
+    memset(qif, 0, sizeof(*qif));
+    if (bench_bqif_load(qif, path))
+        return;
+    qif->buf = bench_read_file(path, &qif->buf_sz);
+    n_alloc_fields = 0;
+    n_alloc_blocks = 0;
+    in_block = 0;
+    lineno = 0;
+
+    for (line = qif->buf; line < qif->buf + qif->buf_sz; line = end + 1)
+    {
+        ++lineno;
+        end = strchr(line, '\n');
+        if (!end)
+            end = qif->buf + qif->buf_sz;
+
+        if (line == end)
+        {
+            in_block = 0;
+            continue;
+        }
+        if (*line == '#')
+            continue;
+
+        tab = memchr(line, '\t', end - line);
+        if (!tab)
+        {
+            fprintf(stderr, "%s: no TAB on line %u\n", path, lineno);
+            exit(EXIT_FAILURE);
+        }
+
+        if (!in_block)
+        {
+            if (qif->n_hblocks + 2 > n_alloc_blocks)
+            {
+                n_alloc_blocks = n_alloc_blocks ? n_alloc_blocks * 2 : 64;
+                qif->hblocks = realloc(qif->hblocks,
+                                    n_alloc_blocks * sizeof(qif->hblocks[0]));
+                if (!qif->hblocks)
+                {
+                    perror("realloc");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            qif->hblocks[ qif->n_hblocks++ ] = qif->n_fields;
+            in_block = 1;
+        }
+
+        if (qif->n_fields >= n_alloc_fields)
+        {
+            n_alloc_fields = n_alloc_fields ? n_alloc_fields * 2 : 256;
+            qif->fields = realloc(qif->fields,
+                                    n_alloc_fields * sizeof(qif->fields[0]));
+            if (!qif->fields)
+            {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        qif->fields[ qif->n_fields ].name_offset = (unsigned) (line - qif->buf);
+        qif->fields[ qif->n_fields ].name_len = (unsigned) (tab - line);
+        qif->fields[ qif->n_fields ].val_offset
+                                            = (unsigned) (tab + 1 - qif->buf);
+        qif->fields[ qif->n_fields ].val_len = (unsigned) (end - tab - 1);
+        qif->raw_bytes += end - line - 1;
+        ++qif->n_fields;
+    }
+
+    if (qif->n_hblocks == 0)
+    {
+        fprintf(stderr, "%s: no header blocks found\n", path);
+        exit(EXIT_FAILURE);
+    }
+    qif->hblocks[ qif->n_hblocks ] = qif->n_fields;
+}
+
+
+static inline void
+bench_qif_cleanup (struct bench_qif *qif)
+{
+    free(qif->hblocks);
+    free(qif->fields);
+#ifndef WIN32
+    if (qif->mapped)
+    {
+        (void) munmap(qif->buf, qif->buf_sz);
+        return;
+    }
+#endif
+    free(qif->buf);
+}
+
+
+/* Parse comma-separated list of unsigned integers.  Returns number of
+ * elements.
+ */
+static inline unsigned
+bench_parse_list (const char *str, unsigned *vals, unsigned max_vals)
+{
+    unsigned n;
+    char *end;
+
+    for (n = 0; n < max_vals; ++n)
+    {
+        vals[n] = (unsigned) strtoul(str, &end, 10);
+        if (end == str)
+            break;
+        if (*end != ',')
+            return n + 1;
+        str = end + 1;
+    }
+
+    fprintf(stderr, "cannot parse list `%s'\n", str);
+    exit(EXIT_FAILURE);
+}
+
+#endif
@@ -0,0 +1,174 @@
+/*
+ * bqif.h -- binary QIF corpus
+ *
+ * BQIF carries the same header lists as QIF, but can be used in place: the
+ * file is mapped into memory and lsxpack_header structs point directly at
+ * the mapped bytes.  tools/qif2bqif.pl and tools/bqif2qif.pl convert between
+ * the two formats.  Comments and annotations are not preserved.
+ *
+ * All integers are little-endian.  The layout is:
+ *
+ *   Offset  Size        Contents
+ *        0     4        Magic: "BQIF"
+ *        4     4        Version: 1
+ *        8     4        Number of header lists, N
+ *       12     4        Reserved, zero
+ *       16     8 * N    Offset of each header list from the start of file
+ *   16+8*N     8        Offset of the end of the last header list
+ *
+ * Each header list is a 32-bit field count followed by the fields.  A field
+ * is a 16-bit name length, a 16-bit value length, the name, and the value.
+ * The name and the value are adjacent, so a single buffer describes both.
+ *
+ * The program includes this file exactly once.
+ */
+
+#ifndef LSQPACK_BQIF_H
+#define LSQPACK_BQIF_H 1
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lsxpack_header.h"
+
+#define BQIF_MAGIC "BQIF"
+#define BQIF_VERSION 1
+#define BQIF_HEADER_SZ 16
+
+struct bqif
+{
+    const unsigned char    *buf;
+    size_t                  size;
+    unsigned                n_lists;
+    unsigned                n_fields;   /* Total */
+};
+
+
+static inline uint16_t
+bqif_u16 (const unsigned char *p)
+{
+    return (uint16_t) (p[0] | p[1] << 8);
+}
+
+
+static inline uint32_t
+bqif_u32 (const unsigned char *p)
+{
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16
+                                                    | (uint32_t) p[3] << 24;
+}
+
+
+static inline uint64_t
+bqif_u64 (const unsigned char *p)
+{
+    return (uint64_t) bqif_u32(p) | (uint64_t) bqif_u32(p + 4) << 32;
+}
+
+
+/* Returns true if the buffer starts with BQIF magic */
+static inline int
+bqif_is_bqif (const void *buf, size_t size)
+{
+    return size >= BQIF_HEADER_SZ && 0 == memcmp(buf, BQIF_MAGIC, 4);
+}
+
+
+/* Check the whole file, so that the accessors below do not have to.
+ * Returns 0 on success and -1 if the file is malformed.
+ */
+static inline int
+bqif_init (struct bqif *bqif, const void *buf, size_t size)
+{
+    const unsigned char *const begin = buf, *const end = begin + size;
+    const unsigned char *p, *list_end;
+    uint64_t off, next_off;
+    unsigned n_lists, n, n_fields;
+    uint32_t list_fields;
+
+    if (!bqif_is_bqif(buf, size)
+            || bqif_u32(begin + 4) != BQIF_VERSION
+            || bqif_u32(begin + 12) != 0)
+        return -1;
+    n_lists = bqif_u32(begin + 8);
+    if ((uint64_t) n_lists + 1 > (size - BQIF_HEADER_SZ) / 8)
+        return -1;
+
+    n_fields = 0;
+    off = bqif_u64(begin + BQIF_HEADER_SZ);
+    for (n = 0; n < n_lists; ++n)
+    {
+        next_off = bqif_u64(begin + BQIF_HEADER_SZ + (n + 1) * 8);
+        if (off < BQIF_HEADER_SZ + ((uint64_t) n_lists + 1) * 8
+                || next_off < off + 4 || next_off > size)
+            return -1;
+        p = begin + off;
+        list_end = begin + next_off;
+        list_fields = bqif_u32(p);
+        p += 4;
+        while (list_fields-- > 0)
+        {
+            if (list_end - p < 4
+                    || (size_t) (list_end - p - 4)
+                                    < (size_t) bqif_u16(p) + bqif_u16(p + 2))
+                return -1;
+            p += 4 + bqif_u16(p) + bqif_u16(p + 2);
+            ++n_fields;
+        }
+        if (p != list_end)
+            return -1;
+        off = next_off;
+    }
+    if (off > (uint64_t) (end - begin))
+        return -1;
+
+    bqif->buf = begin;
+    bqif->size = size;
+    bqif->n_lists = n_lists;
+    bqif->n_fields = n_fields;
+    return 0;
+}
+
+
+/* Return pointer to the first field of header list `idx' */
+static inline const unsigned char *
+bqif_list (const struct bqif *bqif, unsigned idx, unsigned *n_fields)
+{
+    const unsigned char *p;
+
+    p = bqif->buf + bqif_u64(bqif->buf + BQIF_HEADER_SZ + (size_t) idx * 8);
+    *n_fields = bqif_u32(p);
+    return p + 4;
+}
+
+
+/* Point `xhdr' at the field at `p' and return pointer to the next field.
+ * The library only reads the name and the value, so the mapped bytes can
+ * be read-only.
+ */
+static inline const unsigned char *
+bqif_field (const unsigned char *p, struct lsxpack_header *xhdr)
+{
+    const unsigned name_len = bqif_u16(p), val_len = bqif_u16(p + 2);
+
+    lsxpack_header_set_offset2(xhdr, (char *) p + 4, 0, name_len, name_len,
+                                                                    val_len);
+    return p + 4 + name_len + val_len;
+}
+
+
+/* Return field name, value, and pointer to the next field, without going
+ * through lsxpack_header.
+ */
+static inline const unsigned char *
+bqif_field_raw (const unsigned char *p, const char **name, unsigned *name_len,
+                                        const char **val, unsigned *val_len)
+{
+    *name_len = bqif_u16(p);
+    *val_len = bqif_u16(p + 2);
+    *name = (const char *) p + 4;
+    *val = *name + *name_len;
+    return p + 4 + *name_len + *val_len;
+}
+
+#endif
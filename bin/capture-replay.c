@@ -0,0 +1,583 @@
+/*
+ * capture-replay: feed a capture log to a fresh decoder or encoder.
+ *
+ * A capture log is written by lsqpack_dec_capture() or lsqpack_enc_capture()
+ * (see lsqpack.h for the format) in a library built with LSQPACK_CAPTURE.
+ * Replay works with any build.  The decoder or encoder is created using the
+ * parameters in the log header and each record is replayed as fast as
+ * possible, keeping the original chunking.  Decoded header fields and
+ * encoder output are discarded.
+ *
+ * The decoder is created without the options that change how the caller
+ * interacts with it: header block storage, deferred unblocking, and queued
+ * decoder stream.  The log already has the calls these options lead to.
+ *
+ * The following is printed to stdout as JSON:
+ *
+ *  records         Number of records in the log
+ *  captured_ms     Time from the start of the capture to the last record
+ *  replay_ms       Time spent in library calls during replay
+ *  calls           Number of calls and mean time per call of each type
+ *  status          Decoder: how header block calls returned.  Encoder:
+ *                    number of calls that failed.
+ *
+ * With -v, each record is printed to stderr.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+#ifdef WIN32
+#include <getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "lsqpack.h"
+#include "lsxpack_header.h"
+#include "bench.h"
+
+#define N_REC_TYPES (LSQPACK_CAP_ENC_NAME_POLICY + 1)
+
+static int s_verbose;
+
+static const char *const rec2str[N_REC_TYPES] =
+{
+    [LSQPACK_CAP_DEC_ENC_IN]        = "enc_in",
+    [LSQPACK_CAP_DEC_HEADER_IN]     = "header_in",
+    [LSQPACK_CAP_DEC_HEADER_READ]   = "header_read",
+    [LSQPACK_CAP_DEC_CANCEL]        = "cancel",
+    [LSQPACK_CAP_DEC_UNREF]         = "unref",
+    [LSQPACK_CAP_ENC_DECODER_IN]    = "decoder_in",
+    [LSQPACK_CAP_ENC_START]         = "start_header",
+    [LSQPACK_CAP_ENC_FIELD]         = "encode",
+    [LSQPACK_CAP_ENC_END]           = "end_header",
+    [LSQPACK_CAP_ENC_CANCEL]        = "cancel_header",
+    [LSQPACK_CAP_ENC_CAPACITY]      = "set_max_capacity",
+    [LSQPACK_CAP_ENC_NAME_POLICY]   = "set_name_policy",
+};
+
+static void
+usage (const char *name)
+{
+    fprintf(stderr,
+"Usage: %s [options] -i capture\n"
+"\n"
+"Options:\n"
+"   -i FILE     Capture log written by lsqpack_dec_capture() or\n"
+"                 lsqpack_enc_capture().\n"
+"   -n NUMBER   Replay the log this many times.  Defaults to 1.\n"
+"   -v          Print records to stderr.\n"
+"   -h          Print this help screen and exit.\n"
+    , name);
+}
+
+
+struct reader
+{
+    const unsigned char    *p, *end;
+};
+
+
+static void
+malformed (const struct reader *rd, const unsigned char *begin)
+{
+    fprintf(stderr, "malformed capture at offset %zu\n",
+                                                    (size_t) (rd->p - begin));
+    exit(EXIT_FAILURE);
+}
+
+
+static int
+read_varint (struct reader *rd, uint64_t *val)
+{
+    unsigned shift;
+
+    *val = 0;
+    for (shift = 0; rd->p < rd->end && shift < 64; shift += 7)
+    {
+        *val |= (uint64_t) (*rd->p & 0x7F) << shift;
+        if (!(*rd->p++ & 0x80))
+            return 0;
+    }
+    return -1;
+}
+
+
+static int
+read_bytes (struct reader *rd, size_t len, const unsigned char **bytes)
+{
+    if ((size_t) (rd->end - rd->p) < len)
+        return -1;
+    *bytes = rd->p;
+    rd->p += len;
+    return 0;
+}
+
+
+static int
+read_string (struct reader *rd, const unsigned char **bytes, size_t *len)
+{
+    uint64_t val;
+
+    if (0 != read_varint(rd, &val) || val > SIZE_MAX)
+        return -1;
+    *len = (size_t) val;
+    return read_bytes(rd, *len, bytes);
+}
+
+
+/* Log header */
+struct capture
+{
+    const unsigned char    *buf, *records, *end;
+    int                     is_enc;
+    unsigned                flags;
+    uint64_t                max_capacity, cur_capacity, max_risked, opts;
+};
+
+
+static void
+capture_parse (struct capture *cap, const unsigned char *buf, size_t size)
+{
+    struct reader rd = { buf, buf + size, };
+
+    if (size < 7 || 0 != memcmp(buf, "QCAP", 4) || buf[4] != 1 || buf[5] > 1)
+    {
+        fprintf(stderr, "not a capture log\n");
+        exit(EXIT_FAILURE);
+    }
+    cap->buf = buf;
+    cap->is_enc = buf[5];
+    cap->flags = buf[6];
+    cap->cur_capacity = 0;  /* Only encoder captures record it */
+    rd.p += 7;
+    if (0 != read_varint(&rd, &cap->max_capacity)
+        || (cap->is_enc && 0 != read_varint(&rd, &cap->cur_capacity))
+        || 0 != read_varint(&rd, &cap->max_risked)
+        || 0 != read_varint(&rd, &cap->opts)
+        || cap->max_capacity > UINT_MAX || cap->cur_capacity > UINT_MAX
+        || cap->max_risked > UINT_MAX)
+        malformed(&rd, buf);
+    cap->records = rd.p;
+    cap->end = rd.end;
+}
+
+
+struct stats
+{
+    unsigned long           n_records;
+    uint64_t                captured_ns;
+    uint64_t                replay_ns;
+    unsigned long           n_calls[N_REC_TYPES];
+    uint64_t                call_ns[N_REC_TYPES];
+    unsigned long           n_status[4];    /* Decoder: by status */
+    unsigned long           n_failed;       /* Encoder */
+};
+
+
+/* Header blocks being decoded, by stream ID */
+struct hblock
+{
+    TAILQ_ENTRY(hblock)     next;
+    uint64_t                stream_id;
+};
+
+TAILQ_HEAD(hblocks, hblock);
+
+
+static struct hblock *
+find_hblock (struct hblocks *hblocks, uint64_t stream_id)
+{
+    struct hblock *hblock;
+
+    TAILQ_FOREACH(hblock, hblocks, next)
+        if (hblock->stream_id == stream_id)
+            return hblock;
+    return NULL;
+}
+
+
+static void
+drop_hblock (struct hblocks *hblocks, struct hblock *hblock)
+{
+    TAILQ_REMOVE(hblocks, hblock, next);
+    free(hblock);
+}
+
+
+static void
+unblocked (void *hblock_ctx)
+{
+    /* The log has the header_read calls that follow */
+}
+
+
+static struct lsxpack_header *
+prepare_decode (void *hblock_ctx, struct lsxpack_header *xhdr, size_t space)
+{
+    static char xhdr_buf[0x10000];
+    static struct lsxpack_header s_xhdr;
+
+    if (space > sizeof(xhdr_buf))
+        return NULL;
+    if (xhdr)
+    {
+        xhdr->val_len = space;
+        return xhdr;
+    }
+    lsxpack_header_prepare_decode(&s_xhdr, xhdr_buf, 0, space);
+    return &s_xhdr;
+}
+
+
+static int
+process_header (void *hblock_ctx, struct lsxpack_header *xhdr)
+{
+    return 0;
+}
+
+
+static const struct lsqpack_dec_hset_if hset_if = {
+    .dhi_unblocked      = unblocked,
+    .dhi_prepare_decode = prepare_decode,
+    .dhi_process_header = process_header,
+};
+
+
+static void
+replay_dec (const struct capture *cap, struct stats *stats)
+{
+    struct reader rd = { cap->records, cap->end, };
+    struct lsqpack_dec dec;
+    struct hblocks hblocks;
+    struct hblock *hblock;
+    enum lsqpack_read_header_status st;
+    const unsigned char *bytes, *p;
+    size_t len, dec_buf_sz;
+    uint64_t delta, stream_id, header_size, start, ns;
+    unsigned type;
+    unsigned char dec_buf[LSQPACK_LONGEST_HEADER_ACK];
+    unsigned char cancel_buf[LSQPACK_UINT64_ENC_SZ];
+
+    lsqpack_dec_init(&dec, NULL, (unsigned) cap->max_capacity,
+        (unsigned) cap->max_risked, &hset_if, (enum lsqpack_dec_opts)
+        (cap->opts & (LSQPACK_DEC_OPT_HTTP1X|LSQPACK_DEC_OPT_HASH_NAME
+                                            |LSQPACK_DEC_OPT_HASH_NAMEVAL)));
+    TAILQ_INIT(&hblocks);
+
+    while (rd.p < rd.end)
+    {
+        type = *rd.p++;
+        if (type < LSQPACK_CAP_DEC_ENC_IN || type > LSQPACK_CAP_DEC_UNREF
+                                        || 0 != read_varint(&rd, &delta))
+            malformed(&rd, cap->buf);
+        stats->captured_ns += delta;
+        ++stats->n_records;
+        stream_id = 0;
+        header_size = 0;
+        bytes = NULL;
+        len = 0;
+        if (type != LSQPACK_CAP_DEC_ENC_IN
+                                && 0 != read_varint(&rd, &stream_id))
+            malformed(&rd, cap->buf);
+        if (type == LSQPACK_CAP_DEC_HEADER_IN
+                                && 0 != read_varint(&rd, &header_size))
+            malformed(&rd, cap->buf);
+        if (type <= LSQPACK_CAP_DEC_HEADER_READ
+                                && 0 != read_string(&rd, &bytes, &len))
+            malformed(&rd, cap->buf);
+        if (s_verbose)
+            fprintf(stderr, "%-12s stream %-6"PRIu64" %zu bytes\n",
+                                            rec2str[type], stream_id, len);
+
+        hblock = NULL;
+        if (type == LSQPACK_CAP_DEC_HEADER_IN)
+        {
+            hblock = calloc(1, sizeof(*hblock));
+            if (!hblock)
+            {
+                perror("calloc");
+                exit(EXIT_FAILURE);
+            }
+            hblock->stream_id = stream_id;
+            TAILQ_INSERT_TAIL(&hblocks, hblock, next);
+        }
+        else if (type != LSQPACK_CAP_DEC_ENC_IN)
+        {
+            hblock = find_hblock(&hblocks, stream_id);
+            if (!hblock)
+            {
+                fprintf(stderr, "unknown stream %"PRIu64"\n", stream_id);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        p = bytes;
+        dec_buf_sz = sizeof(dec_buf);
+        st = LQRHS_NEED;
+        start = bench_nsec();
+        switch (type)
+        {
+        case LSQPACK_CAP_DEC_ENC_IN:
+            (void) lsqpack_dec_enc_in(&dec, bytes, len);
+            break;
+        case LSQPACK_CAP_DEC_HEADER_IN:
+            st = lsqpack_dec_header_in(&dec, hblock, stream_id,
+                            (size_t) header_size, &p, len, dec_buf, &dec_buf_sz);
+            break;
+        case LSQPACK_CAP_DEC_HEADER_READ:
+            st = lsqpack_dec_header_read(&dec, hblock, &p, len, dec_buf,
+                                                                &dec_buf_sz);
+            break;
+        case LSQPACK_CAP_DEC_CANCEL:
+            (void) lsqpack_dec_cancel_stream(&dec, hblock, cancel_buf,
+                                                        sizeof(cancel_buf));
+            break;
+        default:
+            (void) lsqpack_dec_unref_stream(&dec, hblock);
+            break;
+        }
+        ns = bench_nsec() - start;
+        stats->replay_ns += ns;
+        ++stats->n_calls[type];
+        stats->call_ns[type] += ns;
+
+        if (type == LSQPACK_CAP_DEC_HEADER_IN
+                                    || type == LSQPACK_CAP_DEC_HEADER_READ)
+        {
+            ++stats->n_status[st];
+            if (st == LQRHS_DONE || st == LQRHS_ERROR)
+                drop_hblock(&hblocks, hblock);
+        }
+        else if (type != LSQPACK_CAP_DEC_ENC_IN)
+            drop_hblock(&hblocks, hblock);
+    }
+
+    lsqpack_dec_cleanup(&dec);
+    while ((hblock = TAILQ_FIRST(&hblocks)))
+        drop_hblock(&hblocks, hblock);
+}
+
+
+static void
+replay_enc (const struct capture *cap, struct stats *stats)
+{
+    struct reader rd = { cap->records, cap->end, };
+    struct lsqpack_enc enc;
+    struct lsxpack_header xhdr;
+    const unsigned char *bytes, *name;
+    size_t len, enc_sz, hea_sz, tsu_sz;
+    uint64_t delta, a, b, start, ns, name_len, val_len;
+    unsigned type, xhdr_flags, qpack_index;
+    int failed;
+    static unsigned char enc_buf[0x10000], hea_buf[0x10000];
+    unsigned char tsu_buf[LSQPACK_LONGEST_SDTC], pref_buf[0x20];
+
+    tsu_sz = sizeof(tsu_buf);
+    if (0 != lsqpack_enc_init(&enc, NULL, (unsigned) cap->max_capacity,
+            (unsigned) cap->cur_capacity, (unsigned) cap->max_risked,
+            (enum lsqpack_enc_opts) cap->opts, tsu_buf, &tsu_sz))
+    {
+        perror("lsqpack_enc_init");
+        exit(EXIT_FAILURE);
+    }
+
+    while (rd.p < rd.end)
+    {
+        type = *rd.p++;
+        if (type < LSQPACK_CAP_ENC_DECODER_IN || type >= N_REC_TYPES
+                                        || 0 != read_varint(&rd, &delta))
+            malformed(&rd, cap->buf);
+        stats->captured_ns += delta;
+        ++stats->n_records;
+        a = b = 0;
+        bytes = NULL;
+        len = 0;
+        xhdr_flags = qpack_index = 0;
+        switch (type)
+        {
+        case LSQPACK_CAP_ENC_DECODER_IN:
+            if (0 != read_string(&rd, &bytes, &len))
+                malformed(&rd, cap->buf);
+            break;
+        case LSQPACK_CAP_ENC_START:
+            if (0 != read_varint(&rd, &a) || 0 != read_varint(&rd, &b))
+                malformed(&rd, cap->buf);
+            break;
+        case LSQPACK_CAP_ENC_FIELD:
+            if (0 != read_varint(&rd, &a) || rd.end - rd.p < 2)
+                malformed(&rd, cap->buf);
+            xhdr_flags = *rd.p++;
+            qpack_index = *rd.p++;
+            if (0 != read_varint(&rd, &name_len)
+                    || 0 != read_varint(&rd, &val_len)
+                    || name_len > UINT16_MAX || val_len > UINT16_MAX
+                    || 0 != read_bytes(&rd, name_len + val_len, &name))
+                malformed(&rd, cap->buf);
+            /* Name and value are adjacent */
+            lsxpack_header_set_offset2(&xhdr, (char *) name, 0,
+                            (size_t) name_len, (size_t) name_len, val_len);
+            xhdr.flags = (enum lsxpack_flag) xhdr_flags;
+            xhdr.qpack_index = (uint8_t) qpack_index;
+            len = (size_t) (name_len + val_len);
+            break;
+        case LSQPACK_CAP_ENC_CAPACITY:
+            if (0 != read_varint(&rd, &a) || a > UINT_MAX)
+                malformed(&rd, cap->buf);
+            break;
+        case LSQPACK_CAP_ENC_NAME_POLICY:
+            if (0 != read_varint(&rd, &a) || a > UINT_MAX
+                                || 0 != read_string(&rd, &bytes, &len))
+                malformed(&rd, cap->buf);
+            break;
+        default:
+            break;
+        }
+        if (s_verbose)
+        {
+            if (type == LSQPACK_CAP_ENC_FIELD)
+                fprintf(stderr, "%-16s %.*s: %.*s\n", rec2str[type],
+                    (int) name_len, (const char *) name, (int) val_len,
+                    (const char *) name + name_len);
+            else
+                fprintf(stderr, "%-16s %"PRIu64" %"PRIu64" %zu bytes\n",
+                                                rec2str[type], a, b, len);
+        }
+
+        start = bench_nsec();
+        switch (type)
+        {
+        case LSQPACK_CAP_ENC_DECODER_IN:
+            failed = 0 != lsqpack_enc_decoder_in(&enc, bytes, len);
+            break;
+        case LSQPACK_CAP_ENC_START:
+            failed = 0 != lsqpack_enc_start_header(&enc, a, (unsigned) b);
+            break;
+        case LSQPACK_CAP_ENC_FIELD:
+            enc_sz = sizeof(enc_buf);
+            hea_sz = sizeof(hea_buf);
+            failed = LQES_OK != lsqpack_enc_encode(&enc, enc_buf, &enc_sz,
+                    hea_buf, &hea_sz, &xhdr, (enum lsqpack_enc_flags) a);
+            break;
+        case LSQPACK_CAP_ENC_END:
+            failed = 0 >= lsqpack_enc_end_header(&enc, pref_buf,
+                                                    sizeof(pref_buf), NULL);
+            break;
+        case LSQPACK_CAP_ENC_CANCEL:
+            failed = 0 != lsqpack_enc_cancel_header(&enc);
+            break;
+        case LSQPACK_CAP_ENC_NAME_POLICY:
+            failed = 0 != lsqpack_enc_set_name_policy(&enc,
+                            (const char *) bytes, (unsigned) len,
+                            (enum lsqpack_name_policy) a);
+            break;
+        default:
+            tsu_sz = sizeof(tsu_buf);
+            failed = 0 != lsqpack_enc_set_max_capacity(&enc, (unsigned) a,
+                                                        tsu_buf, &tsu_sz);
+            break;
+        }
+        ns = bench_nsec() - start;
+        stats->replay_ns += ns;
+        ++stats->n_calls[type];
+        stats->call_ns[type] += ns;
+        stats->n_failed += failed;
+    }
+
+    lsqpack_enc_cleanup(&enc);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    const char *in_path = NULL;
+    unsigned n_iters = 1, n;
+    struct capture cap;
+    struct stats stats;
+    unsigned char *buf;
+    size_t size;
+    unsigned type;
+    int opt, first;
+
+    while (-1 != (opt = getopt(argc, argv, "i:n:vh")))
+    {
+        switch (opt)
+        {
+        case 'i':
+            in_path = optarg;
+            break;
+        case 'n':
+            n_iters = atoi(optarg);
+            break;
+        case 'v':
+            ++s_verbose;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!in_path || n_iters == 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    buf = (unsigned char *) bench_read_file(in_path, &size);
+    capture_parse(&cap, buf, size);
+
+    memset(&stats, 0, sizeof(stats));
+    for (n = 0; n < n_iters; ++n)
+        if (cap.is_enc)
+            replay_enc(&cap, &stats);
+        else
+            replay_dec(&cap, &stats);
+
+    printf("{\n"
+           "  \"file\": \"%s\",\n"
+           "  \"side\": \"%s\",\n"
+           "  \"redacted\": %s,\n"
+           "  \"iterations\": %u,\n"
+           "  \"records\": %lu,\n"
+           "  \"captured_ms\": %.3f,\n"
+           "  \"replay_ms\": %.3f,\n"
+           "  \"calls\": {", in_path, cap.is_enc ? "encoder" : "decoder",
+           cap.flags & LSQPACK_CAPTURE_REDACT ? "true" : "false", n_iters,
+           stats.n_records / n_iters, stats.captured_ns / n_iters / 1e6,
+           stats.replay_ns / n_iters / 1e6);
+    first = 1;
+    for (type = 1; type < N_REC_TYPES; ++type)
+        if (stats.n_calls[type])
+        {
+            printf("%s\n    \"%s\": { \"count\": %lu, \"ns_per_call\": %.1f }",
+                first ? "" : ",", rec2str[type],
+                stats.n_calls[type] / n_iters,
+                (double) stats.call_ns[type] / stats.n_calls[type]);
+            first = 0;
+        }
+    printf("\n  },\n");
+    if (cap.is_enc)
+        printf("  \"status\": { \"failed\": %lu }\n",
+                                                stats.n_failed / n_iters);
+    else
+        printf("  \"status\": { \"done\": %lu, \"blocked\": %lu, "
+            "\"need\": %lu, \"error\": %lu }\n",
+            stats.n_status[LQRHS_DONE] / n_iters,
+            stats.n_status[LQRHS_BLOCKED] / n_iters,
+            stats.n_status[LQRHS_NEED] / n_iters,
+            stats.n_status[LQRHS_ERROR] / n_iters);
+    printf("}\n");
+
+    free(buf);
+    return 0;
+}
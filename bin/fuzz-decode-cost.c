@@ -0,0 +1,451 @@
+/*
+ * fuzz-decode-cost: fuzzing target looking for slow inputs.
+ *
+ * Reads the same record format as fuzz-decode.  Instead of looking for
+ * crashes, it measures how much work the decoder does per input byte using
+ * the ds_work counter maintained by the parser (see lsqpack_dec_stats).
+ * With -w, inputs costing more than the given number of work units per
+ * byte abort the program, which the fuzzer records as a crash.  With -v,
+ * the costs are printed.
+ *
+ * Unlike fuzz-decode, the whole fuzz file is processed, header blocks are
+ * given unique contexts, and blocked header blocks are resumed when they
+ * become unblocked.  This makes blocked-stream and Duplicate patterns
+ * reachable.
+ */
+
+#ifdef WIN32
+
+#include <stdio.h>
+
+int
+main (int argc, char **argv)
+{
+    fprintf(stderr, "%s is not supported on Windows: need mmap(2)\n", argv[0]);
+    return 1;
+}
+
+#else
+
+#if defined(__FreeBSD__) || defined(__DragonFly__) || defined(__NetBSD__)
+#include <sys/endian.h>
+#define bswap_32 bswap32
+#define bswap_64 bswap64
+#elif defined(__OpenBSD__)
+#define bswap_32 swap32
+#define bswap_64 swap64
+#elif defined(__APPLE__)
+#include <libkern/OSByteOrder.h>
+#define bswap_32 OSSwapInt32
+#define bswap_64 OSSwapInt64
+#else
+#include <byteswap.h>
+#endif
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/queue.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include "lsqpack.h"
+#include "lsxpack_header.h"
+
+#ifdef __AFL_INIT
+__AFL_FUZZ_INIT();
+#endif
+
+static void
+usage (const char *name)
+{
+    fprintf(stderr,
+"Usage: %s [options] [-i input] [-f fuzz]\n"
+"\n"
+"Options:\n"
+"   -i FILE     Input file, decoded before the fuzz file.  Its cost is not\n"
+"                 counted.\n"
+#ifndef __AFL_INIT
+"   -f FILE     Fuzz file: this is the stuff the fuzzer will change.\n"
+"                 Defaults to stdin.\n"
+#endif
+"   -s NUMBER   Maximum number of risked streams.  Defaults to %u.\n"
+"   -t NUMBER   Dynamic table size.  Defaults to %u.\n"
+"   -H          Decode headers in HTTP/1.x format\n"
+"   -w NUMBER   Abort if the fuzz file costs more than NUMBER work units\n"
+"                 per byte.\n"
+"   -v          Print costs to stdout.\n"
+"\n"
+"   -h          Print this help screen and exit\n"
+    , name, LSQPACK_DEF_MAX_RISKED_STREAMS, LSQPACK_DEF_DYN_TABLE_SIZE);
+}
+
+
+/* Header block whose decoding is in progress */
+struct hblock
+{
+    LIST_ENTRY(hblock)      next_hblock;
+    const unsigned char    *p, *end;
+};
+
+static LIST_HEAD(, hblock) s_hblocks;
+
+
+/* Cost of one kind of call */
+struct cost
+{
+    unsigned long           calls;
+    uint64_t                bytes;
+    uint64_t                work;
+    double                  max_per_byte;
+};
+
+
+static void
+cost_add (struct cost *cost, size_t bytes, uint64_t work)
+{
+    double per_byte;
+
+    ++cost->calls;
+    cost->bytes += bytes;
+    cost->work += work;
+    per_byte = (double) work / (bytes ? bytes : 1);
+    if (per_byte > cost->max_per_byte)
+        cost->max_per_byte = per_byte;
+}
+
+
+static void
+cost_print (const char *name, const struct cost *cost)
+{
+    printf("%s: calls=%lu bytes=%"PRIu64" work=%"PRIu64" per_byte=%.2f "
+        "max_per_byte=%.2f\n", name, cost->calls, cost->bytes, cost->work,
+        cost->bytes ? (double) cost->work / cost->bytes : 0.,
+        cost->max_per_byte);
+}
+
+
+/* Only one header field is being decoded at a time */
+static char s_xhdr_buf[0x10000];
+static struct lsxpack_header s_xhdr;
+
+
+static struct lsxpack_header *
+prepare_decode (void *hblock_ctx, struct lsxpack_header *xhdr, size_t space)
+{
+    if (space > LSXPACK_MAX_STRLEN)
+        return NULL;
+    if (xhdr)
+    {
+        xhdr->val_len = space;
+        return xhdr;
+    }
+    lsxpack_header_prepare_decode(&s_xhdr, s_xhdr_buf, 0, space);
+    return &s_xhdr;
+}
+
+
+static int
+process_header (void *hblock_ctx, struct lsxpack_header *xhdr)
+{
+    return 0;
+}
+
+
+static const struct lsqpack_dec_hset_if hset_if = {
+    .dhi_unblocked      = NULL,
+    .dhi_prepare_decode = prepare_decode,
+    .dhi_process_header = process_header,
+};
+
+
+static void
+hblock_done (struct hblock *hblock)
+{
+    LIST_REMOVE(hblock, next_hblock);
+    free(hblock);
+}
+
+
+/* Returns 0 unless the header block could not be decoded */
+static int
+hblock_read (struct lsqpack_dec *dec, struct hblock *hblock,
+                                                uint64_t stream_id, int first)
+{
+    enum lsqpack_read_header_status rhs;
+    const unsigned char *p;
+
+    p = hblock->p;
+    if (first)
+        rhs = lsqpack_dec_header_in(dec, hblock, stream_id,
+                        hblock->end - p, &p, hblock->end - p, NULL, NULL);
+    else
+        rhs = lsqpack_dec_header_read(dec, hblock, &p, hblock->end - p,
+                                                                NULL, NULL);
+    hblock->p = p;
+    /* The decoder keeps the context of blocked and truncated header blocks
+     * until cleanup.
+     */
+    if (rhs == LQRHS_BLOCKED || rhs == LQRHS_NEED)
+        return 0;
+    hblock_done(hblock);
+    return rhs == LQRHS_DONE ? 0 : -1;
+}
+
+
+static void
+process_records (struct lsqpack_dec *dec, const unsigned char *p,
+                    const unsigned char *end, int strict,
+                    struct cost *enc_cost, struct cost *hea_cost)
+{
+    const unsigned char *const begin = p;
+    struct hblock *hblock;
+    uint64_t stream_id, work;
+    uint32_t size;
+    int r;
+
+    while (p + sizeof(stream_id) + sizeof(size) < end)
+    {
+        memcpy(&stream_id, p, sizeof(stream_id));
+        p += sizeof(stream_id);
+        memcpy(&size, p, sizeof(size));
+        p += sizeof(size);
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+        stream_id = bswap_64(stream_id);
+        size = bswap_32(size);
+#endif
+        if (size > (uint32_t) (end - p))
+        {
+            if (strict)
+            {
+                fprintf(stderr, "truncated input at offset %u",
+                                                    (unsigned) (p - begin));
+                abort();
+            }
+            size = (uint32_t) (end - p);
+        }
+        work = dec->qpd_stats.ds_work;
+        if (stream_id == 0)
+        {
+            r = lsqpack_dec_enc_in(dec, p, size);
+            /* Resuming unblocked header blocks is charged to the encoder
+             * stream: a few bytes may unblock many of them.
+             */
+            while (r == 0 && (hblock = lsqpack_dec_next_unblocked(dec)))
+                r = hblock_read(dec, hblock, 0, 0);
+            if (enc_cost)
+                cost_add(enc_cost, size, dec->qpd_stats.ds_work - work);
+        }
+        else
+        {
+            hblock = malloc(sizeof(*hblock));
+            if (!hblock)
+            {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+            hblock->p = p;
+            hblock->end = p + size;
+            LIST_INSERT_HEAD(&s_hblocks, hblock, next_hblock);
+            r = hblock_read(dec, hblock, stream_id, 1);
+            if (hea_cost)
+                cost_add(hea_cost, size, dec->qpd_stats.ds_work - work);
+        }
+        if (strict && r != 0)
+            abort();
+        /* After an error, the decoder is unusable */
+        if (r != 0)
+            break;
+        p += size;
+    }
+}
+
+
+#pragma clang optimize off
+#pragma GCC optimize("O0")
+
+int
+main (int argc, char **argv)
+{
+    int in_fd = -1;
+#ifndef __AFL_INIT
+    int fuzz_fd = STDIN_FILENO;
+#endif
+    int opt, verbose = 0;
+    unsigned dyn_table_size     = LSQPACK_DEF_DYN_TABLE_SIZE,
+             max_risked_streams = LSQPACK_DEF_MAX_RISKED_STREAMS;
+    double max_per_byte = 0;
+    enum lsqpack_dec_opts dec_opts = LSQPACK_DEC_OPT_DEFER_UNBLOCKED;
+    struct lsqpack_dec decoder;
+    struct cost enc_cost, hea_cost;
+    const unsigned char *fuzz_begin, *fuzz_end;
+    unsigned char *input_begin, *fuzz_file_begin;
+    struct stat st;
+    size_t input_size;
+    uint64_t bytes, work;
+
+#ifndef __AFL_INIT
+#   define __AFL_LOOP(x) loop_var++ == 0
+    int loop_var = 0;
+#endif
+
+    while (-1 != (opt = getopt(argc, argv, "i:s:t:Hw:vh"
+#ifndef __AFL_INIT
+                                                    "f:"
+#endif
+                                                         )))
+    {
+        switch (opt)
+        {
+        case 'i':
+            in_fd = open(optarg, O_RDONLY);
+            if (in_fd < 0)
+            {
+                fprintf(stderr, "cannot open `%s' for reading: %s\n",
+                                            optarg, strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            break;
+#ifndef __AFL_INIT
+        case 'f':
+            fuzz_fd = open(optarg, O_RDONLY);
+            if (fuzz_fd < 0)
+            {
+                fprintf(stderr, "cannot open `%s' for reading: %s\n",
+                                            optarg, strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            break;
+#endif
+        case 's':
+            max_risked_streams = atoi(optarg);
+            break;
+        case 't':
+            dyn_table_size = atoi(optarg);
+            break;
+        case 'H':
+            dec_opts |= LSQPACK_DEC_OPT_HTTP1X;
+            break;
+        case 'w':
+            max_per_byte = atof(optarg);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    input_begin = NULL;
+    input_size = 0;
+    if (in_fd >= 0)
+    {
+        if (0 != fstat(in_fd, &st))
+        {
+            perror("fstat");
+            exit(1);
+        }
+        input_size = (size_t) st.st_size;
+        if (input_size > 0)
+        {
+            input_begin = mmap(NULL, input_size, PROT_READ, MAP_PRIVATE,
+                                                                    in_fd, 0);
+            if (input_begin == MAP_FAILED)
+            {
+                perror("mmap");
+                exit(1);
+            }
+        }
+        (void) close(in_fd);
+    }
+
+#ifndef __AFL_INIT
+    if (0 != fstat(fuzz_fd, &st))
+    {
+        perror("fstat");
+        exit(1);
+    }
+
+    if (st.st_size > 0)
+    {
+        fuzz_file_begin = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                                                                fuzz_fd, 0);
+        if (fuzz_file_begin == MAP_FAILED)
+        {
+            perror("mmap");
+            exit(1);
+        }
+    }
+    else
+        fuzz_file_begin = NULL;
+
+    fuzz_begin = fuzz_file_begin;
+    fuzz_end = fuzz_begin + st.st_size;
+#else
+    fuzz_file_begin = NULL;
+    __AFL_INIT();
+    const unsigned char *const afl_buf = __AFL_FUZZ_TESTCASE_BUF;
+#endif
+
+    while (__AFL_LOOP(10000))
+    {
+#ifdef __AFL_INIT
+        ssize_t fuzz_len = __AFL_FUZZ_TESTCASE_LEN;
+        fuzz_begin = afl_buf;
+        fuzz_end = fuzz_begin + fuzz_len;
+#endif
+
+        LIST_INIT(&s_hblocks);
+        memset(&enc_cost, 0, sizeof(enc_cost));
+        memset(&hea_cost, 0, sizeof(hea_cost));
+        lsqpack_dec_init(&decoder, NULL, dyn_table_size, max_risked_streams,
+                                &hset_if, dec_opts);
+        if (input_begin)
+            process_records(&decoder, input_begin, input_begin + input_size,
+                                                            1, NULL, NULL);
+        process_records(&decoder, fuzz_begin, fuzz_end, 0, &enc_cost,
+                                                                &hea_cost);
+
+        bytes = enc_cost.bytes + hea_cost.bytes;
+        work = enc_cost.work + hea_cost.work;
+        if (verbose)
+        {
+            cost_print("enc_in", &enc_cost);
+            cost_print("header_in", &hea_cost);
+            printf("total: bytes=%"PRIu64" work=%"PRIu64" per_byte=%.2f\n",
+                bytes, work, bytes ? (double) work / bytes : 0.);
+        }
+        if (max_per_byte > 0 && bytes > 0
+                                && (double) work / bytes > max_per_byte)
+        {
+            fprintf(stderr, "work per byte %.2f exceeds %.2f\n",
+                                    (double) work / bytes, max_per_byte);
+            abort();
+        }
+
+        lsqpack_dec_cleanup(&decoder);
+        while (!LIST_EMPTY(&s_hblocks))
+            hblock_done(LIST_FIRST(&s_hblocks));
+    }   /* __AFL_LOOP */
+
+    if (input_begin)
+        munmap(input_begin, input_size);
+#ifndef __AFL_INIT
+    if (fuzz_file_begin)
+        munmap(fuzz_file_begin, st.st_size);
+    (void) close(fuzz_fd);
+#endif
+
+    exit(0);
+}
+
+#endif
@@ -0,0 +1,373 @@
+/*
+ * interop-batch.h -- batch mode shared by interop-encode and interop-decode
+ *
+ * A batch file lists one task per line.  A task is a set of command-line
+ * options -- the same the program accepts -- for example:
+ *
+ *      -i netbsd.qif -o netbsd.out.256 -t 256 -s 100 -A
+ *
+ * Options given on the command line along with -b apply to all tasks and
+ * may be overridden by a task.  Empty lines and lines starting with `#' are
+ * skipped.  Arguments are separated by whitespace and cannot be quoted.
+ *
+ * Tasks run on a pool of worker threads.  Inputs are mapped into memory and
+ * each task writes its output to its own memory buffer, which is written
+ * out when the task is done.  The program includes this file exactly once.
+ */
+
+#ifndef LSQPACK_INTEROP_BATCH_H
+#define LSQPACK_INTEROP_BATCH_H 1
+
+#ifndef WIN32
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define BATCH_MAX_ARGS 64
+
+struct batch_line
+{
+    unsigned    lineno;
+    int         argc;
+    char       *argv[BATCH_MAX_ARGS + 1];
+};
+
+
+/* Read batch file.  The line buffers are never freed: the program exits
+ * once the batch is done.
+ */
+static struct batch_line *
+batch_read (const char *path, const char *progname, unsigned *n_lines_p)
+{
+    FILE *file;
+    struct batch_line *lines, *line;
+    unsigned n_lines, n_alloc, lineno;
+    char line_buf[0x1000], *p;
+
+    if (0 == strcmp(path, "-"))
+        file = stdin;
+    else
+    {
+        file = fopen(path, "r");
+        if (!file)
+        {
+            fprintf(stderr, "cannot open `%s' for reading: %s\n", path,
+                                                            strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    lines = NULL;
+    n_lines = 0;
+    n_alloc = 0;
+    lineno = 0;
+    while (fgets(line_buf, sizeof(line_buf), file))
+    {
+        ++lineno;
+        if (!strchr(line_buf, '\n') && !feof(file))
+        {
+            fprintf(stderr, "%s: line %u is too long\n", path, lineno);
+            exit(EXIT_FAILURE);
+        }
+        p = line_buf;
+        while (isspace((unsigned char) *p))
+            ++p;
+        if (*p == '\0' || *p == '#')
+            continue;
+
+        if (n_lines >= n_alloc)
+        {
+            n_alloc = n_alloc ? n_alloc * 2 : 64;
+            lines = realloc(lines, n_alloc * sizeof(lines[0]));
+            if (!lines)
+            {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        line = &lines[n_lines++];
+        line->lineno = lineno;
+        p = strdup(p);
+        if (!p)
+        {
+            perror("strdup");
+            exit(EXIT_FAILURE);
+        }
+        line->argv[0] = (char *) progname;
+        line->argc = 1;
+        for (p = strtok(p, " \t\r\n"); p; p = strtok(NULL, " \t\r\n"))
+        {
+            if (line->argc >= BATCH_MAX_ARGS)
+            {
+                fprintf(stderr, "%s: too many arguments on line %u\n", path,
+                                                                    lineno);
+                exit(EXIT_FAILURE);
+            }
+            line->argv[ line->argc++ ] = p;
+        }
+        line->argv[ line->argc ] = NULL;
+    }
+
+    if (file != stdin)
+        (void) fclose(file);
+    *n_lines_p = n_lines;
+    return lines;
+}
+
+
+/* Prepare getopt(3) to parse another argument vector */
+static void
+batch_reset_getopt (void)
+{
+#if defined(__GLIBC__)
+    optind = 0;
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__DragonFly__) \
+                            || defined(__NetBSD__) || defined(__OpenBSD__)
+    optreset = 1;
+    optind = 1;
+#else
+    optind = 1;
+#endif
+}
+
+
+/* Input file mapped into memory and read using stdio */
+struct batch_input
+{
+    void       *map;
+    size_t      size;
+};
+
+
+static FILE *
+batch_open_input (const char *path, struct batch_input *input)
+{
+    struct stat st;
+    FILE *in;
+    int fd;
+
+    input->map = NULL;
+    input->size = 0;
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "cannot open `%s' for reading: %s\n", path,
+                                                            strerror(errno));
+        return NULL;
+    }
+    if (0 != fstat(fd, &st))
+    {
+        perror("fstat");
+        (void) close(fd);
+        return NULL;
+    }
+    /* Empty files cannot be mapped */
+    if (st.st_size == 0)
+    {
+        in = fdopen(fd, "rb");
+        if (!in)
+            (void) close(fd);
+        return in;
+    }
+    input->size = (size_t) st.st_size;
+    input->map = mmap(NULL, input->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    (void) close(fd);
+    if (input->map == MAP_FAILED)
+    {
+        perror("mmap");
+        input->map = NULL;
+        return NULL;
+    }
+    in = fmemopen(input->map, input->size, "rb");
+    if (!in)
+    {
+        perror("fmemopen");
+        (void) munmap(input->map, input->size);
+        input->map = NULL;
+    }
+    return in;
+}
+
+
+static void
+batch_close_input (FILE *in, struct batch_input *input)
+{
+    (void) fclose(in);
+    if (input->map)
+        (void) munmap(input->map, input->size);
+}
+
+
+/* Output is accumulated in memory until the task is done */
+struct batch_output
+{
+    char       *buf;
+    size_t      size;
+};
+
+
+static FILE *
+batch_open_output (struct batch_output *output)
+{
+    FILE *out;
+
+    output->buf = NULL;
+    output->size = 0;
+    out = open_memstream(&output->buf, &output->size);
+    if (!out)
+        perror("open_memstream");
+    return out;
+}
+
+
+/* Close output stream and write it to `path'.  Returns 0 on success. */
+static int
+batch_close_output (FILE *out, struct batch_output *output, const char *path)
+{
+    FILE *file;
+    int s;
+
+    if (0 != fclose(out))
+    {
+        perror("fclose");
+        free(output->buf);
+        return -1;
+    }
+
+    if (0 == strcmp(path, "-"))
+        file = stdout;
+    else
+    {
+        file = fopen(path, "wb");
+        if (!file)
+        {
+            fprintf(stderr, "cannot open `%s' for writing: %s\n", path,
+                                                            strerror(errno));
+            free(output->buf);
+            return -1;
+        }
+    }
+    s = output->size == fwrite(output->buf, 1, output->size, file) ? 0 : -1;
+    if (file != stdout)
+        s |= fclose(file);
+    else
+        s |= fflush(file);
+    if (s != 0)
+        fprintf(stderr, "cannot write `%s': %s\n", path, strerror(errno));
+    free(output->buf);
+    return s;
+}
+
+
+/* Worker thread pool.  Each worker picks up the next task until there are
+ * none left.
+ */
+struct batch_pool
+{
+    pthread_mutex_t     mutex;
+    unsigned            next_task;
+    unsigned            n_tasks;
+    unsigned            n_failed;
+    int               (*run)(unsigned task, void *ctx);
+    void               *ctx;
+};
+
+
+static void *
+batch_worker (void *pool_p)
+{
+    struct batch_pool *const pool = pool_p;
+    unsigned task;
+    int s;
+
+    while (1)
+    {
+        pthread_mutex_lock(&pool->mutex);
+        task = pool->next_task;
+        if (task < pool->n_tasks)
+            ++pool->next_task;
+        pthread_mutex_unlock(&pool->mutex);
+        if (task >= pool->n_tasks)
+            break;
+
+        s = pool->run(task, pool->ctx);
+        if (s != 0)
+        {
+            pthread_mutex_lock(&pool->mutex);
+            ++pool->n_failed;
+            pthread_mutex_unlock(&pool->mutex);
+        }
+    }
+
+    return NULL;
+}
+
+
+static unsigned
+batch_n_cpus (void)
+{
+    long n;
+
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned) n : 1;
+}
+
+
+/* Run `n_tasks' tasks using `n_threads' threads.  Zero means one thread
+ * per CPU.  Returns the number of tasks that failed.
+ */
+static unsigned
+batch_run (unsigned n_threads, unsigned n_tasks,
+                            int (*run)(unsigned task, void *ctx), void *ctx)
+{
+    struct batch_pool pool;
+    pthread_t *threads;
+    unsigned n;
+    int s;
+
+    if (n_threads == 0)
+        n_threads = batch_n_cpus();
+    if (n_threads > n_tasks)
+        n_threads = n_tasks ? n_tasks : 1;
+
+    pthread_mutex_init(&pool.mutex, NULL);
+    pool.next_task = 0;
+    pool.n_tasks = n_tasks;
+    pool.n_failed = 0;
+    pool.run = run;
+    pool.ctx = ctx;
+
+    threads = malloc(n_threads * sizeof(threads[0]));
+    if (!threads)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (n = 0; n < n_threads; ++n)
+    {
+        s = pthread_create(&threads[n], NULL, batch_worker, &pool);
+        if (s != 0)
+        {
+            fprintf(stderr, "cannot create thread: %s\n", strerror(s));
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (n = 0; n < n_threads; ++n)
+        (void) pthread_join(threads[n], NULL);
+
+    free(threads);
+    pthread_mutex_destroy(&pool.mutex);
+    return pool.n_failed;
+}
+
+#endif
+
+#endif
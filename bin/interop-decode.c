@@ -49,6 +49,7 @@
 #ifndef DEBUG
 #include "lsqpack-test.h"
 #endif
+#include "interop-batch.h"
 
 #ifndef NDEBUG
 struct static_table_entry
@@ -167,15 +168,7 @@ static const struct static_table_entry static_table[] =
 };
 #endif
 
-static size_t s_max_read_size = SIZE_MAX;
-
 static int s_verbose;
-static enum lsqpack_dec_opts s_dec_opts = LSQPACK_DEC_OPT_HASH_NAME
-                                        | LSQPACK_DEC_OPT_HASH_NAMEVAL;
-
-static int s_check_unset_qpack_idx = 1;
-
-static FILE *s_out;
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
@@ -184,6 +177,7 @@ usage (const char *name)
 {
     fprintf(stderr,
 "Usage: %s [options] [-i input] [-o output]\n"
+"       %s [options] -b batch [-j threads]\n"
 "\n"
 "Options:\n"
 "   -i FILE     Input file.  If not specified or set to `-', the input is\n"
@@ -199,16 +193,52 @@ usage (const char *name)
 "   -v          Verbose: print headers and table state to stderr.\n"
 "   -S          Don't swap encoder stream and header blocks.\n"
 "   -Q          Don't check static table when LSXPACK_QPACK_IDX is not set.\n"
+"   -C FILE     Capture decoder input to FILE.  See bin/capture-replay.c.\n"
+"                 Requires a library built with LSQPACK_CAPTURE.\n"
+"   -R          Redact header values in the capture.\n"
+"   -b FILE     Batch mode: each line in FILE contains options for one\n"
+"                 task.  Each task must specify its input and output files.\n"
+"   -j NUMBER   Number of threads in batch mode.  Defaults to the number\n"
+"                 of CPUs.\n"
 "\n"
 "   -h          Print this help screen and exit\n"
-    , name, LSQPACK_DEF_MAX_RISKED_STREAMS, LSQPACK_DEF_DYN_TABLE_SIZE, SIZE_MAX);
+    , name, name, LSQPACK_DEF_MAX_RISKED_STREAMS, LSQPACK_DEF_DYN_TABLE_SIZE,
+    SIZE_MAX);
 }
 
 
+/* Options of one run.  In batch mode, there is one per task. */
+struct options
+{
+    const char             *in_path;        /* NULL or "-" is stdin */
+    const char             *out_path;       /* NULL or "-" is stdout */
+    const char             *recipe_path;
+    const char             *capture_path;
+    enum lsqpack_capture_flags  capture_flags;
+    unsigned                dyn_table_size;
+    unsigned                max_risked_streams;
+    size_t                  max_read_size;
+    enum lsqpack_dec_opts   dec_opts;
+    int                     do_swap;
+    int                     check_unset_qpack_idx;
+};
+
+
+/* State of one decoder */
+struct decode
+{
+    const struct options   *opts;
+    FILE                   *out;
+    size_t                  max_read_size;  /* Recipe may change it */
+    TAILQ_HEAD(, buf)       bufs;
+};
+
+
 struct buf
 {
     TAILQ_ENTRY(buf)        next_buf;
     struct lsqpack_dec     *dec;
+    struct decode          *decode;
     uint64_t                stream_id;     /* Zero means encoder stream */
     size_t                  size;
     size_t                  off;
@@ -233,13 +263,11 @@ struct buf
 };
 
 
-TAILQ_HEAD(, buf) bufs = TAILQ_HEAD_INITIALIZER(bufs);
-
 static void
 hblock_unblocked (void *buf_p)
 {
     struct buf *buf = buf_p;
-    TAILQ_INSERT_HEAD(&bufs, buf, next_buf);
+    TAILQ_INSERT_HEAD(&buf->decode->bufs, buf, next_buf);
 }
 
 
@@ -279,12 +307,13 @@ static int
 process_header (void *hblock_ctx, struct lsxpack_header *xhdr)
 {
     struct buf *const buf = hblock_ctx;
+    const struct options *const opts = buf->decode->opts;
     const char *p;
     const uint32_t seed = 39378473;
     uint32_t hash, name_hash;
     int nw;
 
-    if (s_dec_opts & LSQPACK_DEC_OPT_HTTP1X)
+    if (opts->dec_opts & LSQPACK_DEC_OPT_HTTP1X)
     {
         p = lsxpack_header_get_name(xhdr) + xhdr->name_len;
         assert(0 == memcmp(p, ": ", 2));
@@ -295,14 +324,14 @@ process_header (void *hblock_ctx, struct lsxpack_header *xhdr)
     else
         assert(xhdr->dec_overhead == 0);
 
-    if (s_dec_opts & LSQPACK_DEC_OPT_HASH_NAME)
+    if (opts->dec_opts & LSQPACK_DEC_OPT_HASH_NAME)
     {
         assert(xhdr->flags & LSXPACK_NAME_HASH);
         hash = XXH32(lsxpack_header_get_name(xhdr), xhdr->name_len, seed);
         assert(hash == xhdr->name_hash);
     }
 
-    if (s_dec_opts & LSQPACK_DEC_OPT_HASH_NAME)
+    if (opts->dec_opts & LSQPACK_DEC_OPT_HASH_NAME)
         assert(xhdr->flags & LSXPACK_NAME_HASH);
 
     if (xhdr->flags & LSXPACK_NAME_HASH)
@@ -316,7 +345,7 @@ process_header (void *hblock_ctx, struct lsxpack_header *xhdr)
         name_hash = XXH32(lsxpack_header_get_name(xhdr), xhdr->name_len, seed);
 #endif
 
-    if (s_dec_opts & LSQPACK_DEC_OPT_HASH_NAMEVAL)
+    if (opts->dec_opts & LSQPACK_DEC_OPT_HASH_NAMEVAL)
     {
         /* This is not required by the API, but internally, if the library
          * calculates nameval hash, it should also set the name hash.
@@ -341,7 +370,7 @@ process_header (void *hblock_ctx, struct lsxpack_header *xhdr)
         assert(0 == memcmp(lsxpack_header_get_name(xhdr),
                         static_table[xhdr->qpack_index].name, xhdr->name_len));
     }
-    else if (s_check_unset_qpack_idx)
+    else if (opts->check_unset_qpack_idx)
     {
         /* The decoder does best effort: if the encoder did not use the
          * static table, QPACK index is not set.  However, since we are
@@ -384,87 +413,54 @@ static const struct lsqpack_dec_hset_if hset_if = {
 static void
 header_block_done (const struct buf *buf)
 {
-    fprintf(s_out, "# stream %"PRIu64"\n", buf->stream_id);
-    fprintf(s_out, "# (stream ID above is used for sorting)\n");
-    fprintf(s_out, "%.*s\n", (int) buf->out_off, buf->out_buf);
+    FILE *const out = buf->decode->out;
+
+    fprintf(out, "# stream %"PRIu64"\n", buf->stream_id);
+    fprintf(out, "# (stream ID above is used for sorting)\n");
+    fprintf(out, "%.*s\n", (int) buf->out_off, buf->out_buf);
 }
 
 
-int
-main (int argc, char **argv)
+static void
+parse_options (int argc, char **argv, struct options *opts,
+                        const char **batch_path, unsigned *n_threads)
 {
-    FILE *in = stdin;
-    FILE *recipe = NULL;
     int opt;
-    unsigned dyn_table_size     = LSQPACK_DEF_DYN_TABLE_SIZE,
-             max_risked_streams = LSQPACK_DEF_MAX_RISKED_STREAMS;
-    struct lsqpack_dec decoder;
-    const struct lsqpack_dec_err *err;
-    const unsigned char *p;
-    ssize_t nr;
-    int r;
-    uint64_t stream_id;
-    uint32_t size;
-    size_t off;         /* For debugging */
-    size_t file_off;
-    struct buf *buf;
-    unsigned lineno;
-    char *line, *end;
-    enum lsqpack_read_header_status rhs;
-    int do_swap = 1;
-    char command[0x100];
-    char line_buf[0x100];
 
-    while (-1 != (opt = getopt(argc, argv, "i:o:r:s:t:m:hvH:SQ")))
+    while (-1 != (opt = getopt(argc, argv, "b:i:j:o:r:s:t:m:hvH:SQC:R")))
     {
         switch (opt)
         {
-        case 'i':
-            if (0 != strcmp(optarg, "-"))
+        case 'b':
+        case 'j':
+            if (!batch_path)
             {
-                in = fopen(optarg, "rb");
-                if (!in)
-                {
-                    fprintf(stderr, "cannot open `%s' for reading: %s\n",
-                                                optarg, strerror(errno));
-                    exit(EXIT_FAILURE);
-                }
+                fprintf(stderr, "option -%c cannot be used in batch file\n",
+                                                                        opt);
+                exit(EXIT_FAILURE);
             }
+            if (opt == 'b')
+                *batch_path = optarg;
+            else
+                *n_threads = atoi(optarg);
+            break;
+        case 'i':
+            opts->in_path = optarg;
             break;
         case 'o':
-            if (0 != strcmp(optarg, "-"))
-            {
-                s_out = fopen(optarg, "w");
-                if (!s_out)
-                {
-                    fprintf(stderr, "cannot open `%s' for writing: %s\n",
-                                                optarg, strerror(errno));
-                    exit(EXIT_FAILURE);
-                }
-            }
+            opts->out_path = optarg;
             break;
         case 'r':
-            if (0 == strcmp(optarg, "-"))
-                recipe = stdin;
-            else
-            {
-                recipe = fopen(optarg, "r");
-                if (!recipe)
-                {
-                    fprintf(stderr, "cannot open `%s' for reading: %s\n",
-                                                optarg, strerror(errno));
-                    exit(EXIT_FAILURE);
-                }
-            }
+            opts->recipe_path = optarg;
             break;
         case 's':
-            max_risked_streams = atoi(optarg);
+            opts->max_risked_streams = atoi(optarg);
             break;
         case 't':
-            dyn_table_size = atoi(optarg);
+            opts->dyn_table_size = atoi(optarg);
             break;
         case 'm':
-            s_max_read_size = atoi(optarg);
+            opts->max_read_size = atoi(optarg);
             break;
         case 'h':
             usage(argv[0]);
@@ -473,27 +469,90 @@ main (int argc, char **argv)
             ++s_verbose;
             break;
         case 'S':
-            do_swap = 0;
+            opts->do_swap = 0;
             break;
         case 'H':
             if (atoi(optarg))
-                s_dec_opts |= LSQPACK_DEC_OPT_HTTP1X;
+                opts->dec_opts |= LSQPACK_DEC_OPT_HTTP1X;
             else
-                s_dec_opts &= ~LSQPACK_DEC_OPT_HTTP1X;
+                opts->dec_opts &= ~LSQPACK_DEC_OPT_HTTP1X;
             break;
         case 'Q':
-            s_check_unset_qpack_idx = 0;
+            opts->check_unset_qpack_idx = 0;
+            break;
+        case 'C':
+            opts->capture_path = optarg;
+            break;
+        case 'R':
+            opts->capture_flags |= LSQPACK_CAPTURE_REDACT;
             break;
         default:
             exit(EXIT_FAILURE);
         }
     }
+}
+
+
+/* Decode intermediate format read from `in' and write QIF to `out'.
+ * Returns 0 on success and -1 on error.
+ */
+static int
+decode (const struct options *opts, FILE *in, FILE *out)
+{
+    const unsigned dyn_table_size = opts->dyn_table_size,
+                   max_risked_streams = opts->max_risked_streams;
+    FILE *recipe = NULL, *capture = NULL;
+    struct decode decode;
+    struct lsqpack_dec decoder;
+    const struct lsqpack_dec_err *err;
+    const unsigned char *p;
+    ssize_t nr;
+    int r;
+    uint64_t stream_id;
+    uint32_t size;
+    size_t off;         /* For debugging */
+    size_t file_off;
+    struct buf *buf;
+    unsigned lineno;
+    char *line, *end;
+    enum lsqpack_read_header_status rhs;
+    char command[0x100];
+    char line_buf[0x100];
+
+    if (opts->recipe_path)
+    {
+        if (0 == strcmp(opts->recipe_path, "-"))
+            recipe = stdin;
+        else
+        {
+            recipe = fopen(opts->recipe_path, "r");
+            if (!recipe)
+            {
+                fprintf(stderr, "cannot open `%s' for reading: %s\n",
+                                    opts->recipe_path, strerror(errno));
+                return -1;
+            }
+        }
+    }
 
-    if (!s_out)
-        s_out = stdout;
+    decode.opts = opts;
+    decode.out = out;
+    decode.max_read_size = opts->max_read_size;
+    TAILQ_INIT(&decode.bufs);
 
     lsqpack_dec_init(&decoder, s_verbose ? stderr : NULL, dyn_table_size,
-                        max_risked_streams, &hset_if, s_dec_opts);
+                        max_risked_streams, &hset_if, opts->dec_opts);
+    if (opts->capture_path)
+    {
+        capture = fopen(opts->capture_path, "wb");
+        if (!capture || 0 != lsqpack_dec_capture(&decoder, capture,
+                                                        opts->capture_flags))
+        {
+            fprintf(stderr, "cannot capture to `%s': %s\n",
+                                    opts->capture_path, strerror(errno));
+            goto err;
+        }
+    }
 
     off = 0;
     while (1)
@@ -535,19 +594,22 @@ main (int argc, char **argv)
         {
             fprintf(stderr, "could not read %"PRIu32" bytes (buffer) at "
                 "offset %zu: %s\n", size, off, strerror(errno));
+            free(buf);
             goto read_err;
         }
         off += nr;
         buf->dec = &decoder;
+        buf->decode = &decode;
         buf->stream_id = stream_id;
         buf->size = size;
         buf->file_off = file_off;
         if (buf->size == 0)
-            exit(EXIT_FAILURE);
-        TAILQ_INSERT_TAIL(&bufs, buf, next_buf);
+        {
+            free(buf);
+            goto err;
+        }
+        TAILQ_INSERT_TAIL(&decode.bufs, buf, next_buf);
     }
-    (void) fclose(in);
-    in = NULL;
 
     if (recipe)
     {
@@ -559,7 +621,7 @@ main (int argc, char **argv)
             if (!end)
             {
                 fprintf(stderr, "no newline on line %u\n", lineno);
-                exit(EXIT_FAILURE);
+                goto err;
             }
             *end = '\0';
 
@@ -568,14 +630,14 @@ main (int argc, char **argv)
 
             if (3 == sscanf(line, " %[s] %"PRIu64" %"PRIu32" ", command, &stream_id, &size))
             {
-                TAILQ_FOREACH(buf, &bufs, next_buf)
+                TAILQ_FOREACH(buf, &decode.bufs, next_buf)
                     if (stream_id == buf->stream_id)
                         break;
                 if (!buf)
                 {
                     fprintf(stderr, "stream %"PRIu64" not found (recipe line %u)\n",
                         stream_id, lineno);
-                    exit(EXIT_FAILURE);
+                    goto err;
                 }
                 p = buf->buf;
                 rhs = lsqpack_dec_header_in(&decoder, buf, stream_id,
@@ -590,12 +652,12 @@ main (int argc, char **argv)
                     if (s_verbose)
                         fprintf(stderr, "compression ratio: %.3f\n",
                             lsqpack_dec_ratio(&decoder));
-                    TAILQ_REMOVE(&bufs, buf, next_buf);
+                    TAILQ_REMOVE(&decode.bufs, buf, next_buf);
                     free(buf);
                     break;
                 case LQRHS_BLOCKED:
                     buf->off += (unsigned) (p - buf->buf);
-                    TAILQ_REMOVE(&bufs, buf, next_buf);
+                    TAILQ_REMOVE(&decode.bufs, buf, next_buf);
                     break;
                 case LQRHS_NEED:
                     buf->off += (unsigned) (p - buf->buf);
@@ -604,29 +666,32 @@ main (int argc, char **argv)
                     assert(rhs == LQRHS_ERROR);
                     fprintf(stderr, "recipe line %u: stream %"PRIu64": "
                         "header_in error\n", lineno, stream_id);
-                    exit(EXIT_FAILURE);
+                    goto err;
                 }
             }
             else if (2 == sscanf(line, " %[z] %u ", command, &size))
             {
-                s_max_read_size = size;
+                decode.max_read_size = size;
             }
             else
             {
                 perror("sscanf");
-                exit(EXIT_FAILURE);
+                goto err;
             }
         }
-        fclose(recipe);
+        if (recipe != stdin)
+            (void) fclose(recipe);
+        recipe = NULL;
     }
-    else if (do_swap && max_risked_streams && dyn_table_size
-                    && TAILQ_FIRST(&bufs) && TAILQ_FIRST(&bufs)->stream_id)
+    else if (opts->do_swap && max_risked_streams && dyn_table_size
+                    && TAILQ_FIRST(&decode.bufs)
+                    && TAILQ_FIRST(&decode.bufs)->stream_id)
     {
         /* Swap header blocks and encoder stream bufs to exercise blocked
          * header blocks logic.
          */
         struct buf *saved_hblock = NULL, *next;
-        for (buf = TAILQ_FIRST(&bufs); buf; buf = next)
+        for (buf = TAILQ_FIRST(&decode.bufs); buf; buf = next)
         {
             next = TAILQ_NEXT(buf, next_buf);
             if (buf->stream_id)
@@ -634,14 +699,14 @@ main (int argc, char **argv)
             if (saved_hblock)
                 TAILQ_INSERT_BEFORE(buf, saved_hblock, next_buf);
             saved_hblock = buf;
-            TAILQ_REMOVE(&bufs, buf, next_buf);
+            TAILQ_REMOVE(&decode.bufs, buf, next_buf);
         }
-        TAILQ_INSERT_TAIL(&bufs, saved_hblock, next_buf);
+        TAILQ_INSERT_TAIL(&decode.bufs, saved_hblock, next_buf);
     }
 
-    while (buf = TAILQ_FIRST(&bufs), buf != NULL)
+    while (buf = TAILQ_FIRST(&decode.bufs), buf != NULL)
     {
-        TAILQ_REMOVE(&bufs, buf, next_buf);
+        TAILQ_REMOVE(&decode.bufs, buf, next_buf);
         if (buf->stream_id == 0)
         {
             r = lsqpack_dec_enc_in(&decoder, buf->buf, buf->size - buf->off);
@@ -650,7 +715,8 @@ main (int argc, char **argv)
                 err = lsqpack_dec_get_err_info(buf->dec);
                 fprintf(stderr, "encoder_in error; off %"PRIu64", line %d\n",
                                                             err->off, err->line);
-                exit(EXIT_FAILURE);
+                free(buf);
+                goto err;
             }
             if (s_verbose)
                 lsqpack_dec_print_table(&decoder, stderr);
@@ -662,12 +728,12 @@ main (int argc, char **argv)
             p = buf->buf + buf->off;
             if (buf->off == 0)
                 rhs = lsqpack_dec_header_in(&decoder, buf, buf->stream_id,
-                                buf->size, &p, MIN(s_max_read_size, buf->size),
-                                NULL, NULL);
+                        buf->size, &p, MIN(decode.max_read_size, buf->size),
+                        NULL, NULL);
             else
                 rhs = lsqpack_dec_header_read(buf->dec, buf, &p,
-                                MIN(s_max_read_size, (buf->size - buf->off)),
-                                NULL, NULL);
+                        MIN(decode.max_read_size, (buf->size - buf->off)),
+                        NULL, NULL);
             switch (rhs)
             {
             case LQRHS_DONE:
@@ -691,15 +757,16 @@ main (int argc, char **argv)
                 err = lsqpack_dec_get_err_info(&decoder);
                 fprintf(stderr, "encoder_in error; off %"PRIu64", line %d\n",
                                                             err->off, err->line);
-                exit(EXIT_FAILURE);
+                free(buf);
+                goto err;
             }
         }
     }
 
-    if (!TAILQ_EMPTY(&bufs))
+    if (!TAILQ_EMPTY(&decode.bufs))
     {
         fprintf(stderr, "some streams reamain\n");
-        exit(EXIT_FAILURE);
+        goto err;
     }
     /* TODO: check if decoder has any stream references.  That would be
      * an error.
@@ -709,13 +776,12 @@ main (int argc, char **argv)
         lsqpack_dec_print_table(&decoder, stderr);
 
     lsqpack_dec_cleanup(&decoder);
+    if (capture)
+        (void) fclose(capture);
 
-    assert(TAILQ_EMPTY(&bufs));
-
-    if (s_out)
-        (void) fclose(s_out);
+    assert(TAILQ_EMPTY(&decode.bufs));
 
-    exit(EXIT_SUCCESS);
+    return 0;
 
   read_err:
     if (nr < 0)
@@ -724,5 +790,168 @@ main (int argc, char **argv)
         fprintf(stderr, "unexpected EOF\n");
     else
         fprintf(stderr, "not enough bytes read (%zu)\n", (size_t) nr);
-    exit(EXIT_FAILURE);
+  err:
+    /* Blocked header blocks are not on the list and are not freed */
+    lsqpack_dec_cleanup(&decoder);
+    if (capture)
+        (void) fclose(capture);
+    while (buf = TAILQ_FIRST(&decode.bufs), buf != NULL)
+    {
+        TAILQ_REMOVE(&decode.bufs, buf, next_buf);
+        free(buf->xhdr.buf);
+        free(buf);
+    }
+    if (recipe && recipe != stdin)
+        (void) fclose(recipe);
+    return -1;
+}
+
+
+#ifndef WIN32
+struct batch
+{
+    const struct batch_line    *lines;
+    const struct options       *opts;
+};
+
+
+static int
+run_task (unsigned task, void *batch_p)
+{
+    const struct batch *const batch = batch_p;
+    const struct options *const opts = &batch->opts[task];
+    struct batch_input input;
+    struct batch_output output;
+    FILE *in, *out;
+    int s;
+
+    in = batch_open_input(opts->in_path, &input);
+    if (!in)
+        goto err;
+    out = batch_open_output(&output);
+    if (!out)
+    {
+        batch_close_input(in, &input);
+        goto err;
+    }
+    s = decode(opts, in, out);
+    batch_close_input(in, &input);
+    s |= batch_close_output(out, &output, opts->out_path);
+    if (s == 0)
+        return 0;
+
+  err:
+    fprintf(stderr, "batch line %u: task failed\n",
+                                                batch->lines[task].lineno);
+    return -1;
+}
+
+
+static void
+run_batch (const char *batch_path, unsigned n_threads,
+                                            const struct options *base_opts)
+{
+    struct batch batch;
+    struct batch_line *lines;
+    struct options *opts;
+    unsigned n_lines, n, n_failed;
+
+    lines = batch_read(batch_path, "interop-decode", &n_lines);
+    opts = malloc(n_lines * sizeof(opts[0]) + 1);
+    if (!opts)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (n = 0; n < n_lines; ++n)
+    {
+        opts[n] = *base_opts;
+        opts[n].in_path = NULL;
+        opts[n].out_path = NULL;
+        batch_reset_getopt();
+        parse_options(lines[n].argc, lines[n].argv, &opts[n], NULL, NULL);
+        if (!opts[n].in_path || !opts[n].out_path)
+        {
+            fprintf(stderr, "%s: line %u: input and output must be "
+                                "specified\n", batch_path, lines[n].lineno);
+            exit(EXIT_FAILURE);
+        }
+        if (opts[n].recipe_path && 0 == strcmp(opts[n].recipe_path, "-"))
+        {
+            fprintf(stderr, "%s: line %u: recipe cannot be read from stdin "
+                                "in batch mode\n", batch_path, lines[n].lineno);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    batch.lines = lines;
+    batch.opts = opts;
+    n_failed = batch_run(n_threads, n_lines, run_task, &batch);
+    free(opts);
+    if (n_failed)
+    {
+        fprintf(stderr, "%u of %u tasks failed\n", n_failed, n_lines);
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
+#endif
+
+
+int
+main (int argc, char **argv)
+{
+    FILE *in = stdin;
+    FILE *out = stdout;
+    const char *batch_path = NULL;
+    unsigned n_threads = 0;
+    struct options opts = {
+        .dyn_table_size         = LSQPACK_DEF_DYN_TABLE_SIZE,
+        .max_risked_streams     = LSQPACK_DEF_MAX_RISKED_STREAMS,
+        .max_read_size          = SIZE_MAX,
+        .dec_opts               = LSQPACK_DEC_OPT_HASH_NAME
+                                | LSQPACK_DEC_OPT_HASH_NAMEVAL,
+        .do_swap                = 1,
+        .check_unset_qpack_idx  = 1,
+    };
+    int s;
+
+    parse_options(argc, argv, &opts, &batch_path, &n_threads);
+
+    if (batch_path)
+    {
+#ifndef WIN32
+        run_batch(batch_path, n_threads, &opts);
+#else
+        fprintf(stderr, "batch mode is not supported on Windows\n");
+        exit(EXIT_FAILURE);
+#endif
+    }
+
+    if (opts.in_path && 0 != strcmp(opts.in_path, "-"))
+    {
+        in = fopen(opts.in_path, "rb");
+        if (!in)
+        {
+            fprintf(stderr, "cannot open `%s' for reading: %s\n",
+                                        opts.in_path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (opts.out_path && 0 != strcmp(opts.out_path, "-"))
+    {
+        out = fopen(opts.out_path, "w");
+        if (!out)
+        {
+            fprintf(stderr, "cannot open `%s' for writing: %s\n",
+                                        opts.out_path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    s = decode(&opts, in, out);
+    (void) fclose(in);
+    (void) fclose(out);
+
+    exit(s == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
 }
@@ -44,6 +44,8 @@
 
 #include "lsqpack.h"
 #include "lsxpack_header.h"
+#include "interop-batch.h"
+#include "bqif.h"
 
 static int s_verbose;
 
@@ -56,10 +58,12 @@ usage (const char *name)
 {
     fprintf(stderr,
 "Usage: %s [options] [-i input] [-o output]\n"
+"       %s [options] -b batch [-j threads]\n"
 "\n"
 "Options:\n"
 "   -i FILE     Input file.  If not specified or set to `-', the input is\n"
-"                 read from stdin.\n"
+"                 read from stdin.  A named file may be in BQIF format\n"
+"                 (see tools/qif2bqif.pl); it is detected automatically.\n"
 "   -o FILE     Output file.  If not spepcified or set to `-', the output\n"
 "                 is written to stdout.\n"
 "   -s NUMBER   Maximum number of risked streams.  Defaults to %u.\n"
@@ -71,12 +75,20 @@ usage (const char *name)
 "   -S          Server mode.\n"
 "   -D          Do not emit \"Duplicate\" instructions.\n"
 "   -A          Aggressive indexing.\n"
+"   -F          Use frequency sketch instead of history.\n"
 "   -M          Turn off memory guard.\n"
 "   -f          Fast: use maximum output buffers.\n"
+"   -C FILE     Capture encoder input to FILE.  See bin/capture-replay.c.\n"
+"                 Requires a library built with LSQPACK_CAPTURE.\n"
+"   -R          Redact header values in the capture.\n"
 "   -v          Verbose: print various messages to stderr.\n"
+"   -b FILE     Batch mode: each line in FILE contains options for one\n"
+"                 task.  Each task must specify its input and output files.\n"
+"   -j NUMBER   Number of threads in batch mode.  Defaults to the number\n"
+"                 of CPUs.\n"
 "\n"
 "   -h          Print this help screen and exit\n"
-    , name, LSQPACK_DEF_MAX_RISKED_STREAMS, LSQPACK_DEF_DYN_TABLE_SIZE);
+    , name, name, LSQPACK_DEF_MAX_RISKED_STREAMS, LSQPACK_DEF_DYN_TABLE_SIZE);
 }
 
 
@@ -174,9 +186,8 @@ write_enc_and_header_streams (FILE *out, unsigned stream_id,
 }
 
 
-static unsigned s_saved_ins_count;
 static int
-ack_last_entry_id (struct lsqpack_enc *encoder)
+ack_last_entry_id (struct lsqpack_enc *encoder, unsigned *saved_ins_count)
 {
     unsigned char *end_cmd;
     unsigned char cmd[80];
@@ -186,8 +197,8 @@ ack_last_entry_id (struct lsqpack_enc *encoder)
         fprintf(stderr, "ACK entry ID %u\n", encoder->qpe_ins_count);
 
     cmd[0] = 0x00;
-    val = encoder->qpe_ins_count - s_saved_ins_count;
-    s_saved_ins_count = encoder->qpe_ins_count;
+    val = encoder->qpe_ins_count - *saved_ins_count;
+    *saved_ins_count = encoder->qpe_ins_count;
     end_cmd = lsqpack_enc_int(cmd, cmd + sizeof(cmd), val, 6);
     assert(end_cmd > cmd);
     return lsqpack_enc_decoder_in(encoder, cmd, end_cmd - cmd);
@@ -242,90 +253,90 @@ cancel_stream (struct lsqpack_enc *encoder, uint64_t stream_id)
 }
 
 
-int
-main (int argc, char **argv)
+/* Options of one run.  In batch mode, there is one per task. */
+struct options
+{
+    const char             *in_path;        /* NULL or "-" is stdin */
+    const char             *out_path;       /* NULL or "-" is stdout */
+    unsigned                dyn_table_size;
+    unsigned                max_risked_streams;
+    enum lsqpack_enc_opts   enc_opts;
+    enum { ACK_NEVER, ACK_IMMEDIATE, }
+                            ack_mode;
+    int                     process_annotations;
+    int                     fast;
+    const char             *capture_path;
+    enum lsqpack_capture_flags  capture_flags;
+};
+
+
+static void
+parse_options (int argc, char **argv, struct options *opts,
+                        const char **batch_path, unsigned *n_threads)
 {
-    FILE *in = stdin;
-    FILE *out = stdout;
     int opt;
-    unsigned dyn_table_size     = LSQPACK_DEF_DYN_TABLE_SIZE,
-             max_risked_streams = LSQPACK_DEF_MAX_RISKED_STREAMS;
-    unsigned lineno, stream_id;
-    struct lsqpack_enc encoder;
-    char *line, *end, *tab;
-    ssize_t pref_sz;
-    enum lsqpack_enc_status st;
-    enum lsqpack_enc_opts enc_opts = 0;
-    size_t enc_sz, hea_sz, enc_off, hea_off;
-    int header_opened, r;
-    unsigned arg;
-    enum { ACK_NEVER, ACK_IMMEDIATE, } ack_mode = ACK_NEVER;
-    int process_annotations = 0;
-    char line_buf[0x1000];
-    unsigned char tsu_buf[LSQPACK_LONGEST_SDTC];
-    size_t tsu_buf_sz;
-    enum lsqpack_enc_header_flags hflags;
-    int fast = 0;
-    struct lsxpack_header xhdr;
-    unsigned char enc_buf[0x1000], hea_buf[0x1000], pref_buf[0x20];
 
-    while (-1 != (opt = getopt(argc, argv, "ADMSa:i:no:s:t:hvf")))
+    while (-1 != (opt = getopt(argc, argv, "ADFMSa:b:i:j:no:s:t:hvfC:R")))
     {
         switch (opt)
         {
         case 'S':
-            enc_opts |= LSQPACK_ENC_OPT_SERVER;
+            opts->enc_opts |= LSQPACK_ENC_OPT_SERVER;
             break;
         case 'D':
-            enc_opts |= LSQPACK_ENC_OPT_NO_DUP;
+            opts->enc_opts |= LSQPACK_ENC_OPT_NO_DUP;
             break;
         case 'A':
-            enc_opts |= LSQPACK_ENC_OPT_IX_AGGR;
+            opts->enc_opts |= LSQPACK_ENC_OPT_IX_AGGR;
+            break;
+        case 'F':
+            opts->enc_opts |= LSQPACK_ENC_OPT_FREQ_SKETCH;
             break;
         case 'M':
-            enc_opts |= LSQPACK_ENC_OPT_NO_MEM_GUARD;
+            opts->enc_opts |= LSQPACK_ENC_OPT_NO_MEM_GUARD;
             break;
         case 'n':
-            ++process_annotations;
+            ++opts->process_annotations;
             break;
         case 'a':
-            ack_mode = atoi(optarg) ? ACK_IMMEDIATE : ACK_NEVER;
+            opts->ack_mode = atoi(optarg) ? ACK_IMMEDIATE : ACK_NEVER;
             break;
-        case 'i':
-            if (0 != strcmp(optarg, "-"))
+        case 'b':
+        case 'j':
+            if (!batch_path)
             {
-                in = fopen(optarg, "r");
-                if (!in)
-                {
-                    fprintf(stderr, "cannot open `%s' for reading: %s\n",
-                                                optarg, strerror(errno));
-                    exit(EXIT_FAILURE);
-                }
+                fprintf(stderr, "option -%c cannot be used in batch file\n",
+                                                                        opt);
+                exit(EXIT_FAILURE);
             }
+            if (opt == 'b')
+                *batch_path = optarg;
+            else
+                *n_threads = atoi(optarg);
+            break;
+        case 'i':
+            opts->in_path = optarg;
             break;
         case 'o':
-            if (0 != strcmp(optarg, "-"))
-            {
-                out = fopen(optarg, "wb");
-                if (!out)
-                {
-                    fprintf(stderr, "cannot open `%s' for writing: %s\n",
-                                                optarg, strerror(errno));
-                    exit(EXIT_FAILURE);
-                }
-            }
+            opts->out_path = optarg;
             break;
         case 's':
-            max_risked_streams = atoi(optarg);
+            opts->max_risked_streams = atoi(optarg);
             break;
         case 't':
-            dyn_table_size = atoi(optarg);
+            opts->dyn_table_size = atoi(optarg);
             break;
         case 'h':
             usage(argv[0]);
             exit(EXIT_SUCCESS);
         case 'f':
-            fast = 1;
+            opts->fast = 1;
+            break;
+        case 'C':
+            opts->capture_path = optarg;
+            break;
+        case 'R':
+            opts->capture_flags |= LSQPACK_CAPTURE_REDACT;
             break;
         case 'v':
             ++s_verbose;
@@ -334,22 +345,263 @@ main (int argc, char **argv)
             exit(EXIT_FAILURE);
         }
     }
+}
+
+
+/* State of one encoding run */
+struct encode
+{
+    const struct options   *opts;
+    FILE                   *out;
+    FILE                   *capture;
+    struct lsqpack_enc      encoder;
+    unsigned                stream_id;
+    unsigned                saved_ins_count;
+    int                     header_opened;
+    size_t                  enc_off, hea_off;
+    unsigned char           tsu_buf[LSQPACK_LONGEST_SDTC];
+    unsigned char           enc_buf[0x1000], hea_buf[0x1000], pref_buf[0x20];
+};
+
+
+/* Encode one header field, opening a new header block if necessary.
+ * Returns 0 on success and -1 on error.
+ */
+static int
+encode_field (struct encode *enc, struct lsxpack_header *xhdr)
+{
+    enum lsqpack_enc_status st;
+    size_t enc_sz, hea_sz;
+
+    if (!enc->header_opened)
+    {
+        ++enc->stream_id;
+        if (0 != lsqpack_enc_start_header(&enc->encoder, enc->stream_id, 0))
+        {
+            fprintf(stderr, "start_header failed: %s\n", strerror(errno));
+            return -1;
+        }
+        enc->header_opened = 1;
+    }
+    if (enc->opts->fast)
+    {
+        enc_sz = sizeof(enc->enc_buf) - enc->enc_off;
+        hea_sz = sizeof(enc->hea_buf) - enc->hea_off;
+    }
+    else
+    {
+        /* Increase buffers one by one to exercise error conditions */
+        enc_sz = 0;
+        hea_sz = 0;
+    }
+    while (1)
+    {
+        st = lsqpack_enc_encode(&enc->encoder, enc->enc_buf + enc->enc_off,
+                    &enc_sz, enc->hea_buf + enc->hea_off, &hea_sz, xhdr, 0);
+        switch (st)
+        {
+        case LQES_NOBUF_ENC:
+            if (enc_sz < sizeof(enc->enc_buf) - enc->enc_off)
+                ++enc_sz;
+            else
+                assert(0);
+            break;
+        case LQES_NOBUF_HEAD:
+            if (hea_sz < sizeof(enc->hea_buf) - enc->hea_off)
+                ++hea_sz;
+            else
+                assert(0);
+            break;
+        default:
+            assert(st == LQES_OK);
+            goto end_encode_one_header;
+        }
+    }
+    if (st != LQES_OK)
+    {
+        /* It could only run of of output space, so it's not really an
+         * error, but we make no provision in the interop encoder to
+         * grow the buffers.
+         */
+        fprintf(stderr, "Could not encode header: %u\n", st);
+        return -1;
+    }
+  end_encode_one_header:
+    enc->enc_off += enc_sz;
+    enc->hea_off += hea_sz;
+    return 0;
+}
+
+
+/* Close header block opened by encode_field() and write it out.  Returns
+ * 0 on success and -1 on error.
+ */
+static int
+end_header (struct encode *enc)
+{
+    const size_t pref_max = sizeof(enc->pref_buf);
+    enum lsqpack_enc_header_flags hflags;
+    ssize_t pref_sz;
+    size_t sz;
+    int r;
+
+    if (!enc->header_opened)
+        return 0;
+
+    for (sz = (enc->opts->fast ? pref_max : 0); sz <= pref_max; sz++)
+    {
+        pref_sz = lsqpack_enc_end_header(&enc->encoder, enc->pref_buf, sz,
+                                                                    &hflags);
+        if (pref_sz > 0)
+        {
+            if (enc->opts->max_risked_streams == 0)
+                assert(!(hflags & LSQECH_REF_AT_RISK));
+            break;
+        }
+    }
+    assert(pref_sz <= lsqpack_enc_header_block_prefix_size(&enc->encoder));
+    if (pref_sz < 0)
+    {
+        fprintf(stderr, "end_header failed: %s", strerror(errno));
+        return -1;
+    }
+    if (enc->opts->ack_mode == ACK_IMMEDIATE)
+    {
+        if (!(2 == pref_sz && enc->pref_buf[0] == 0 && enc->pref_buf[1] == 0))
+            r = ack_stream(&enc->encoder, enc->stream_id);
+        else
+            r = 0;
+        if (r == 0 && enc->encoder.qpe_ins_count > enc->saved_ins_count)
+            r = ack_last_entry_id(&enc->encoder, &enc->saved_ins_count);
+        else
+            r = 0;
+        if (r != 0)
+        {
+            fprintf(stderr, "acking stream %u failed: %s", enc->stream_id,
+                                                            strerror(errno));
+            return -1;
+        }
+    }
+    if (s_verbose)
+        fprintf(stderr, "compression ratio: %.3f\n",
+            lsqpack_enc_ratio(&enc->encoder));
+    write_enc_and_header_streams(enc->out, enc->stream_id, enc->enc_buf,
+            enc->enc_off, enc->pref_buf, pref_sz, enc->hea_buf, enc->hea_off);
+    enc->enc_off = 0;
+    enc->hea_off = 0;
+    enc->header_opened = 0;
+    return 0;
+}
+
+
+/* Close header block left open at the end of input */
+static int
+end_last_header (struct encode *enc)
+{
+    enum lsqpack_enc_header_flags hflags;
+    ssize_t pref_sz;
+
+    if (!enc->header_opened)
+        return 0;
+
+    if (s_verbose)
+        fprintf(stderr, "close opened header\n");
+    pref_sz = lsqpack_enc_end_header(&enc->encoder, enc->pref_buf,
+                                            sizeof(enc->pref_buf), &hflags);
+    if (pref_sz < 0)
+    {
+        fprintf(stderr, "end_header failed: %s", strerror(errno));
+        return -1;
+    }
+    if (enc->opts->max_risked_streams == 0)
+        assert(!(hflags & LSQECH_REF_AT_RISK));
+    if (enc->opts->ack_mode == ACK_IMMEDIATE
+        && !(2 == pref_sz && enc->pref_buf[0] == 0 && enc->pref_buf[1] == 0)
+        && 0 != ack_stream(&enc->encoder, enc->stream_id))
+    {
+        fprintf(stderr, "acking stream %u failed: %s", enc->stream_id,
+                                                            strerror(errno));
+        return -1;
+    }
+    if (s_verbose)
+        fprintf(stderr, "compression ratio: %.3f\n",
+            lsqpack_enc_ratio(&enc->encoder));
+    write_enc_and_header_streams(enc->out, enc->stream_id, enc->enc_buf,
+        enc->enc_off, enc->pref_buf, pref_sz, enc->hea_buf, enc->hea_off);
+    enc->header_opened = 0;
+    return 0;
+}
+
+
+static void
+encode_destroy (struct encode *enc)
+{
+    lsqpack_enc_cleanup(&enc->encoder);
+    if (enc->capture)
+        (void) fclose(enc->capture);
+    free(enc);
+}
+
 
-    tsu_buf_sz = sizeof(tsu_buf);
-    if (0 != lsqpack_enc_init(&encoder, s_verbose ? stderr : NULL, dyn_table_size,
-                    dyn_table_size, max_risked_streams, enc_opts, tsu_buf,
+static struct encode *
+encode_new (const struct options *opts, FILE *out)
+{
+    struct encode *enc;
+    size_t tsu_buf_sz;
+
+    enc = calloc(1, sizeof(*enc));
+    if (!enc)
+    {
+        perror("calloc");
+        return NULL;
+    }
+    enc->opts = opts;
+    enc->out = out;
+    tsu_buf_sz = sizeof(enc->tsu_buf);
+    if (0 != lsqpack_enc_init(&enc->encoder, s_verbose ? stderr : NULL,
+                    opts->dyn_table_size, opts->dyn_table_size,
+                    opts->max_risked_streams, opts->enc_opts, enc->tsu_buf,
                     &tsu_buf_sz))
     {
         perror("lsqpack_enc_init");
-        exit(EXIT_FAILURE);
+        free(enc);
+        return NULL;
     }
+    if (opts->capture_path)
+    {
+        enc->capture = fopen(opts->capture_path, "wb");
+        if (!enc->capture || 0 != lsqpack_enc_capture(&enc->encoder,
+                                        enc->capture, opts->capture_flags))
+        {
+            fprintf(stderr, "cannot capture to `%s': %s\n",
+                                    opts->capture_path, strerror(errno));
+            encode_destroy(enc);
+            return NULL;
+        }
+    }
+    return enc;
+}
 
-    lineno = 0;
-    stream_id = 0;
-    enc_off = 0;
-    hea_off = 0;
-    header_opened = 0;
 
+/* Encode QIF read from `in' and write it to `out'.  Returns 0 on success
+ * and -1 on error.
+ */
+static int
+encode (const struct options *opts, FILE *in, FILE *out)
+{
+    struct encode *enc;
+    unsigned lineno;
+    char *line, *end, *tab;
+    unsigned arg;
+    char line_buf[0x1000];
+    size_t tsu_buf_sz;
+    struct lsxpack_header xhdr;
+
+    enc = encode_new(opts, out);
+    if (!enc)
+        return -1;
+
+    lineno = 0;
     while (line = fgets(line_buf, sizeof(line_buf), in), line != NULL)
     {
         ++lineno;
@@ -357,93 +609,50 @@ main (int argc, char **argv)
         if (!end)
         {
             fprintf(stderr, "no newline on line %u\n", lineno);
-            exit(EXIT_FAILURE);
+            goto err;
         }
         *end = '\0';
 
         if (end == line)
         {
-            if (header_opened)
-            {
-                size_t sz, pref_max = sizeof(pref_buf);
-                for (sz = (fast ? pref_max : 0); sz <= pref_max; sz++)
-                {
-                    pref_sz = lsqpack_enc_end_header(&encoder, pref_buf, sz, &hflags);
-                    if (pref_sz > 0)
-                    {
-                        if (max_risked_streams == 0)
-                            assert(!(hflags & LSQECH_REF_AT_RISK));
-                        break;
-                    }
-                }
-                assert(pref_sz <= lsqpack_enc_header_block_prefix_size(&encoder));
-                if (pref_sz < 0)
-                {
-                    fprintf(stderr, "end_header failed: %s", strerror(errno));
-                    exit(EXIT_FAILURE);
-                }
-                if (ack_mode == ACK_IMMEDIATE)
-                {
-                    if (!(2 == pref_sz && pref_buf[0] == 0 && pref_buf[1] == 0))
-                        r = ack_stream(&encoder, stream_id);
-                    else
-                        r = 0;
-                    if (r == 0 && encoder.qpe_ins_count > s_saved_ins_count)
-                        r = ack_last_entry_id(&encoder);
-                    else
-                        r = 0;
-                    if (r != 0)
-                    {
-                        fprintf(stderr, "acking stream %u failed: %s", stream_id,
-                                                                    strerror(errno));
-                        exit(EXIT_FAILURE);
-                    }
-                }
-                if (s_verbose)
-                    fprintf(stderr, "compression ratio: %.3f\n",
-                        lsqpack_enc_ratio(&encoder));
-                write_enc_and_header_streams(out, stream_id, enc_buf, enc_off,
-                                             pref_buf, pref_sz, hea_buf, hea_off);
-                enc_off = 0;
-                hea_off = 0;
-                header_opened = 0;
-            }
+            if (0 != end_header(enc))
+                goto err;
             continue;
         }
 
         if (*line == '#')
         {
-            if (!process_annotations)
+            if (!opts->process_annotations)
                 continue;
 
             /* Lines starting with ## are potential annotations */
-            if (ack_mode != ACK_IMMEDIATE
+            if (opts->ack_mode != ACK_IMMEDIATE
                 /* Ignore ACK annotations in immediate ACK mode, as we do
                  * not tolerate duplicate ACKs.
                  */
                                 && 1 == sscanf(line, "## %*[a] %u ", &arg))
             {
-                if (0 != ack_stream(&encoder, arg))
+                if (0 != ack_stream(&enc->encoder, arg))
                 {
                     fprintf(stderr, "ACKing stream ID %u failed\n", arg);
-                    exit(EXIT_FAILURE);
+                    goto err;
                 }
             }
             else if (1 == sscanf(line, "## %*[s] %u", &arg))
-                sync_table(&encoder, arg);
+                sync_table(&enc->encoder, arg);
             else if (1 == sscanf(line, "## %*[c] %u", &arg))
-                cancel_stream(&encoder, arg);
+                cancel_stream(&enc->encoder, arg);
             else if (1 == sscanf(line, "## %*[t] %u", &arg))
             {
-                tsu_buf_sz = sizeof(tsu_buf);
-                if (0 != lsqpack_enc_set_max_capacity(&encoder, arg, tsu_buf,
-                                                                &tsu_buf_sz))
+                tsu_buf_sz = sizeof(enc->tsu_buf);
+                if (0 != lsqpack_enc_set_max_capacity(&enc->encoder, arg,
+                                                enc->tsu_buf, &tsu_buf_sz))
                 {
                     fprintf(stderr, "cannot set capacity to %u: %s\n", arg,
                         strerror(errno));
-                    exit(EXIT_FAILURE);
+                    goto err;
                 }
-                write_enc_stream(out, tsu_buf, tsu_buf_sz);
+                write_enc_stream(out, enc->tsu_buf, tsu_buf_sz);
             }
             continue;
         }
@@ -452,104 +661,239 @@ main (int argc, char **argv)
         if (!tab)
         {
             fprintf(stderr, "no TAB on line %u\n", lineno);
-            exit(EXIT_FAILURE);
+            goto err;
         }
 
-        if (!header_opened)
+        lsxpack_header_set_offset2(&xhdr, line, 0, tab - line,
+                                        tab + 1 - line, end - tab - 1);
+        if (0 != encode_field(enc, &xhdr))
         {
-            ++stream_id;
-            if (0 != lsqpack_enc_start_header(&encoder, stream_id, 0))
-            {
-                fprintf(stderr, "start_header failed: %s\n", strerror(errno));
-                exit(EXIT_FAILURE);
-            }
-            header_opened = 1;
-        }
-        if (fast)
-        {
-            enc_sz = sizeof(enc_buf) - enc_off;
-            hea_sz = sizeof(hea_buf) - hea_off;
-        }
-        else
-        {
-            /* Increase buffers one by one to exercise error conditions */
-            enc_sz = 0;
-            hea_sz = 0;
+            fprintf(stderr, "failed on line %u\n", lineno);
+            goto err;
         }
-        while (1)
+    }
+
+    if (s_verbose)
+        fprintf(stderr, "exited while loop\n");
+
+    if (0 != end_last_header(enc))
+        goto err;
+
+    encode_destroy(enc);
+    return 0;
+
+  err:
+    encode_destroy(enc);
+    return -1;
+}
+
+
+/* Encode BQIF file mapped at `buf'.  The header fields are encoded in
+ * place.  Returns 0 on success and -1 on error.
+ */
+static int
+encode_bqif (const struct options *opts, const void *buf, size_t size,
+                                                                    FILE *out)
+{
+    struct encode *enc;
+    struct bqif bqif;
+    struct lsxpack_header xhdr;
+    const unsigned char *p;
+    unsigned list, n, n_fields;
+
+    if (0 != bqif_init(&bqif, buf, size))
+    {
+        fprintf(stderr, "malformed BQIF input\n");
+        return -1;
+    }
+
+    enc = encode_new(opts, out);
+    if (!enc)
+        return -1;
+
+    for (list = 0; list < bqif.n_lists; ++list)
+    {
+        p = bqif_list(&bqif, list, &n_fields);
+        for (n = 0; n < n_fields; ++n)
         {
-            lsxpack_header_set_offset2(&xhdr, line, 0, tab - line,
-                                            tab + 1 - line, end - tab - 1);
-            st = lsqpack_enc_encode(&encoder, enc_buf + enc_off, &enc_sz,
-                        hea_buf + hea_off, &hea_sz, &xhdr, 0);
-            switch (st)
+            p = bqif_field(p, &xhdr);
+            if (0 != encode_field(enc, &xhdr))
             {
-            case LQES_NOBUF_ENC:
-                if (enc_sz < sizeof(enc_buf) - enc_off)
-                    ++enc_sz;
-                else
-                    assert(0);
-                break;
-            case LQES_NOBUF_HEAD:
-                if (hea_sz < sizeof(hea_buf) - hea_off)
-                    ++hea_sz;
-                else
-                    assert(0);
-                break;
-            default:
-                assert(st == LQES_OK);
-                goto end_encode_one_header;
+                fprintf(stderr, "failed on header list %u\n", list);
+                goto err;
             }
         }
-        if (st != LQES_OK)
+        if (0 != end_header(enc))
+            goto err;
+    }
+
+    encode_destroy(enc);
+    return 0;
+
+  err:
+    encode_destroy(enc);
+    return -1;
+}
+
+
+#ifndef WIN32
+struct batch
+{
+    const struct batch_line    *lines;
+    const struct options       *opts;
+};
+
+
+static int
+run_task (unsigned task, void *batch_p)
+{
+    const struct batch *const batch = batch_p;
+    const struct options *const opts = &batch->opts[task];
+    struct batch_input input;
+    struct batch_output output;
+    FILE *in, *out;
+    int s;
+
+    in = batch_open_input(opts->in_path, &input);
+    if (!in)
+        goto err;
+    out = batch_open_output(&output);
+    if (!out)
+    {
+        batch_close_input(in, &input);
+        goto err;
+    }
+    if (input.map && bqif_is_bqif(input.map, input.size))
+        s = encode_bqif(opts, input.map, input.size, out);
+    else
+        s = encode(opts, in, out);
+    batch_close_input(in, &input);
+    s |= batch_close_output(out, &output, opts->out_path);
+    if (s == 0)
+        return 0;
+
+  err:
+    fprintf(stderr, "batch line %u: task failed\n",
+                                                batch->lines[task].lineno);
+    return -1;
+}
+
+
+static void
+run_batch (const char *batch_path, unsigned n_threads,
+                                            const struct options *base_opts)
+{
+    struct batch batch;
+    struct batch_line *lines;
+    struct options *opts;
+    unsigned n_lines, n, n_failed;
+
+    lines = batch_read(batch_path, "interop-encode", &n_lines);
+    opts = malloc(n_lines * sizeof(opts[0]) + 1);
+    if (!opts)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (n = 0; n < n_lines; ++n)
+    {
+        opts[n] = *base_opts;
+        opts[n].in_path = NULL;
+        opts[n].out_path = NULL;
+        batch_reset_getopt();
+        parse_options(lines[n].argc, lines[n].argv, &opts[n], NULL, NULL);
+        if (!opts[n].in_path || !opts[n].out_path)
         {
-            /* It could only run of of output space, so it's not really an
-             * error, but we make no provision in the interop encoder to
-             * grow the buffers.
-             */
-            fprintf(stderr, "Could not encode header on line %u: %u\n",
-                                                                lineno, st);
+            fprintf(stderr, "%s: line %u: input and output must be "
+                                "specified\n", batch_path, lines[n].lineno);
             exit(EXIT_FAILURE);
         }
-    end_encode_one_header:
-        enc_off += enc_sz;
-        hea_off += hea_sz;
     }
 
-    if (s_verbose)
-        fprintf(stderr, "exited while loop\n");
+    batch.lines = lines;
+    batch.opts = opts;
+    n_failed = batch_run(n_threads, n_lines, run_task, &batch);
+    free(opts);
+    if (n_failed)
+    {
+        fprintf(stderr, "%u of %u tasks failed\n", n_failed, n_lines);
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
+#endif
 
-    (void) fclose(in);
 
-    if (header_opened)
+int
+main (int argc, char **argv)
+{
+    FILE *in = stdin;
+    FILE *out = stdout;
+#ifndef WIN32
+    struct batch_input input = { NULL, 0, };
+#endif
+    const char *batch_path = NULL;
+    unsigned n_threads = 0;
+    struct options opts = {
+        .dyn_table_size     = LSQPACK_DEF_DYN_TABLE_SIZE,
+        .max_risked_streams = LSQPACK_DEF_MAX_RISKED_STREAMS,
+        .ack_mode           = ACK_NEVER,
+    };
+    int s;
+
+    parse_options(argc, argv, &opts, &batch_path, &n_threads);
+
+    if (batch_path)
     {
-        if (s_verbose)
-            fprintf(stderr, "close opened header\n");
-        pref_sz = lsqpack_enc_end_header(&encoder, pref_buf, sizeof(pref_buf),
-                                                                    &hflags);
-        if (pref_sz < 0)
+#ifndef WIN32
+        run_batch(batch_path, n_threads, &opts);
+#else
+        fprintf(stderr, "batch mode is not supported on Windows\n");
+        exit(EXIT_FAILURE);
+#endif
+    }
+
+    if (opts.in_path && 0 != strcmp(opts.in_path, "-"))
+    {
+#ifndef WIN32
+        /* Map the file, so that BQIF input can be encoded in place */
+        in = batch_open_input(opts.in_path, &input);
+        if (!in)
+            exit(EXIT_FAILURE);
+#else
+        in = fopen(opts.in_path, "r");
+        if (!in)
         {
-            fprintf(stderr, "end_header failed: %s", strerror(errno));
+            fprintf(stderr, "cannot open `%s' for reading: %s\n",
+                                        opts.in_path, strerror(errno));
             exit(EXIT_FAILURE);
         }
-        if (max_risked_streams == 0)
-            assert(!(hflags & LSQECH_REF_AT_RISK));
-        if (ack_mode == ACK_IMMEDIATE
-            && !(2 == pref_sz && pref_buf[0] == 0 && pref_buf[1] == 0)
-            && 0 != ack_stream(&encoder, stream_id))
+#endif
+    }
+    if (opts.out_path && 0 != strcmp(opts.out_path, "-"))
+    {
+        out = fopen(opts.out_path, "wb");
+        if (!out)
         {
-            fprintf(stderr, "acking stream %u failed: %s", stream_id,
-                                                                strerror(errno));
+            fprintf(stderr, "cannot open `%s' for writing: %s\n",
+                                        opts.out_path, strerror(errno));
             exit(EXIT_FAILURE);
         }
-        if (s_verbose)
-            fprintf(stderr, "compression ratio: %.3f\n",
-                lsqpack_enc_ratio(&encoder));
-        write_enc_and_header_streams(out, stream_id, enc_buf, enc_off, pref_buf,
-                                     pref_sz, hea_buf, hea_off);
     }
 
-    lsqpack_enc_cleanup(&encoder);
+#ifndef WIN32
+    if (input.map && bqif_is_bqif(input.map, input.size))
+        s = encode_bqif(&opts, input.map, input.size, out);
+    else
+        s = encode(&opts, in, out);
+    if (in != stdin)
+        batch_close_input(in, &input);
+#else
+    s = encode(&opts, in, out);
+    (void) fclose(in);
+#endif
+    if (s != 0)
+        exit(EXIT_FAILURE);
 
     if (0 != fclose(out))
     {
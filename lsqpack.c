@@ -32,12 +32,15 @@ SOFTWARE.
 #include <assert.h>
 #include <errno.h>
 #include <math.h>
+#include <stdarg.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/queue.h>
 #include <sys/types.h>
 #include <inttypes.h>
+#include <time.h>
 
 
 #if defined(__linux__)
@@ -74,6 +77,12 @@ SOFTWARE.
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
+#if LSQPACK_DEVEL_MODE
+#   define STATIC
+#else
+#   define STATIC static
+#endif
+
 #ifndef FALL_THROUGH
 #  if 201710L < __STDC_VERSION__
 #    define FALL_THROUGH [[fallthrough]]
@@ -87,10 +96,10 @@ SOFTWARE.
 #  endif
 #endif
 
-static unsigned char *
+STATIC unsigned char *
 qenc_huffman_enc (const unsigned char *, const unsigned char *const, unsigned char *);
 
-static unsigned
+STATIC unsigned
 qenc_enc_str_size (const unsigned char *, unsigned);
 
 struct static_table_entry
@@ -208,36 +217,977 @@ static const struct static_table_entry static_table[] =
     {"x-frame-options", "sameorigin", 15, 10,},
 };
 
-#define QPACK_STATIC_TABLE_SIZE (sizeof(static_table) / sizeof(static_table[0]))
+#define QPACK_STATIC_TABLE_SIZE (sizeof(static_table) / sizeof(static_table[0]))
+
+/* RFC 7541, Section 4.1:
+ *
+ * " The size of the dynamic table is the sum of the size of its entries.
+ * "
+ * " The size of an entry is the sum of its name's length in octets (as
+ * " defined in Section 5.2), its value's length in octets, and 32.
+ */
+#define DYNAMIC_ENTRY_OVERHEAD 32u
+
+/* Initial guess at number of header fields per list: */
+#define GUESS_N_HEADER_FIELDS 12
+
+#define MAX_QUIC_STREAM_ID ((1ull << 62) - 1)
+
+/* Numeric value of the lowest enum lsqpack_log_level compiled in.  Call
+ * sites below it are removed by the compiler.
+ */
+#ifndef LSQPACK_MIN_LOG_LEVEL
+#define LSQPACK_MIN_LOG_LEVEL 0
+#endif
+
+#if !(defined(LSQPACK_ENC_LOGGER_HEADER) && defined(LSQPACK_DEC_LOGGER_HEADER))
+/* Format the message once and pass it to the callback or, if there is no
+ * callback, write it to `logger_ctx' as a FILE *.
+ */
+static void
+#if __GNUC__
+__attribute__((format(printf, 5, 6)))
+#endif
+lsqpack_log (lsqpack_log_f log_f, void *logger_ctx,
+        enum lsqpack_log_level level, const char *prefix, const char *fmt, ...)
+{
+    char buf[0x200], *msg;
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (len < 0)
+        return;
+
+    msg = buf;
+    if ((size_t) len >= sizeof(buf))
+    {
+        msg = malloc((size_t) len + 1);
+        if (msg)
+        {
+            va_start(ap, fmt);
+            (void) vsnprintf(msg, (size_t) len + 1, fmt, ap);
+            va_end(ap);
+        }
+        else
+        {
+            msg = buf;
+            len = sizeof(buf) - 1;
+        }
+    }
+
+    if (log_f)
+        log_f(logger_ctx, level, msg, (size_t) len);
+    else
+        fprintf(logger_ctx, "%s%s\n", prefix, msg);
+
+    if (msg != buf)
+        free(msg);
+}
+#endif
+
+/* Statically defined tracing (USDT) probes.  Compiled in if LSQPACK_USDT
+ * is set; otherwise, they are no-ops.  The provider is `lsqpack'.  The
+ * first argument is always the encoder or the decoder:
+ *
+ *  enc_header_start    stream ID, seqno
+ *  enc_program         encoder stream, header block, and table actions
+ *  enc_header_end      header block prefix size, max ID, at risk
+ *  enc_insert          entry ID, entry size
+ *  enc_evict           entry ID, entry size
+ *  enc_ack             stream ID, max ID referenced by header block
+ *  enc_ici             increment, new max acked ID
+ *  enc_cancel          stream ID, number of header blocks cancelled
+ *  dec_header_start    stream ID, header block size
+ *  dec_header_end      stream ID, number of header fields
+ *  dec_block           stream ID, Required Insert Count
+ *  dec_unblock         stream ID, encoder stream bytes waited
+ *  dec_enc_in          chunk size, insert count before the chunk
+ *  dec_insert          insert count, entry size
+ *  dec_evict           entry size
+ */
+#if LSQPACK_USDT
+#include <sys/sdt.h>
+#define PROBE2(name, a, b) DTRACE_PROBE2(lsqpack, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(lsqpack, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(lsqpack, name, a, b, c, d)
+#else
+#define PROBE2(name, a, b) do { } while (0)
+#define PROBE3(name, a, b, c) do { } while (0)
+#define PROBE4(name, a, b, c, d) do { } while (0)
+#endif
+
+/* Profiling.  If LSQPACK_PROFILE is set, prof_now() reads the TSC (on x86)
+ * or the monotonic clock and prof_record() adds the time elapsed since
+ * `start' to the histogram for `point'.  Otherwise, they do nothing.
+ */
+#if LSQPACK_PROFILE
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define prof_now() __rdtsc()
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define prof_now() __rdtsc()
+#else
+static uint64_t
+prof_now (void)
+{
+    struct timespec ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+#endif
+
+
+static unsigned
+prof_bucket (uint64_t val)
+{
+    unsigned msb;
+
+    if (val < (1u << LSQPACK_PROF_SUB_BITS))
+        return (unsigned) val;
+#if __GNUC__
+    msb = 63 - (unsigned) __builtin_clzll(val);
+#else
+    for (msb = LSQPACK_PROF_SUB_BITS; val >> (msb + 1); ++msb)
+        ;
+#endif
+    return ((msb - LSQPACK_PROF_SUB_BITS + 1) << LSQPACK_PROF_SUB_BITS)
+         | (unsigned) ((val >> (msb - LSQPACK_PROF_SUB_BITS))
+                                    & ((1u << LSQPACK_PROF_SUB_BITS) - 1));
+}
+
+
+static void
+prof_record (struct lsqpack_prof_hist *hists, enum lsqpack_prof_point point,
+                                                                uint64_t start)
+{
+    struct lsqpack_prof_hist *hist;
+    uint64_t val;
+
+    if (!hists)
+        return;
+    val = prof_now() - start;
+    hist = &hists[point];
+    ++hist->ph_count;
+    hist->ph_sum += val;
+    if (val > hist->ph_max)
+        hist->ph_max = val;
+    ++hist->ph_buckets[ prof_bucket(val) ];
+}
+#else
+#define prof_now() 0
+#define prof_record(hists, point, start) do { (void) (start); } while (0)
+#endif
+
+/* Capture.  See lsqpack_dec_capture() and lsqpack_enc_capture().  Only
+ * compiled in if LSQPACK_CAPTURE is set; otherwise, the hooks below do
+ * nothing.
+ *
+ * Records are built in memory.  When values are redacted, a record is held
+ * back while a Huffman-encoded value that starts in it is incomplete: the
+ * value is rewritten only when all of its bits are known.  Records after
+ * a held record are held as well, so that the log stays in order.
+ */
+#if LSQPACK_CAPTURE
+#define CAP_VERSION 1
+
+struct cap_rec
+{
+    STAILQ_ENTRY(cap_rec)   cr_next;
+    size_t                  cr_sz;
+    unsigned char           cr_buf[];
+};
+
+/* Part of a Huffman-encoded value in a record */
+struct cap_span
+{
+    unsigned char          *cs_buf;
+    size_t                  cs_len;
+};
+
+/* Redaction state of the encoder stream or of a header block */
+struct cap_redact
+{
+    TAILQ_ENTRY(cap_redact) cd_next;
+    uint64_t                cd_stream_id;
+    uint64_t                cd_int;         /* Integer being read */
+    uint64_t                cd_str_left;    /* Bytes left in string */
+    struct cap_span        *cd_spans;
+    unsigned                cd_n_spans, cd_n_alloc;
+    unsigned                cd_shift;
+    enum {
+        CDS_FIRST,  /* First byte of the next item */
+        CDS_INT,    /* Integer continuation bytes */
+        CDS_STR,    /* String bytes */
+        CDS_DEAD,   /* Input is malformed: stop parsing */
+    }                       cd_state;
+    enum {
+        CDP_RIC,    /* Header block prefix: Required Insert Count */
+        CDP_BASE,   /* Header block prefix: Base */
+        CDP_ITEM,   /* First item of instruction or representation */
+        CDP_VALUE,  /* Value string */
+    }                       cd_phase;
+    signed char             cd_hblock;      /* Header block or encoder stream */
+    signed char             cd_has_value;   /* Instruction has value string */
+    signed char             cd_is_len;      /* Integer is string length */
+    signed char             cd_huffman;
+};
+
+struct lsqpack_capture
+{
+    FILE                           *cap_out;
+    enum lsqpack_capture_flags      cap_flags;
+    uint64_t                        cap_last_time;
+    /* Number of Huffman-encoded values that span the end of a record */
+    unsigned                        cap_n_open;
+    STAILQ_HEAD(, cap_rec)          cap_held;
+    struct cap_redact               cap_enc_stream;
+    TAILQ_HEAD(, cap_redact)        cap_hblocks;
+    /* Canonical Huffman code: first code and number of codes of each
+     * length.
+     */
+    uint32_t                        cap_huff_first[31];
+    unsigned                        cap_huff_count[31];
+    /* Seeds the hash of redacted encoder values.  It is never written to
+     * the log, so filler cannot be matched against guessed values.
+     */
+    uint64_t                        cap_salt;
+};
+
+
+static uint64_t
+cap_now (void)
+{
+    struct timespec ts;
+
+#if defined(WIN32) || !defined(CLOCK_MONOTONIC)
+    (void) timespec_get(&ts, TIME_UTC);
+#else
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+
+/* Read the salt from the system random source.  Where there is none, mix
+ * whatever varies between captures.
+ */
+static uint64_t
+cap_salt (const struct lsqpack_capture *cap)
+{
+    uint64_t salt, mix[3];
+#ifndef WIN32
+    FILE *urandom;
+
+    urandom = fopen("/dev/urandom", "rb");
+    if (urandom)
+    {
+        if (1 == fread(&salt, sizeof(salt), 1, urandom))
+        {
+            fclose(urandom);
+            return salt;
+        }
+        fclose(urandom);
+    }
+#endif
+    mix[0] = cap_now();
+    mix[1] = (uint64_t) time(NULL);
+    mix[2] = (uint64_t) (uintptr_t) cap;
+    salt = XXH64(mix, sizeof(mix), 0);
+    return salt;
+}
+
+
+static unsigned char *
+cap_varint (unsigned char *p, uint64_t val)
+{
+    while (val >= 0x80)
+    {
+        *p++ = (unsigned char) (val | 0x80);
+        val >>= 7;
+    }
+    *p++ = (unsigned char) val;
+    return p;
+}
+
+
+static struct lsqpack_capture *
+cap_new (FILE *out, enum lsqpack_capture_flags flags,
+                                const unsigned char *header, size_t header_sz)
+{
+    struct lsqpack_capture *cap;
+    unsigned sym, bits;
+
+    cap = calloc(1, sizeof(*cap));
+    if (!cap)
+        return NULL;
+    cap->cap_out = out;
+    cap->cap_flags = flags;
+    cap->cap_last_time = cap_now();
+    STAILQ_INIT(&cap->cap_held);
+    TAILQ_INIT(&cap->cap_hblocks);
+    cap->cap_enc_stream.cd_phase = CDP_ITEM;
+    cap->cap_salt = cap_salt(cap);
+
+    for (bits = 0; bits < 31; ++bits)
+        cap->cap_huff_first[bits] = UINT32_MAX;
+    for (sym = 0; sym < 257; ++sym)
+    {
+        bits = encode_table[sym].bits;
+        ++cap->cap_huff_count[bits];
+        if (encode_table[sym].code < cap->cap_huff_first[bits])
+            cap->cap_huff_first[bits] = encode_table[sym].code;
+    }
+
+    (void) fwrite(header, 1, header_sz, out);
+    return cap;
+}
+
+
+/* Allocate record and fill in type and time.  `extra' is the number of
+ * bytes the caller appends.
+ */
+static struct cap_rec *
+cap_rec_new (struct lsqpack_capture *cap, enum lsqpack_capture_rec type,
+                                            uint64_t time, size_t extra)
+{
+    struct cap_rec *rec;
+    unsigned char *p;
+
+    rec = malloc(sizeof(*rec) + 1 + 10 + extra);
+    if (!rec)
+        return NULL;
+    p = rec->cr_buf;
+    *p++ = (unsigned char) type;
+    p = cap_varint(p, time > cap->cap_last_time
+                                    ? time - cap->cap_last_time : 0);
+    cap->cap_last_time = MAX(time, cap->cap_last_time);
+    rec->cr_sz = p - rec->cr_buf;
+    return rec;
+}
+
+
+static void
+cap_flush_held (struct lsqpack_capture *cap)
+{
+    struct cap_rec *rec;
+
+    while ((rec = STAILQ_FIRST(&cap->cap_held)))
+    {
+        STAILQ_REMOVE_HEAD(&cap->cap_held, cr_next);
+        (void) fwrite(rec->cr_buf, 1, rec->cr_sz, cap->cap_out);
+        free(rec);
+    }
+}
+
+
+static void
+cap_rec_out (struct lsqpack_capture *cap, struct cap_rec *rec)
+{
+    if (cap->cap_n_open == 0 && STAILQ_EMPTY(&cap->cap_held))
+    {
+        (void) fwrite(rec->cr_buf, 1, rec->cr_sz, cap->cap_out);
+        free(rec);
+        return;
+    }
+    STAILQ_INSERT_TAIL(&cap->cap_held, rec, cr_next);
+    if (cap->cap_n_open == 0)
+        cap_flush_held(cap);
+}
+
+
+static uint32_t
+cap_read_bits (const unsigned char *buf, size_t pos, unsigned n_bits)
+{
+    uint32_t val;
+    unsigned i;
+
+    val = 0;
+    for (i = 0; i < n_bits; ++i, ++pos)
+        val = val << 1 | ((buf[pos >> 3] >> (7 - (pos & 7))) & 1);
+    return val;
+}
+
+
+static void
+cap_write_bits (unsigned char *buf, size_t pos, unsigned n_bits, uint32_t val)
+{
+    unsigned i, bit;
+
+    for (i = n_bits; i > 0; --i, ++pos)
+    {
+        bit = (val >> (i - 1)) & 1;
+        buf[pos >> 3] = (unsigned char) ((buf[pos >> 3]
+                                    & ~(0x80 >> (pos & 7))) | bit << (7 - (pos & 7)));
+    }
+}
+
+
+/* Replace each symbol with the first symbol whose code is as long.  The
+ * canonical code makes this easy: codes of the same length are consecutive
+ * and numerically smaller than any prefix of a longer code.  Padding and
+ * anything that does not decode are left alone.
+ */
+static void
+cap_redact_huffman (const struct lsqpack_capture *cap, unsigned char *buf,
+                                                                size_t len)
+{
+    const size_t total = len * 8;
+    size_t pos;
+    uint32_t code;
+    unsigned bits;
+
+    pos = 0;
+    while (1)
+    {
+        for (bits = 5; bits <= 30; ++bits)
+        {
+            if (pos + bits > total)
+                return;
+            code = cap_read_bits(buf, pos, bits);
+            if (cap->cap_huff_count[bits]
+                    && code >= cap->cap_huff_first[bits]
+                    && code - cap->cap_huff_first[bits]
+                                                < cap->cap_huff_count[bits])
+                break;
+        }
+        if (bits > 30)
+            return;
+        cap_write_bits(buf, pos, bits, cap->cap_huff_first[bits]);
+        pos += bits;
+    }
+}
+
+
+/* Huffman-encoded value is complete: rewrite it */
+static void
+cap_redact_spans (struct lsqpack_capture *cap, struct cap_redact *cd)
+{
+    unsigned char *buf;
+    size_t len, off;
+    unsigned n;
+
+    if (cd->cd_n_spans == 1)
+        cap_redact_huffman(cap, cd->cd_spans[0].cs_buf,
+                                                cd->cd_spans[0].cs_len);
+    else
+    {
+        len = 0;
+        for (n = 0; n < cd->cd_n_spans; ++n)
+            len += cd->cd_spans[n].cs_len;
+        buf = malloc(len);
+        if (buf)
+        {
+            for (off = 0, n = 0; n < cd->cd_n_spans; ++n)
+            {
+                memcpy(buf + off, cd->cd_spans[n].cs_buf,
+                                                    cd->cd_spans[n].cs_len);
+                off += cd->cd_spans[n].cs_len;
+            }
+            cap_redact_huffman(cap, buf, len);
+            for (off = 0, n = 0; n < cd->cd_n_spans; ++n)
+            {
+                memcpy(cd->cd_spans[n].cs_buf, buf + off,
+                                                    cd->cd_spans[n].cs_len);
+                off += cd->cd_spans[n].cs_len;
+            }
+            free(buf);
+        }
+        else
+            for (n = 0; n < cd->cd_n_spans; ++n)
+                memset(cd->cd_spans[n].cs_buf, 0, cd->cd_spans[n].cs_len);
+    }
+    cd->cd_n_spans = 0;
+}
+
+
+/* Item -- integer or string -- is complete: move on to the next one */
+static void
+cap_redact_next (struct cap_redact *cd)
+{
+    switch (cd->cd_phase)
+    {
+    case CDP_RIC:
+        cd->cd_phase = CDP_BASE;
+        break;
+    case CDP_BASE:
+        cd->cd_phase = CDP_ITEM;
+        break;
+    case CDP_ITEM:
+        if (cd->cd_has_value)
+            cd->cd_phase = CDP_VALUE;
+        break;
+    default:
+        cd->cd_phase = CDP_ITEM;
+        break;
+    }
+    cd->cd_state = CDS_FIRST;
+}
+
+
+static void
+cap_redact_int_done (struct lsqpack_capture *cap, struct cap_redact *cd)
+{
+    if (cd->cd_is_len && cd->cd_int > 0)
+    {
+        cd->cd_str_left = cd->cd_int;
+        cd->cd_state = CDS_STR;
+    }
+    else
+        cap_redact_next(cd);
+}
+
+
+static void
+cap_redact_start_int (struct lsqpack_capture *cap, struct cap_redact *cd,
+                    unsigned char byte, unsigned prefix_bits, int is_len)
+{
+    const unsigned mask = (1u << prefix_bits) - 1;
+
+    cd->cd_is_len = is_len;
+    cd->cd_int = byte & mask;
+    cd->cd_shift = 0;
+    if (cd->cd_int < mask)
+        cap_redact_int_done(cap, cd);
+    else
+        cd->cd_state = CDS_INT;
+}
+
+
+/* Parse the first byte of an item: learn what the item is and, at the start
+ * of an instruction, whether a value string follows.
+ */
+static void
+cap_redact_first (struct lsqpack_capture *cap, struct cap_redact *cd,
+                                                            unsigned char b)
+{
+    switch (cd->cd_phase)
+    {
+    case CDP_RIC:
+        cap_redact_start_int(cap, cd, b, 8, 0);
+        return;
+    case CDP_BASE:
+        cap_redact_start_int(cap, cd, b, 7, 0);
+        return;
+    case CDP_VALUE:
+        cd->cd_huffman = (b & 0x80) != 0;
+        cap_redact_start_int(cap, cd, b, 7, 1);
+        return;
+    default:
+        break;
+    }
+
+    cd->cd_huffman = 0;
+    if (!cd->cd_hblock)
+    {
+        if (b & 0x80)           /* Insert With Name Reference */
+        {
+            cd->cd_has_value = 1;
+            cap_redact_start_int(cap, cd, b, 6, 0);
+        }
+        else if (b & 0x40)      /* Insert With Literal Name */
+        {
+            cd->cd_has_value = 1;
+            cd->cd_huffman = (b & 0x20) != 0;
+            cap_redact_start_int(cap, cd, b, 5, 1);
+        }
+        else                    /* Set Dynamic Table Capacity, Duplicate */
+        {
+            cd->cd_has_value = 0;
+            cap_redact_start_int(cap, cd, b, 5, 0);
+        }
+    }
+    else
+    {
+        if (b & 0x80)           /* Indexed Field Line */
+        {
+            cd->cd_has_value = 0;
+            cap_redact_start_int(cap, cd, b, 6, 0);
+        }
+        else if (b & 0x40)      /* Literal With Name Reference */
+        {
+            cd->cd_has_value = 1;
+            cap_redact_start_int(cap, cd, b, 4, 0);
+        }
+        else if (b & 0x20)      /* Literal With Literal Name */
+        {
+            cd->cd_has_value = 1;
+            cd->cd_huffman = (b & 0x08) != 0;
+            cap_redact_start_int(cap, cd, b, 3, 1);
+        }
+        else if (b & 0x10)      /* Indexed Field Line With Post-Base Index */
+        {
+            cd->cd_has_value = 0;
+            cap_redact_start_int(cap, cd, b, 4, 0);
+        }
+        else                    /* Literal With Post-Base Name Reference */
+        {
+            cd->cd_has_value = 1;
+            cap_redact_start_int(cap, cd, b, 3, 0);
+        }
+    }
+}
+
+
+static int
+cap_redact_add_span (struct lsqpack_capture *cap, struct cap_redact *cd,
+                                            unsigned char *buf, size_t len)
+{
+    struct cap_span *spans;
+    unsigned n_alloc;
+
+    if (cd->cd_n_spans >= cd->cd_n_alloc)
+    {
+        n_alloc = cd->cd_n_alloc ? cd->cd_n_alloc * 2 : 4;
+        spans = realloc(cd->cd_spans, n_alloc * sizeof(spans[0]));
+        if (!spans)
+            return -1;
+        cd->cd_spans = spans;
+        cd->cd_n_alloc = n_alloc;
+    }
+    if (cd->cd_n_spans == 0)
+        ++cap->cap_n_open;
+    cd->cd_spans[ cd->cd_n_spans++ ] = (struct cap_span) { buf, len, };
+    return 0;
+}
+
+
+/* Redact values in `buf', which is part of a record */
+static void
+cap_redact (struct lsqpack_capture *cap, struct cap_redact *cd,
+                                            unsigned char *buf, size_t len)
+{
+    unsigned char *const end = buf + len;
+    size_t n;
+
+    while (buf < end)
+        switch (cd->cd_state)
+        {
+        case CDS_FIRST:
+            cap_redact_first(cap, cd, *buf++);
+            break;
+        case CDS_INT:
+            if (cd->cd_shift > 56)
+            {
+                cd->cd_state = CDS_DEAD;
+                break;
+            }
+            cd->cd_int += (uint64_t) (*buf & 0x7F) << cd->cd_shift;
+            cd->cd_shift += 7;
+            if (!(*buf++ & 0x80))
+                cap_redact_int_done(cap, cd);
+            break;
+        case CDS_STR:
+            n = (size_t) MIN(cd->cd_str_left, (uint64_t) (end - buf));
+            if (cd->cd_phase == CDP_VALUE)
+            {
+                if (!cd->cd_huffman)
+                    memset(buf, 'x', n);
+                else if (0 != cap_redact_add_span(cap, cd, buf, n))
+                    memset(buf, 0, n);
+            }
+            buf += n;
+            cd->cd_str_left -= n;
+            if (cd->cd_str_left == 0)
+            {
+                if (cd->cd_n_spans > 0)
+                {
+                    cap_redact_spans(cap, cd);
+                    --cap->cap_n_open;
+                }
+                cap_redact_next(cd);
+            }
+            break;
+        default:
+            /* Do not leave anything in the clear past the point where
+             * parsing failed.
+             */
+            memset(buf, 0, end - buf);
+            return;
+        }
+}
+
+
+/* Stop redacting: the value being read, if any, is wiped */
+static void
+cap_redact_abort (struct lsqpack_capture *cap, struct cap_redact *cd)
+{
+    unsigned n;
+
+    if (cd->cd_n_spans > 0)
+    {
+        for (n = 0; n < cd->cd_n_spans; ++n)
+            memset(cd->cd_spans[n].cs_buf, 0, cd->cd_spans[n].cs_len);
+        cd->cd_n_spans = 0;
+        --cap->cap_n_open;
+    }
+    free(cd->cd_spans);
+    cd->cd_spans = NULL;
+    cd->cd_n_alloc = 0;
+}
+
+
+static struct cap_redact *
+cap_find_hblock (struct lsqpack_capture *cap, uint64_t stream_id)
+{
+    struct cap_redact *cd;
+
+    TAILQ_FOREACH(cd, &cap->cap_hblocks, cd_next)
+        if (cd->cd_stream_id == stream_id)
+            return cd;
+    return NULL;
+}
+
+
+static void
+cap_end_hblock (struct lsqpack_capture *cap, uint64_t stream_id)
+{
+    struct cap_redact *cd;
+
+    cd = cap_find_hblock(cap, stream_id);
+    if (cd)
+    {
+        TAILQ_REMOVE(&cap->cap_hblocks, cd, cd_next);
+        cap_redact_abort(cap, cd);
+        free(cd);
+        if (cap->cap_n_open == 0)
+            cap_flush_held(cap);
+    }
+}
+
+
+static void
+cap_destroy (struct lsqpack_capture *cap)
+{
+    struct cap_redact *cd;
+
+    while ((cd = TAILQ_FIRST(&cap->cap_hblocks)))
+    {
+        TAILQ_REMOVE(&cap->cap_hblocks, cd, cd_next);
+        cap_redact_abort(cap, cd);
+        free(cd);
+    }
+    cap_redact_abort(cap, &cap->cap_enc_stream);
+    cap_flush_held(cap);
+    (void) fflush(cap->cap_out);
+    free(cap);
+}
+
+
+/* Record decoder input that carries bytes: an encoder stream chunk or part
+ * of a header block.  `header_size' is only used for HEADER_IN.
+ */
+static void
+cap_dec_bytes (struct lsqpack_capture *cap, enum lsqpack_capture_rec type,
+        uint64_t time, uint64_t stream_id, uint64_t header_size,
+        const unsigned char *buf, size_t sz)
+{
+    struct cap_redact *cd;
+    struct cap_rec *rec;
+    unsigned char *p;
+
+    rec = cap_rec_new(cap, type, time, 30 + sz);
+    if (!rec)
+        return;
+    p = rec->cr_buf + rec->cr_sz;
+    if (type != LSQPACK_CAP_DEC_ENC_IN)
+        p = cap_varint(p, stream_id);
+    if (type == LSQPACK_CAP_DEC_HEADER_IN)
+        p = cap_varint(p, header_size);
+    p = cap_varint(p, sz);
+    memcpy(p, buf, sz);
+    rec->cr_sz = p + sz - rec->cr_buf;
+
+    if (cap->cap_flags & LSQPACK_CAPTURE_REDACT)
+    {
+        if (type == LSQPACK_CAP_DEC_ENC_IN)
+            cd = &cap->cap_enc_stream;
+        else
+        {
+            cd = cap_find_hblock(cap, stream_id);
+            if (type == LSQPACK_CAP_DEC_HEADER_IN || !cd)
+            {
+                /* Stream ID may be reused after an error */
+                if (cd)
+                    cap_end_hblock(cap, stream_id);
+                cd = calloc(1, sizeof(*cd));
+                if (!cd)
+                {
+                    memset(p, 0, sz);
+                    goto out;
+                }
+                cd->cd_stream_id = stream_id;
+                cd->cd_hblock = 1;
+                cd->cd_phase = type == LSQPACK_CAP_DEC_HEADER_IN
+                                    ? CDP_RIC : CDP_ITEM;
+                if (type != LSQPACK_CAP_DEC_HEADER_IN)
+                    cd->cd_state = CDS_DEAD;    /* Unknown position */
+                TAILQ_INSERT_TAIL(&cap->cap_hblocks, cd, cd_next);
+            }
+        }
+        cap_redact(cap, cd, p, sz);
+    }
+
+  out:
+    cap_rec_out(cap, rec);
+}
+
+
+/* Record decoder input that has only a stream ID */
+static void
+cap_dec_stream (struct lsqpack_capture *cap, enum lsqpack_capture_rec type,
+                                                        uint64_t stream_id)
+{
+    struct cap_rec *rec;
+
+    rec = cap_rec_new(cap, type, cap_now(), 10);
+    if (!rec)
+        return;
+    rec->cr_sz = cap_varint(rec->cr_buf + rec->cr_sz, stream_id)
+                                                            - rec->cr_buf;
+    cap_rec_out(cap, rec);
+    cap_end_hblock(cap, stream_id);
+}
+
+
+static void
+cap_dec_header (struct lsqpack_capture *cap, enum lsqpack_capture_rec type,
+        uint64_t time, uint64_t stream_id, uint64_t header_size,
+        const unsigned char *buf, size_t sz,
+        enum lsqpack_read_header_status st)
+{
+    cap_dec_bytes(cap, type, time, stream_id, header_size, buf, sz);
+    if (st == LQRHS_DONE || st == LQRHS_ERROR)
+        cap_end_hblock(cap, stream_id);
+}
+
+
+/* Fill `dst' with characters derived from the salted hash of `src' */
+static void
+cap_filler (const struct lsqpack_capture *cap, char *dst, const char *src,
+                                                                size_t len)
+{
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    uint64_t state;
+    size_t n;
+
+    state = XXH64(src, len, cap->cap_salt) | 1;
+    for (n = 0; n < len; ++n)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        dst[n] = chars[ state % (sizeof(chars) - 1) ];
+    }
+}
+
+
+static void
+cap_enc_field (struct lsqpack_capture *cap, uint64_t time,
+                enum lsqpack_enc_flags flags, const struct lsxpack_header *xhdr)
+{
+    struct cap_rec *rec;
+    unsigned char *p;
 
-/* RFC 7541, Section 4.1:
- *
- * " The size of the dynamic table is the sum of the size of its entries.
- * "
- * " The size of an entry is the sum of its name's length in octets (as
- * " defined in Section 5.2), its value's length in octets, and 32.
- */
-#define DYNAMIC_ENTRY_OVERHEAD 32u
+    rec = cap_rec_new(cap, LSQPACK_CAP_ENC_FIELD, time,
+                                    32 + xhdr->name_len + xhdr->val_len);
+    if (!rec)
+        return;
+    p = rec->cr_buf + rec->cr_sz;
+    p = cap_varint(p, flags);
+    *p++ = (unsigned char) (xhdr->flags
+                & (LSXPACK_QPACK_IDX|LSXPACK_VAL_MATCHED|LSXPACK_NEVER_INDEX));
+    *p++ = xhdr->qpack_index;
+    p = cap_varint(p, xhdr->name_len);
+    p = cap_varint(p, xhdr->val_len);
+    memcpy(p, lsxpack_header_get_name(xhdr), xhdr->name_len);
+    p += xhdr->name_len;
+    if (cap->cap_flags & LSQPACK_CAPTURE_REDACT)
+        cap_filler(cap, (char *) p, lsxpack_header_get_value(xhdr),
+                                                            xhdr->val_len);
+    else
+        memcpy(p, lsxpack_header_get_value(xhdr), xhdr->val_len);
+    p += xhdr->val_len;
+    rec->cr_sz = p - rec->cr_buf;
+    cap_rec_out(cap, rec);
+}
 
-/* Initial guess at number of header fields per list: */
-#define GUESS_N_HEADER_FIELDS 12
 
-#define MAX_QUIC_STREAM_ID ((1ull << 62) - 1)
+/* Record encoder input: up to two integers and optional bytes */
+static void
+cap_enc_rec (struct lsqpack_capture *cap, enum lsqpack_capture_rec type,
+        uint64_t time, unsigned n_ints, uint64_t a, uint64_t b,
+        const unsigned char *buf, size_t sz)
+{
+    struct cap_rec *rec;
+    unsigned char *p;
+
+    rec = cap_rec_new(cap, type, time, 30 + sz);
+    if (!rec)
+        return;
+    p = rec->cr_buf + rec->cr_sz;
+    if (n_ints > 0)
+        p = cap_varint(p, a);
+    if (n_ints > 1)
+        p = cap_varint(p, b);
+    if (buf)
+    {
+        p = cap_varint(p, sz);
+        memcpy(p, buf, sz);
+        p += sz;
+    }
+    rec->cr_sz = p - rec->cr_buf;
+    cap_rec_out(cap, rec);
+}
+#else
+/* Arguments are referenced so that variables set only for capture do not
+ * trigger warnings.
+ */
+#define cap_now() 0
+#define cap_destroy(cap) do { } while (0)
+#define cap_enc_rec(cap, type, time, n_ints, a, b, buf, sz) do {             \
+    (void) (time); (void) (a); (void) (b); (void) (buf); (void) (sz);        \
+} while (0)
+#define cap_enc_field(cap, time, flags, xhdr) do {                           \
+    (void) (time); (void) (flags); (void) (xhdr);                            \
+} while (0)
+#define cap_dec_bytes(cap, type, time, stream_id, header_size, buf, sz) do { \
+    (void) (time); (void) (stream_id); (void) (header_size);                 \
+    (void) (buf); (void) (sz);                                               \
+} while (0)
+#define cap_dec_stream(cap, type, stream_id) do {                            \
+    (void) (stream_id);                                                      \
+} while (0)
+#define cap_dec_header(cap, type, time, stream_id, header_size, buf, sz, st) \
+                                                                        do { \
+    (void) (time); (void) (stream_id); (void) (header_size);                 \
+    (void) (buf); (void) (sz); (void) (st);                                  \
+} while (0)
+#endif
 
 #ifdef LSQPACK_ENC_LOGGER_HEADER
 #include LSQPACK_ENC_LOGGER_HEADER
 #else
-#define E_LOG(prefix, ...) do {                                         \
-    if (enc->qpe_logger_ctx) {                                          \
-        fprintf(enc->qpe_logger_ctx, prefix);                           \
-        fprintf(enc->qpe_logger_ctx, __VA_ARGS__);                      \
-        fprintf(enc->qpe_logger_ctx, "\n");                             \
-    }                                                                   \
+#define E_LOG_ENABLED(level) (LSQPACK_MIN_LOG_LEVEL <= (level)             \
+                                    && enc->qpe_log_level <= (level))
+#define E_LOG(level, prefix, ...) do {                                  \
+    if (E_LOG_ENABLED(level))                                           \
+        lsqpack_log(enc->qpe_log_f, enc->qpe_logger_ctx, level,         \
+                                                prefix, __VA_ARGS__);   \
 } while (0)
-#define E_DEBUG(...) E_LOG("qenc: debug: ", __VA_ARGS__)
-#define E_INFO(...)  E_LOG("qenc: info: ", __VA_ARGS__)
-#define E_WARN(...)  E_LOG("qenc: warn: ", __VA_ARGS__)
-#define E_ERROR(...) E_LOG("qenc: error: ", __VA_ARGS__)
+#define E_DEBUG(...) E_LOG(LSQPACK_LOG_DEBUG, "qenc: debug: ", __VA_ARGS__)
+#define E_INFO(...)  E_LOG(LSQPACK_LOG_INFO, "qenc: info: ", __VA_ARGS__)
+#define E_WARN(...)  E_LOG(LSQPACK_LOG_WARN, "qenc: warn: ", __VA_ARGS__)
+#define E_ERROR(...) E_LOG(LSQPACK_LOG_ERROR, "qenc: error: ", __VA_ARGS__)
+#endif
+
+/* Guards diagnostics that are expensive to compute. */
+#ifndef E_LOG_ENABLED
+#define E_LOG_ENABLED(level) (enc->qpe_logger_ctx != NULL)
 #endif
 
 /* Entries in the encoder's dynamic table are hashed 1) by name and 2) by
@@ -288,6 +1238,9 @@ struct lsqpack_header_info
     unsigned                            qhi_bytes_inserted;
     lsqpack_abs_id_t                    qhi_min_id;
     lsqpack_abs_id_t                    qhi_max_id;
+    enum {
+        QHI_RISKED  = 1 << 0,   /* On qpe_risked_hinfos list */
+    }                                   qhi_flags;
 };
 
 /* Absolute index starts with 1.  0 indicates that the value is not set */
@@ -391,6 +1344,91 @@ enc_use_dynamic_table (const struct lsqpack_enc *enc)
 }
 
 
+/* Count-min sketch of name/value hashes, as in TinyLFU.  Each of the
+ * SKETCH_DEPTH rows is indexed by the top bits of the hash times a
+ * different odd constant.  Counters saturate at SKETCH_MAX_COUNT and are
+ * halved every fs_period additions, so that old counts age out.
+ */
+#define SKETCH_DEPTH 4u
+#define SKETCH_MAX_COUNT 15
+#define SKETCH_MIN_BITS 6
+/* Number of table-fulls of fields in the aging period */
+#define SKETCH_TABLE_GENS 4
+
+struct lsqpack_freq_sketch
+{
+    unsigned        fs_bits;
+    unsigned        fs_period;
+    unsigned        fs_adds;
+    unsigned char   fs_counters[];
+};
+
+static const unsigned sketch_mults[SKETCH_DEPTH] =
+{
+    0x9E3779B1u, 0x85EBCA77u, 0xC2B2AE3Du, 0x27D4EB2Fu,
+};
+
+
+#define SKETCH_IDX(fs_, row_, hash_) (((row_) << (fs_)->fs_bits)          \
+    + ((uint32_t) ((hash_) * sketch_mults[row_]) >> (32 - (fs_)->fs_bits)))
+
+
+static struct lsqpack_freq_sketch *
+qenc_sketch_new (unsigned n_fields)
+{
+    struct lsqpack_freq_sketch *fs;
+    unsigned bits;
+
+    for (bits = SKETCH_MIN_BITS; (1u << bits) < n_fields * SKETCH_TABLE_GENS;
+                                                                        ++bits)
+        ;
+    fs = calloc(1, sizeof(*fs) + (SKETCH_DEPTH << bits));
+    if (!fs)
+        return NULL;
+    fs->fs_bits = bits;
+    fs->fs_period = n_fields * SKETCH_TABLE_GENS;
+    return fs;
+}
+
+
+static unsigned
+qenc_sketch_estimate (const struct lsqpack_freq_sketch *fs, unsigned hash)
+{
+    unsigned row, count, min;
+
+    min = SKETCH_MAX_COUNT;
+    for (row = 0; row < SKETCH_DEPTH; ++row)
+    {
+        count = fs->fs_counters[ SKETCH_IDX(fs, row, hash) ];
+        if (count < min)
+            min = count;
+    }
+
+    return min;
+}
+
+
+static void
+qenc_sketch_add (struct lsqpack_freq_sketch *fs, unsigned hash)
+{
+    unsigned row, min, i;
+
+    /* Conservative update: only increment the counters at the minimum */
+    min = qenc_sketch_estimate(fs, hash);
+    if (min < SKETCH_MAX_COUNT)
+        for (row = 0; row < SKETCH_DEPTH; ++row)
+            if (fs->fs_counters[ SKETCH_IDX(fs, row, hash) ] == min)
+                ++fs->fs_counters[ SKETCH_IDX(fs, row, hash) ];
+
+    if (++fs->fs_adds >= fs->fs_period)
+    {
+        for (i = 0; i < SKETCH_DEPTH << fs->fs_bits; ++i)
+            fs->fs_counters[i] >>= 1;
+        fs->fs_adds /= 2;
+    }
+}
+
+
 enum he { HE_NAME, HE_NAMEVAL, N_HES };
 
 
@@ -446,6 +1484,8 @@ static void
 qenc_hist_add (struct lsqpack_enc *enc, unsigned name_hash,
                                                     unsigned nameval_hash)
 {
+    if (enc->qpe_freq_sketch)
+        qenc_sketch_add(enc->qpe_freq_sketch, nameval_hash);
     if (enc->qpe_hist_nels)
     {
         enc->qpe_hist_els[ enc->qpe_hist_idx ].he_hashes[HE_NAME] = name_hash;
@@ -479,6 +1519,218 @@ qenc_hist_seen (struct lsqpack_enc *enc, enum he he, unsigned hash)
 }
 
 
+/* Response header lists mix fields whose values rarely change
+ * (content-type, content-security-policy) with fields whose values are
+ * almost always new (date, etag, x-request-id).  The encoder keeps track of
+ * how often values of each name repeat.  In server mode, values of volatile
+ * names are not indexed even if history has seen them -- the repeat is a
+ * coincidence -- and values of stable names are indexed before history
+ * says so.  In client mode, the classification is only reported: request
+ * names like :path have few repeats, but the ones they have pay off.
+ *
+ * To keep a name from flapping, a volatile name stays volatile until its
+ * repeat rate reaches the upper edge of a dead band.  Stable names have
+ * no dead band: they leave the class as soon as the rate drops below the
+ * threshold, so that eager inserts of a name whose values stopped
+ * repeating do not linger.
+ */
+#define N_NAME_STATS 64             /* Direct-mapped by name hash */
+#define NAME_STAT_MIN_COUNT 4       /* Do not classify names seen less */
+#define NAME_STAT_MAX_COUNT 64      /* Halve counts to follow changes */
+/* Repeat rates in eighths: */
+#define VOLATILE_ENTER 1            /* Volatile below 1/8 */
+#define VOLATILE_LEAVE 2            /* ...until at least 1/4 */
+#define STABLE_ENTER 4              /* Stable at 1/2 and above */
+#define STABLE_LEAVE 4              /* ...until below 1/2: no dead band */
+/* Values at least this long are inserted on first sight if their name is
+ * stable: the extra copy on the encoder stream is paid back by the first
+ * reference.  Entries larger than a fraction of the table are not: they
+ * would evict too much.
+ */
+#define LARGE_STABLE_VALUE 64
+#define LARGE_STABLE_MAX_FRAC 8
+
+enum name_card
+{
+    NC_UNKNOWN  = LSQPACK_NC_UNKNOWN,
+    NC_STABLE   = LSQPACK_NC_STABLE,
+    NC_VOLATILE = LSQPACK_NC_VOLATILE,
+};
+
+
+struct lsqpack_name_stat
+{
+    unsigned        ns_name_hash;
+    unsigned        ns_count;
+    unsigned        ns_repeats;
+    enum name_card  ns_card;
+};
+
+
+static enum name_card
+qenc_name_card (const struct lsqpack_enc *enc, unsigned name_hash)
+{
+    const struct lsqpack_name_stat *ns;
+
+    ns = &enc->qpe_name_stats[ name_hash & (N_NAME_STATS - 1) ];
+    if (ns->ns_name_hash == name_hash)
+        return ns->ns_card;
+    else
+        return NC_UNKNOWN;
+}
+
+
+static void
+qenc_name_stat_add (struct lsqpack_enc *enc, unsigned name_hash, int repeat)
+{
+    struct lsqpack_name_stat *ns;
+
+    ns = &enc->qpe_name_stats[ name_hash & (N_NAME_STATS - 1) ];
+    if (ns->ns_name_hash != name_hash)
+    {
+        ns->ns_name_hash = name_hash;
+        ns->ns_count = 0;
+        ns->ns_repeats = 0;
+        ns->ns_card = NC_UNKNOWN;
+    }
+    ++ns->ns_count;
+    ns->ns_repeats += repeat != 0;
+    if (ns->ns_count >= NAME_STAT_MAX_COUNT)
+    {
+        ns->ns_count /= 2;
+        ns->ns_repeats /= 2;
+    }
+    if (ns->ns_count < NAME_STAT_MIN_COUNT)
+        return;
+
+#define RATE_BELOW(eighths) (ns->ns_repeats * 8 < (eighths) * ns->ns_count)
+    switch (ns->ns_card)
+    {
+    case NC_UNKNOWN:
+        if (RATE_BELOW(VOLATILE_ENTER))
+            ns->ns_card = NC_VOLATILE;
+        else if (!RATE_BELOW(STABLE_ENTER))
+            ns->ns_card = NC_STABLE;
+        break;
+    case NC_VOLATILE:
+        if (!RATE_BELOW(STABLE_ENTER))
+            ns->ns_card = NC_STABLE;
+        else if (!RATE_BELOW(VOLATILE_LEAVE))
+            ns->ns_card = NC_UNKNOWN;
+        break;
+    default:
+        if (RATE_BELOW(VOLATILE_ENTER))
+            ns->ns_card = NC_VOLATILE;
+        else if (RATE_BELOW(STABLE_LEAVE))
+            ns->ns_card = NC_UNKNOWN;
+        break;
+    }
+#undef RATE_BELOW
+}
+
+
+struct lsqpack_name_policy_el
+{
+    char                       *np_name;
+    unsigned                    np_name_len;
+    unsigned                    np_name_hash;
+    enum lsqpack_name_policy    np_policy;
+};
+
+
+static struct lsqpack_name_policy_el *
+qenc_find_name_policy (const struct lsqpack_enc *enc, const char *name,
+                                        unsigned name_len, unsigned name_hash)
+{
+    struct lsqpack_name_policy_el *np;
+
+    for (np = enc->qpe_name_policies;
+                np < enc->qpe_name_policies + enc->qpe_n_name_policies; ++np)
+        if (np->np_name_hash == name_hash && np->np_name_len == name_len
+                                && 0 == memcmp(np->np_name, name, name_len))
+            return np;
+
+    return NULL;
+}
+
+
+/* TinyLFU admission: if inserting a field would evict the oldest entry,
+ * insert it only if it has been seen more often.  Evicting an entry that
+ * has a newer copy -- usually a duplicate of a draining entry -- costs
+ * nothing.
+ */
+static int
+qenc_sketch_admit (const struct lsqpack_enc *enc, unsigned nameval_hash,
+                                                        unsigned entry_cost)
+{
+    const struct lsqpack_enc_table_entry *victim, *entry;
+    unsigned buckno;
+
+    if (enc->qpe_cur_bytes_used + entry_cost <= enc->qpe_cur_max_capacity)
+        return 1;
+
+    victim = STAILQ_FIRST(&enc->qpe_all_entries);
+    if (!victim)
+        return 1;
+
+    buckno = BUCKNO(enc->qpe_nbits, victim->ete_nameval_hash);
+    STAILQ_FOREACH(entry, &enc->qpe_buckets[buckno].by_nameval,
+                                                            ete_next_nameval)
+        if (entry != victim
+                        && entry->ete_nameval_hash == victim->ete_nameval_hash)
+            return 1;
+
+    return qenc_sketch_estimate(enc->qpe_freq_sketch, nameval_hash)
+        > qenc_sketch_estimate(enc->qpe_freq_sketch, victim->ete_nameval_hash);
+}
+
+
+/* Whether to index a field given that history has or has not seen it.
+ * `volatile_lit' is set if a field seen before is not indexed because its
+ * name is volatile.
+ */
+static int
+qenc_index_seen (struct lsqpack_enc *enc, int seen_nameval,
+            enum lsqpack_name_policy policy, unsigned name_hash,
+            unsigned nameval_hash, unsigned name_len, unsigned value_len,
+            int *volatile_lit)
+{
+    if (policy == LSQPACK_NP_ALWAYS_INSERT)
+        return 1;
+    if (policy == LSQPACK_NP_NAME_ONLY)
+        return 0;
+
+    /* The sketch remembers values that recur at intervals longer than the
+     * history covers.
+     */
+    if (enc->qpe_freq_sketch)
+    {
+        if (!qenc_sketch_admit(enc, nameval_hash,
+                                            ENTRY_COST(name_len, value_len)))
+            return 0;
+        seen_nameval = seen_nameval
+            || qenc_sketch_estimate(enc->qpe_freq_sketch, nameval_hash) > 0;
+    }
+
+    if (!(enc->qpe_name_stats && (enc->qpe_opts & LSQPACK_ENC_OPT_SERVER)))
+        return seen_nameval;
+
+    switch (qenc_name_card(enc, name_hash))
+    {
+    case NC_VOLATILE:
+        *volatile_lit = seen_nameval != 0;
+        return 0;
+    case NC_STABLE:
+        return seen_nameval
+            || (value_len >= LARGE_STABLE_VALUE
+                && ENTRY_COST(name_len, value_len)
+                        <= enc->qpe_cur_max_capacity / LARGE_STABLE_MAX_FRAC);
+    default:
+        return seen_nameval;
+    }
+}
+
+
 unsigned char *
 lsqpack_enc_int (unsigned char *, unsigned char *const, uint64_t, unsigned);
 
@@ -492,10 +1744,26 @@ lsqpack_enc_preinit (struct lsqpack_enc *enc, void *logger_ctx)
     TAILQ_INIT(&enc->qpe_all_hinfos);
     TAILQ_INIT(&enc->qpe_risked_hinfos);
     enc->qpe_logger_ctx        = logger_ctx;
+    enc->qpe_log_level         = logger_ctx ? LSQPACK_LOG_DEBUG
+                                            : LSQPACK_LOG_NONE;
     E_DEBUG("preinitialized");
 };
 
 
+void
+lsqpack_enc_set_logger (struct lsqpack_enc *enc, lsqpack_log_f log_f,
+                        void *logger_ctx, enum lsqpack_log_level min_level)
+{
+    enc->qpe_log_f = log_f;
+    enc->qpe_logger_ctx = logger_ctx;
+    enc->qpe_flags |= LSQPACK_ENC_LOGGER_SET;
+    if (log_f || logger_ctx)
+        enc->qpe_log_level = min_level;
+    else
+        enc->qpe_log_level = LSQPACK_LOG_NONE;
+}
+
+
 int
 lsqpack_enc_init (struct lsqpack_enc *enc, void *logger_ctx,
                   unsigned max_table_size, unsigned dyn_table_size,
@@ -521,7 +1789,7 @@ lsqpack_enc_init (struct lsqpack_enc *enc, void *logger_ctx,
         if (!(tsu_buf && tsu_buf_sz && *tsu_buf_sz))
         {
             errno = EINVAL;
-            return -1;
+            goto err;
         }
         p = tsu_buf;
         *p = 0x20;
@@ -529,7 +1797,7 @@ lsqpack_enc_init (struct lsqpack_enc *enc, void *logger_ctx,
         if (p <= tsu_buf)
         {
             errno = ENOBUFS;
-            return -1;
+            goto err;
         }
         E_DEBUG("generated TSU=%u instruction %zd byte%.*s in size",
             dyn_table_size, p - tsu_buf, p - tsu_buf != 1, "s");
@@ -547,7 +1815,17 @@ lsqpack_enc_init (struct lsqpack_enc *enc, void *logger_ctx,
         );
         enc->qpe_hist_els = malloc(sizeof(enc->qpe_hist_els[0]) * (enc->qpe_hist_nels + 1));
         if (!enc->qpe_hist_els)
-            return -1;
+            goto err;
+        if (enc_opts & LSQPACK_ENC_OPT_FREQ_SKETCH)
+        {
+            enc->qpe_freq_sketch = qenc_sketch_new(enc->qpe_hist_nels);
+            if (!enc->qpe_freq_sketch)
+                goto err;
+        }
+        enc->qpe_name_stats = calloc(N_NAME_STATS,
+                                            sizeof(enc->qpe_name_stats[0]));
+        if (!enc->qpe_name_stats)
+            goto err;
     }
     else
     {
@@ -555,15 +1833,18 @@ lsqpack_enc_init (struct lsqpack_enc *enc, void *logger_ctx,
         enc->qpe_hist_els = NULL;
     }
 
+#if LSQPACK_PROFILE
+    enc->qpe_prof = calloc(LSQPACK_PROF_N_POINTS, sizeof(enc->qpe_prof[0]));
+    if (!enc->qpe_prof)
+        goto err;
+#endif
+
     if (max_table_size / DYNAMIC_ENTRY_OVERHEAD)
     {
         nbits = 2;
         buckets = malloc(sizeof(buckets[0]) * N_BUCKETS(nbits));
         if (!buckets)
-        {
-            free(enc->qpe_hist_els);
-            return -1;
-        }
+            goto err;
 
         for (i = 0; i < N_BUCKETS(nbits); ++i)
         {
@@ -581,9 +1862,15 @@ lsqpack_enc_init (struct lsqpack_enc *enc, void *logger_ctx,
     enc->qpe_real_max_capacity = max_table_size;
     enc->qpe_cur_max_capacity = dyn_table_size;
     enc->qpe_max_risked_streams = max_risked_streams;
+    enc->qpe_opts         = enc_opts;
     enc->qpe_buckets      = buckets;
     enc->qpe_nbits        = nbits;
-    enc->qpe_logger_ctx   = logger_ctx;
+    if (!(enc->qpe_flags & LSQPACK_ENC_LOGGER_SET))
+    {
+        enc->qpe_logger_ctx = logger_ctx;
+        enc->qpe_log_level  = logger_ctx ? LSQPACK_LOG_DEBUG
+                                         : LSQPACK_LOG_NONE;
+    }
     if (!(enc_opts & LSQPACK_ENC_OPT_NO_DUP))
         enc->qpe_flags   |= LSQPACK_ENC_USE_DUP;
     if (enc_opts & LSQPACK_ENC_OPT_NO_MEM_GUARD)
@@ -593,6 +1880,17 @@ lsqpack_enc_init (struct lsqpack_enc *enc, void *logger_ctx,
         enc->qpe_max_risked_streams);
 
     return 0;
+
+  err:
+    free(enc->qpe_hist_els);
+    enc->qpe_hist_els = NULL;
+    free(enc->qpe_freq_sketch);
+    enc->qpe_freq_sketch = NULL;
+    free(enc->qpe_name_stats);
+    enc->qpe_name_stats = NULL;
+    free(enc->qpe_prof);
+    enc->qpe_prof = NULL;
+    return -1;
 }
 
 
@@ -614,12 +1912,70 @@ lsqpack_enc_cleanup (struct lsqpack_enc *enc)
         free(hiarr);
     }
 
+    if (enc->qpe_capture)
+        cap_destroy(enc->qpe_capture);
     free(enc->qpe_buckets);
     free(enc->qpe_hist_els);
+    free(enc->qpe_freq_sketch);
+    free(enc->qpe_name_stats);
+    while (enc->qpe_n_name_policies)
+        free(enc->qpe_name_policies[ --enc->qpe_n_name_policies ].np_name);
+    free(enc->qpe_name_policies);
+    free(enc->qpe_prof);
     E_DEBUG("cleaned up");
 }
 
 
+#if LSQPACK_CAPTURE
+int
+lsqpack_enc_capture (struct lsqpack_enc *enc, FILE *out,
+                                        enum lsqpack_capture_flags flags)
+{
+    unsigned char header[8 + 4 * 10], *p;
+    const struct lsqpack_name_policy_el *np;
+
+    if (enc->qpe_capture)
+    {
+        cap_destroy(enc->qpe_capture);
+        enc->qpe_capture = NULL;
+    }
+    if (!out)
+        return 0;
+
+    memcpy(header, "QCAP", 4);
+    p = header + 4;
+    *p++ = CAP_VERSION;
+    *p++ = 1;
+    *p++ = (unsigned char) flags;
+    p = cap_varint(p, enc->qpe_real_max_capacity);
+    p = cap_varint(p, enc->qpe_cur_max_capacity);
+    p = cap_varint(p, enc->qpe_max_risked_streams);
+    p = cap_varint(p, enc->qpe_opts & ~LSQPACK_ENC_OPT_STAGE_2);
+    enc->qpe_capture = cap_new(out, flags, header, p - header);
+    if (!enc->qpe_capture)
+        return -1;
+    /* Policies set before capture started are part of the initial state */
+    for (np = enc->qpe_name_policies;
+                np < enc->qpe_name_policies + enc->qpe_n_name_policies; ++np)
+        cap_enc_rec(enc->qpe_capture, LSQPACK_CAP_ENC_NAME_POLICY, cap_now(),
+                    1, np->np_policy, 0, (const unsigned char *) np->np_name,
+                    np->np_name_len);
+    E_DEBUG("started capture; flags: 0x%X", flags);
+    return 0;
+}
+#else
+int
+lsqpack_enc_capture (struct lsqpack_enc *enc, FILE *out,
+                                        enum lsqpack_capture_flags flags)
+{
+    if (!out)
+        return 0;
+    errno = ENOTSUP;
+    return -1;
+}
+#endif
+
+
 #define LSQPACK_XXH_SEED 39378473
 #define XXH_NAME_WIDTH 9
 #define XXH_NAME_SHIFT 0
@@ -899,6 +2255,8 @@ qenc_drop_oldest_entry (struct lsqpack_enc *enc)
     enc->qpe_dropped += ETE_SIZE(entry);
     enc->qpe_cur_bytes_used -= ETE_SIZE(entry);
     --enc->qpe_nelem;
+    ++enc->qpe_stats.es_evictions;
+    PROBE3(enc_evict, enc, entry->ete_id, ETE_SIZE(entry));
     free(entry);
 }
 
@@ -969,7 +2327,7 @@ qenc_remove_overflow_entries (struct lsqpack_enc *enc)
         ++dropped;
     }
 
-    if (enc->qpe_logger_ctx && enc->qpe_cur_max_capacity)
+    if (E_LOG_ENABLED(LSQPACK_LOG_DEBUG) && enc->qpe_cur_max_capacity)
     {
         if (enc->qpe_flags & LSQPACK_ENC_USE_DUP)
             E_DEBUG("fill: %.2f; effective fill: %.2f",
@@ -1077,6 +2435,7 @@ lsqpack_enc_push_entry (struct lsqpack_enc *enc, uint32_t name_hash,
         entry->ete_id, (int) entry->ete_name_len, ETE_NAME(entry),
         (int) entry->ete_val_len, ETE_VALUE(entry), enc->qpe_nelem,
         enc->qpe_cur_bytes_used);
+    PROBE3(enc_insert, enc, entry->ete_id, ETE_SIZE(entry));
     return entry;
 }
 
@@ -1117,6 +2476,10 @@ lsqpack_enc_start_header (struct lsqpack_enc *enc, uint64_t stream_id,
             }
 
     enc->qpe_flags |= LSQPACK_ENC_HEADER;
+    PROBE3(enc_header_start, enc, stream_id, seqno);
+    if (enc->qpe_capture)
+        cap_enc_rec(enc->qpe_capture, LSQPACK_CAP_ENC_START, cap_now(), 2,
+                                                    stream_id, seqno, NULL, 0);
 
     return 0;
 }
@@ -1167,6 +2530,9 @@ lsqpack_enc_cancel_header (struct lsqpack_enc *enc)
     }
 
     enc->qpe_flags &= ~LSQPACK_ENC_HEADER;
+    if (enc->qpe_capture)
+        cap_enc_rec(enc->qpe_capture, LSQPACK_CAP_ENC_CANCEL, cap_now(), 0,
+                                                            0, 0, NULL, 0);
 
     return 0;
 }
@@ -1177,6 +2543,7 @@ qenc_add_to_risked_list (struct lsqpack_enc *enc,
                                             struct lsqpack_header_info *hinfo)
 {
     TAILQ_INSERT_TAIL(&enc->qpe_risked_hinfos, hinfo, qhi_next_risked);
+    hinfo->qhi_flags |= QHI_RISKED;
     if (enc->qpe_cur_header.other_at_risk)
     {
         hinfo->qhi_same_stream_id
@@ -1203,6 +2570,7 @@ qenc_remove_from_risked_list (struct lsqpack_enc *enc,
         return;
     }
     TAILQ_REMOVE(&enc->qpe_risked_hinfos, hinfo, qhi_next_risked);
+    hinfo->qhi_flags &= ~QHI_RISKED;
     if (hinfo->qhi_same_stream_id == hinfo)
     {
         assert(enc->qpe_cur_streams_at_risk > 0);
@@ -1228,8 +2596,8 @@ qenc_hinfo_at_risk (const struct lsqpack_enc *enc,
 }
 
 
-ssize_t
-lsqpack_enc_end_header (struct lsqpack_enc *enc, unsigned char *buf, size_t sz,
+static ssize_t
+qenc_end_header (struct lsqpack_enc *enc, unsigned char *buf, size_t sz,
         enum lsqpack_enc_header_flags *header_flags)
 {
     struct lsqpack_header_info *hinfo;
@@ -1298,7 +2666,10 @@ lsqpack_enc_end_header (struct lsqpack_enc *enc, unsigned char *buf, size_t sz,
             return 0;
 
         if (qenc_hinfo_at_risk(enc, hinfo))
+        {
             qenc_add_to_risked_list(enc, hinfo);
+            ++enc->qpe_stats.es_risked_hblocks;
+        }
 
         E_DEBUG("ended header for stream %"PRIu64"; max ref: %u encoded as %u; "
             "risked: %d", hinfo->qhi_stream_id, hinfo->qhi_max_id,
@@ -1313,6 +2684,10 @@ lsqpack_enc_end_header (struct lsqpack_enc *enc, unsigned char *buf, size_t sz,
                 *header_flags |= LSQECH_REF_AT_RISK;
         }
         enc->qpe_bytes_out += (unsigned)(dst - end + sz);
+        ++enc->qpe_stats.es_hblocks;
+        enc->qpe_stats.es_hea_bytes += dst - end + sz;
+        PROBE4(enc_header_end, enc, dst - end + sz, hinfo->qhi_max_id,
+                                            qenc_hinfo_at_risk(enc, hinfo));
         return dst - end + sz;
     }
 
@@ -1332,6 +2707,9 @@ lsqpack_enc_end_header (struct lsqpack_enc *enc, unsigned char *buf, size_t sz,
         if (header_flags)
             *header_flags = enc->qpe_cur_header.flags;
         enc->qpe_bytes_out += 2;
+        ++enc->qpe_stats.es_hblocks;
+        enc->qpe_stats.es_hea_bytes += 2;
+        PROBE4(enc_header_end, enc, 2, 0, 0);
         return 2;
     }
     else
@@ -1339,6 +2717,24 @@ lsqpack_enc_end_header (struct lsqpack_enc *enc, unsigned char *buf, size_t sz,
 }
 
 
+ssize_t
+lsqpack_enc_end_header (struct lsqpack_enc *enc, unsigned char *buf, size_t sz,
+        enum lsqpack_enc_header_flags *header_flags)
+{
+    ssize_t nw;
+    uint64_t start, time;
+
+    time = enc->qpe_capture ? cap_now() : 0;
+    start = prof_now();
+    nw = qenc_end_header(enc, buf, sz, header_flags);
+    prof_record(enc->qpe_prof, LSQPACK_PROF_ENC_END_HEADER, start);
+    if (enc->qpe_capture && nw > 0)
+        cap_enc_rec(enc->qpe_capture, LSQPACK_CAP_ENC_END, time, 0, 0, 0,
+                                                                    NULL, 0);
+    return nw;
+}
+
+
 struct encode_program
 {
     enum enc_stream_action {        /* What to do on encoder stream */
@@ -1537,6 +2933,18 @@ qenc_entry_is_draining (const struct lsqpack_enc *enc,
 }
 
 
+static int
+qenc_dup_stable (struct lsqpack_enc *enc,
+                            const struct lsqpack_enc_table_entry *entry)
+{
+    return (enc->qpe_opts & LSQPACK_ENC_OPT_SERVER)
+        && (enc->qpe_flags & LSQPACK_ENC_USE_DUP)
+        && NC_STABLE == qenc_name_card(enc, entry->ete_name_hash)
+        && qenc_safe_to_dup(enc, entry)
+        && qenc_has_or_can_evict_at_least(enc, ETE_SIZE(entry));
+}
+
+
 static int
 qenc_can_risk (const struct lsqpack_enc *enc)
 {
@@ -1595,26 +3003,100 @@ qenc_dup_draining (struct lsqpack_enc *enc, unsigned char *enc_buf,
             candidate = entry;
     }
 
-    if (!candidate)
-        return 0;
+    if (!candidate)
+        return 0;
+
+    E_DEBUG("dup draining");
+
+    *enc_buf = 0;
+    dst = lsqpack_enc_int(enc_buf, enc_buf + enc_buf_sz,
+                                    enc->qpe_ins_count - candidate->ete_id, 5);
+    if (dst <= enc_buf)
+        return 0;
+
+    entry = lsqpack_enc_push_entry(enc, candidate->ete_name_hash,
+                candidate->ete_nameval_hash, ETE_NAME(candidate),
+                candidate->ete_name_len, ETE_VALUE(candidate),
+                candidate->ete_val_len);
+    if (!entry)
+        return 0;
+
+    ++enc->qpe_stats.es_dups;
+    ++enc->qpe_stats.es_dups_draining;
+    return (unsigned) (dst - enc_buf);
+}
+
+
+static void
+qenc_count_program (struct lsqpack_enc_stats *stats,
+                                        const struct encode_program *prog)
+{
+    switch (prog->ep_hea_action)
+    {
+    case EHA_INDEXED_STAT:
+        ++stats->es_static_full;
+        break;
+    case EHA_INDEXED_NEW:
+    case EHA_INDEXED_DYN:
+        ++stats->es_dyn_full;
+        break;
+    case EHA_LIT_WITH_NAME_STAT:
+        ++stats->es_static_name;
+        break;
+    case EHA_LIT_WITH_NAME_NEW:
+    case EHA_LIT_WITH_NAME_DYN:
+        ++stats->es_dyn_name;
+        break;
+    case EHA_LIT:
+        ++stats->es_literal;
+        break;
+    }
+
+    switch (prog->ep_enc_action)
+    {
+    case EEA_DUP:
+        ++stats->es_dups;
+        break;
+    case EEA_INS_NAMEREF_STATIC:
+        ++stats->es_ins_nameref_static;
+        break;
+    case EEA_INS_NAMEREF_DYNAMIC:
+        ++stats->es_ins_nameref_dyn;
+        break;
+    case EEA_INS_LIT:
+        ++stats->es_ins_lit;
+        break;
+    case EEA_INS_LIT_NAME:
+        ++stats->es_ins_lit_name;
+        break;
+    case EEA_NONE:
+        break;
+    }
+}
+
 
-    E_DEBUG("dup draining");
+static int
+qenc_enc_str (struct lsqpack_enc *enc, unsigned prefix_bits,
+        unsigned char *dst, size_t dst_len, const unsigned char *str,
+        unsigned str_len)
+{
+    uint64_t start;
+    int r;
 
-    *enc_buf = 0;
-    dst = lsqpack_enc_int(enc_buf, enc_buf + enc_buf_sz,
-                                    enc->qpe_ins_count - candidate->ete_id, 5);
-    if (dst <= enc_buf)
-        return 0;
+    start = prof_now();
+    r = lsqpack_enc_enc_str(prefix_bits, dst, dst_len, str, str_len);
+    prof_record(enc->qpe_prof, LSQPACK_PROF_ENC_STRING, start);
+    return r;
+}
 
-    entry = lsqpack_enc_push_entry(enc, candidate->ete_name_hash,
-                candidate->ete_nameval_hash, ETE_NAME(candidate),
-                candidate->ete_name_len, ETE_VALUE(candidate),
-                candidate->ete_val_len);
-    if (!entry)
-        return 0;
 
-    return (unsigned) (dst - enc_buf);
-}
+/* Count a string literal just encoded at `p': the H bit follows the
+ * prefix.
+ */
+#define COUNT_STR(p, prefix_bits) do {                                  \
+    ++n_strs;                                                           \
+    n_huff += (*(p) >> (prefix_bits)) & 1;                              \
+} while (0)
 
 
 /* Clang does not produce incorrect "may be used uninitialized" warnings
@@ -1627,8 +3109,8 @@ qenc_dup_draining (struct lsqpack_enc *enc, unsigned char *enc_buf,
 #endif
 
 
-enum lsqpack_enc_status
-lsqpack_enc_encode (struct lsqpack_enc *enc,
+static enum lsqpack_enc_status
+qenc_encode (struct lsqpack_enc *enc,
         unsigned char *enc_buf, size_t *enc_sz_p,
         unsigned char *hea_buf, size_t *hea_sz_p,
         const struct lsxpack_header *xhdr,
@@ -1639,14 +3121,17 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
     struct lsqpack_enc_table_entry *entry, *new_entry;
     struct lsqpack_enc_table_entry *candidates[2];
     struct encode_program prog;
+    const struct lsqpack_name_policy_el *np;
+    enum lsqpack_name_policy policy;
     int index, risk, use_dyn_table, static_id, enough_room, seen_nameval;
-    int update_hist;
+    int seen_name, ratio_reset, volatile_lit, update_hist;
     unsigned name_hash, nameval_hash, buckno;
 
     size_t enc_sz, hea_sz, sz;
     unsigned char *dst;
     lsqpack_abs_id_t id;
-    unsigned n_cand;
+    unsigned n_cand, n_strs, n_huff;
+    uint64_t t_phase;
     int r;
 
     const char *const name = lsxpack_header_get_name(xhdr);
@@ -1664,10 +3149,14 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
         return LQES_NOBUF_HEAD;
 
     seen_nameval = -1;
+    seen_name = -1;
+    ratio_reset = 0;
+    volatile_lit = 0;
 
     if (xhdr->flags & LSXPACK_NEVER_INDEX)
         flags |= LQEF_NEVER_INDEX;
 
+    t_phase = prof_now();
     /* Look for a full match in the static table */
     if ((xhdr->flags & (LSXPACK_QPACK_IDX|LSXPACK_VAL_MATCHED))
                                 != (LSXPACK_QPACK_IDX|LSXPACK_VAL_MATCHED))
@@ -1684,6 +3173,8 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
         else
             nameval_hash = XXH32(value, value_len, name_hash);
         E_DEBUG("name hash: 0x%X; nameval hash: 0x%X", name_hash, nameval_hash);
+        prof_record(enc->qpe_prof, LSQPACK_PROF_ENC_HASH, t_phase);
+        t_phase = prof_now();
         static_id = find_in_static_full(nameval_hash, name, name_len, value,
                                                                 value_len);
     }
@@ -1710,6 +3201,7 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
         risk = 0;
         entry = NULL;
         index = 0;
+        policy = LSQPACK_NP_HIST_DEFAULT;
 #endif
         goto execute_program;
     }
@@ -1718,6 +3210,16 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
         id = 0;
 #endif
 
+    if (enc->qpe_n_name_policies
+            && (np = qenc_find_name_policy(enc, name, name_len, name_hash)))
+    {
+        policy = np->np_policy;
+        if (policy == LSQPACK_NP_NEVER_INDEX)
+            flags |= LQEF_NEVER_INDEX|LQEF_NO_HIST_UPD;
+    }
+    else
+        policy = LSQPACK_NP_HIST_DEFAULT;
+
     use_dyn_table = !(flags & LQEF_NO_DYN)
         && enc_use_dynamic_table(enc)
         ;
@@ -1795,6 +3297,17 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
                             .ep_tab_action = ETA_NOOP,
                             .ep_flags      = EPF_REF_FOUND,
                 };
+            else if ((risk || entry->ete_id <= enc->qpe_max_acked_id)
+                                    && index && qenc_dup_stable(enc, entry))
+                /* Server mode: duplicate instead of sending a literal */
+                prog = (struct encode_program) {
+                            .ep_enc_action = EEA_DUP,
+                            .ep_hea_action = risk ? EHA_INDEXED_NEW
+                                                  : EHA_INDEXED_DYN,
+                            .ep_tab_action = ETA_NEW,
+                            .ep_flags      = risk ? EPF_REF_FOUND|EPF_REF_NEW
+                                                  : EPF_REF_FOUND,
+                };
             else
                 break;
             goto execute_program;
@@ -1858,7 +3371,10 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
                 [1][1][1] = { EEA_NONE,               EHA_LIT_WITH_NAME_STAT, ETA_NOOP, 0, },   /* Invalid state */
             };
             seen_nameval = qenc_hist_seen(enc, HE_NAMEVAL, nameval_hash);
-            prog = programs[seen_nameval][risk][use_dyn_table && n_cand > 0];
+            prog = programs[qenc_index_seen(enc, seen_nameval, policy,
+                    name_hash, nameval_hash, name_len, value_len,
+                    &volatile_lit)]
+                                        [risk][use_dyn_table && n_cand > 0];
         }
         else
             prog = (struct encode_program) { EEA_NONE, EHA_LIT_WITH_NAME_STAT, ETA_NOOP, 0, };
@@ -1889,8 +3405,11 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
             {
                 id = entry->ete_id;
                 if (index && enough_room && risk
-                    && (seen_nameval < 0 ? (seen_nameval
-                        = qenc_hist_seen(enc, HE_NAMEVAL, nameval_hash)) : seen_nameval))
+                    && qenc_index_seen(enc, seen_nameval < 0 ? (seen_nameval
+                        = qenc_hist_seen(enc, HE_NAMEVAL, nameval_hash))
+                            : seen_nameval, policy, name_hash,
+                                        nameval_hash, name_len, value_len,
+                                        &volatile_lit))
                     prog = (struct encode_program) { EEA_INS_NAMEREF_DYNAMIC,
                                 EHA_INDEXED_NEW, ETA_NEW,
                                 EPF_REF_NEW|EPF_REF_FOUND, };
@@ -1903,8 +3422,11 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
 
     /* No matches found */
     if (index
-            && (seen_nameval < 0 ? (seen_nameval
-                    = qenc_hist_seen(enc, HE_NAMEVAL, nameval_hash)) : seen_nameval)
+            && qenc_index_seen(enc, seen_nameval < 0 ? (seen_nameval
+                    = qenc_hist_seen(enc, HE_NAMEVAL, nameval_hash))
+                        : seen_nameval, policy, name_hash,
+                                        nameval_hash, name_len, value_len,
+                                        &volatile_lit)
             && (enough_room < 0 ?
             (enough_room = qenc_has_or_can_evict_at_least(enc,
                             ENTRY_COST(name_len, value_len))) : enough_room))
@@ -1917,7 +3439,7 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
         };
         prog = programs[risk][use_dyn_table && n_cand > 0];
     }
-    else if (index && qenc_hist_seen(enc, HE_NAME, name_hash)
+    else if (index && (seen_name = qenc_hist_seen(enc, HE_NAME, name_hash))
                 && qenc_has_or_can_evict_at_least(enc, ENTRY_COST(name_len, 0)))
     {
         static const struct encode_program programs[2] = {
@@ -1930,6 +3452,7 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
         prog = (struct encode_program) { EEA_NONE, EHA_LIT, ETA_NOOP, 0, };
 
   execute_program:
+    prof_record(enc->qpe_prof, LSQPACK_PROF_ENC_LOOKUP, t_phase);
     if (((1 << prog.ep_enc_action) &
             ((1 << EEA_INS_NAMEREF_STATIC)  |
              (1 << EEA_INS_NAMEREF_DYNAMIC) |
@@ -1952,6 +3475,7 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
         {
             assert(index);
             index = 0;
+            ratio_reset = 1;
             E_DEBUG("double lit would result in ratio > 0.95, reset");
             goto restart;
         }
@@ -1960,6 +3484,10 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
     E_DEBUG("program: %s; %s; %s; flags: 0x%X",
         eea2str[ prog.ep_enc_action ], eha2str[ prog.ep_hea_action ],
         eta2str[ prog.ep_tab_action ], prog.ep_flags);
+    PROBE4(enc_program, enc, prog.ep_enc_action, prog.ep_hea_action,
+                                                        prog.ep_tab_action);
+    n_strs = 0;
+    n_huff = 0;
     switch (prog.ep_enc_action)
     {
     case EEA_DUP:
@@ -1980,10 +3508,11 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
         dst = lsqpack_enc_int(dst, enc_buf_end, id, 6);
         if (dst <= enc_buf)
             return LQES_NOBUF_ENC;
-        r = lsqpack_enc_enc_str(7, dst, enc_buf_end - dst,
+        r = qenc_enc_str(enc, 7, dst, enc_buf_end - dst,
                                     (const unsigned char *) value, value_len);
         if (r < 0)
             return LQES_NOBUF_ENC;
+        COUNT_STR(dst, 7);
         dst += (unsigned) r;
         enc_sz = dst - enc_buf;
         break;
@@ -1995,10 +3524,11 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
         dst = lsqpack_enc_int(dst, enc_buf_end, enc->qpe_ins_count - id, 6);
         if (dst <= enc_buf)
             return LQES_NOBUF_ENC;
-        r = lsqpack_enc_enc_str(7, dst, enc_buf_end - dst,
+        r = qenc_enc_str(enc, 7, dst, enc_buf_end - dst,
                                     (const unsigned char *) value, value_len);
         if (r < 0)
             return LQES_NOBUF_ENC;
+        COUNT_STR(dst, 7);
         dst += (unsigned) r;
         enc_sz = dst - enc_buf;
         break;
@@ -2008,16 +3538,19 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
             return LQES_NOBUF_ENC;
         dst = enc_buf;
         *dst = 0x40;
-        r = lsqpack_enc_enc_str(5, dst, enc_buf_end - dst,
+        r = qenc_enc_str(enc, 5, dst, enc_buf_end - dst,
                                 (const unsigned char *) name, name_len);
         if (r < 0)
             return LQES_NOBUF_ENC;
+        COUNT_STR(dst, 5);
         dst += r;
-        r = lsqpack_enc_enc_str(7, dst, enc_buf_end - dst,
+        r = qenc_enc_str(enc, 7, dst, enc_buf_end - dst,
                         (const unsigned char *) value,
                         prog.ep_enc_action == EEA_INS_LIT ? value_len : 0);
         if (r < 0)
             return LQES_NOBUF_ENC;
+        if (prog.ep_enc_action == EEA_INS_LIT)
+            COUNT_STR(dst, 7);
         dst += r;
         enc_sz = dst - enc_buf;
         break;
@@ -2062,15 +3595,17 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
         *dst = 0x20
                | (((flags & LQEF_NEVER_INDEX) > 0) << 4)
                ;
-        r = lsqpack_enc_enc_str(3, dst, hea_buf_end - dst,
+        r = qenc_enc_str(enc, 3, dst, hea_buf_end - dst,
                                 (const unsigned char *) name, name_len);
         if (r < 0)
             return LQES_NOBUF_HEAD;
+        COUNT_STR(dst, 3);
         dst += r;
-        r = lsqpack_enc_enc_str(7, dst, hea_buf_end - dst,
+        r = qenc_enc_str(enc, 7, dst, hea_buf_end - dst,
                                 (const unsigned char *) value, value_len);
         if (r < 0)
             return LQES_NOBUF_HEAD;
+        COUNT_STR(dst, 7);
         dst += r;
         hea_sz = dst - hea_buf;
         break;
@@ -2083,10 +3618,11 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
                                     id - enc->qpe_cur_header.base_idx - 1, 3);
         if (dst <= hea_buf)
             return LQES_NOBUF_HEAD;
-        r = lsqpack_enc_enc_str(7, dst, hea_buf_end - dst,
+        r = qenc_enc_str(enc, 7, dst, hea_buf_end - dst,
                                 (const unsigned char *) value, value_len);
         if (r < 0)
             return LQES_NOBUF_HEAD;
+        COUNT_STR(dst, 7);
         dst += (unsigned) r;
         hea_sz = dst - hea_buf;
         break;
@@ -2100,10 +3636,11 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
                                         enc->qpe_cur_header.base_idx - id, 4);
         if (dst <= hea_buf)
             return LQES_NOBUF_HEAD;
-        r = lsqpack_enc_enc_str(7, dst, hea_buf_end - dst,
+        r = qenc_enc_str(enc, 7, dst, hea_buf_end - dst,
                                 (const unsigned char *) value, value_len);
         if (r < 0)
             return LQES_NOBUF_HEAD;
+        COUNT_STR(dst, 7);
         dst += (unsigned) r;
         hea_sz = dst - hea_buf;
         break;
@@ -2116,10 +3653,11 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
         dst = lsqpack_enc_int(dst, hea_buf_end, id, 4);
         if (dst <= hea_buf)
             return LQES_NOBUF_HEAD;
-        r = lsqpack_enc_enc_str(7, dst, hea_buf_end - dst,
+        r = qenc_enc_str(enc, 7, dst, hea_buf_end - dst,
                                 (const unsigned char *) value, value_len);
         if (r < 0)
             return LQES_NOBUF_HEAD;
+        COUNT_STR(dst, 7);
         dst += (unsigned) r;
         hea_sz = dst - hea_buf;
         break;
@@ -2170,6 +3708,11 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
             qenc_hist_update_size(enc, enc->qpe_hist_nels + 4);
         qenc_hist_add(enc, name_hash, nameval_hash);
         ++enc->qpe_cur_header.n_hdr_added_to_hist;
+        /* A full dynamic table match means the value was seen before */
+        if (enc->qpe_name_stats
+                && (seen_nameval >= 0 || prog.ep_enc_action == EEA_DUP
+                                || prog.ep_hea_action == EHA_INDEXED_DYN))
+            qenc_name_stat_add(enc, name_hash, seen_nameval != 0);
     }
 
     while (sz = qenc_dup_draining(enc, enc_buf + enc_sz,
@@ -2179,6 +3722,27 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
         qenc_remove_overflow_entries(enc);
     }
 
+    qenc_count_program(&enc->qpe_stats, &prog);
+    if (enc->qpe_hist_els)
+    {
+        if (seen_nameval >= 0)
+        {
+            enc->qpe_stats.es_hist_hits += seen_nameval;
+            enc->qpe_stats.es_hist_misses += !seen_nameval;
+        }
+        if (seen_name >= 0)
+        {
+            enc->qpe_stats.es_hist_hits += seen_name;
+            enc->qpe_stats.es_hist_misses += !seen_name;
+        }
+    }
+    enc->qpe_stats.es_ratio_resets += ratio_reset;
+    enc->qpe_stats.es_volatile_lits += volatile_lit;
+    enc->qpe_stats.es_str_huffman += n_huff;
+    enc->qpe_stats.es_str_plain += n_strs - n_huff;
+    enc->qpe_stats.es_hea_bytes += hea_sz;
+    enc->qpe_stats.es_enc_bytes += enc_sz;
+
     enc->qpe_bytes_in += name_len + value_len;
     enc->qpe_bytes_out += (unsigned)(enc_sz + hea_sz);
     if (enc->qpe_bytes_out > (1u << (sizeof(enc->qpe_bytes_out) * 8 - 1)))
@@ -2196,6 +3760,26 @@ lsqpack_enc_encode (struct lsqpack_enc *enc,
 }
 
 
+enum lsqpack_enc_status
+lsqpack_enc_encode (struct lsqpack_enc *enc,
+        unsigned char *enc_buf, size_t *enc_sz_p,
+        unsigned char *hea_buf, size_t *hea_sz_p,
+        const struct lsxpack_header *xhdr,
+        enum lsqpack_enc_flags flags)
+{
+    enum lsqpack_enc_status st;
+    uint64_t start, time;
+
+    time = enc->qpe_capture ? cap_now() : 0;
+    start = prof_now();
+    st = qenc_encode(enc, enc_buf, enc_sz_p, hea_buf, hea_sz_p, xhdr, flags);
+    prof_record(enc->qpe_prof, LSQPACK_PROF_ENC_ENCODE, start);
+    if (enc->qpe_capture && st == LQES_OK)
+        cap_enc_field(enc->qpe_capture, time, flags, xhdr);
+    return st;
+}
+
+
 int
 lsqpack_enc_set_max_capacity (struct lsqpack_enc *enc, unsigned capacity,
                                     unsigned char *tsu_buf, size_t *tsu_buf_sz)
@@ -2212,6 +3796,9 @@ lsqpack_enc_set_max_capacity (struct lsqpack_enc *enc, unsigned capacity,
     {
         E_DEBUG("set_capacity: capacity stays unchanged at %u", capacity);
         *tsu_buf_sz = 0;
+        if (enc->qpe_capture)
+            cap_enc_rec(enc->qpe_capture, LSQPACK_CAP_ENC_CAPACITY,
+                                    cap_now(), 1, capacity, 0, NULL, 0);
         return 0;
     }
 
@@ -2234,6 +3821,72 @@ lsqpack_enc_set_max_capacity (struct lsqpack_enc *enc, unsigned capacity,
                                                                     capacity);
     enc->qpe_cur_max_capacity = capacity;
     qenc_remove_overflow_entries(enc);
+    if (enc->qpe_capture)
+        cap_enc_rec(enc->qpe_capture, LSQPACK_CAP_ENC_CAPACITY, cap_now(), 1,
+                                                    capacity, 0, NULL, 0);
+    return 0;
+}
+
+
+int
+lsqpack_enc_set_name_policy (struct lsqpack_enc *enc, const char *name,
+                        unsigned name_len, enum lsqpack_name_policy policy)
+{
+    struct lsqpack_name_policy_el *np, *new_policies;
+    unsigned name_hash;
+    char *new_name;
+
+    switch (policy)
+    {
+    case LSQPACK_NP_HIST_DEFAULT:
+    case LSQPACK_NP_ALWAYS_INSERT:
+    case LSQPACK_NP_NAME_ONLY:
+    case LSQPACK_NP_NEVER_INDEX:
+        break;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+
+    name_hash = XXH32(name, name_len, LSQPACK_XXH_SEED);
+    np = qenc_find_name_policy(enc, name, name_len, name_hash);
+    if (np)
+    {
+        if (policy == LSQPACK_NP_HIST_DEFAULT)
+        {
+            free(np->np_name);
+            *np = enc->qpe_name_policies[ --enc->qpe_n_name_policies ];
+        }
+        else
+            np->np_policy = policy;
+    }
+    else if (policy != LSQPACK_NP_HIST_DEFAULT)
+    {
+        new_name = malloc(name_len ? name_len : 1);
+        if (!new_name)
+            return -1;
+        new_policies = realloc(enc->qpe_name_policies,
+            sizeof(enc->qpe_name_policies[0])
+                                        * (enc->qpe_n_name_policies + 1));
+        if (!new_policies)
+        {
+            free(new_name);
+            return -1;
+        }
+        memcpy(new_name, name, name_len);
+        enc->qpe_name_policies = new_policies;
+        np = &enc->qpe_name_policies[ enc->qpe_n_name_policies++ ];
+        np->np_name = new_name;
+        np->np_name_len = name_len;
+        np->np_name_hash = name_hash;
+        np->np_policy = policy;
+    }
+
+    E_DEBUG("name policy for `%.*s' set to %d", (int) name_len, name,
+                                                                (int) policy);
+    if (enc->qpe_capture)
+        cap_enc_rec(enc->qpe_capture, LSQPACK_CAP_ENC_NAME_POLICY, cap_now(),
+                        1, policy, 0, (const unsigned char *) name, name_len);
     return 0;
 }
 
@@ -2270,15 +3923,18 @@ enc_proc_header_ack (struct lsqpack_enc *enc, uint64_t stream_id)
     if (!hinfo)
         return -1;
 
+    if (hinfo->qhi_flags & QHI_RISKED)
+        qenc_remove_from_risked_list(enc, hinfo);
     if (hinfo->qhi_max_id > enc->qpe_max_acked_id)
     {
-        qenc_remove_from_risked_list(enc, hinfo);
         enc->qpe_max_acked_id = hinfo->qhi_max_id;
-        qenc_update_risked_list(enc);
+        enc->qpe_flags |= LSQPACK_ENC_RISKED_STALE;
         E_DEBUG("max acked ID is now %u", enc->qpe_max_acked_id);
     }
 
+    PROBE3(enc_ack, enc, stream_id, hinfo->qhi_max_id);
     enc_free_hinfo(enc, hinfo);
+    enc->qpe_flags |= LSQPACK_ENC_MINREF_STALE;
     return 0;
 }
 
@@ -2311,13 +3967,14 @@ enc_proc_ici (struct lsqpack_enc *enc, uint64_t ins_count)
     }
 
     max_acked = (lsqpack_abs_id_t) ins_count + enc->qpe_last_ici;
+    PROBE3(enc_ici, enc, ins_count, max_acked);
 
     if (max_acked > enc->qpe_max_acked_id)
     {
         enc->qpe_last_ici = max_acked;
         enc->qpe_max_acked_id = max_acked;
+        enc->qpe_flags |= LSQPACK_ENC_RISKED_STALE;
         E_DEBUG("max acked ID is now %u", enc->qpe_max_acked_id);
-        qenc_update_risked_list(enc);
     }
     else
     {
@@ -2349,15 +4006,17 @@ enc_proc_stream_cancel (struct lsqpack_enc *enc, uint64_t stream_id)
         {
             E_DEBUG("cancel header block for stream %"PRIu64", seqno %u",
                 stream_id, hinfo->qhi_seqno);
-            if (qenc_hinfo_at_risk(enc, hinfo))
+            if (hinfo->qhi_flags & QHI_RISKED)
                 qenc_remove_from_risked_list(enc, hinfo);
             enc_free_hinfo(enc, hinfo);
+            enc->qpe_flags |= LSQPACK_ENC_MINREF_STALE;
             ++count;
         }
     }
 
     E_DEBUG("cancelled %u header block%.*s of stream %"PRIu64,
                                         count, count != 1, "s", stream_id);
+    PROBE3(enc_cancel, enc, stream_id, count);
     return 0;
 }
 
@@ -2460,8 +4119,8 @@ lsqpack_dec_int24 (const unsigned char **src_p, const unsigned char *src_end,
 }
 
 
-int
-lsqpack_enc_decoder_in (struct lsqpack_enc *enc,
+static int
+qenc_decoder_in (struct lsqpack_enc *enc,
                                     const unsigned char *buf, size_t buf_sz)
 {
     const unsigned char *const end = buf + buf_sz;
@@ -2521,6 +4180,86 @@ lsqpack_enc_decoder_in (struct lsqpack_enc *enc,
 }
 
 
+/* The instructions in the chunk are applied first; the risked list and the
+ * cached minimum referenced ID are then brought up to date only once.
+ */
+int
+lsqpack_enc_decoder_in (struct lsqpack_enc *enc,
+                                    const unsigned char *buf, size_t buf_sz)
+{
+    uint64_t start;
+    int r;
+
+    if (enc->qpe_capture)
+        cap_enc_rec(enc->qpe_capture, LSQPACK_CAP_ENC_DECODER_IN, cap_now(),
+                                                    0, 0, 0, buf, buf_sz);
+    start = prof_now();
+    r = qenc_decoder_in(enc, buf, buf_sz);
+
+    if (enc->qpe_flags & LSQPACK_ENC_RISKED_STALE)
+        qenc_update_risked_list(enc);
+    if (enc->qpe_flags & LSQPACK_ENC_MINREF_STALE)
+        enc->qpe_cur_header.flags &= ~LSQECH_MINREF_CACHED;
+    enc->qpe_flags &= ~(LSQPACK_ENC_RISKED_STALE|LSQPACK_ENC_MINREF_STALE);
+
+    prof_record(enc->qpe_prof, LSQPACK_PROF_ENC_DECODER_IN, start);
+    return r;
+}
+
+
+void
+lsqpack_enc_get_stats (const struct lsqpack_enc *enc,
+                                            struct lsqpack_enc_stats *stats)
+{
+    const struct lsqpack_enc_table_entry *entry;
+    const struct lsqpack_header_info_arr *hiarr;
+    const struct lsqpack_name_stat *ns;
+
+    *stats = enc->qpe_stats;
+
+    stats->es_table_mem = 0;
+    STAILQ_FOREACH(entry, &enc->qpe_all_entries, ete_next_all)
+        stats->es_table_mem += sizeof(*entry) + entry->ete_name_len
+                                                        + entry->ete_val_len;
+
+    stats->es_bucket_mem = enc->qpe_buckets
+        ? N_BUCKETS(enc->qpe_nbits) * sizeof(enc->qpe_buckets[0]) : 0;
+    stats->es_hist_mem = enc->qpe_hist_els
+        ? (enc->qpe_hist_nels + 1) * sizeof(enc->qpe_hist_els[0]) : 0;
+    if (enc->qpe_freq_sketch)
+        stats->es_hist_mem += sizeof(*enc->qpe_freq_sketch)
+                        + (SKETCH_DEPTH << enc->qpe_freq_sketch->fs_bits);
+    if (enc->qpe_name_stats)
+        stats->es_hist_mem += N_NAME_STATS * sizeof(enc->qpe_name_stats[0]);
+
+    stats->es_hinfo_mem = 0;
+    STAILQ_FOREACH(hiarr, &enc->qpe_hinfo_arrs, hia_next)
+        stats->es_hinfo_mem += sizeof(*hiarr);
+
+    stats->es_names_stable = 0;
+    stats->es_names_volatile = 0;
+    if (enc->qpe_name_stats)
+        for (ns = enc->qpe_name_stats; ns < enc->qpe_name_stats + N_NAME_STATS;
+                                                                        ++ns)
+        {
+            stats->es_names_stable += ns->ns_card == NC_STABLE;
+            stats->es_names_volatile += ns->ns_card == NC_VOLATILE;
+        }
+}
+
+
+enum lsqpack_name_class
+lsqpack_enc_get_name_class (const struct lsqpack_enc *enc, const char *name,
+                                                        unsigned name_len)
+{
+    if (!enc->qpe_name_stats)
+        return LSQPACK_NC_UNKNOWN;
+
+    return (enum lsqpack_name_class) qenc_name_card(enc,
+                                    XXH32(name, name_len, LSQPACK_XXH_SEED));
+}
+
+
 float
 lsqpack_enc_ratio (const struct lsqpack_enc *enc)
 {
@@ -2541,17 +4280,21 @@ lsqpack_enc_ratio (const struct lsqpack_enc *enc)
 #ifdef LSQPACK_DEC_LOGGER_HEADER
 #include LSQPACK_DEC_LOGGER_HEADER
 #else
-#define D_LOG(prefix, ...) do {                                     \
-    if (dec->qpd_logger_ctx) {                                          \
-        fprintf(dec->qpd_logger_ctx, prefix);                           \
-        fprintf(dec->qpd_logger_ctx, __VA_ARGS__);                      \
-        fprintf(dec->qpd_logger_ctx, "\n");                             \
-    }                                                                   \
+#define D_LOG_ENABLED(level) (LSQPACK_MIN_LOG_LEVEL <= (level)             \
+                                    && dec->qpd_log_level <= (level))
+#define D_LOG(level, prefix, ...) do {                                  \
+    if (D_LOG_ENABLED(level))                                           \
+        lsqpack_log(dec->qpd_log_f, dec->qpd_logger_ctx, level,         \
+                                                prefix, __VA_ARGS__);   \
 } while (0)
-#define D_DEBUG(...) D_LOG("qdec: debug: ", __VA_ARGS__)
-#define D_INFO(...)  D_LOG("qdec: info: ", __VA_ARGS__)
-#define D_WARN(...)  D_LOG("qdec: warn: ", __VA_ARGS__)
-#define D_ERROR(...) D_LOG("qdec: error: ", __VA_ARGS__)
+#define D_DEBUG(...) D_LOG(LSQPACK_LOG_DEBUG, "qdec: debug: ", __VA_ARGS__)
+#define D_INFO(...)  D_LOG(LSQPACK_LOG_INFO, "qdec: info: ", __VA_ARGS__)
+#define D_WARN(...)  D_LOG(LSQPACK_LOG_WARN, "qdec: warn: ", __VA_ARGS__)
+#define D_ERROR(...) D_LOG(LSQPACK_LOG_ERROR, "qdec: error: ", __VA_ARGS__)
+#endif
+
+#ifndef D_LOG_ENABLED
+#define D_LOG_ENABLED(level) (dec->qpd_logger_ctx != NULL)
 #endif
 
 
@@ -2584,12 +4327,6 @@ enum
 };
 
 
-#if LSQPACK_DEVEL_MODE
-#   define STATIC
-#else
-#   define STATIC static
-#endif
-
 STATIC unsigned
 ringbuf_count (const struct lsqpack_ringbuf *rbuf)
 {
@@ -2780,10 +4517,10 @@ lsqpack_dec_init (struct lsqpack_dec *dec, void *logger_ctx,
     unsigned dyn_table_size, unsigned max_risked_streams,
     const struct lsqpack_dec_hset_if *dh_if, enum lsqpack_dec_opts opts)
 {
-    unsigned i;
     memset(dec, 0, sizeof(*dec));
     dec->qpd_opts = opts;
     dec->qpd_logger_ctx = logger_ctx;
+    dec->qpd_log_level = logger_ctx ? LSQPACK_LOG_DEBUG : LSQPACK_LOG_NONE;
     dec->qpd_max_capacity = dyn_table_size;
     dec->qpd_cur_max_capacity = dyn_table_size;
     dec->qpd_max_entries = dec->qpd_max_capacity / DYNAMIC_ENTRY_OVERHEAD;
@@ -2792,8 +4529,10 @@ lsqpack_dec_init (struct lsqpack_dec *dec, void *logger_ctx,
     dec->qpd_max_risked_streams = max_risked_streams;
     dec->qpd_dh_if = dh_if;
     TAILQ_INIT(&dec->qpd_hbrcs);
-    for (i = 0; i < (1 << LSQPACK_DEC_BLOCKED_BITS); ++i)
-        TAILQ_INIT(&dec->qpd_blocked_headers[i]);
+    TAILQ_INIT(&dec->qpd_unblocked);
+#if LSQPACK_PROFILE
+    dec->qpd_prof = calloc(LSQPACK_PROF_N_POINTS, sizeof(dec->qpd_prof[0]));
+#endif
     D_DEBUG("initialized.  max capacity=%u; max risked streams=%u",
         dec->qpd_max_capacity, dec->qpd_max_risked_streams);
 }
@@ -2829,13 +4568,23 @@ enum {
 struct header_block_read_ctx
 {
     TAILQ_ENTRY(header_block_read_ctx)  hbrc_next_all,
-                                        hbrc_next_blocked;
+                                        hbrc_next_unblocked;
     void                               *hbrc_hblock;
     uint64_t                            hbrc_stream_id;
     size_t                              hbrc_orig_size;     /* To report error offset */
     size_t                              hbrc_size;
     lsqpack_abs_id_t                    hbrc_largest_ref;   /* Parsed from prefix */
     lsqpack_abs_id_t                    hbrc_base_index;    /* Parsed from prefix */
+    /* Required Insert Count in terms of qpd_ins_count and position in the
+     * blocked heap.  Only valid if HBRC_BLOCKED is set.
+     */
+    uint64_t                            hbrc_ric;
+    unsigned                            hbrc_blocked_idx;
+    /* Values of qpd_ins_count and ds_enc_bytes when the header block got
+     * blocked.
+     */
+    uint64_t                            hbrc_blocked_ins;
+    uint64_t                            hbrc_blocked_off;
     unsigned                            hbrc_header_count;
 
     struct {
@@ -2862,6 +4611,7 @@ struct header_block_read_ctx
 #define LARGEST_USED_SHIFT 5
         HBRC_LARGEST_REF_USED   = 1 << LARGEST_USED_SHIFT,
         HBRC_DYN_USED_IN_ERR    = 1 << 6,
+        HBRC_UNBLOCKED          = 1 << 7, /* On qpd_unblocked queue */
     }                                   hbrc_flags;
 
     struct hbrc_buf {
@@ -2927,6 +4677,26 @@ parse_header_data (struct lsqpack_dec *,
         struct header_block_read_ctx *, const unsigned char *, size_t);
 
 
+void
+lsqpack_dec_set_logger (struct lsqpack_dec *dec, lsqpack_log_f log_f,
+                        void *logger_ctx, enum lsqpack_log_level min_level)
+{
+    dec->qpd_log_f = log_f;
+    dec->qpd_logger_ctx = logger_ctx;
+    if (log_f || logger_ctx)
+        dec->qpd_log_level = min_level;
+    else
+        dec->qpd_log_level = LSQPACK_LOG_NONE;
+}
+
+
+size_t
+lsqpack_dec_hblock_ctx_size (const struct lsqpack_dec *dec)
+{
+    return sizeof(struct header_block_read_ctx);
+}
+
+
 float
 lsqpack_dec_ratio (const struct lsqpack_dec *dec)
 {
@@ -2954,7 +4724,10 @@ lsqpack_dec_cleanup (struct lsqpack_dec *dec)
                                                     read_ctx = next_read_ctx)
     {
         next_read_ctx = TAILQ_NEXT(read_ctx, hbrc_next_all);
-        free(read_ctx);
+        if (dec->qpd_opts & LSQPACK_DEC_OPT_HBLOCK_STORAGE)
+            read_ctx->hbrc_flags = 0;
+        else
+            free(read_ctx);
     }
 
     if (dec->qpd_enc_state.resume >= DEI_WINR_READ_NAME_IDX
@@ -2982,10 +4755,57 @@ lsqpack_dec_cleanup (struct lsqpack_dec *dec)
         qdec_decref_entry(entry);
     }
     ringbuf_cleanup(&dec->qpd_dyn_table);
+    free(dec->qpd_blocked_headers);
+    free(dec->qpd_out.buf);
+    free(dec->qpd_prof);
+    if (dec->qpd_capture)
+        cap_destroy(dec->qpd_capture);
     D_DEBUG("cleaned up");
 }
 
 
+#if LSQPACK_CAPTURE
+int
+lsqpack_dec_capture (struct lsqpack_dec *dec, FILE *out,
+                                        enum lsqpack_capture_flags flags)
+{
+    unsigned char header[8 + 3 * 10], *p;
+
+    if (dec->qpd_capture)
+    {
+        cap_destroy(dec->qpd_capture);
+        dec->qpd_capture = NULL;
+    }
+    if (!out)
+        return 0;
+
+    memcpy(header, "QCAP", 4);
+    p = header + 4;
+    *p++ = CAP_VERSION;
+    *p++ = 0;
+    *p++ = (unsigned char) flags;
+    p = cap_varint(p, dec->qpd_max_capacity);
+    p = cap_varint(p, dec->qpd_max_risked_streams);
+    p = cap_varint(p, dec->qpd_opts);
+    dec->qpd_capture = cap_new(out, flags, header, p - header);
+    if (!dec->qpd_capture)
+        return -1;
+    D_DEBUG("started capture; flags: 0x%X", flags);
+    return 0;
+}
+#else
+int
+lsqpack_dec_capture (struct lsqpack_dec *dec, FILE *out,
+                                        enum lsqpack_capture_flags flags)
+{
+    if (!out)
+        return 0;
+    errno = ENOTSUP;
+    return -1;
+}
+#endif
+
+
 static void
 qdec_maybe_update_entry_hashes (const struct lsqpack_dec *dec,
                                     struct lsqpack_dec_table_entry *entry)
@@ -3009,6 +4829,20 @@ qdec_maybe_update_entry_hashes (const struct lsqpack_dec *dec,
 }
 
 
+static int
+qdec_process_header (struct lsqpack_dec *dec,
+            struct header_block_read_ctx *read_ctx, struct lsxpack_header *xhdr)
+{
+    uint64_t start;
+    int r;
+
+    start = prof_now();
+    r = dec->qpd_dh_if->dhi_process_header(read_ctx->hbrc_hblock, xhdr);
+    prof_record(dec->qpd_prof, LSQPACK_PROF_DEC_CALLBACK, start);
+    return r;
+}
+
+
 static int
 header_out_static_entry (struct lsqpack_dec *dec,
                     struct header_block_read_ctx *read_ctx, uint64_t idx)
@@ -3049,7 +4883,7 @@ header_out_static_entry (struct lsqpack_dec *dec,
     dst += static_table[ idx ].val_len;
     if (http1x)
         memcpy(dst, "\r\n", 2);
-    r = dec->qpd_dh_if->dhi_process_header(read_ctx->hbrc_hblock, xhdr);
+    r = qdec_process_header(dec, read_ctx, xhdr);
     if (r == 0)
         dec->qpd_bytes_out += static_table[ idx ].name_len
                             + static_table[ idx ].val_len;
@@ -3110,7 +4944,8 @@ header_out_dynamic_entry (struct lsqpack_dec *dec,
     dst += entry->dte_val_len;
     if (http1x)
         memcpy(dst, "\r\n", 2);
-    r = dec->qpd_dh_if->dhi_process_header(read_ctx->hbrc_hblock, xhdr);
+    dec->qpd_stats.ds_work += entry->dte_name_len + entry->dte_val_len;
+    r = qdec_process_header(dec, read_ctx, xhdr);
     if (r == 0)
         dec->qpd_bytes_out += entry->dte_name_len + entry->dte_val_len;
     return r;
@@ -3194,6 +5029,7 @@ header_out_begin_dynamic_nameref (struct lsqpack_dec *dec,
     xhdr->name_len = (lsxpack_strlen_t)entry->dte_name_len;
     dst = xhdr->buf + xhdr->name_offset;
     memcpy(dst, DTE_NAME(entry), entry->dte_name_len);
+    dec->qpd_stats.ds_work += entry->dte_name_len;
     dst += entry->dte_name_len;
     if (http1x)
     {
@@ -3310,7 +5146,7 @@ header_out_write_value (struct lsqpack_dec *dec,
             xhdr->flags |= LSXPACK_NAMEVAL_HASH;
         }
         bytes_out = xhdr->name_len + xhdr->val_len;
-        r = dec->qpd_dh_if->dhi_process_header(read_ctx->hbrc_hblock, xhdr);
+        r = qdec_process_header(dec, read_ctx, xhdr);
         if (r == 0)
             dec->qpd_bytes_out += bytes_out;
         ++read_ctx->hbrc_header_count;
@@ -3432,10 +5268,11 @@ struct huff_decode_retval
 
 
 #if LS_QPACK_USE_LARGE_TABLES
-static struct huff_decode_retval
+STATIC struct huff_decode_retval
 huff_decode_fast (const unsigned char *src, int src_len,
             unsigned char *dst, int dst_len,
-            struct lsqpack_huff_decode_state *state, int final);
+            struct lsqpack_huff_decode_state *state, int final,
+            unsigned *n_src_full);
 #else
 #define lsqpack_huff_decode_full lsqpack_huff_decode
 #endif
@@ -3517,17 +5354,17 @@ lsqpack_huff_decode_full (const unsigned char *src, int src_len,
 }
 
 
-#if LS_QPACK_USE_LARGE_TABLES
-#if !LSQPACK_DEVEL_MODE
-static
-#endif
+#if LS_QPACK_USE_LARGE_TABLES && LSQPACK_DEVEL_MODE
 struct huff_decode_retval
 lsqpack_huff_decode (const unsigned char *src, int src_len,
             unsigned char *dst, int dst_len,
             struct lsqpack_huff_decode_state *state, int final)
 {
+    unsigned n_src_full;
+
     if (state->resume == 0 && final)
-        return huff_decode_fast(src, src_len, dst, dst_len, state, final);
+        return huff_decode_fast(src, src_len, dst, dst_len, state, final,
+                                                                &n_src_full);
     else
         return lsqpack_huff_decode_full(src, src_len, dst, dst_len, state,
                                                                     final);
@@ -3535,6 +5372,48 @@ lsqpack_huff_decode (const unsigned char *src, int src_len,
 #endif
 
 
+/* Same as lsqpack_huff_decode(), counting input bytes by the decoder that
+ * processed them.
+ */
+static struct huff_decode_retval
+qdec_huff_decode (struct lsqpack_dec *dec, const unsigned char *src,
+            int src_len, unsigned char *dst, int dst_len,
+            struct lsqpack_huff_decode_state *state, int final)
+{
+    struct huff_decode_retval rv;
+    uint64_t start;
+#if LS_QPACK_USE_LARGE_TABLES
+    unsigned n_src_full;
+#endif
+
+    start = prof_now();
+#if LS_QPACK_USE_LARGE_TABLES
+    if (state->resume == 0 && final)
+    {
+        n_src_full = 0;
+        rv = huff_decode_fast(src, src_len, dst, dst_len, state, final,
+                                                                &n_src_full);
+        if (rv.status != HUFF_DEC_ERROR)
+        {
+            dec->qpd_stats.ds_huff_fast_bytes += rv.n_src - n_src_full;
+            dec->qpd_stats.ds_huff_full_bytes += n_src_full;
+            dec->qpd_stats.ds_work += rv.n_dst;
+        }
+        prof_record(dec->qpd_prof, LSQPACK_PROF_DEC_HUFFMAN, start);
+        return rv;
+    }
+#endif
+    rv = lsqpack_huff_decode_full(src, src_len, dst, dst_len, state, final);
+    if (rv.status != HUFF_DEC_ERROR)
+    {
+        dec->qpd_stats.ds_huff_full_bytes += rv.n_src;
+        dec->qpd_stats.ds_work += rv.n_dst;
+    }
+    prof_record(dec->qpd_prof, LSQPACK_PROF_DEC_HUFFMAN, start);
+    return rv;
+}
+
+
 static void
 check_dyn_table_errors (struct header_block_read_ctx *read_ctx,
                                                         lsqpack_abs_id_t id)
@@ -3715,7 +5594,7 @@ parse_header_data (struct lsqpack_dec *dec,
             if (size == 0)
                 RETURN_ERROR();
             dst = get_dst(dec, read_ctx, &dst_size);
-            hdr = lsqpack_huff_decode(buf, (int)size, dst, (int)dst_size,
+            hdr = qdec_huff_decode(dec, buf, (int)size, dst, (int)dst_size,
                     &DATA.dec_huff_state, DATA.left == size);
             buf += hdr.n_src;
             DATA.left -= hdr.n_src;
@@ -3792,7 +5671,7 @@ parse_header_data (struct lsqpack_dec *dec,
             if (size == 0)
                 RETURN_ERROR();
             dst = get_dst(dec, read_ctx, &dst_size);
-            hdr = lsqpack_huff_decode(buf, (int)size, dst, (int)dst_size,
+            hdr = qdec_huff_decode(dec, buf, (int)size, dst, (int)dst_size,
                     &DATA.dec_huff_state, DATA.left == size);
             buf += hdr.n_src;
             DATA.left -= hdr.n_src;
@@ -4078,36 +5957,111 @@ qdec_read_header_block (struct hbrc_buf *hbrc_buf,
 }
 
 
-static enum lsqpack_read_header_status
-qdec_read_header (struct lsqpack_dec *dec,
-                                    struct header_block_read_ctx *read_ctx)
+static enum lsqpack_read_header_status
+qdec_read_header (struct lsqpack_dec *dec,
+                                    struct header_block_read_ctx *read_ctx)
+{
+    const unsigned char *buf;
+    enum lsqpack_read_header_status st;
+    size_t n_to_read;
+    size_t buf_sz;
+
+    while (read_ctx->hbrc_size > 0)
+    {
+        n_to_read = max_to_read(read_ctx);
+        buf_sz = qdec_read_header_block(&read_ctx->hbrc_buf, &buf, n_to_read);
+        if (buf_sz > 0)
+        {
+            read_ctx->hbrc_size -= buf_sz;
+            dec->qpd_stats.ds_work += buf_sz;
+            st = read_ctx->hbrc_parse(dec, read_ctx, buf, buf_sz);
+            if (st == LQRHS_NEED)
+            {
+                if (read_ctx->hbrc_size == 0)
+                    return LQRHS_ERROR;
+            }
+            else
+                return st;
+        }
+        else
+            return LQRHS_NEED;
+    }
+
+    return LQRHS_DONE;
+}
+
+
+static void
+qdec_blocked_set (struct lsqpack_dec *dec, unsigned idx,
+                        struct header_block_read_ctx *read_ctx)
+{
+    dec->qpd_blocked_headers[idx] = read_ctx;
+    read_ctx->hbrc_blocked_idx = idx;
+}
+
+
+static void
+qdec_blocked_sift_up (struct lsqpack_dec *dec, unsigned idx)
+{
+    struct header_block_read_ctx *const read_ctx
+                                        = dec->qpd_blocked_headers[idx];
+    unsigned parent;
+
+    while (idx > 0)
+    {
+        parent = (idx - 1) / 2;
+        if (dec->qpd_blocked_headers[parent]->hbrc_ric <= read_ctx->hbrc_ric)
+            break;
+        ++dec->qpd_stats.ds_work;
+        qdec_blocked_set(dec, idx, dec->qpd_blocked_headers[parent]);
+        idx = parent;
+    }
+    qdec_blocked_set(dec, idx, read_ctx);
+}
+
+
+static void
+qdec_blocked_sift_down (struct lsqpack_dec *dec, unsigned idx)
+{
+    struct header_block_read_ctx *const read_ctx
+                                        = dec->qpd_blocked_headers[idx];
+    unsigned child;
+
+    while ((child = idx * 2 + 1) < dec->qpd_n_blocked)
+    {
+        if (child + 1 < dec->qpd_n_blocked
+                && dec->qpd_blocked_headers[child + 1]->hbrc_ric
+                                < dec->qpd_blocked_headers[child]->hbrc_ric)
+            ++child;
+        if (read_ctx->hbrc_ric <= dec->qpd_blocked_headers[child]->hbrc_ric)
+            break;
+        ++dec->qpd_stats.ds_work;
+        qdec_blocked_set(dec, idx, dec->qpd_blocked_headers[child]);
+        idx = child;
+    }
+    qdec_blocked_set(dec, idx, read_ctx);
+}
+
+
+static void
+qdec_blocked_remove (struct lsqpack_dec *dec,
+                        struct header_block_read_ctx *read_ctx)
 {
-    const unsigned char *buf;
-    enum lsqpack_read_header_status st;
-    size_t n_to_read;
-    size_t buf_sz;
+    struct header_block_read_ctx *last;
+    unsigned idx;
 
-    while (read_ctx->hbrc_size > 0)
+    assert(read_ctx->hbrc_flags & HBRC_BLOCKED);
+    assert(dec->qpd_blocked_headers[read_ctx->hbrc_blocked_idx] == read_ctx);
+    idx = read_ctx->hbrc_blocked_idx;
+    read_ctx->hbrc_flags &= ~HBRC_BLOCKED;
+    --dec->qpd_n_blocked;
+    if (idx < dec->qpd_n_blocked)
     {
-        n_to_read = max_to_read(read_ctx);
-        buf_sz = qdec_read_header_block(&read_ctx->hbrc_buf, &buf, n_to_read);
-        if (buf_sz > 0)
-        {
-            read_ctx->hbrc_size -= buf_sz;
-            st = read_ctx->hbrc_parse(dec, read_ctx, buf, buf_sz);
-            if (st == LQRHS_NEED)
-            {
-                if (read_ctx->hbrc_size == 0)
-                    return LQRHS_ERROR;
-            }
-            else
-                return st;
-        }
-        else
-            return LQRHS_NEED;
+        last = dec->qpd_blocked_headers[dec->qpd_n_blocked];
+        qdec_blocked_set(dec, idx, last);
+        qdec_blocked_sift_up(dec, idx);
+        qdec_blocked_sift_down(dec, last->hbrc_blocked_idx);
     }
-
-    return LQRHS_DONE;
 }
 
 
@@ -4115,16 +6069,15 @@ static void
 destroy_header_block_read_ctx (struct lsqpack_dec *dec,
                         struct header_block_read_ctx *read_ctx)
 {
-    lsqpack_abs_id_t id;
-
     TAILQ_REMOVE(&dec->qpd_hbrcs, read_ctx, hbrc_next_all);
     if (read_ctx->hbrc_flags & HBRC_BLOCKED)
-    {
-        id = read_ctx->hbrc_largest_ref & ((1 << LSQPACK_DEC_BLOCKED_BITS) - 1);
-        TAILQ_REMOVE(&dec->qpd_blocked_headers[id], read_ctx, hbrc_next_blocked);
-        --dec->qpd_n_blocked;
-    }
-    free(read_ctx);
+        qdec_blocked_remove(dec, read_ctx);
+    if (read_ctx->hbrc_flags & HBRC_UNBLOCKED)
+        TAILQ_REMOVE(&dec->qpd_unblocked, read_ctx, hbrc_next_unblocked);
+    if (dec->qpd_opts & LSQPACK_DEC_OPT_HBLOCK_STORAGE)
+        read_ctx->hbrc_flags = 0;
+    else
+        free(read_ctx);
 }
 
 
@@ -4141,14 +6094,41 @@ static int
 stash_blocked_header (struct lsqpack_dec *dec,
                         struct header_block_read_ctx *read_ctx)
 {
-    lsqpack_abs_id_t id;
+    struct header_block_read_ctx **heap;
+    unsigned nalloc;
 
     if (dec->qpd_n_blocked < dec->qpd_max_risked_streams)
     {
-        id = read_ctx->hbrc_largest_ref & ((1 << LSQPACK_DEC_BLOCKED_BITS) - 1);
-        TAILQ_INSERT_TAIL(&dec->qpd_blocked_headers[id], read_ctx, hbrc_next_blocked);
-        ++dec->qpd_n_blocked;
+        if (dec->qpd_n_blocked >= dec->qpd_blocked_nalloc)
+        {
+            if (dec->qpd_blocked_nalloc)
+                nalloc = dec->qpd_blocked_nalloc * 2;
+            else
+                nalloc = 8;
+            if (nalloc > dec->qpd_max_risked_streams)
+                nalloc = dec->qpd_max_risked_streams;
+            heap = realloc(dec->qpd_blocked_headers, sizeof(heap[0]) * nalloc);
+            if (!heap)
+            {
+                D_WARN("cannot allocate blocked headers heap of %u elements",
+                                                                    nalloc);
+                return -1;
+            }
+            dec->qpd_blocked_headers = heap;
+            dec->qpd_blocked_nalloc = nalloc;
+        }
+        /* The reference is in the future, see qdec_in_future() */
+        read_ctx->hbrc_ric = dec->qpd_ins_count
+                    + ID_MINUS(read_ctx->hbrc_largest_ref, dec->qpd_last_id);
+        read_ctx->hbrc_blocked_ins = dec->qpd_ins_count;
+        read_ctx->hbrc_blocked_off = dec->qpd_stats.ds_enc_bytes;
         read_ctx->hbrc_flags |= HBRC_BLOCKED;
+        qdec_blocked_set(dec, dec->qpd_n_blocked++, read_ctx);
+        qdec_blocked_sift_up(dec, read_ctx->hbrc_blocked_idx);
+        ++dec->qpd_stats.ds_blocked_total;
+        if (dec->qpd_n_blocked > dec->qpd_stats.ds_blocked_peak)
+            dec->qpd_stats.ds_blocked_peak = dec->qpd_n_blocked;
+        PROBE3(dec_block, dec, read_ctx->hbrc_stream_id, read_ctx->hbrc_ric);
         return 0;
     }
     else
@@ -4165,19 +6145,73 @@ find_header_block_read_ctx (struct lsqpack_dec *dec, void *hblock)
 {
     struct header_block_read_ctx *read_ctx;
 
+    if (dec->qpd_opts & LSQPACK_DEC_OPT_HBLOCK_STORAGE)
+    {
+        read_ctx = hblock;
+        if (read_ctx && (read_ctx->hbrc_flags & HBRC_ON_LIST))
+            return read_ctx;
+        else
+            return NULL;
+    }
+
     TAILQ_FOREACH(read_ctx, &dec->qpd_hbrcs, hbrc_next_all)
+    {
+        ++dec->qpd_stats.ds_work;
         if (read_ctx->hbrc_hblock == hblock)
             return read_ctx;
+    }
 
     return NULL;
 }
 
 
+static int
+qdec_queue_inst (struct lsqpack_dec *dec, const unsigned char *buf, size_t sz)
+{
+    unsigned char *new_buf;
+    size_t nalloc;
+
+    if (dec->qpd_out.sz + sz > dec->qpd_out.nalloc)
+    {
+        nalloc = dec->qpd_out.nalloc ? dec->qpd_out.nalloc * 2 : 64;
+        while (nalloc < dec->qpd_out.sz + sz)
+            nalloc *= 2;
+        new_buf = realloc(dec->qpd_out.buf, nalloc);
+        if (!new_buf)
+        {
+            D_WARN("cannot allocate decoder stream queue of %zu bytes",
+                                                                    nalloc);
+            return -1;
+        }
+        dec->qpd_out.buf = new_buf;
+        dec->qpd_out.nalloc = nalloc;
+    }
+
+    memcpy(dec->qpd_out.buf + dec->qpd_out.sz, buf, sz);
+    dec->qpd_out.sz += sz;
+    ++dec->qpd_out.n_insts;
+    dec->qpd_bytes_in += (unsigned) sz;
+    D_DEBUG("queued %zu-byte decoder stream instruction; queue size: %zu "
+        "bytes in %u instructions", sz, dec->qpd_out.sz, dec->qpd_out.n_insts);
+    return 0;
+}
+
+
 static int
 qdec_try_writing_header_ack (struct lsqpack_dec *dec, uint64_t stream_id,
                        unsigned char *dec_buf, size_t *dec_buf_sz)
 {
     unsigned char *p = dec_buf;
+    unsigned char inst[LSQPACK_UINT64_ENC_SZ];
+
+    if (dec->qpd_opts & LSQPACK_DEC_OPT_QUEUE_DEC_STREAM)
+    {
+        if (dec_buf_sz)
+            *dec_buf_sz = 0;
+        inst[0] = 0x80;
+        p = lsqpack_enc_int(inst, inst + sizeof(inst), stream_id, 7);
+        return qdec_queue_inst(dec, inst, p - inst);
+    }
 
     if (*dec_buf_sz > 0)
     {
@@ -4222,7 +6256,8 @@ qdec_header_process (struct lsqpack_dec *dec,
     case LQRHS_DONE:
         update_ema(&dec->qpd_hlist_size_ema, read_ctx->hbrc_header_count);
         if ((read_ctx->hbrc_flags & HBRC_LARGEST_REF_SET)
-                                                    && dec_buf && dec_buf_sz)
+                && ((dec_buf && dec_buf_sz)
+                    || (dec->qpd_opts & LSQPACK_DEC_OPT_QUEUE_DEC_STREAM)))
         {
             if (0 == qdec_try_writing_header_ack(dec, read_ctx->hbrc_stream_id,
                                                         dec_buf, dec_buf_sz))
@@ -4248,10 +6283,15 @@ qdec_header_process (struct lsqpack_dec *dec,
         }
         D_DEBUG("header block for stream %"PRIu64" is done",
                                                     read_ctx->hbrc_stream_id);
+        PROBE3(dec_header_end, dec, read_ctx->hbrc_stream_id,
+                                                read_ctx->hbrc_header_count);
         break;
     case LQRHS_NEED:
     case LQRHS_BLOCKED:
-        if (!(read_ctx->hbrc_flags & HBRC_ON_LIST))
+        if (!(read_ctx->hbrc_flags & HBRC_ON_LIST)
+                && (dec->qpd_opts & LSQPACK_DEC_OPT_HBLOCK_STORAGE))
+            qdec_insert_header_block(dec, read_ctx);
+        else if (!(read_ctx->hbrc_flags & HBRC_ON_LIST))
         {
             read_ctx_copy = malloc(sizeof(*read_ctx_copy));
             if (!read_ctx_copy)
@@ -4292,8 +6332,8 @@ qdec_header_process (struct lsqpack_dec *dec,
 }
 
 
-enum lsqpack_read_header_status
-lsqpack_dec_header_read (struct lsqpack_dec *dec, void *hblock,
+static enum lsqpack_read_header_status
+qdec_header_read (struct lsqpack_dec *dec, void *hblock,
     const unsigned char **buf, size_t bufsz,
     unsigned char *dec_buf, size_t *dec_buf_sz)
 {
@@ -4304,6 +6344,12 @@ lsqpack_dec_header_read (struct lsqpack_dec *dec, void *hblock,
     {
         D_DEBUG("continue reading header block for stream %"PRIu64,
                                                     read_ctx->hbrc_stream_id);
+        /* The caller need not wait for lsqpack_dec_next_unblocked() */
+        if (read_ctx->hbrc_flags & HBRC_UNBLOCKED)
+        {
+            TAILQ_REMOVE(&dec->qpd_unblocked, read_ctx, hbrc_next_unblocked);
+            read_ctx->hbrc_flags &= ~HBRC_UNBLOCKED;
+        }
         return qdec_header_process(dec, read_ctx, buf, bufsz,
                                    dec_buf, dec_buf_sz);
     }
@@ -4315,8 +6361,8 @@ lsqpack_dec_header_read (struct lsqpack_dec *dec, void *hblock,
 }
 
 
-enum lsqpack_read_header_status
-lsqpack_dec_header_in (struct lsqpack_dec *dec, void *hblock,
+static enum lsqpack_read_header_status
+qdec_header_in (struct lsqpack_dec *dec, void *hblock,
             uint64_t stream_id, size_t header_size, const unsigned char **buf,
             size_t bufsz, unsigned char *dec_buf, size_t *dec_buf_sz)
 {
@@ -4342,11 +6388,82 @@ lsqpack_dec_header_in (struct lsqpack_dec *dec, void *hblock,
     };
 
     D_DEBUG("begin reading header block for stream %"PRIu64, stream_id);
+    PROBE3(dec_header_start, dec, stream_id, header_size);
+    if (dec->qpd_opts & LSQPACK_DEC_OPT_HBLOCK_STORAGE)
+    {
+        /* Build state in place: there is nothing to copy if the header
+         * block cannot be decoded in one go.
+         */
+        if (((struct header_block_read_ctx *) hblock)->hbrc_flags
+                                                            & HBRC_ON_LIST)
+        {
+            D_INFO("header block for stream %"PRIu64" is already in "
+                                                    "progress", stream_id);
+            return LQRHS_ERROR;
+        }
+        memcpy(hblock, &read_ctx, sizeof(read_ctx));
+        return qdec_header_process(dec, hblock, buf, bufsz,
+                                   dec_buf, dec_buf_sz);
+    }
     return qdec_header_process(dec, &read_ctx, buf, bufsz,
                                dec_buf, dec_buf_sz);
 }
 
 
+enum lsqpack_read_header_status
+lsqpack_dec_header_in (struct lsqpack_dec *dec, void *hblock,
+            uint64_t stream_id, size_t header_size, const unsigned char **buf,
+            size_t bufsz, unsigned char *dec_buf, size_t *dec_buf_sz)
+{
+    enum lsqpack_read_header_status st;
+    const unsigned char *const begin = *buf;
+    uint64_t start, time;
+
+    time = dec->qpd_capture ? cap_now() : 0;
+    start = prof_now();
+    st = qdec_header_in(dec, hblock, stream_id, header_size, buf, bufsz,
+                                                        dec_buf, dec_buf_sz);
+    prof_record(dec->qpd_prof, LSQPACK_PROF_DEC_HEADER_IN, start);
+    if (dec->qpd_capture)
+        cap_dec_header(dec->qpd_capture, LSQPACK_CAP_DEC_HEADER_IN, time,
+                    stream_id, header_size, begin,
+                    st == LQRHS_ERROR ? bufsz : (size_t) (*buf - begin), st);
+    return st;
+}
+
+
+enum lsqpack_read_header_status
+lsqpack_dec_header_read (struct lsqpack_dec *dec, void *hblock,
+    const unsigned char **buf, size_t bufsz,
+    unsigned char *dec_buf, size_t *dec_buf_sz)
+{
+    enum lsqpack_read_header_status st;
+    const struct header_block_read_ctx *read_ctx;
+    const unsigned char *const begin = *buf;
+    uint64_t start, time, stream_id;
+
+    /* Read context is gone once the header block is done */
+    read_ctx = NULL;
+    stream_id = 0;
+    time = 0;
+    if (dec->qpd_capture)
+    {
+        time = cap_now();
+        read_ctx = find_header_block_read_ctx(dec, hblock);
+        if (read_ctx)
+            stream_id = read_ctx->hbrc_stream_id;
+    }
+    start = prof_now();
+    st = qdec_header_read(dec, hblock, buf, bufsz, dec_buf, dec_buf_sz);
+    prof_record(dec->qpd_prof, LSQPACK_PROF_DEC_HEADER_READ, start);
+    if (read_ctx)
+        cap_dec_header(dec->qpd_capture, LSQPACK_CAP_DEC_HEADER_READ, time,
+                    stream_id, 0, begin,
+                    st == LQRHS_ERROR ? bufsz : (size_t) (*buf - begin), st);
+    return st;
+}
+
+
 static void
 qdec_drop_oldest_entry (struct lsqpack_dec *dec)
 {
@@ -4354,6 +6471,7 @@ qdec_drop_oldest_entry (struct lsqpack_dec *dec)
 
     entry = ringbuf_advance_tail(&dec->qpd_dyn_table);
     dec->qpd_cur_capacity -= DTE_SIZE(entry);
+    PROBE2(dec_evict, dec, DTE_SIZE(entry));
     qdec_decref_entry(entry);
 }
 
@@ -4364,6 +6482,7 @@ qdec_remove_overflow_entries (struct lsqpack_dec *dec)
     while (dec->qpd_cur_capacity > dec->qpd_cur_max_capacity)
     {
         D_DEBUG("capacity %u, drop entry", dec->qpd_cur_capacity);
+        ++dec->qpd_stats.ds_work;
         qdec_drop_oldest_entry(dec);
     }
 }
@@ -4377,28 +6496,57 @@ qdec_update_max_capacity (struct lsqpack_dec *dec, unsigned new_capacity)
 }
 
 
+/* Called once per encoder stream chunk: unblock header blocks in order of
+ * their Required Insert Count.
+ */
 static void
 qdec_process_blocked_headers (struct lsqpack_dec *dec)
 {
-    struct header_block_read_ctx *read_ctx, *next;
-    lsqpack_abs_id_t id;
-
-    id = dec->qpd_last_id & ((1 << LSQPACK_DEC_BLOCKED_BITS) - 1);
-    for (read_ctx = TAILQ_FIRST(&dec->qpd_blocked_headers[id]); read_ctx;
-                                                            read_ctx = next)
-    {
-        next = TAILQ_NEXT(read_ctx, hbrc_next_blocked);
-        if (read_ctx->hbrc_largest_ref == dec->qpd_last_id)
+    struct header_block_read_ctx *read_ctx;
+    uint64_t waited;
+
+    while (dec->qpd_n_blocked > 0
+            && dec->qpd_blocked_headers[0]->hbrc_ric <= dec->qpd_ins_count)
+    {
+        read_ctx = dec->qpd_blocked_headers[0];
+        qdec_blocked_remove(dec, read_ctx);
+        ++dec->qpd_stats.ds_unblocked;
+        ++dec->qpd_stats.ds_work;
+        dec->qpd_stats.ds_unblock_inserts
+                        += read_ctx->hbrc_ric - read_ctx->hbrc_blocked_ins;
+        waited = dec->qpd_stats.ds_enc_bytes - read_ctx->hbrc_blocked_off;
+        dec->qpd_stats.ds_unblock_bytes += waited;
+        if (waited > dec->qpd_stats.ds_unblock_bytes_max)
+            dec->qpd_stats.ds_unblock_bytes_max = waited;
+        PROBE3(dec_unblock, dec, read_ctx->hbrc_stream_id, waited);
+        D_DEBUG("header block for stream %"PRIu64" has become unblocked",
+            read_ctx->hbrc_stream_id);
+        if (dec->qpd_opts & LSQPACK_DEC_OPT_DEFER_UNBLOCKED)
         {
-            read_ctx->hbrc_flags &= ~HBRC_BLOCKED;
-            TAILQ_REMOVE(&dec->qpd_blocked_headers[id], read_ctx,
-                                                            hbrc_next_blocked);
-            --dec->qpd_n_blocked;
-            D_DEBUG("header block for stream %"PRIu64" has become unblocked",
-                read_ctx->hbrc_stream_id);
-            dec->qpd_dh_if->dhi_unblocked(read_ctx->hbrc_hblock);
+            TAILQ_INSERT_TAIL(&dec->qpd_unblocked, read_ctx,
+                                                        hbrc_next_unblocked);
+            read_ctx->hbrc_flags |= HBRC_UNBLOCKED;
         }
+        else
+            dec->qpd_dh_if->dhi_unblocked(read_ctx->hbrc_hblock);
+    }
+}
+
+
+void *
+lsqpack_dec_next_unblocked (struct lsqpack_dec *dec)
+{
+    struct header_block_read_ctx *read_ctx;
+
+    read_ctx = TAILQ_FIRST(&dec->qpd_unblocked);
+    if (read_ctx)
+    {
+        TAILQ_REMOVE(&dec->qpd_unblocked, read_ctx, hbrc_next_unblocked);
+        read_ctx->hbrc_flags &= ~HBRC_UNBLOCKED;
+        return read_ctx->hbrc_hblock;
     }
+    else
+        return NULL;
 }
 
 
@@ -4440,6 +6588,72 @@ lsqpack_dec_write_ici (struct lsqpack_dec *dec, unsigned char *buf, size_t sz)
 }
 
 
+void
+lsqpack_dec_set_flush_policy (struct lsqpack_dec *dec,
+                    enum lsqpack_dec_flush_policy policy, unsigned max_insts)
+{
+    dec->qpd_out.policy = policy;
+    dec->qpd_out.max_insts = max_insts;
+    D_DEBUG("set flush policy to 0x%X, max instructions: %u",
+                                                    policy, max_insts);
+}
+
+
+int
+lsqpack_dec_flush_ready (const struct lsqpack_dec *dec)
+{
+    return ((dec->qpd_out.policy & LSQPACK_DEC_FLUSH_COUNT)
+                    && dec->qpd_out.n_insts > 0
+                    && dec->qpd_out.n_insts >= dec->qpd_out.max_insts)
+        || ((dec->qpd_out.policy & LSQPACK_DEC_FLUSH_ICI)
+                    && lsqpack_dec_ici_pending(dec));
+}
+
+
+size_t
+lsqpack_dec_flush_size (const struct lsqpack_dec *dec)
+{
+    return dec->qpd_out.sz
+                    + (lsqpack_dec_ici_pending(dec) ? LSQPACK_LONGEST_ICI : 0);
+}
+
+
+ssize_t
+lsqpack_dec_flush (struct lsqpack_dec *dec, unsigned char *buf, size_t sz)
+{
+    unsigned char ici[LSQPACK_LONGEST_ICI];
+    unsigned char *p;
+    unsigned count;
+    size_t n;
+
+    /* Section Acknowledgements have already advanced qpd_largest_known_id:
+     * ICI only covers what they do not.
+     */
+    if (lsqpack_dec_ici_pending(dec))
+    {
+        count = ID_MINUS(dec->qpd_last_id, dec->qpd_largest_known_id);
+        ici[0] = 0;
+        p = lsqpack_enc_int(ici, ici + sizeof(ici), count, 6);
+        if (0 != qdec_queue_inst(dec, ici, p - ici))
+            return -1;
+        D_DEBUG("queued ICI: count=%u", count);
+        dec->qpd_largest_known_id = dec->qpd_last_id;
+    }
+
+    n = MIN(sz, dec->qpd_out.sz);
+    memcpy(buf, dec->qpd_out.buf, n);
+    dec->qpd_out.sz -= n;
+    /* Instructions stay counted until all of their bytes are handed out */
+    if (dec->qpd_out.sz)
+        memmove(dec->qpd_out.buf, dec->qpd_out.buf + n, dec->qpd_out.sz);
+    else
+        dec->qpd_out.n_insts = 0;
+    D_DEBUG("flushed %zu bytes of decoder stream; %zu bytes left", n,
+                                                        dec->qpd_out.sz);
+    return (ssize_t) n;
+}
+
+
 int
 lsqpack_dec_unref_stream (struct lsqpack_dec *dec, void *hblock)
 {
@@ -4450,6 +6664,9 @@ lsqpack_dec_unref_stream (struct lsqpack_dec *dec, void *hblock)
     {
         D_DEBUG("unreffed header block for stream %"PRIu64,
                                                     read_ctx->hbrc_stream_id);
+        if (dec->qpd_capture)
+            cap_dec_stream(dec->qpd_capture, LSQPACK_CAP_DEC_UNREF,
+                                                    read_ctx->hbrc_stream_id);
         destroy_header_block_read_ctx(dec, read_ctx);
         return 0;
     }
@@ -4461,6 +6678,18 @@ lsqpack_dec_unref_stream (struct lsqpack_dec *dec, void *hblock)
 }
 
 
+static int
+qdec_queue_cancel (struct lsqpack_dec *dec, uint64_t stream_id)
+{
+    unsigned char inst[LSQPACK_UINT64_ENC_SZ];
+    unsigned char *p;
+
+    inst[0] = 0x40;
+    p = lsqpack_enc_int(inst, inst + sizeof(inst), stream_id, 6);
+    return qdec_queue_inst(dec, inst, p - inst);
+}
+
+
 ssize_t
 lsqpack_dec_cancel_stream (struct lsqpack_dec *dec, void *hblock,
                                         unsigned char *buf, size_t buf_sz)
@@ -4475,6 +6704,18 @@ lsqpack_dec_cancel_stream (struct lsqpack_dec *dec, void *hblock,
         return 0;
     }
 
+    if (dec->qpd_opts & LSQPACK_DEC_OPT_QUEUE_DEC_STREAM)
+    {
+        if (0 != qdec_queue_cancel(dec, read_ctx->hbrc_stream_id))
+            return -1;
+        D_DEBUG("cancelled stream %"PRIu64, read_ctx->hbrc_stream_id);
+        if (dec->qpd_capture)
+            cap_dec_stream(dec->qpd_capture, LSQPACK_CAP_DEC_CANCEL,
+                                                    read_ctx->hbrc_stream_id);
+        destroy_header_block_read_ctx(dec, read_ctx);
+        return 0;
+    }
+
     if (buf_sz == 0)
         return -1;
 
@@ -4484,6 +6725,9 @@ lsqpack_dec_cancel_stream (struct lsqpack_dec *dec, void *hblock,
     {
         D_DEBUG("cancelled stream %"PRIu64"; generate instruction of %u bytes",
             read_ctx->hbrc_stream_id, (unsigned) (p - buf));
+        if (dec->qpd_capture)
+            cap_dec_stream(dec->qpd_capture, LSQPACK_CAP_DEC_CANCEL,
+                                                    read_ctx->hbrc_stream_id);
         destroy_header_block_read_ctx(dec, read_ctx);
         dec->qpd_bytes_in += (unsigned)(p - buf);
         return p - buf;
@@ -4509,6 +6753,9 @@ lsqpack_dec_cancel_stream_id (struct lsqpack_dec *dec, uint64_t stream_id,
     if (dec->qpd_max_capacity == 0)
         return 0;
 
+    if (dec->qpd_opts & LSQPACK_DEC_OPT_QUEUE_DEC_STREAM)
+        return qdec_queue_cancel(dec, stream_id);
+
     if (buf_sz == 0)
         return -1;
 
@@ -4534,6 +6781,8 @@ static int
 lsqpack_dec_push_entry (struct lsqpack_dec *dec,
                                         struct lsqpack_dec_table_entry *entry)
 {
+    if (ringbuf_full(&dec->qpd_dyn_table))
+        dec->qpd_stats.ds_work += ringbuf_count(&dec->qpd_dyn_table);
     if (0 == ringbuf_add(&dec->qpd_dyn_table, entry))
     {
         dec->qpd_cur_capacity += DTE_SIZE(entry);
@@ -4542,8 +6791,9 @@ lsqpack_dec_push_entry (struct lsqpack_dec *dec,
                                 (int) entry->dte_val_len, DTE_VALUE(entry),
                                 dec->qpd_cur_capacity);
         dec->qpd_last_id = ID_PLUS(dec->qpd_last_id, 1);
+        ++dec->qpd_ins_count;
+        PROBE3(dec_insert, dec, dec->qpd_ins_count, DTE_SIZE(entry));
         qdec_remove_overflow_entries(dec);
-        qdec_process_blocked_headers(dec);
         if (dec->qpd_cur_capacity <= dec->qpd_cur_max_capacity)
             return 0;
     }
@@ -4552,9 +6802,8 @@ lsqpack_dec_push_entry (struct lsqpack_dec *dec,
 }
 
 
-int
-lsqpack_dec_enc_in (struct lsqpack_dec *dec, const unsigned char *buf,
-                                                                size_t buf_sz)
+static int
+qdec_enc_in (struct lsqpack_dec *dec, const unsigned char *buf, size_t buf_sz)
 {
     const unsigned char *const end = buf + buf_sz;
     struct lsqpack_dec_table_entry *entry, *new_entry;
@@ -4565,6 +6814,7 @@ lsqpack_dec_enc_in (struct lsqpack_dec *dec, const unsigned char *buf,
 
     D_DEBUG("got %zu bytes of encoder stream", buf_sz);
     dec->qpd_bytes_in += (unsigned)buf_sz;
+    dec->qpd_stats.ds_work += buf_sz;
 
 #define WINR dec->qpd_enc_state.ctx_u.with_namref
 #define WONR dec->qpd_enc_state.ctx_u.wo_namref
@@ -4711,7 +6961,7 @@ lsqpack_dec_enc_in (struct lsqpack_dec *dec, const unsigned char *buf,
             break;
         case DEI_WINR_READ_VALUE_HUFFMAN:
             size = MIN((unsigned) (end - buf), WINR.val_len - WINR.nread);
-            hdr = lsqpack_huff_decode(buf, (int)size,
+            hdr = qdec_huff_decode(dec, buf, (int)size,
                     (unsigned char *) DTE_VALUE(WINR.entry) + WINR.val_off,
                     WINR.alloced_val_len - WINR.val_off,
                     &WINR.dec_huff_state, WINR.nread + size == WINR.val_len);
@@ -4730,6 +6980,7 @@ lsqpack_dec_enc_in (struct lsqpack_dec *dec, const unsigned char *buf,
                 r = lsqpack_dec_push_entry(dec, WINR.entry);
                 if (0 == r)
                 {
+                    ++dec->qpd_stats.ds_ins_winr;
                     dec->qpd_enc_state.resume = 0;
                     WINR.entry = NULL;
                     break;
@@ -4777,6 +7028,7 @@ lsqpack_dec_enc_in (struct lsqpack_dec *dec, const unsigned char *buf,
                 r = lsqpack_dec_push_entry(dec, WINR.entry);
                 if (0 == r)
                 {
+                    ++dec->qpd_stats.ds_ins_winr;
                     dec->qpd_enc_state.resume = 0;
                     WINR.entry = NULL;
                     break;
@@ -4821,7 +7073,7 @@ lsqpack_dec_enc_in (struct lsqpack_dec *dec, const unsigned char *buf,
                 return -1;
         case DEI_WONR_READ_NAME_HUFFMAN:
             size = MIN((unsigned) (end - buf), WONR.str_len - WONR.nread);
-            hdr = lsqpack_huff_decode(buf, (int)size,
+            hdr = qdec_huff_decode(dec, buf, (int)size,
                     (unsigned char *) DTE_NAME(WONR.entry) + WONR.str_off,
                     (int)(WONR.alloced_len - WONR.str_off),
                     &WONR.dec_huff_state, WONR.nread + size == WONR.str_len);
@@ -4905,7 +7157,7 @@ lsqpack_dec_enc_in (struct lsqpack_dec *dec, const unsigned char *buf,
             break;
         case DEI_WONR_READ_VALUE_HUFFMAN:
             size = MIN((unsigned) (end - buf), WONR.str_len - WONR.nread);
-            hdr = lsqpack_huff_decode(buf, (int)size,
+            hdr = qdec_huff_decode(dec, buf, (int)size,
                     (unsigned char *) DTE_VALUE(WONR.entry) + WONR.str_off,
                     WONR.alloced_len - WONR.entry->dte_name_len - WONR.str_off,
                     &WONR.dec_huff_state, WONR.nread + size == WONR.str_len);
@@ -4918,6 +7170,7 @@ lsqpack_dec_enc_in (struct lsqpack_dec *dec, const unsigned char *buf,
                 r = lsqpack_dec_push_entry(dec, WONR.entry);
                 if (0 == r)
                 {
+                    ++dec->qpd_stats.ds_ins_wonr;
                     dec->qpd_enc_state.resume = 0;
                     WONR.entry = NULL;
                     break;
@@ -4969,6 +7222,7 @@ lsqpack_dec_enc_in (struct lsqpack_dec *dec, const unsigned char *buf,
                 r = lsqpack_dec_push_entry(dec, WONR.entry);
                 if (0 == r)
                 {
+                    ++dec->qpd_stats.ds_ins_wonr;
                     dec->qpd_enc_state.resume = 0;
                     WONR.entry = NULL;
                     break;
@@ -4993,9 +7247,11 @@ lsqpack_dec_enc_in (struct lsqpack_dec *dec, const unsigned char *buf,
                 if (!new_entry)
                     return -1;
                 memcpy(new_entry, entry, size);
+                dec->qpd_stats.ds_work += size;
                 new_entry->dte_refcnt = 1;
                 if (0 == lsqpack_dec_push_entry(dec, new_entry))
                 {
+                    ++dec->qpd_stats.ds_ins_dup;
                     dec->qpd_enc_state.resume = 0;
                     break;
                 }
@@ -5040,6 +7296,59 @@ lsqpack_dec_enc_in (struct lsqpack_dec *dec, const unsigned char *buf,
 }
 
 
+int
+lsqpack_dec_enc_in (struct lsqpack_dec *dec, const unsigned char *buf,
+                                                                size_t buf_sz)
+{
+    uint64_t start;
+    int r;
+
+    if (dec->qpd_capture)
+        cap_dec_bytes(dec->qpd_capture, LSQPACK_CAP_DEC_ENC_IN, cap_now(),
+                                                        0, 0, buf, buf_sz);
+    start = prof_now();
+    PROBE3(dec_enc_in, dec, buf_sz, dec->qpd_ins_count);
+    r = qdec_enc_in(dec, buf, buf_sz);
+    if (r == 0)
+    {
+        dec->qpd_stats.ds_enc_bytes += buf_sz;
+        qdec_process_blocked_headers(dec);
+    }
+    prof_record(dec->qpd_prof, LSQPACK_PROF_DEC_ENC_IN, start);
+    return r;
+}
+
+
+void
+lsqpack_dec_get_stats (const struct lsqpack_dec *dec,
+                                            struct lsqpack_dec_stats *stats)
+{
+    const struct lsqpack_dec_table_entry *entry;
+    const struct header_block_read_ctx *read_ctx;
+    struct ringbuf_iter riter;
+
+    *stats = dec->qpd_stats;
+    stats->ds_blocked_cur = dec->qpd_n_blocked;
+
+    stats->ds_table_mem = 0;
+    for (entry = ringbuf_iter_first(&riter, &dec->qpd_dyn_table);
+                                    entry; entry = ringbuf_iter_next(&riter))
+        stats->ds_table_mem += sizeof(*entry) + entry->dte_name_len
+                                                        + entry->dte_val_len;
+
+    stats->ds_hblock_mem = 0;
+    if (!(dec->qpd_opts & LSQPACK_DEC_OPT_HBLOCK_STORAGE))
+        TAILQ_FOREACH(read_ctx, &dec->qpd_hbrcs, hbrc_next_all)
+            stats->ds_hblock_mem += sizeof(*read_ctx);
+
+    stats->ds_ringbuf_mem = dec->qpd_dyn_table.rb_nalloc
+                                    * sizeof(dec->qpd_dyn_table.rb_els[0]);
+    stats->ds_other_mem = dec->qpd_blocked_nalloc
+                                    * sizeof(dec->qpd_blocked_headers[0])
+                        + dec->qpd_out.nalloc;
+}
+
+
 void
 lsqpack_dec_print_table (const struct lsqpack_dec *dec, FILE *out)
 {
@@ -5063,6 +7372,124 @@ lsqpack_dec_print_table (const struct lsqpack_dec *dec, FILE *out)
 }
 
 
+uint64_t
+lsqpack_prof_bucket_floor (unsigned idx)
+{
+    unsigned msb;
+
+    if (idx < (1u << LSQPACK_PROF_SUB_BITS))
+        return idx;
+    msb = (idx >> LSQPACK_PROF_SUB_BITS) - 1 + LSQPACK_PROF_SUB_BITS;
+    if (msb > 63)
+        return UINT64_MAX;
+    return (1ull << msb) | ((uint64_t) (idx
+                & ((1u << LSQPACK_PROF_SUB_BITS) - 1))
+                                        << (msb - LSQPACK_PROF_SUB_BITS));
+}
+
+
+uint64_t
+lsqpack_prof_quantile (const struct lsqpack_prof_hist *hist, double q)
+{
+    uint64_t target, sum;
+    unsigned idx;
+
+    if (hist->ph_count == 0)
+        return 0;
+
+    target = (uint64_t) ceil(q * (double) hist->ph_count);
+    if (target == 0)
+        target = 1;
+    sum = 0;
+    for (idx = 0; idx < LSQPACK_PROF_N_BUCKETS; ++idx)
+    {
+        sum += hist->ph_buckets[idx];
+        if (sum >= target)
+            return lsqpack_prof_bucket_floor(idx);
+    }
+
+    return hist->ph_max;
+}
+
+
+static void
+prof_print (const struct lsqpack_prof_hist *hists,
+            enum lsqpack_prof_point first, enum lsqpack_prof_point last,
+            FILE *out)
+{
+    static const char *const point2str[] = {
+        [LSQPACK_PROF_ENC_ENCODE]       = "encode",
+        [LSQPACK_PROF_ENC_END_HEADER]   = "end_header",
+        [LSQPACK_PROF_ENC_DECODER_IN]   = "decoder_in",
+        [LSQPACK_PROF_ENC_HASH]         = "hash",
+        [LSQPACK_PROF_ENC_LOOKUP]       = "lookup",
+        [LSQPACK_PROF_ENC_STRING]       = "string",
+        [LSQPACK_PROF_DEC_HEADER_IN]    = "header_in",
+        [LSQPACK_PROF_DEC_HEADER_READ]  = "header_read",
+        [LSQPACK_PROF_DEC_ENC_IN]       = "enc_in",
+        [LSQPACK_PROF_DEC_HUFFMAN]      = "huffman",
+        [LSQPACK_PROF_DEC_CALLBACK]     = "callback",
+    };
+    const struct lsqpack_prof_hist *hist;
+    unsigned point;
+
+    if (!hists)
+        return;
+
+    for (point = first; point <= last; ++point)
+    {
+        hist = &hists[point];
+        if (hist->ph_count == 0)
+            continue;
+        fprintf(out, "%-12s count: %"PRIu64"; mean: %.1f; p50: %"PRIu64"; "
+            "p99: %"PRIu64"; p999: %"PRIu64"; max: %"PRIu64"\n",
+            point2str[point], hist->ph_count,
+            (double) hist->ph_sum / (double) hist->ph_count,
+            lsqpack_prof_quantile(hist, 0.5),
+            lsqpack_prof_quantile(hist, 0.99),
+            lsqpack_prof_quantile(hist, 0.999), hist->ph_max);
+    }
+}
+
+
+const struct lsqpack_prof_hist *
+lsqpack_enc_prof_hist (const struct lsqpack_enc *enc,
+                                                enum lsqpack_prof_point point)
+{
+    if (enc->qpe_prof && point < LSQPACK_PROF_N_POINTS)
+        return &enc->qpe_prof[point];
+    else
+        return NULL;
+}
+
+
+const struct lsqpack_prof_hist *
+lsqpack_dec_prof_hist (const struct lsqpack_dec *dec,
+                                                enum lsqpack_prof_point point)
+{
+    if (dec->qpd_prof && point < LSQPACK_PROF_N_POINTS)
+        return &dec->qpd_prof[point];
+    else
+        return NULL;
+}
+
+
+void
+lsqpack_enc_print_prof (const struct lsqpack_enc *enc, FILE *out)
+{
+    prof_print(enc->qpe_prof, LSQPACK_PROF_ENC_ENCODE,
+                                            LSQPACK_PROF_ENC_STRING, out);
+}
+
+
+void
+lsqpack_dec_print_prof (const struct lsqpack_dec *dec, FILE *out)
+{
+    prof_print(dec->qpd_prof, LSQPACK_PROF_DEC_HEADER_IN,
+                                            LSQPACK_PROF_DEC_CALLBACK, out);
+}
+
+
 const struct lsqpack_dec_err *
 lsqpack_dec_get_err_info (const struct lsqpack_dec *dec)
 {
@@ -5082,7 +7509,7 @@ lsqpack_dec_get_err_info (const struct lsqpack_dec *dec)
 #endif
 #endif
 
-static unsigned char *
+STATIC unsigned char *
 qenc_huffman_enc (const unsigned char *src, const unsigned char *const src_end,
     unsigned char *dst)
 {
@@ -5195,7 +7622,7 @@ qenc_huffman_enc (const unsigned char *src, const unsigned char *const src_end,
 }
 
 
-static unsigned
+STATIC unsigned
 qenc_enc_str_size (const unsigned char *str, unsigned str_len)
 {
     unsigned const char *const end = str + str_len;
@@ -5239,10 +7666,11 @@ qdec_huff_dec4bits (uint8_t src_4bits, unsigned char *dst,
  * In the case a longer code is encoutered, we fall back to the original
  * Huffman decoder that supports all code lengths.
  */
-static struct huff_decode_retval
+STATIC struct huff_decode_retval
 huff_decode_fast (const unsigned char *src, int src_len,
             unsigned char *dst, int dst_len,
-            struct lsqpack_huff_decode_state *state, int final)
+            struct lsqpack_huff_decode_state *state, int final,
+            unsigned *n_src_full)
 {
     unsigned char *const orig_dst = dst;
     const unsigned char *const src_end = src + src_len;
@@ -5459,6 +7887,7 @@ huff_decode_fast (const unsigned char *src, int src_len,
                                   (int)(dst_end - dst), state, final);
     if (rv.status == HUFF_DEC_OK || rv.status == HUFF_DEC_END_DST)
     {
+        *n_src_full = rv.n_src;
         rv.n_dst += dst_len - (int)(dst_end - dst);
         rv.n_src += src_len - (int)(src_end - src);
     }
@@ -57,6 +57,30 @@ typedef unsigned lsqpack_abs_id_t;
 struct lsqpack_enc;
 struct lsqpack_dec;
 struct lsxpack_header;
+struct lsqpack_capture;
+
+/**
+ * Log levels used by @ref lsqpack_log_f.  Messages below the level passed
+ * to @ref lsqpack_enc_set_logger() or @ref lsqpack_dec_set_logger() are
+ * not formatted.  To remove lower-level call sites from the library
+ * entirely, compile it with LSQPACK_MIN_LOG_LEVEL set to the numeric value
+ * of the lowest level to keep.
+ */
+enum lsqpack_log_level
+{
+    LSQPACK_LOG_DEBUG,
+    LSQPACK_LOG_INFO,
+    LSQPACK_LOG_WARN,
+    LSQPACK_LOG_ERROR,
+    LSQPACK_LOG_NONE,
+};
+
+/**
+ * Logging callback.  `msg' is preformatted, is `msg_len' bytes long and
+ * is NUL-terminated; it is only valid for the duration of the call.
+ */
+typedef void (*lsqpack_log_f)(void *logger_ctx, enum lsqpack_log_level,
+                                            const char *msg, size_t msg_len);
 
 enum lsqpack_enc_opts
 {
@@ -64,8 +88,13 @@ enum lsqpack_enc_opts
      * Client and server follow different heuristics.  The encoder is either
      * in one or the other mode.
      *
-     * At the moment this option is a no-op.  This is a potential future
-     * work item where some heuristics may be added to the library.
+     * The encoder tracks how often values of each header name repeat
+     * (see @ref lsqpack_enc_get_name_class()).  In server mode, values of
+     * names whose values are almost always new (such as `expires' or
+     * `etag') are not inserted into the dynamic table.  New values of
+     * names whose values repeat are inserted the first time they are seen,
+     * and draining entries of such names are duplicated rather than sent
+     * as literals.
      */
     LSQPACK_ENC_OPT_SERVER  = 1 << 0,
 
@@ -75,6 +104,16 @@ enum lsqpack_enc_opts
      */
     LSQPACK_ENC_OPT_STAGE_2 = 1 << 1,
 
+    /**
+     * Back the history of recent fields with a frequency sketch.  A field
+     * counts as seen before if it occurred within a window several times
+     * larger than the dynamic table, so values that recur at intervals
+     * longer than the history covers get indexed.  If inserting a field
+     * would evict the oldest entry, the field is inserted only if it has
+     * been seen more often than that entry.
+     */
+    LSQPACK_ENC_OPT_FREQ_SKETCH = 1 << 5,
+
     /* The options below are advanced.  The author only uses them for debugging
      * or testing.
      */
@@ -115,6 +154,16 @@ enum lsqpack_enc_opts
 void
 lsqpack_enc_preinit (struct lsqpack_enc *, void *logger_ctx);
 
+/**
+ * Set the logging callback and the lowest level to log.  If `log_f' is
+ * NULL, `logger_ctx' is used as a `FILE *' the way it is when passed to
+ * @ref lsqpack_enc_preinit().  Call after @ref lsqpack_enc_preinit() or
+ * @ref lsqpack_enc_init().
+ */
+void
+lsqpack_enc_set_logger (struct lsqpack_enc *, lsqpack_log_f log_f,
+                        void *logger_ctx, enum lsqpack_log_level min_level);
+
 /**
  * Number of bytes required to encode the longest possible Set Dynamic Table
  * Capacity instruction.  This is a theoretical limit based on the integral
@@ -169,6 +218,43 @@ int
 lsqpack_enc_set_max_capacity (struct lsqpack_enc *enc, unsigned capacity,
                                     unsigned char *sdtc_buf, size_t *sdtc_buf_sz);
 
+/** Per-name indexing policies: see @ref lsqpack_enc_set_name_policy() */
+enum lsqpack_name_policy
+{
+    /** Let the encoder decide using its history.  This is the default. */
+    LSQPACK_NP_HIST_DEFAULT,
+    /** Insert name and value into the dynamic table on first sight */
+    LSQPACK_NP_ALWAYS_INSERT,
+    /**
+     * Never insert the value.  The name may still be inserted by itself
+     * and referenced.
+     */
+    LSQPACK_NP_NAME_ONLY,
+    /**
+     * Encode as a literal with the N bit set, as if LQEF_NEVER_INDEX were
+     * passed, and keep the field out of the history.
+     */
+    LSQPACK_NP_NEVER_INDEX,
+};
+
+/**
+ * Set indexing policy for header name `name'.  The policy is consulted for
+ * each field with this name that does not fully match a static table entry,
+ * before the dynamic table and history logic, so that callers do not have
+ * to pass LQEF_* flags on every call.  A full static table match is always
+ * encoded as an indexed field line regardless of the policy.  Setting the
+ * policy to LSQPACK_NP_HIST_DEFAULT removes it.  The name is matched
+ * exactly, including case.
+ *
+ * This function can be called after @ref lsqpack_enc_preinit() or
+ * @ref lsqpack_enc_init().
+ *
+ * Returns 0 on success or -1 on error.
+ */
+int
+lsqpack_enc_set_name_policy (struct lsqpack_enc *, const char *name,
+                            unsigned name_len, enum lsqpack_name_policy);
+
 /** Start a new header block.  Return 0 on success or -1 on error. */
 int
 lsqpack_enc_start_header (struct lsqpack_enc *, uint64_t stream_id,
@@ -296,6 +382,89 @@ lsqpack_enc_decoder_in (struct lsqpack_enc *, const unsigned char *, size_t);
 float
 lsqpack_enc_ratio (const struct lsqpack_enc *);
 
+/**
+ * Encoder counters.  They accumulate from @ref lsqpack_enc_preinit() (or
+ * @ref lsqpack_enc_init(), unless it is called with
+ * @ref LSQPACK_ENC_OPT_STAGE_2) and are only updated on success.
+ */
+struct lsqpack_enc_stats
+{
+    /* Header fields by header block representation: */
+    uint64_t    es_static_full;     /* Indexed, static table */
+    uint64_t    es_static_name;     /* Static name reference */
+    uint64_t    es_dyn_full;        /* Indexed, dynamic table */
+    uint64_t    es_dyn_name;        /* Dynamic name reference */
+    uint64_t    es_literal;         /* Literal name and value */
+
+    /* String literals on either stream, by encoding: */
+    uint64_t    es_str_huffman;
+    uint64_t    es_str_plain;
+
+    /* Encoder stream instructions: */
+    uint64_t    es_ins_nameref_static;
+    uint64_t    es_ins_nameref_dyn;
+    uint64_t    es_ins_lit;         /* Literal name and value */
+    uint64_t    es_ins_lit_name;    /* Literal name, empty value */
+    uint64_t    es_dups;            /* Includes es_dups_draining */
+    uint64_t    es_dups_draining;   /* Duplicates of draining entries */
+
+    uint64_t    es_evictions;
+    uint64_t    es_hblocks;         /* Header blocks ended */
+    uint64_t    es_risked_hblocks;  /* ...of which may block the decoder */
+    /* Insertions given up because of the 0.95 compression ratio check: */
+    uint64_t    es_ratio_resets;
+    uint64_t    es_hist_hits;
+    uint64_t    es_hist_misses;
+    /* Fields seen before but not indexed because their name is volatile: */
+    uint64_t    es_volatile_lits;
+
+    uint64_t    es_hea_bytes;       /* Header blocks, including prefixes */
+    uint64_t    es_enc_bytes;       /* Encoder stream, by encode calls */
+
+    /* Memory held by the encoder, in bytes: */
+    size_t      es_table_mem;       /* Dynamic table entries */
+    size_t      es_bucket_mem;      /* Hash table buckets */
+    size_t      es_hist_mem;        /* History, sketch, and name stats */
+    size_t      es_hinfo_mem;       /* Header info arrays */
+
+    /* Tracked header names, by @ref lsqpack_enc_get_name_class(): */
+    unsigned    es_names_stable;
+    unsigned    es_names_volatile;
+};
+
+/**
+ * Fill `stats' with encoder counters and gauges.  Gauges are computed by
+ * walking the dynamic table, the list of header info arrays, and the
+ * header name statistics.
+ */
+void
+lsqpack_enc_get_stats (const struct lsqpack_enc *,
+                                            struct lsqpack_enc_stats *stats);
+
+/** How often values of a header name repeat */
+enum lsqpack_name_class
+{
+    /** Not seen often enough, or history is disabled */
+    LSQPACK_NC_UNKNOWN,
+    /** Values mostly repeat */
+    LSQPACK_NC_STABLE,
+    /**
+     * Values are almost always new, like those of `date' or `etag'.  In
+     * server mode, values of volatile names are not inserted into the
+     * dynamic table; the name is still referenced.
+     */
+    LSQPACK_NC_VOLATILE,
+};
+
+/**
+ * Return the class the encoder has learned for header name `name'.  The
+ * encoder tracks a limited number of recently encoded names, so a name
+ * that has not been encoded for a while becomes LSQPACK_NC_UNKNOWN again.
+ */
+enum lsqpack_name_class
+lsqpack_enc_get_name_class (const struct lsqpack_enc *, const char *name,
+                                                        unsigned name_len);
+
 /**
  * Return maximum size needed to encode Header Block Prefix
  */
@@ -326,6 +495,54 @@ enum lsqpack_dec_opts
     LSQPACK_DEC_OPT_HASH_NAME       = 1 << 1,
     /** Include nameval hash into lsxpack_header */
     LSQPACK_DEC_OPT_HASH_NAMEVAL    = 1 << 2,
+    /**
+     * The caller provides storage for header block read state: `hblock_ctx'
+     * passed to @ref lsqpack_dec_header_in() must point to at least
+     * @ref lsqpack_dec_hblock_ctx_size() bytes of suitably aligned memory.
+     * The decoder keeps its state there instead of allocating it, and the
+     * same pointer is passed to the callbacks.  The memory must stay valid
+     * until the decoder no longer references the header block (see
+     * @ref lsqpack_dec_header_in()).  The memory must be zeroed before
+     * it is used for the first time.
+     */
+    LSQPACK_DEC_OPT_HBLOCK_STORAGE  = 1 << 3,
+    /**
+     * Do not call hblock_unblocked() from inside @ref lsqpack_dec_enc_in().
+     * Instead, unblocked header blocks are queued and the caller retrieves
+     * them using @ref lsqpack_dec_next_unblocked().  In this mode,
+     * hblock_unblocked() callback may be NULL.
+     */
+    LSQPACK_DEC_OPT_DEFER_UNBLOCKED = 1 << 4,
+    /**
+     * Queue decoder stream instructions inside the decoder instead of
+     * writing them to caller-supplied buffers.  Section Acknowledgements
+     * and Stream Cancellations are queued as they are generated; Insert
+     * Count Increment is added when the queue is flushed, so that it is
+     * never made redundant by a later Section Acknowledgement.  See
+     * @ref lsqpack_dec_flush().
+     */
+    LSQPACK_DEC_OPT_QUEUE_DEC_STREAM = 1 << 5,
+};
+
+/**
+ * When @ref lsqpack_dec_flush_ready() returns true in
+ * @ref LSQPACK_DEC_OPT_QUEUE_DEC_STREAM mode.  The flags can be combined.
+ */
+enum lsqpack_dec_flush_policy
+{
+    /**
+     * Never: the caller flushes the queue itself, for example, once per
+     * event loop iteration.  This is the default.
+     */
+    LSQPACK_DEC_FLUSH_TICK      = 0,
+    /** Ready when the number of queued instructions reaches the limit */
+    LSQPACK_DEC_FLUSH_COUNT     = 1 << 0,
+    /**
+     * Ready when an Insert Count Increment is pending, that is, when
+     * queued Section Acknowledgements do not tell the encoder about all
+     * the entries it inserted.
+     */
+    LSQPACK_DEC_FLUSH_ICI       = 1 << 1,
 };
 
 void
@@ -333,6 +550,23 @@ lsqpack_dec_init (struct lsqpack_dec *, void *logger_ctx,
     unsigned dyn_table_size, unsigned max_risked_streams,
     const struct lsqpack_dec_hset_if *, enum lsqpack_dec_opts);
 
+/**
+ * Set the logging callback and the lowest level to log.  If `log_f' is
+ * NULL, `logger_ctx' is used as a `FILE *' the way it is when passed to
+ * @ref lsqpack_dec_init().  Call after @ref lsqpack_dec_init().
+ */
+void
+lsqpack_dec_set_logger (struct lsqpack_dec *, lsqpack_log_f log_f,
+                        void *logger_ctx, enum lsqpack_log_level min_level);
+
+/**
+ * Return the number of bytes of header block read state.  This is how much
+ * memory `hblock_ctx' must point to in @ref LSQPACK_DEC_OPT_HBLOCK_STORAGE
+ * mode.
+ */
+size_t
+lsqpack_dec_hblock_ctx_size (const struct lsqpack_dec *);
+
 /**
  * Values returned by @ref lsqpack_dec_header_in() and
  * @ref lsqpack_dec_header_read()
@@ -348,7 +582,9 @@ enum lsqpack_read_header_status
      * The decoder cannot decode the header block until more dynamic table
      * entries become available.  `buf' is advanced.  When the header block
      * becomes unblocked, the decoder will call hblock_unblocked() callback
-     * specified in the constructor.  See @ref lsqpack_dec_init().
+     * specified in the constructor.  See @ref lsqpack_dec_init().  (In
+     * @ref LSQPACK_DEC_OPT_DEFER_UNBLOCKED mode, the header block context
+     * is returned by @ref lsqpack_dec_next_unblocked() instead.)
      *
      * Once a header block is unblocked, it cannot get blocked again.  In
      * other words, this status can only be returned once per header block.
@@ -418,6 +654,49 @@ lsqpack_dec_header_read (struct lsqpack_dec *dec, void *hblock_ctx,
 int
 lsqpack_dec_enc_in (struct lsqpack_dec *, const unsigned char *, size_t);
 
+/**
+ * In @ref LSQPACK_DEC_OPT_DEFER_UNBLOCKED mode, return the next header block
+ * context that has become unblocked, in order of Required Insert Count.
+ * NULL is returned when there are no more.  Call this after
+ * @ref lsqpack_dec_enc_in() and resume decoding of each returned header
+ * block using @ref lsqpack_dec_header_read().
+ */
+void *
+lsqpack_dec_next_unblocked (struct lsqpack_dec *);
+
+/**
+ * Set flush policy of the decoder stream queue.  `max_insts' is only used
+ * with @ref LSQPACK_DEC_FLUSH_COUNT.
+ */
+void
+lsqpack_dec_set_flush_policy (struct lsqpack_dec *,
+                    enum lsqpack_dec_flush_policy, unsigned max_insts);
+
+/**
+ * Returns true if the decoder stream queue should be flushed according to
+ * the policy set by @ref lsqpack_dec_set_flush_policy().
+ */
+int
+lsqpack_dec_flush_ready (const struct lsqpack_dec *);
+
+/**
+ * Returns the number of bytes @ref lsqpack_dec_flush() needs to empty the
+ * decoder stream queue.  Zero means there is nothing to flush.
+ */
+size_t
+lsqpack_dec_flush_size (const struct lsqpack_dec *);
+
+/**
+ * Write queued decoder stream instructions to `buf', followed by an Insert
+ * Count Increment if necessary.  If `buf' is too small, the rest is kept
+ * for the next call: the decoder stream is a byte stream, so instructions
+ * may be split between writes.
+ *
+ * Returns the number of bytes written or -1 on memory allocation failure.
+ */
+ssize_t
+lsqpack_dec_flush (struct lsqpack_dec *, unsigned char *buf, size_t sz);
+
 /**
  * Returns true if Insert Count Increment (ICI) instruction is pending.
  */
@@ -444,6 +723,9 @@ lsqpack_dec_write_ici (struct lsqpack_dec *, unsigned char *, size_t);
  * Number of bytes written to `buf' is returned.  If stream `stream_id'
  * could not be found, zero is returned.  If `buf' is too short, -1 is
  * returned.
+ *
+ * In @ref LSQPACK_DEC_OPT_QUEUE_DEC_STREAM mode, the instruction is queued
+ * and zero is returned; `buf' is not used.
  */
 ssize_t
 lsqpack_dec_cancel_stream (struct lsqpack_dec *, void *hblock_ctx,
@@ -457,6 +739,9 @@ lsqpack_dec_cancel_stream (struct lsqpack_dec *, void *hblock_ctx,
  *  -1  error (`buf' is too short)
  *   0  Emitting Cancel Stream instruction is unnecessary
  *  >0  Size of Cancel Stream instruction written to `buf'.
+ *
+ * In @ref LSQPACK_DEC_OPT_QUEUE_DEC_STREAM mode, the instruction is queued
+ * and zero is returned; `buf' is not used.
  */
 ssize_t
 lsqpack_dec_cancel_stream_id (struct lsqpack_dec *dec, uint64_t stream_id,
@@ -486,12 +771,242 @@ lsqpack_dec_ratio (const struct lsqpack_dec *);
 void
 lsqpack_dec_cleanup (struct lsqpack_dec *);
 
+/**
+ * Decoder counters and gauges.  Counters accumulate from
+ * @ref lsqpack_dec_init(); gauges describe the current state.
+ */
+struct lsqpack_dec_stats
+{
+    /* Blocked header blocks: */
+    unsigned    ds_blocked_cur;
+    unsigned    ds_blocked_peak;
+    uint64_t    ds_blocked_total;
+
+    /* Header blocks that became unblocked and how long they waited, summed
+     * over all of them:
+     */
+    uint64_t    ds_unblocked;
+    uint64_t    ds_unblock_inserts;     /* ...in dynamic table insertions */
+    uint64_t    ds_unblock_bytes;       /* ...in encoder stream bytes */
+    uint64_t    ds_unblock_bytes_max;   /* Longest single wait in bytes */
+
+    /* Dynamic table insertions by encoder stream instruction: */
+    uint64_t    ds_ins_winr;            /* Insert With Name Reference */
+    uint64_t    ds_ins_wonr;            /* Insert With Literal Name */
+    uint64_t    ds_ins_dup;             /* Duplicate */
+    uint64_t    ds_enc_bytes;           /* Encoder stream bytes read */
+
+    /* Huffman-encoded bytes by decoder: the fast decoder handles codes up
+     * to 16 bits long, the rest goes to the full decoder.
+     */
+    uint64_t    ds_huff_fast_bytes;
+    uint64_t    ds_huff_full_bytes;
+
+    /* Parser work in abstract units: one per byte read, copied, or
+     * Huffman-decoded, per blocked-heap and pending-list step, and per
+     * evicted or unblocked entry.  Work per input byte that keeps growing
+     * with the input points to an algorithmic-complexity problem.
+     */
+    uint64_t    ds_work;
+
+    /* Memory held by the decoder, in bytes: */
+    size_t      ds_table_mem;           /* Dynamic table entries */
+    size_t      ds_hblock_mem;          /* Pending header block read state */
+    size_t      ds_ringbuf_mem;         /* Dynamic table ring buffer */
+    size_t      ds_other_mem;           /* Blocked heap and output queue */
+};
+
+/**
+ * Fill `stats' with decoder counters and gauges.  Gauges are computed by
+ * walking the dynamic table and the list of pending header blocks.
+ */
+void
+lsqpack_dec_get_stats (const struct lsqpack_dec *,
+                                            struct lsqpack_dec_stats *stats);
+
+/**
+ * Points timed when the library is built with LSQPACK_PROFILE.  Time is
+ * measured in TSC ticks on x86 and in nanoseconds elsewhere.
+ */
+enum lsqpack_prof_point
+{
+    LSQPACK_PROF_ENC_ENCODE,        /* lsqpack_enc_encode() */
+    LSQPACK_PROF_ENC_END_HEADER,    /* lsqpack_enc_end_header() */
+    LSQPACK_PROF_ENC_DECODER_IN,    /* lsqpack_enc_decoder_in() */
+    LSQPACK_PROF_ENC_HASH,          /* Hashing name and value */
+    LSQPACK_PROF_ENC_LOOKUP,        /* Static and dynamic table lookups */
+    LSQPACK_PROF_ENC_STRING,        /* String literal, including Huffman */
+    LSQPACK_PROF_DEC_HEADER_IN,     /* lsqpack_dec_header_in() */
+    LSQPACK_PROF_DEC_HEADER_READ,   /* lsqpack_dec_header_read() */
+    LSQPACK_PROF_DEC_ENC_IN,        /* lsqpack_dec_enc_in() */
+    LSQPACK_PROF_DEC_HUFFMAN,       /* Huffman decoding */
+    LSQPACK_PROF_DEC_CALLBACK,      /* dhi_process_header() */
+    LSQPACK_PROF_N_POINTS
+};
+
+/**
+ * Log-linear histogram: each power of two is split into
+ * 2^LSQPACK_PROF_SUB_BITS buckets.
+ */
+#define LSQPACK_PROF_SUB_BITS 2
+#define LSQPACK_PROF_N_BUCKETS (64 << LSQPACK_PROF_SUB_BITS)
+
+struct lsqpack_prof_hist
+{
+    uint64_t    ph_count;
+    uint64_t    ph_sum;
+    uint64_t    ph_max;
+    uint64_t    ph_buckets[LSQPACK_PROF_N_BUCKETS];
+};
+
+/**
+ * Return histogram for `point' or NULL if the library is built without
+ * LSQPACK_PROFILE.  Encoder histograms are allocated by
+ * @ref lsqpack_enc_init(), so NULL is also returned before it is called.
+ */
+const struct lsqpack_prof_hist *
+lsqpack_enc_prof_hist (const struct lsqpack_enc *, enum lsqpack_prof_point);
+
+const struct lsqpack_prof_hist *
+lsqpack_dec_prof_hist (const struct lsqpack_dec *, enum lsqpack_prof_point);
+
+/**
+ * Return the smallest value that falls into histogram bucket `idx'.
+ */
+uint64_t
+lsqpack_prof_bucket_floor (unsigned idx);
+
+/**
+ * Return approximate quantile `q' (0 to 1) of histogram values: the floor
+ * of the bucket it falls in.
+ */
+uint64_t
+lsqpack_prof_quantile (const struct lsqpack_prof_hist *, double q);
+
+/**
+ * Print count, mean, p50, p99, p999, and maximum for each point that has
+ * values.  Does nothing if the library is built without LSQPACK_PROFILE.
+ */
+void
+lsqpack_enc_print_prof (const struct lsqpack_enc *, FILE *out);
+
+void
+lsqpack_dec_print_prof (const struct lsqpack_dec *, FILE *out);
+
 /**
  * Print human-readable decoder table.
  */
 void
 lsqpack_dec_print_table (const struct lsqpack_dec *, FILE *out);
 
+/**
+ * Capture flags; see @ref lsqpack_dec_capture().
+ */
+enum lsqpack_capture_flags
+{
+    /**
+     * Replace header values with filler of the same length.  Names are kept.
+     *
+     * The decoder overwrites values as they appear on the encoder stream and
+     * in header blocks.  A Huffman-encoded value is rewritten symbol by
+     * symbol into a string that decodes to the same number of characters,
+     * so dynamic table accounting -- and thus replay -- is not affected.
+     * The encoder replaces each value with characters derived from its
+     * hash, seeded with a random salt that is not logged: equal values stay
+     * equal within a capture, but their encoded size may change.
+     */
+    LSQPACK_CAPTURE_REDACT  = 1 << 0,
+};
+
+/**
+ * Capture log record types.  A capture log starts with a header:
+ *
+ *   "QCAP"     Magic
+ *   u8         Version: 1
+ *   u8         Side: 0 is decoder, 1 is encoder
+ *   u8         Capture flags
+ *   varint...  Decoder: maximum capacity, maximum risked streams, options.
+ *              Encoder: maximum capacity, current capacity, maximum risked
+ *                streams, options.
+ *
+ * Each record is the type byte followed by the time since the previous
+ * record (or since the header) in nanoseconds as a varint and the fields
+ * listed below.  A varint is an unsigned LEB128 integer.  Byte strings are
+ * a varint length followed by the bytes.
+ */
+enum lsqpack_capture_rec
+{
+    /** Encoder stream chunk (bytes) */
+    LSQPACK_CAP_DEC_ENC_IN      = 1,
+    /**
+     * Stream ID, header block size, and header block bytes.  Only the bytes
+     * the decoder consumed are recorded, unless the call failed.
+     */
+    LSQPACK_CAP_DEC_HEADER_IN   = 2,
+    /** Stream ID and header block bytes */
+    LSQPACK_CAP_DEC_HEADER_READ = 3,
+    /** Stream ID of the header block cancelled using
+     *  @ref lsqpack_dec_cancel_stream()
+     */
+    LSQPACK_CAP_DEC_CANCEL      = 4,
+    /** Stream ID of the header block passed to
+     *  @ref lsqpack_dec_unref_stream()
+     */
+    LSQPACK_CAP_DEC_UNREF       = 5,
+    /** Decoder stream chunk (bytes) */
+    LSQPACK_CAP_ENC_DECODER_IN  = 6,
+    /** Stream ID and sequence number */
+    LSQPACK_CAP_ENC_START       = 7,
+    /**
+     * Encoder flags (varint), lsxpack_header flags (u8), QPACK static table
+     * index (u8), name length and value length (varints), name, and value.
+     * Only successfully encoded fields are recorded.
+     */
+    LSQPACK_CAP_ENC_FIELD       = 8,
+    /** Header block ended: no fields */
+    LSQPACK_CAP_ENC_END         = 9,
+    /** Header block cancelled: no fields */
+    LSQPACK_CAP_ENC_CANCEL      = 10,
+    /** New maximum capacity (varint) */
+    LSQPACK_CAP_ENC_CAPACITY    = 11,
+    /** Name policy (varint) and name (bytes) */
+    LSQPACK_CAP_ENC_NAME_POLICY = 12,
+};
+
+/**
+ * Start appending decoder input to capture log `out'.  Each call to
+ * @ref lsqpack_dec_enc_in(), @ref lsqpack_dec_header_in(),
+ * @ref lsqpack_dec_header_read(), @ref lsqpack_dec_cancel_stream(), and
+ * @ref lsqpack_dec_unref_stream() becomes a timestamped record that
+ * preserves the original chunking.  Replaying the log through a fresh
+ * decoder (see bin/capture-replay.c) reproduces the original run, so start
+ * capturing right after @ref lsqpack_dec_init().
+ *
+ * With @ref LSQPACK_CAPTURE_REDACT, records are held back while a
+ * Huffman-encoded value spans them and are written once it is complete.
+ * Pass NULL to stop capturing; held records are written out first.  The
+ * caller owns `out'.  Write errors are ignored.
+ *
+ * Capture is only available if the library is built with LSQPACK_CAPTURE.
+ * Otherwise, starting a capture fails with errno set to ENOTSUP.
+ *
+ * Returns 0 on success and -1 on memory allocation failure.
+ */
+int
+lsqpack_dec_capture (struct lsqpack_dec *, FILE *out,
+                                            enum lsqpack_capture_flags);
+
+/**
+ * Start appending encoder input to capture log `out'.  Header lists given
+ * to @ref lsqpack_enc_start_header(), @ref lsqpack_enc_encode(), and
+ * @ref lsqpack_enc_end_header(), header block cancellations, capacity
+ * changes, and decoder stream chunks are recorded.  See
+ * @ref lsqpack_dec_capture().
+ */
+int
+lsqpack_enc_capture (struct lsqpack_enc *, FILE *out,
+                                            enum lsqpack_capture_flags);
+
 
 struct lsqpack_dec_err
 {
@@ -661,6 +1176,14 @@ struct lsqpack_enc
         LSQPACK_ENC_HEADER  = 1 << 0,
         LSQPACK_ENC_USE_DUP = 1 << 1,
         LSQPACK_ENC_NO_MEM_GUARD    = 1 << 2,
+        /* Set while processing decoder stream if the risked list needs to
+         * be updated at the end of the chunk.
+         */
+        LSQPACK_ENC_RISKED_STALE    = 1 << 3,
+        /* Set while processing decoder stream if header infos were freed */
+        LSQPACK_ENC_MINREF_STALE    = 1 << 4,
+        /* Set by lsqpack_enc_set_logger() so that init keeps its level */
+        LSQPACK_ENC_LOGGER_SET      = 1 << 5,
     }                           qpe_flags;
 
     unsigned                    qpe_cur_bytes_used;
@@ -719,7 +1242,15 @@ struct lsqpack_enc
      */
     unsigned                    qpe_bytes_in;
     unsigned                    qpe_bytes_out;
+    struct lsqpack_enc_stats    qpe_stats;
+    /* Only allocated if built with LSQPACK_PROFILE */
+    struct lsqpack_prof_hist   *qpe_prof;
+    /* Set by lsqpack_enc_capture() */
+    struct lsqpack_capture     *qpe_capture;
+    enum lsqpack_enc_opts       qpe_opts;
     void                       *qpe_logger_ctx;
+    lsqpack_log_f               qpe_log_f;
+    enum lsqpack_log_level      qpe_log_level;
 
     /* Exponential moving averages (EMAs) of the number of elements in the
      * dynamic table and the number of header fields in a single header list.
@@ -732,6 +1263,19 @@ struct lsqpack_enc
     unsigned                    qpe_hist_idx;
     unsigned                    qpe_hist_nels;
     int                         qpe_hist_wrapped;
+
+    /* For each recently encoded name, how often its value had been seen
+     * before.  Allocated along with the history.
+     */
+    struct lsqpack_name_stat   *qpe_name_stats;
+
+    /* Set using lsqpack_enc_set_name_policy() */
+    struct lsqpack_name_policy_el
+                               *qpe_name_policies;
+    unsigned                    qpe_n_name_policies;
+
+    /* Only allocated if LSQPACK_ENC_OPT_FREQ_SKETCH is set */
+    struct lsqpack_freq_sketch *qpe_freq_sketch;
 };
 
 struct lsqpack_ringbuf
@@ -784,6 +1328,8 @@ struct lsqpack_dec
                            *qpd_dh_if;
 
     void                   *qpd_logger_ctx;
+    lsqpack_log_f           qpd_log_f;
+    enum lsqpack_log_level  qpd_log_level;
 
     /** This is the dynamic table */
     struct lsqpack_ringbuf  qpd_dyn_table;
@@ -791,12 +1337,40 @@ struct lsqpack_dec
     TAILQ_HEAD(, header_block_read_ctx)
                             qpd_hbrcs;
 
-    /** Blocked headers are kept in a small hash */
-#define LSQPACK_DEC_BLOCKED_BITS 3
-    TAILQ_HEAD(, header_block_read_ctx)
-                            qpd_blocked_headers[1 << LSQPACK_DEC_BLOCKED_BITS];
+    /** Blocked headers are kept in a min-heap ordered by Required Insert
+     * Count.  The heap grows as needed up to qpd_max_risked_streams.
+     */
+    struct header_block_read_ctx
+                          **qpd_blocked_headers;
+    unsigned                qpd_blocked_nalloc;
     /** Number of blocked streams (in qpd_blocked_headers) */
     unsigned                qpd_n_blocked;
+    /** Total number of entries inserted into the dynamic table */
+    uint64_t                qpd_ins_count;
+    /** Unblocked header blocks not yet returned by
+     * lsqpack_dec_next_unblocked()
+     */
+    TAILQ_HEAD(, header_block_read_ctx)
+                            qpd_unblocked;
+
+    /** Decoder stream output queue */
+    struct {
+        unsigned char                  *buf;
+        size_t                          sz;
+        size_t                          nalloc;
+        unsigned                        n_insts;
+        unsigned                        max_insts;
+        enum lsqpack_dec_flush_policy   policy;
+    }                       qpd_out;
+
+    /** Counters; gauges are computed by lsqpack_dec_get_stats() */
+    struct lsqpack_dec_stats
+                            qpd_stats;
+    /** Only allocated if built with LSQPACK_PROFILE */
+    struct lsqpack_prof_hist
+                           *qpd_prof;
+    /** Set by lsqpack_dec_capture() */
+    struct lsqpack_capture *qpd_capture;
 
     /** Average number of header fields in header list */
     float                   qpd_hlist_size_ema;
@@ -45,6 +45,22 @@ lsqpack_huff_decode_full (const unsigned char *src, int src_len,
             unsigned char *dst, int dst_len,
             struct lsqpack_huff_decode_state *state, int final);
 
+/* The following are only exported in LSQPACK_DEVEL_MODE */
+unsigned char *
+qenc_huffman_enc (const unsigned char *src, const unsigned char *const src_end,
+    unsigned char *dst);
+
+unsigned
+qenc_enc_str_size (const unsigned char *str, unsigned str_len);
+
+#if LS_QPACK_USE_LARGE_TABLES
+struct huff_decode_retval
+huff_decode_fast (const unsigned char *src, int src_len,
+            unsigned char *dst, int dst_len,
+            struct lsqpack_huff_decode_state *state, int final,
+            unsigned *n_src_full);
+#endif
+
 int
 lsqpack_find_in_static_headers (uint32_t name_hash, const char *name,
                                                         unsigned name_len);
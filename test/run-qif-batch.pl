@@ -0,0 +1,122 @@
+#!/usr/bin/perl
+#
+# Run the QIF matrix -- same parameters as the individual qif-* tests --
+# using batch mode: one interop-encode and one interop-decode process for
+# all QIF files and parameter sets.  With --bqif, the QIF files are first
+# converted to BQIF and the encoder reads those.
+
+use strict;
+use warnings;
+
+use File::Compare qw(compare);
+use File::Path qw(remove_tree);
+use File::Spec::Functions qw(catfile);
+use Getopt::Long qw(GetOptions);
+
+my $cleanup = 1;
+my $threads = 0;
+my $bqif = 0;
+
+GetOptions(
+    "threads=i"         => \$threads,
+    "bqif"              => \$bqif,
+    "no-cleanup"        => sub { $cleanup = 0 },
+);
+
+my $dir = catfile(($ENV{TMP} || $ENV{TEMP} || "/tmp"),
+                                            "run-qif-batch-" . rand . $$);
+mkdir $dir or die "cannot create temp directory $dir";
+if (!$cleanup)
+{
+    print "created temp directory: $dir\n";
+}
+
+END {
+    if (defined($dir) && $cleanup) {
+        remove_tree($dir);
+    }
+}
+
+my (@encode_tasks, @decode_tasks, @checks);
+for my $qif (@ARGV) {
+    my $name = (split m{[/\\]}, $qif)[-1];
+    my $input = $qif;
+    if ($bqif) {
+        $input = catfile($dir, "$name.bqif");
+        system("qif2bqif.pl --output $input $qif")
+            and die "qif2bqif.pl failed";
+    }
+    for my $table_size (0, 256, 512, 1024, 4096) {
+        for my $risked_streams (0, 100) {
+            for my $immed_ack (0, 1) {
+                for my $aggressive (0, 1) {
+                    my $http1x = ($aggressive + $table_size + $immed_ack
+                                                    + $risked_streams) & 1;
+                    my $id = "$name-t$table_size-s$risked_streams"
+                                            . "-a$immed_ack-A$aggressive";
+                    my $bin_file = catfile($dir, "$id.out");
+                    my $result = catfile($dir, "$id.qif");
+                    my $args = "-t $table_size -s $risked_streams";
+                    push @encode_tasks, "$args -a $immed_ack"
+                        . ($aggressive ? " -A" : "")
+                        . " -i $input -o $bin_file";
+                    push @decode_tasks, "$args -m 1 -H $http1x"
+                        . " -i $bin_file -o $result";
+                    push @checks, [ $qif, $result ];
+                }
+            }
+        }
+    }
+}
+
+sub write_batch {
+    my ($file, @tasks) = @_;
+    open F, ">", $file or die "cannot open $file for writing: $!";
+    print F map "$_\n", @tasks;
+    close F;
+}
+
+my $encode_batch = catfile($dir, "encode.batch");
+my $decode_batch = catfile($dir, "decode.batch");
+write_batch($encode_batch, @encode_tasks);
+write_batch($decode_batch, @decode_tasks);
+
+system("interop-encode -j $threads -b $encode_batch")
+    and die "interop-encode failed";
+system("interop-decode -j $threads -b $decode_batch")
+    and die "interop-decode failed";
+
+sub sort_qif {
+    no warnings 'uninitialized';
+    my ($in, $out) = @_;
+    local $/ = "\n\n";
+    open F, $in or die "cannot open $in for reading: $!";
+    my @chunks = map $$_[1],
+		 sort { $$a[0] <=> $$b[0] }
+		 map { /^#\s*stream\s+(\d+)/; [ $1, $_ ] }
+		 <F>;
+    close F;
+    for (@chunks) {
+        s/^#.*\n//mg;
+    }
+    open F, ">", $out or die "cannot open $out for writing: $!";
+    print F @chunks;
+    close F;
+}
+
+my %canonical;
+my $failed = 0;
+for (@checks) {
+    my ($qif, $result) = @$_;
+    if (!exists $canonical{$qif}) {
+        $canonical{$qif} = catfile($dir, "canonical-" . keys %canonical);
+        sort_qif($qif, $canonical{$qif});
+    }
+    sort_qif($result, "$result.canonical");
+    if (compare($canonical{$qif}, "$result.canonical")) {
+        print STDERR "mismatch: $result\n";
+        $failed = 1;
+    }
+}
+
+exit $failed;
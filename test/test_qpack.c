@@ -4,6 +4,7 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -473,6 +474,434 @@ run_decoded_headers_test (const struct qpack_header_block_test *test)
 }
 
 
+/* In LSQPACK_DEC_OPT_HBLOCK_STORAGE mode, header block read state lives
+ * right after this structure: the decoder passes a pointer to the state to
+ * the callbacks.
+ */
+struct storage_stream
+{
+    struct dhte                 dhte;
+    unsigned                    n_unblocked;
+};
+
+
+static struct storage_stream *
+storage_stream (void *hblock_ctx_p)
+{
+    return (struct storage_stream *) hblock_ctx_p - 1;
+}
+
+
+static void
+storage_unblocked (void *hblock_ctx_p)
+{
+    ++storage_stream(hblock_ctx_p)->n_unblocked;
+}
+
+
+static struct lsxpack_header *
+storage_prepare_decode (void *hblock_ctx_p, struct lsxpack_header *xhdr,
+                                                                size_t space)
+{
+    return dht_prepare_decode(&storage_stream(hblock_ctx_p)->dhte, xhdr, space);
+}
+
+
+static int
+storage_process_header (void *hblock_ctx_p, struct lsxpack_header *xhdr)
+{
+    return dht_process_header(&storage_stream(hblock_ctx_p)->dhte, xhdr);
+}
+
+
+/* Decode a blocked header block using caller-provided read state */
+static void
+test_hblock_storage (const struct qpack_header_block_test *test)
+{
+    struct lsqpack_dec dec;
+    struct storage_stream *stream;
+    void *hblock;
+    enum lsqpack_read_header_status rhs;
+    const unsigned char *buf, *resume;
+    unsigned char block[PREFIX_BUF_SZ + HEADER_BUF_SZ];
+    unsigned char dec_buf[LSQPACK_LONGEST_HEADER_ACK];
+    size_t dec_sz, block_sz;
+    int s;
+    const struct lsqpack_dec_hset_if storage_if = {
+        .dhi_unblocked      = storage_unblocked,
+        .dhi_prepare_decode = storage_prepare_decode,
+        .dhi_process_header = storage_process_header,
+    };
+
+    lsqpack_dec_init(&dec, NULL, test->qhbt_table_size,
+                                test->qhbt_max_risked_streams, &storage_if,
+                                LSQPACK_DEC_OPT_HBLOCK_STORAGE);
+    stream = calloc(1, sizeof(*stream) + lsqpack_dec_hblock_ctx_size(&dec));
+    assert(stream);
+    hblock = stream + 1;
+
+    /* Nothing to find yet */
+    assert(LQRHS_ERROR == lsqpack_dec_header_read(&dec, hblock, &buf, 0,
+                                                                NULL, NULL));
+    assert(-1 == lsqpack_dec_unref_stream(&dec, hblock));
+
+    memcpy(block, test->qhbt_prefix_buf, test->qhbt_prefix_sz);
+    memcpy(block + test->qhbt_prefix_sz, test->qhbt_header_buf,
+                                                    test->qhbt_header_sz);
+    block_sz = test->qhbt_prefix_sz + test->qhbt_header_sz;
+
+    buf = block;
+    dec_sz = sizeof(dec_buf);
+    rhs = lsqpack_dec_header_in(&dec, hblock, 0, block_sz, &buf, block_sz,
+                                                        dec_buf, &dec_sz);
+    assert(rhs == LQRHS_BLOCKED);
+    resume = buf;
+
+    /* The same storage cannot be used for two header blocks at once */
+    buf = test->qhbt_prefix_buf;
+    rhs = lsqpack_dec_header_in(&dec, hblock, 4,
+                test->qhbt_prefix_sz + test->qhbt_header_sz,
+                &buf, test->qhbt_prefix_sz, dec_buf, &dec_sz);
+    assert(rhs == LQRHS_ERROR);
+
+    s = lsqpack_dec_enc_in(&dec, test->qhbt_enc_buf, test->qhbt_enc_sz);
+    assert(s == 0);
+    assert(stream->n_unblocked == 1);
+
+    buf = resume;
+    dec_sz = sizeof(dec_buf);
+    rhs = lsqpack_dec_header_read(&dec, hblock, &buf, block + block_sz - buf,
+                                                        dec_buf, &dec_sz);
+    assert(rhs == LQRHS_DONE);
+    assert(buf == block + block_sz);
+    assert(dec_sz > 0);
+    assert(stream->dhte.buf_off > 0);
+
+    /* Storage is released: the decoder no longer knows about it */
+    assert(-1 == lsqpack_dec_unref_stream(&dec, hblock));
+
+    /* Reuse the storage for another header block and leave it unfinished */
+    buf = test->qhbt_prefix_buf;
+    dec_sz = sizeof(dec_buf);
+    rhs = lsqpack_dec_header_in(&dec, hblock, 4,
+                test->qhbt_prefix_sz + test->qhbt_header_sz,
+                &buf, test->qhbt_prefix_sz, dec_buf, &dec_sz);
+    assert(rhs == LQRHS_NEED);
+    lsqpack_dec_cleanup(&dec);
+
+    free(stream);
+}
+
+
+struct blocked_stream
+{
+    struct dhte                 dhte;
+    unsigned                    ric;
+    int                         unblocked;
+    unsigned char               block[3];
+};
+
+
+static struct blocked_stream *s_unblocked[100];
+static unsigned s_n_unblocked;
+
+
+static void
+blocked_unblocked (void *hblock_ctx_p)
+{
+    struct blocked_stream *const stream = hblock_ctx_p;
+
+    assert(!stream->unblocked);
+    stream->unblocked = 1;
+    s_unblocked[s_n_unblocked++] = stream;
+}
+
+
+static struct lsxpack_header *
+blocked_prepare_decode (void *hblock_ctx_p, struct lsxpack_header *xhdr,
+                                                                size_t space)
+{
+    return dht_prepare_decode(&((struct blocked_stream *) hblock_ctx_p)->dhte,
+                                                                xhdr, space);
+}
+
+
+static int
+blocked_process_header (void *hblock_ctx_p, struct lsxpack_header *xhdr)
+{
+    return dht_process_header(&((struct blocked_stream *) hblock_ctx_p)->dhte,
+                                                                        xhdr);
+}
+
+
+/* Block many streams with different Required Insert Counts, cancel some of
+ * them, and check that encoder stream chunks unblock the rest in order.
+ */
+static void
+test_many_blocked (int defer)
+{
+    struct lsqpack_dec dec;
+    struct blocked_stream streams[60];
+    enum lsqpack_read_header_status rhs;
+    const unsigned char *buf;
+    unsigned char enc_buf[4 * 7];
+    unsigned i, n_inserted, n_expected;
+    void *hblock;
+    int s;
+    const struct lsqpack_dec_hset_if blocked_if = {
+        .dhi_unblocked      = defer ? NULL : blocked_unblocked,
+        .dhi_prepare_decode = blocked_prepare_decode,
+        .dhi_process_header = blocked_process_header,
+    };
+
+    lsqpack_dec_init(&dec, NULL, 0x1000, 100, &blocked_if,
+                                defer ? LSQPACK_DEC_OPT_DEFER_UNBLOCKED : 0);
+
+    for (i = 0; i < sizeof(streams) / sizeof(streams[0]); ++i)
+    {
+        memset(&streams[i], 0, sizeof(streams[i]));
+        streams[i].ric = 1 + (i * 7) % 20;
+        streams[i].block[0] = streams[i].ric + 1;   /* Encoded RIC */
+        streams[i].block[1] = 0;                    /* Base = RIC */
+        streams[i].block[2] = 0x80;                 /* Entry RIC - 1 */
+        buf = streams[i].block;
+        rhs = lsqpack_dec_header_in(&dec, &streams[i], i * 4,
+                        sizeof(streams[i].block), &buf,
+                        sizeof(streams[i].block), NULL, NULL);
+        assert(rhs == LQRHS_BLOCKED);
+    }
+
+    for (i = 0; i < sizeof(streams) / sizeof(streams[0]); i += 5)
+    {
+        s = lsqpack_dec_unref_stream(&dec, &streams[i]);
+        assert(s == 0);
+    }
+
+    /* Each chunk inserts seven entries */
+    for (i = 0; i < 7; ++i)
+        memcpy(enc_buf + i * 4, "\x41" "a" "\x01" "b", 4);
+
+    for (n_inserted = 7; n_inserted <= 21; n_inserted += 7)
+    {
+        s_n_unblocked = 0;
+        s = lsqpack_dec_enc_in(&dec, enc_buf, sizeof(enc_buf));
+        assert(s == 0);
+        if (defer)
+        {
+            assert(s_n_unblocked == 0);
+            while ((hblock = lsqpack_dec_next_unblocked(&dec)))
+                blocked_unblocked(hblock);
+        }
+        n_expected = 0;
+        for (i = 0; i < sizeof(streams) / sizeof(streams[0]); ++i)
+            if (i % 5 != 0 && streams[i].ric <= n_inserted
+                                            && streams[i].ric > n_inserted - 7)
+                ++n_expected;
+        assert(s_n_unblocked == n_expected);
+        for (i = 0; i < s_n_unblocked; ++i)
+        {
+            assert(s_unblocked[i]->ric <= n_inserted);
+            if (i > 0)
+                assert(s_unblocked[i - 1]->ric <= s_unblocked[i]->ric);
+            buf = s_unblocked[i]->block + 1;
+            rhs = lsqpack_dec_header_read(&dec, s_unblocked[i], &buf,
+                        sizeof(s_unblocked[i]->block) - 1, NULL, NULL);
+            assert(rhs == LQRHS_DONE);
+            assert(s_unblocked[i]->dhte.buf_off == 2);
+        }
+    }
+
+    for (i = 0; i < sizeof(streams) / sizeof(streams[0]); ++i)
+        assert(streams[i].unblocked == (i % 5 != 0));
+    assert(NULL == lsqpack_dec_next_unblocked(&dec));
+
+    if (defer)
+    {
+        /* Unreffing a queued header block removes it from the queue */
+        streams[0].block[0] = 22 + 1;
+        buf = streams[0].block;
+        rhs = lsqpack_dec_header_in(&dec, &streams[0], 1000,
+                        sizeof(streams[0].block), &buf,
+                        sizeof(streams[0].block), NULL, NULL);
+        assert(rhs == LQRHS_BLOCKED);
+        s = lsqpack_dec_enc_in(&dec, enc_buf, 4);
+        assert(s == 0);
+        s = lsqpack_dec_unref_stream(&dec, &streams[0]);
+        assert(s == 0);
+        assert(NULL == lsqpack_dec_next_unblocked(&dec));
+    }
+
+    lsqpack_dec_cleanup(&dec);
+}
+
+
+static void
+test_dec_stats (void)
+{
+    struct lsqpack_dec dec;
+    struct lsqpack_dec_stats stats;
+    struct blocked_stream stream;
+    enum lsqpack_read_header_status rhs;
+    const unsigned char *buf;
+    unsigned char enc_buf[0x40];
+    uint64_t work;
+    int s, r;
+    const struct lsqpack_dec_hset_if blocked_if = {
+        .dhi_unblocked      = blocked_unblocked,
+        .dhi_prepare_decode = blocked_prepare_decode,
+        .dhi_process_header = blocked_process_header,
+    };
+
+    lsqpack_dec_init(&dec, NULL, 0x1000, 100, &blocked_if, 0);
+
+    memset(&stream, 0, sizeof(stream));
+    stream.ric = 2;
+    stream.block[0] = stream.ric + 1;   /* Encoded RIC */
+    stream.block[1] = 0;                /* Base = RIC */
+    stream.block[2] = 0x80;             /* Entry RIC - 1 */
+    buf = stream.block;
+    rhs = lsqpack_dec_header_in(&dec, &stream, 0, sizeof(stream.block), &buf,
+                                        sizeof(stream.block), NULL, NULL);
+    assert(rhs == LQRHS_BLOCKED);
+
+    lsqpack_dec_get_stats(&dec, &stats);
+    assert(1 == stats.ds_blocked_cur);
+    assert(1 == stats.ds_blocked_peak);
+    assert(1 == stats.ds_blocked_total);
+    assert(stats.ds_hblock_mem > 0);
+    assert(0 == stats.ds_table_mem);
+    assert(stats.ds_work > 0);
+    work = stats.ds_work;
+
+    /* Insert With Literal Name, then Duplicate in a separate chunk */
+    s = lsqpack_dec_enc_in(&dec, (unsigned char *) "\x41" "a" "\x01" "b", 4);
+    assert(s == 0);
+    s_n_unblocked = 0;
+    s = lsqpack_dec_enc_in(&dec, (unsigned char *) "\x00", 1);
+    assert(s == 0);
+    assert(s_n_unblocked == 1);
+
+    lsqpack_dec_get_stats(&dec, &stats);
+    assert(0 == stats.ds_blocked_cur);
+    assert(1 == stats.ds_blocked_peak);
+    assert(1 == stats.ds_unblocked);
+    assert(2 == stats.ds_unblock_inserts);
+    assert(5 == stats.ds_unblock_bytes);
+    assert(5 == stats.ds_unblock_bytes_max);
+    assert(1 == stats.ds_ins_wonr);
+    assert(1 == stats.ds_ins_dup);
+    assert(0 == stats.ds_ins_winr);
+    assert(5 == stats.ds_enc_bytes);
+    /* Five encoder stream bytes, entry copied by Duplicate, one unblocked */
+    assert(stats.ds_work >= work + 5 + 2 + 1);
+    assert(stats.ds_table_mem >= 2 * 2);
+    assert(stats.ds_ringbuf_mem > 0);
+
+    buf = stream.block + 1;
+    rhs = lsqpack_dec_header_read(&dec, &stream, &buf,
+                                    sizeof(stream.block) - 1, NULL, NULL);
+    assert(rhs == LQRHS_DONE);
+    lsqpack_dec_get_stats(&dec, &stats);
+    assert(0 == stats.ds_hblock_mem);
+
+    /* Insert With Name Reference to static entry with a Huffman value */
+    enc_buf[0] = 0xC0;
+    enc_buf[1] = 0;
+    r = lsqpack_enc_enc_str(7, enc_buf + 1, sizeof(enc_buf) - 1,
+                        (const unsigned char *) "www.example.com", 15);
+    assert(r > 0);
+    assert(enc_buf[1] & 0x80);
+    s = lsqpack_dec_enc_in(&dec, enc_buf, 1 + (size_t) r);
+    assert(s == 0);
+    lsqpack_dec_get_stats(&dec, &stats);
+    assert(1 == stats.ds_ins_winr);
+    assert(stats.ds_huff_fast_bytes + stats.ds_huff_full_bytes
+                                                        == (unsigned) r - 1);
+
+    lsqpack_dec_cleanup(&dec);
+}
+
+
+/* Decoder stream instructions are queued and flushed in one call */
+static void
+test_dec_stream_queue (const struct qpack_header_block_test *test)
+{
+    struct lsqpack_dec dec;
+    struct dhte dhte;
+    enum lsqpack_read_header_status rhs;
+    const unsigned char *buf;
+    unsigned char block[PREFIX_BUF_SZ + HEADER_BUF_SZ];
+    unsigned char out[0x10];
+    size_t block_sz, dec_sz;
+    ssize_t nw;
+    int s;
+    const struct lsqpack_dec_hset_if dht_if = {
+        .dhi_unblocked      = dht_unblocked,
+        .dhi_prepare_decode = dht_prepare_decode,
+        .dhi_process_header = dht_process_header,
+    };
+
+    memcpy(block, test->qhbt_prefix_buf, test->qhbt_prefix_sz);
+    memcpy(block + test->qhbt_prefix_sz, test->qhbt_header_buf,
+                                                    test->qhbt_header_sz);
+    block_sz = test->qhbt_prefix_sz + test->qhbt_header_sz;
+
+    lsqpack_dec_init(&dec, NULL, test->qhbt_table_size,
+                        test->qhbt_max_risked_streams, &dht_if,
+                        LSQPACK_DEC_OPT_QUEUE_DEC_STREAM);
+    lsqpack_dec_set_flush_policy(&dec,
+                        LSQPACK_DEC_FLUSH_COUNT|LSQPACK_DEC_FLUSH_ICI, 3);
+    assert(!lsqpack_dec_flush_ready(&dec));
+    assert(0 == lsqpack_dec_flush_size(&dec));
+
+    /* ICI is pending after insertion... */
+    s = lsqpack_dec_enc_in(&dec, test->qhbt_enc_buf, test->qhbt_enc_sz);
+    assert(s == 0);
+    assert(lsqpack_dec_flush_ready(&dec));
+
+    /* ...until a Section Acknowledgement makes it redundant */
+    dhte.buf_off = 0;
+    buf = block;
+    dec_sz = 1;
+    rhs = lsqpack_dec_header_in(&dec, &dhte, 8, block_sz, &buf, block_sz,
+                                                            NULL, &dec_sz);
+    assert(rhs == LQRHS_DONE);
+    assert(dec_sz == 0);
+    assert(!lsqpack_dec_flush_ready(&dec));
+    nw = lsqpack_dec_cancel_stream_id(&dec, 12, out, sizeof(out));
+    assert(nw == 0);
+    assert(!lsqpack_dec_flush_ready(&dec));
+    nw = lsqpack_dec_cancel_stream_id(&dec, 16, out, sizeof(out));
+    assert(nw == 0);
+    assert(lsqpack_dec_flush_ready(&dec));
+    assert(3 == lsqpack_dec_flush_size(&dec));
+
+    /* Instructions may be split between flushes.  The queue stays ready
+     * until it is drained.
+     */
+    nw = lsqpack_dec_flush(&dec, out, 2);
+    assert(nw == 2);
+    assert(0 == memcmp(out, "\x88\x4C", 2));
+    assert(lsqpack_dec_flush_ready(&dec));
+    nw = lsqpack_dec_flush(&dec, out, sizeof(out));
+    assert(nw == 1);
+    assert(out[0] == 0x50);
+    assert(0 == lsqpack_dec_flush_size(&dec));
+
+    /* Nothing acknowledges the second insertion: ICI is generated */
+    s = lsqpack_dec_enc_in(&dec, test->qhbt_enc_buf, test->qhbt_enc_sz);
+    assert(s == 0);
+    assert(lsqpack_dec_flush_ready(&dec));
+    nw = lsqpack_dec_flush(&dec, out, sizeof(out));
+    assert(nw == 1);
+    assert(out[0] == 0x01);
+    assert(!lsqpack_dec_flush_ready(&dec));
+    assert(0 == lsqpack_dec_flush(&dec, out, sizeof(out)));
+
+    lsqpack_dec_cleanup(&dec);
+}
+
+
 static void
 run_header_cancellation_test(const struct qpack_header_block_test *test) {
     unsigned char header_buf[HEADER_BUF_SZ];
@@ -563,6 +992,468 @@ test_enc_init (void)
 }
 
 
+struct log_counts
+{
+    unsigned    n_msgs[LSQPACK_LOG_NONE];
+};
+
+
+static void
+count_log (void *ctx, enum lsqpack_log_level level, const char *msg,
+                                                                size_t msg_len)
+{
+    struct log_counts *const counts = ctx;
+
+    assert(level < LSQPACK_LOG_NONE);
+    assert(msg_len > 0);
+    assert(strlen(msg) == msg_len);
+    ++counts->n_msgs[level];
+}
+
+
+static void
+test_logger (const struct qpack_header_block_test *test)
+{
+    struct lsqpack_enc enc;
+    struct lsqpack_dec dec;
+    struct log_counts counts;
+    FILE *log_file;
+    unsigned char header_buf[HEADER_BUF_SZ], enc_buf[ENC_BUF_SZ],
+        prefix_buf[PREFIX_BUF_SZ], dec_buf[LSQPACK_LONGEST_SDTC];
+    size_t header_sz, enc_sz, dec_sz;
+    enum lsqpack_enc_status enc_st;
+    struct lsxpack_header xhdr;
+    struct header_buf hbuf;
+    ssize_t nw;
+    int s;
+    const struct lsqpack_dec_hset_if dht_if = {
+        .dhi_unblocked      = dht_unblocked,
+        .dhi_prepare_decode = dht_prepare_decode,
+        .dhi_process_header = dht_process_header,
+    };
+
+    /* Callback set before STAGE_2 initialization is kept */
+    memset(&counts, 0, sizeof(counts));
+    lsqpack_enc_preinit(&enc, NULL);
+    lsqpack_enc_set_logger(&enc, count_log, &counts, LSQPACK_LOG_DEBUG);
+    dec_sz = sizeof(dec_buf);
+    s = lsqpack_enc_init(&enc, NULL, 0x1000, 0x1000, 0,
+                                LSQPACK_ENC_OPT_STAGE_2, dec_buf, &dec_sz);
+    assert(0 == s);
+    assert(counts.n_msgs[LSQPACK_LOG_DEBUG] > 0);
+
+    /* Nothing is formatted below the minimum level */
+    lsqpack_enc_set_logger(&enc, count_log, &counts, LSQPACK_LOG_ERROR);
+    memset(&counts, 0, sizeof(counts));
+    s = lsqpack_enc_start_header(&enc, 0, 0);
+    assert(0 == s);
+    enc_sz = sizeof(enc_buf);
+    header_sz = sizeof(header_buf);
+    hbuf.off = 0;
+    header_set_ptr(&xhdr, &hbuf, "some-header", 11, "some-value", 10);
+    enc_st = lsqpack_enc_encode(&enc, enc_buf, &enc_sz, header_buf,
+                                                    &header_sz, &xhdr, 0);
+    assert(LQES_OK == enc_st);
+    nw = lsqpack_enc_end_header(&enc, prefix_buf, sizeof(prefix_buf), NULL);
+    assert(nw > 0);
+    assert(0 == counts.n_msgs[LSQPACK_LOG_DEBUG]);
+    assert(0 == counts.n_msgs[LSQPACK_LOG_INFO]);
+    lsqpack_enc_cleanup(&enc);
+
+    /* Level set for a FILE logger before STAGE_2 initialization is kept */
+    log_file = tmpfile();
+    assert(log_file);
+    lsqpack_enc_preinit(&enc, NULL);
+    lsqpack_enc_set_logger(&enc, NULL, log_file, LSQPACK_LOG_ERROR);
+    dec_sz = sizeof(dec_buf);
+    s = lsqpack_enc_init(&enc, log_file, 0x1000, 0x1000, 0,
+                                LSQPACK_ENC_OPT_STAGE_2, dec_buf, &dec_sz);
+    assert(0 == s);
+    lsqpack_enc_cleanup(&enc);
+    assert(0 == ftell(log_file));
+    fclose(log_file);
+
+    memset(&counts, 0, sizeof(counts));
+    lsqpack_dec_init(&dec, NULL, test->qhbt_table_size,
+                        test->qhbt_max_risked_streams, &dht_if, 0);
+    lsqpack_dec_set_logger(&dec, count_log, &counts, LSQPACK_LOG_DEBUG);
+    s = lsqpack_dec_enc_in(&dec, test->qhbt_enc_buf, test->qhbt_enc_sz);
+    assert(0 == s);
+    assert(counts.n_msgs[LSQPACK_LOG_DEBUG] > 0);
+
+    /* Setting the flush policy logs at DEBUG */
+    memset(&counts, 0, sizeof(counts));
+    lsqpack_dec_set_flush_policy(&dec, LSQPACK_DEC_FLUSH_TICK, 0);
+    assert(1 == counts.n_msgs[LSQPACK_LOG_DEBUG]);
+
+    /* No callback and no FILE: logging is off */
+    lsqpack_dec_set_logger(&dec, NULL, NULL, LSQPACK_LOG_DEBUG);
+    memset(&counts, 0, sizeof(counts));
+    lsqpack_dec_set_flush_policy(&dec, LSQPACK_DEC_FLUSH_TICK, 0);
+    assert(0 == counts.n_msgs[LSQPACK_LOG_DEBUG]);
+    lsqpack_dec_cleanup(&dec);
+    assert(0 == counts.n_msgs[LSQPACK_LOG_DEBUG]);
+}
+
+
+static void
+test_enc_stats (void)
+{
+    struct lsqpack_enc enc;
+    struct lsqpack_enc_stats stats;
+    unsigned char header_buf[HEADER_BUF_SZ], enc_buf[ENC_BUF_SZ],
+        prefix_buf[PREFIX_BUF_SZ], dec_buf[LSQPACK_LONGEST_SDTC];
+    size_t header_sz, enc_sz, dec_sz, total_hea, total_enc;
+    enum lsqpack_enc_status enc_st;
+    struct lsxpack_header xhdr;
+    struct header_buf hbuf;
+    ssize_t nw;
+    unsigned i;
+    int s;
+    const struct {
+        const char *name, *value;
+    } headers[] = {
+        { ":method", "GET", },                      /* Static full */
+        { ":authority", "www.example.com", },       /* Insert w/ static name */
+        { "x-some-header", "some value", },         /* Insert literal */
+        { "x-some-header", "some value", },         /* Dynamic full */
+    };
+
+    dec_sz = sizeof(dec_buf);
+    s = lsqpack_enc_init(&enc, NULL, 0x1000, 0x1000, 100,
+                                LSQPACK_ENC_OPT_IX_AGGR, dec_buf, &dec_sz);
+    assert(0 == s);
+
+    s = lsqpack_enc_start_header(&enc, 0, 0);
+    assert(0 == s);
+    total_hea = 0;
+    total_enc = 0;
+    hbuf.off = 0;
+    for (i = 0; i < sizeof(headers) / sizeof(headers[0]); ++i)
+    {
+        enc_sz = sizeof(enc_buf);
+        header_sz = sizeof(header_buf);
+        header_set_ptr(&xhdr, &hbuf, headers[i].name, strlen(headers[i].name),
+                                headers[i].value, strlen(headers[i].value));
+        enc_st = lsqpack_enc_encode(&enc, enc_buf, &enc_sz, header_buf,
+                                                    &header_sz, &xhdr, 0);
+        assert(LQES_OK == enc_st);
+        total_hea += header_sz;
+        total_enc += enc_sz;
+    }
+    nw = lsqpack_enc_end_header(&enc, prefix_buf, sizeof(prefix_buf), NULL);
+    assert(nw > 0);
+    total_hea += (size_t) nw;
+
+    lsqpack_enc_get_stats(&enc, &stats);
+    assert(1 == stats.es_static_full);
+    assert(3 == stats.es_dyn_full);
+    assert(0 == stats.es_static_name);
+    assert(0 == stats.es_dyn_name);
+    assert(0 == stats.es_literal);
+    assert(1 == stats.es_ins_nameref_static);
+    assert(1 == stats.es_ins_lit);
+    assert(0 == stats.es_dups);
+    /* One value, then a name and a value: */
+    assert(3 == stats.es_str_huffman + stats.es_str_plain);
+    assert(1 == stats.es_hblocks);
+    assert(1 == stats.es_risked_hblocks);
+    assert(0 == stats.es_evictions);
+    assert(total_hea == stats.es_hea_bytes);
+    assert(total_enc == stats.es_enc_bytes);
+    /* Two entries in the table, one header info array: */
+    assert(stats.es_table_mem >= strlen(":authority") + strlen("www.example.com")
+                            + strlen("x-some-header") + strlen("some value"));
+    assert(stats.es_bucket_mem > 0);
+    assert(stats.es_hinfo_mem > 0);
+
+    lsqpack_enc_cleanup(&enc);
+}
+
+
+/* A field to encode and, once encoded, the number of bytes it wrote to the
+ * encoder stream and the first byte of its representation.
+ */
+struct enc_field
+{
+    const char         *name;
+    const char         *value;
+    size_t              enc_sz;
+    unsigned char       first_byte;
+};
+
+
+/* Encode `fields' in one header block. */
+static void
+enc_block (struct lsqpack_enc *enc, unsigned stream_id,
+                                struct enc_field *fields, unsigned n_fields)
+{
+    unsigned char header_buf[HEADER_BUF_SZ], enc_buf[ENC_BUF_SZ],
+        prefix_buf[PREFIX_BUF_SZ];
+    size_t header_sz, enc_sz;
+    enum lsqpack_enc_status enc_st;
+    struct lsxpack_header xhdr;
+    struct header_buf hbuf;
+    unsigned i;
+    ssize_t nw;
+    int s;
+
+    s = lsqpack_enc_start_header(enc, stream_id, 0);
+    assert(0 == s);
+    hbuf.off = 0;
+    for (i = 0; i < n_fields; ++i)
+    {
+        enc_sz = sizeof(enc_buf);
+        header_sz = sizeof(header_buf);
+        header_set_ptr(&xhdr, &hbuf, fields[i].name, strlen(fields[i].name),
+                            fields[i].value, strlen(fields[i].value));
+        enc_st = lsqpack_enc_encode(enc, enc_buf, &enc_sz, header_buf,
+                                                    &header_sz, &xhdr, 0);
+        assert(LQES_OK == enc_st);
+        assert(header_sz > 0);
+        fields[i].enc_sz = enc_sz;
+        fields[i].first_byte = header_buf[0];
+    }
+    nw = lsqpack_enc_end_header(enc, prefix_buf, sizeof(prefix_buf), NULL);
+    assert(nw > 0);
+}
+
+
+/* In server mode, a new value of a name whose values repeat is inserted
+ * the first time it is seen, while values of a name whose values do not
+ * repeat are never inserted.  The classification is reported in both modes.
+ */
+static void
+test_enc_server (void)
+{
+    struct lsqpack_enc enc;
+    struct lsqpack_enc_stats stats;
+    unsigned char dec_buf[LSQPACK_LONGEST_SDTC];
+    const char *const csp_a = "default-src 'self'; img-src *; "
+                                            "script-src 'self' example.com";
+    const char *const csp_b = "default-src 'self'; img-src * data:; "
+                        "script-src 'self' 'unsafe-eval' static.example.com";
+    struct enc_field fields[2] = {
+        { "content-security-policy", NULL, 0, 0, },
+        { "etag", NULL, 0, 0, },
+    };
+    char etag[0x20];
+    size_t dec_sz;
+    unsigned i, server;
+    int s;
+
+    for (server = 0; server < 2; ++server)
+    {
+        dec_sz = sizeof(dec_buf);
+        s = lsqpack_enc_init(&enc, NULL, 0x4000, 0x4000, 100,
+                    server ? LSQPACK_ENC_OPT_SERVER : 0, dec_buf, &dec_sz);
+        assert(0 == s);
+
+        for (i = 0; i < 6; ++i)
+        {
+            snprintf(etag, sizeof(etag), "\"%08x\"", i * 0x1234567u);
+            fields[0].value = csp_a;
+            fields[1].value = etag;
+            enc_block(&enc, i + 1, fields, 2);
+            /* History decides: inserted on second sight */
+            assert((i == 1) == (fields[0].enc_sz > 0));
+        }
+
+        /* New value with stable name */
+        fields[0].value = csp_b;
+        enc_block(&enc, 7, fields, 2);
+        assert(server == (fields[0].enc_sz > 0));
+        /* Repeated value with volatile name */
+        assert(server == (fields[1].enc_sz == 0));
+
+        assert(LSQPACK_NC_STABLE == lsqpack_enc_get_name_class(&enc,
+                "content-security-policy", strlen("content-security-policy")));
+        /* One repeat in seven is above the 1/8 threshold, but the name
+         * stays volatile until a quarter of its values are repeats.
+         */
+        assert(LSQPACK_NC_VOLATILE == lsqpack_enc_get_name_class(&enc,
+                                                                "etag", 4));
+        assert(LSQPACK_NC_UNKNOWN == lsqpack_enc_get_name_class(&enc,
+                                                                "date", 4));
+        lsqpack_enc_get_stats(&enc, &stats);
+        assert(1 == stats.es_names_stable);
+        assert(1 == stats.es_names_volatile);
+        assert(server == (stats.es_volatile_lits > 0));
+
+        /* Two repeats in eight */
+        enc_block(&enc, 8, fields, 2);
+        assert(LSQPACK_NC_UNKNOWN == lsqpack_enc_get_name_class(&enc,
+                                                                "etag", 4));
+
+        lsqpack_enc_cleanup(&enc);
+    }
+}
+
+
+static void
+test_enc_name_policy (void)
+{
+    struct lsqpack_enc enc;
+    struct enc_field ua = { "user-agent", "Mozilla/5.0", 0, 0, },
+                     trace = { "x-trace", "abc", 0, 0, },
+                     auth = { "authorization", "Basic Zm9v", 0, 0, };
+    unsigned char dec_buf[LSQPACK_LONGEST_SDTC];
+    size_t dec_sz;
+    unsigned i, stream_id;
+    int s;
+
+    dec_sz = sizeof(dec_buf);
+    s = lsqpack_enc_init(&enc, NULL, 0x1000, 0x1000, 100, 0, dec_buf,
+                                                                    &dec_sz);
+    assert(0 == s);
+
+    s = lsqpack_enc_set_name_policy(&enc, "user-agent", 10,
+                                                LSQPACK_NP_ALWAYS_INSERT);
+    assert(0 == s);
+    s = lsqpack_enc_set_name_policy(&enc, "x-trace", 7, LSQPACK_NP_NAME_ONLY);
+    assert(0 == s);
+    s = lsqpack_enc_set_name_policy(&enc, "authorization", 13,
+                                                LSQPACK_NP_NEVER_INDEX);
+    assert(0 == s);
+    s = lsqpack_enc_set_name_policy(&enc, "x-trace", 7,
+                                            (enum lsqpack_name_policy) 100);
+    assert(-1 == s);
+
+    stream_id = 1;
+
+    /* Inserted on first sight */
+    enc_block(&enc, stream_id++, &ua, 1);
+    assert(ua.enc_sz > 0);
+
+    for (i = 0; i < 3; ++i)
+    {
+        /* Value is never inserted, so the field is never indexed */
+        enc_block(&enc, stream_id++, &trace, 1);
+        assert(0 == (trace.first_byte & 0x80));
+        assert(0x10 != (trace.first_byte & 0xF0));
+        /* Never inserted; literal with static name reference and N bit */
+        enc_block(&enc, stream_id++, &auth, 1);
+        assert(0 == auth.enc_sz);
+        assert(0x70 == (auth.first_byte & 0xF0));
+    }
+
+    /* Back to the history: the value seen before is inserted */
+    s = lsqpack_enc_set_name_policy(&enc, "x-trace", 7,
+                                                LSQPACK_NP_HIST_DEFAULT);
+    assert(0 == s);
+    enc_block(&enc, stream_id++, &trace, 1);
+    assert(trace.enc_sz > 0);
+
+    lsqpack_enc_cleanup(&enc);
+}
+
+
+/* A value that recurs at intervals longer than the history covers is only
+ * inserted if the frequency sketch is used.
+ */
+static void
+test_enc_freq_sketch (void)
+{
+    struct lsqpack_enc enc;
+    struct enc_field recurring = { "x-recurring", "some value", 0, 0, },
+                     filler_field = { "x-filler", NULL, 0, 0, };
+    unsigned char dec_buf[LSQPACK_LONGEST_SDTC];
+    char filler[0x20];
+    size_t dec_sz;
+    unsigned i, sketch;
+    int s;
+
+    for (sketch = 0; sketch < 2; ++sketch)
+    {
+        dec_sz = sizeof(dec_buf);
+        s = lsqpack_enc_init(&enc, NULL, 0x1000, 0x1000, 100,
+                sketch ? LSQPACK_ENC_OPT_FREQ_SKETCH : 0, dec_buf, &dec_sz);
+        assert(0 == s);
+
+        /* History holds 0x1000 / 32 / 3 = 42 fields */
+        for (i = 0; i <= 60; ++i)
+            if (i % 60 == 0)
+            {
+                enc_block(&enc, i + 1, &recurring, 1);
+                assert((i > 0 && sketch) == (recurring.enc_sz > 0));
+            }
+            else
+            {
+                snprintf(filler, sizeof(filler), "%u", i * 0x1234567u);
+                filler_field.value = filler;
+                enc_block(&enc, i + 1, &filler_field, 1);
+            }
+
+        lsqpack_enc_cleanup(&enc);
+    }
+}
+
+
+static void
+test_prof (void)
+{
+    struct lsqpack_prof_hist hist;
+    struct lsqpack_enc enc;
+    const struct lsqpack_prof_hist *enc_hist;
+    unsigned char header_buf[HEADER_BUF_SZ], enc_buf[ENC_BUF_SZ];
+    size_t header_sz, enc_sz;
+    enum lsqpack_enc_status enc_st;
+    struct lsxpack_header xhdr;
+    struct header_buf hbuf;
+    unsigned idx;
+    int s;
+
+    /* Bucket floors are increasing and exact for small values */
+    for (idx = 0; idx < 8; ++idx)
+        assert(lsqpack_prof_bucket_floor(idx) == idx);
+    for (idx = 1; idx < 63 << LSQPACK_PROF_SUB_BITS; ++idx)
+        assert(lsqpack_prof_bucket_floor(idx - 1)
+                                        < lsqpack_prof_bucket_floor(idx));
+    assert(lsqpack_prof_bucket_floor(8) == 8);
+    assert(lsqpack_prof_bucket_floor(9) == 10);
+
+    /* 90 values in bucket 3, 9 in bucket 20, 1 in bucket 40 */
+    memset(&hist, 0, sizeof(hist));
+    hist.ph_count = 100;
+    hist.ph_buckets[3] = 90;
+    hist.ph_buckets[20] = 9;
+    hist.ph_buckets[40] = 1;
+    assert(lsqpack_prof_quantile(&hist, 0.5) == 3);
+    assert(lsqpack_prof_quantile(&hist, 0.9) == 3);
+    assert(lsqpack_prof_quantile(&hist, 0.99)
+                                        == lsqpack_prof_bucket_floor(20));
+    assert(lsqpack_prof_quantile(&hist, 0.999)
+                                        == lsqpack_prof_bucket_floor(40));
+
+    /* Histograms are allocated by init, not by preinit */
+    lsqpack_enc_preinit(&enc, NULL);
+    assert(!lsqpack_enc_prof_hist(&enc, LSQPACK_PROF_ENC_ENCODE));
+    lsqpack_enc_cleanup(&enc);
+
+    s = lsqpack_enc_init(&enc, NULL, 0, 0, 0, 0, NULL, NULL);
+    assert(0 == s);
+    s = lsqpack_enc_start_header(&enc, 0, 0);
+    assert(0 == s);
+    enc_sz = sizeof(enc_buf);
+    header_sz = sizeof(header_buf);
+    hbuf.off = 0;
+    header_set_ptr(&xhdr, &hbuf, "some-header", 11, "some-value", 10);
+    enc_st = lsqpack_enc_encode(&enc, enc_buf, &enc_sz, header_buf,
+                                                    &header_sz, &xhdr, 0);
+    assert(LQES_OK == enc_st);
+    enc_hist = lsqpack_enc_prof_hist(&enc, LSQPACK_PROF_ENC_ENCODE);
+#if LSQPACK_PROFILE
+    assert(enc_hist);
+    assert(enc_hist->ph_count == 1);
+    enc_hist = lsqpack_enc_prof_hist(&enc, LSQPACK_PROF_ENC_STRING);
+    assert(enc_hist->ph_count == 2);
+#else
+    assert(!enc_hist);
+#endif
+    lsqpack_enc_cleanup(&enc);
+}
+
+
 /* Test that push promise header does not use the dynamic table, nor does
  * it update history.
  */
@@ -984,7 +1875,8 @@ test_enc_risked_streams_test (const char *test)
         unsigned seqno;
     } seqnos[10], *seq_el;
     unsigned char buf[0x100];
-    unsigned char *end_cmd;
+    unsigned char batch_buf[0x100];
+    unsigned char *end_cmd, *batch;
     int expect_failure;
     struct lsxpack_header xhdr;
     struct header_buf hbuf;
@@ -1003,6 +1895,7 @@ test_enc_risked_streams_test (const char *test)
     fprintf(stderr, "BEGIN TEST %s\n", test);
     lsqpack_enc_preinit(&enc, stderr);
     hbuf.off = 0;
+    batch = NULL;
 
     while (1)
     {
@@ -1054,6 +1947,12 @@ test_enc_risked_streams_test (const char *test)
             arg = strtol(test, (char**)&test, 10);
             buf[0] = 0x80;
             end_cmd = lsqpack_enc_int(buf, buf + sizeof(buf), arg, 7);
+            if (batch)
+            {
+                memcpy(batch, buf, end_cmd - buf);
+                batch += end_cmd - buf;
+                break;
+            }
             s = lsqpack_enc_decoder_in(&enc, buf, end_cmd - buf);
             if (expect_failure)
                 assert(s < 0);
@@ -1065,6 +1964,12 @@ test_enc_risked_streams_test (const char *test)
             arg = strtol(test, (char**)&test, 10);
             buf[0] = 0x40;
             end_cmd = lsqpack_enc_int(buf, buf + sizeof(buf), arg, 6);
+            if (batch)
+            {
+                memcpy(batch, buf, end_cmd - buf);
+                batch += end_cmd - buf;
+                break;
+            }
             s = lsqpack_enc_decoder_in(&enc, buf, end_cmd - buf);
             if (expect_failure)
                 assert(s < 0);
@@ -1076,12 +1981,29 @@ test_enc_risked_streams_test (const char *test)
             arg = strtol(test, (char**)&test, 10);
             buf[0] = 0x00;
             end_cmd = lsqpack_enc_int(buf, buf + sizeof(buf), arg, 6);
+            if (batch)
+            {
+                memcpy(batch, buf, end_cmd - buf);
+                batch += end_cmd - buf;
+                break;
+            }
             s = lsqpack_enc_decoder_in(&enc, buf, end_cmd - buf);
             if (expect_failure)
                 assert(s < 0);
             else
                 assert(s == 0);
             break;
+        case 'b':   /* Begin batch: instructions are fed in one chunk */
+            batch = batch_buf;
+            break;
+        case 'f':   /* Feed batch */
+        case 'F':
+            s = lsqpack_enc_decoder_in(&enc, batch_buf, batch - batch_buf);
+            if (expect_failure)
+                assert(s < 0);
+            else
+                assert(s == 0);
+            batch = NULL;
             break;
         case '\0':
             goto end;
@@ -1126,6 +2048,28 @@ test_enc_risked_streams (void)
         "n1r0"
         ,
 
+        /* Acks, ICI, and cancellation in a single decoder stream chunk */
+        "i3r0s1c0c1c2er0"
+        "s2c0er1"
+        "s3c1er2"
+        "s4c2er3"
+        "ba2a3l4fr0"
+        ,
+
+        "i3r0s1c0c1c2er0"
+        "s2c0er1"
+        "s3c1er2"
+        "s4c2er3"
+        "bn3a3l4fr0"
+        "s5c0er0"
+        ,
+
+        "i3r0s1c0c1c2er0"
+        "s2c0er1"
+        "s3c1er2"
+        "ba3l2a2Fr0"
+        ,
+
         NULL,
     };
 
@@ -1134,6 +2078,351 @@ test_enc_risked_streams (void)
 }
 
 
+#if LSQPACK_CAPTURE
+/* Header block being decoded during capture test */
+struct capture_stream
+{
+    struct dhte                 dhte;       /* Must be first */
+    unsigned                    n_unblocked;
+};
+
+
+static void
+capture_unblocked (void *hblock_ctx_p)
+{
+    ++((struct capture_stream *) hblock_ctx_p)->n_unblocked;
+}
+
+
+static const struct lsqpack_dec_hset_if capture_if = {
+    .dhi_unblocked      = capture_unblocked,
+    .dhi_prepare_decode = dht_prepare_decode,
+    .dhi_process_header = dht_process_header,
+};
+
+
+static unsigned char *
+capture_read (FILE *file, size_t *sz)
+{
+    unsigned char *buf;
+    long len;
+
+    assert(0 == fflush(file));
+    len = ftell(file);
+    assert(len > 0);
+    buf = malloc((size_t) len);
+    assert(buf);
+    rewind(file);
+    assert((size_t) len == fread(buf, 1, (size_t) len, file));
+    *sz = (size_t) len;
+    return buf;
+}
+
+
+static const unsigned char *
+capture_find (const unsigned char *buf, size_t sz, const char *str)
+{
+    const size_t len = strlen(str);
+    size_t off;
+
+    for (off = 0; off + len <= sz; ++off)
+        if (0 == memcmp(buf + off, str, len))
+            return buf + off;
+    return NULL;
+}
+
+
+static int
+capture_has (const unsigned char *buf, size_t sz, const char *str)
+{
+    return capture_find(buf, sz, str) != NULL;
+}
+
+
+static const unsigned char *
+capture_varint (const unsigned char *p, uint64_t *val)
+{
+    unsigned shift;
+
+    *val = 0;
+    for (shift = 0; *p & 0x80; shift += 7)
+        *val |= (uint64_t) (*p++ & 0x7F) << shift;
+    *val |= (uint64_t) *p++ << shift;
+    return p;
+}
+
+
+/* Feed decoder capture to a fresh decoder, the way bin/capture-replay.c
+ * does.  There is a single header block.
+ */
+static void
+capture_replay_dec (const unsigned char *p, size_t sz,
+                                                struct capture_stream *stream)
+{
+    const unsigned char *const end = p + sz;
+    const unsigned char *buf;
+    struct lsqpack_dec dec;
+    uint64_t max_capacity, max_risked, opts, val, header_size;
+    enum lsqpack_read_header_status rhs;
+    unsigned char dec_buf[LSQPACK_LONGEST_HEADER_ACK];
+    size_t dec_sz;
+    unsigned type;
+    int s;
+
+    assert(0 == memcmp(p, "QCAP", 4));
+    assert(p[4] == 1 && p[5] == 0 && p[6] == LSQPACK_CAPTURE_REDACT);
+    p = capture_varint(p + 7, &max_capacity);
+    p = capture_varint(p, &max_risked);
+    p = capture_varint(p, &opts);
+    lsqpack_dec_init(&dec, NULL, (unsigned) max_capacity,
+            (unsigned) max_risked, &capture_if, (enum lsqpack_dec_opts) opts);
+
+    rhs = LQRHS_NEED;
+    while (p < end)
+    {
+        type = *p++;
+        p = capture_varint(p, &val);    /* Time */
+        if (type != LSQPACK_CAP_DEC_ENC_IN)
+        {
+            p = capture_varint(p, &val);
+            assert(val == 0);           /* Stream ID */
+        }
+        if (type == LSQPACK_CAP_DEC_HEADER_IN)
+            p = capture_varint(p, &header_size);
+        p = capture_varint(p, &val);
+        buf = p;
+        p += val;
+        dec_sz = sizeof(dec_buf);
+        switch (type)
+        {
+        case LSQPACK_CAP_DEC_ENC_IN:
+            s = lsqpack_dec_enc_in(&dec, buf, (size_t) val);
+            assert(0 == s);
+            break;
+        case LSQPACK_CAP_DEC_HEADER_IN:
+            rhs = lsqpack_dec_header_in(&dec, stream, 0,
+                    (size_t) header_size, &buf, (size_t) val, dec_buf, &dec_sz);
+            break;
+        default:
+            assert(type == LSQPACK_CAP_DEC_HEADER_READ);
+            rhs = lsqpack_dec_header_read(&dec, stream, &buf, (size_t) val,
+                                                            dec_buf, &dec_sz);
+            break;
+        }
+    }
+    assert(p == end);
+    assert(rhs == LQRHS_DONE);
+    lsqpack_dec_cleanup(&dec);
+}
+
+
+/* Capture encoder and decoder input with redaction.  The Huffman-encoded
+ * value on the encoder stream is split between two chunks and the header
+ * block is blocked.
+ */
+static void
+test_capture (void)
+{
+    static const char expected[] =
+        "x-secret: hunter2-password\r\nx-plain: {~}|{~}|{~}|\r\n";
+    struct lsqpack_enc enc;
+    struct lsqpack_dec dec;
+    struct capture_stream stream, replayed;
+    struct lsxpack_header xhdr;
+    struct header_buf hbuf;
+    FILE *enc_cap, *dec_cap;
+    unsigned char enc_buf[ENC_BUF_SZ], header_buf[HEADER_BUF_SZ + PREFIX_BUF_SZ],
+                  prefix_buf[PREFIX_BUF_SZ], tsu_buf[LSQPACK_LONGEST_SDTC],
+                  dec_buf[LSQPACK_LONGEST_HEADER_ACK], *cap_buf;
+    const unsigned char *buf;
+    size_t enc_off, hea_off, enc_sz, hea_sz, tsu_sz, dec_sz, cap_sz;
+    enum lsqpack_read_header_status rhs;
+    enum lsqpack_enc_status es;
+    ssize_t pref_sz;
+    int s;
+
+    enc_cap = tmpfile();
+    dec_cap = tmpfile();
+    assert(enc_cap && dec_cap);
+
+    tsu_sz = sizeof(tsu_buf);
+    s = lsqpack_enc_init(&enc, NULL, 0x1000, 0x1000, 100,
+                                LSQPACK_ENC_OPT_IX_AGGR, tsu_buf, &tsu_sz);
+    assert(0 == s);
+    s = lsqpack_enc_capture(&enc, enc_cap, LSQPACK_CAPTURE_REDACT);
+    assert(0 == s);
+    s = lsqpack_enc_start_header(&enc, 0, 0);
+    assert(0 == s);
+    hbuf.off = 0;
+    enc_off = hea_off = 0;
+    header_set_ptr(&xhdr, &hbuf, "x-secret", 8, "hunter2-password", 16);
+    enc_sz = sizeof(enc_buf) - enc_off;
+    hea_sz = HEADER_BUF_SZ - hea_off;
+    es = lsqpack_enc_encode(&enc, enc_buf + enc_off, &enc_sz,
+        header_buf + PREFIX_BUF_SZ + hea_off, &hea_sz, &xhdr, 0);
+    assert(LQES_OK == es);
+    enc_off += enc_sz;
+    hea_off += hea_sz;
+    header_set_ptr(&xhdr, &hbuf, "x-plain", 7, "{~}|{~}|{~}|", 12);
+    enc_sz = sizeof(enc_buf) - enc_off;
+    hea_sz = HEADER_BUF_SZ - hea_off;
+    es = lsqpack_enc_encode(&enc, enc_buf + enc_off, &enc_sz,
+        header_buf + PREFIX_BUF_SZ + hea_off, &hea_sz, &xhdr, 0);
+    assert(LQES_OK == es);
+    enc_off += enc_sz;
+    hea_off += hea_sz;
+    pref_sz = lsqpack_enc_end_header(&enc, prefix_buf, sizeof(prefix_buf),
+                                                                        NULL);
+    assert(pref_sz > 0);
+    assert(enc_off > 0);
+    memcpy(header_buf + PREFIX_BUF_SZ - pref_sz, prefix_buf, pref_sz);
+    lsqpack_enc_cleanup(&enc);
+
+    /* Names are kept, values are not */
+    cap_buf = capture_read(enc_cap, &cap_sz);
+    assert(0 == memcmp(cap_buf, "QCAP", 4));
+    assert(cap_buf[5] == 1);
+    assert(capture_has(cap_buf, cap_sz, "x-secret"));
+    assert(capture_has(cap_buf, cap_sz, "x-plain"));
+    assert(!capture_has(cap_buf, cap_sz, "hunter2"));
+    assert(!capture_has(cap_buf, cap_sz, "{~}|"));
+    free(cap_buf);
+
+    memset(&stream, 0, sizeof(stream));
+    lsqpack_dec_init(&dec, NULL, 0x1000, 100, &capture_if,
+                                                    LSQPACK_DEC_OPT_HTTP1X);
+    s = lsqpack_dec_capture(&dec, dec_cap, LSQPACK_CAPTURE_REDACT);
+    assert(0 == s);
+    buf = header_buf + PREFIX_BUF_SZ - pref_sz;
+    dec_sz = sizeof(dec_buf);
+    rhs = lsqpack_dec_header_in(&dec, &stream, 0, pref_sz + hea_off, &buf,
+                                        pref_sz + hea_off, dec_buf, &dec_sz);
+    assert(LQRHS_BLOCKED == rhs);
+    s = lsqpack_dec_enc_in(&dec, enc_buf, enc_off / 2);
+    assert(0 == s);
+    s = lsqpack_dec_enc_in(&dec, enc_buf + enc_off / 2,
+                                                    enc_off - enc_off / 2);
+    assert(0 == s);
+    assert(stream.n_unblocked == 1);
+    dec_sz = sizeof(dec_buf);
+    rhs = lsqpack_dec_header_read(&dec, &stream, &buf,
+                header_buf + PREFIX_BUF_SZ + hea_off - buf, dec_buf, &dec_sz);
+    assert(LQRHS_DONE == rhs);
+    /* Decoder input itself is not modified */
+    stream.dhte.buf[stream.dhte.buf_off] = '\0';
+    assert(0 == strcmp(stream.dhte.buf, expected));
+    lsqpack_dec_cleanup(&dec);
+
+    cap_buf = capture_read(dec_cap, &cap_sz);
+    assert(!capture_has(cap_buf, cap_sz, "{~}|"));
+    assert(capture_has(cap_buf, cap_sz, "xxxxxxxxxxxx"));
+
+    /* Replay yields values of the same length */
+    memset(&replayed, 0, sizeof(replayed));
+    capture_replay_dec(cap_buf, cap_sz, &replayed);
+    assert(replayed.n_unblocked == 1);
+    assert(replayed.dhte.buf_off == sizeof(expected) - 1);
+    replayed.dhte.buf[replayed.dhte.buf_off] = '\0';
+    assert(0 == strncmp(replayed.dhte.buf, "x-secret: ", 10));
+    assert(0 != strncmp(replayed.dhte.buf + 10, "hunter2-password", 16));
+    assert(0 == strcmp(replayed.dhte.buf + 28,
+                                            "x-plain: xxxxxxxxxxxx\r\n"));
+    free(cap_buf);
+
+    (void) fclose(enc_cap);
+    (void) fclose(dec_cap);
+}
+
+
+/* Redact `x-secret: hunter2-password' in a new encoder capture and return
+ * the filler that replaced the value.
+ */
+static void
+capture_redacted_value (char filler[16])
+{
+    struct lsqpack_enc enc;
+    struct lsxpack_header xhdr;
+    struct header_buf hbuf;
+    FILE *enc_cap;
+    unsigned char enc_buf[ENC_BUF_SZ], header_buf[HEADER_BUF_SZ],
+                  prefix_buf[PREFIX_BUF_SZ], tsu_buf[LSQPACK_LONGEST_SDTC],
+                  *cap_buf;
+    const unsigned char *name;
+    size_t enc_sz, hea_sz, tsu_sz, cap_sz;
+    enum lsqpack_enc_status es;
+    ssize_t pref_sz;
+    int s;
+
+    enc_cap = tmpfile();
+    assert(enc_cap);
+    tsu_sz = sizeof(tsu_buf);
+    s = lsqpack_enc_init(&enc, NULL, 0x1000, 0x1000, 100,
+                                LSQPACK_ENC_OPT_IX_AGGR, tsu_buf, &tsu_sz);
+    assert(0 == s);
+    s = lsqpack_enc_capture(&enc, enc_cap, LSQPACK_CAPTURE_REDACT);
+    assert(0 == s);
+    s = lsqpack_enc_start_header(&enc, 0, 0);
+    assert(0 == s);
+    hbuf.off = 0;
+    header_set_ptr(&xhdr, &hbuf, "x-secret", 8, "hunter2-password", 16);
+    enc_sz = sizeof(enc_buf);
+    hea_sz = sizeof(header_buf);
+    es = lsqpack_enc_encode(&enc, enc_buf, &enc_sz, header_buf, &hea_sz,
+                                                                    &xhdr, 0);
+    assert(LQES_OK == es);
+    pref_sz = lsqpack_enc_end_header(&enc, prefix_buf, sizeof(prefix_buf),
+                                                                        NULL);
+    assert(pref_sz > 0);
+    lsqpack_enc_cleanup(&enc);
+
+    cap_buf = capture_read(enc_cap, &cap_sz);
+    name = capture_find(cap_buf, cap_sz, "x-secret");
+    assert(name && name + 8 + 16 <= cap_buf + cap_sz);
+    memcpy(filler, name + 8, 16);
+    free(cap_buf);
+    (void) fclose(enc_cap);
+}
+
+
+/* The same value is redacted differently in different captures */
+static void
+test_capture_salt (void)
+{
+    char filler[2][16];
+
+    capture_redacted_value(filler[0]);
+    capture_redacted_value(filler[1]);
+    assert(0 != memcmp(filler[0], "hunter2-password", 16));
+    assert(0 != memcmp(filler[0], filler[1], 16));
+}
+#else
+/* Without capture support, starting a capture fails */
+static void
+test_capture (void)
+{
+    struct lsqpack_enc enc;
+    struct lsqpack_dec dec;
+    FILE *cap;
+    int s;
+
+    cap = tmpfile();
+    assert(cap);
+    s = lsqpack_enc_init(&enc, NULL, 0, 0, 0, 0, NULL, NULL);
+    assert(0 == s);
+    s = lsqpack_enc_capture(&enc, cap, 0);
+    assert(-1 == s && ENOTSUP == errno);
+    assert(0 == lsqpack_enc_capture(&enc, NULL, 0));
+    lsqpack_enc_cleanup(&enc);
+    lsqpack_dec_init(&dec, NULL, 0, 0, &hset_if, 0);
+    s = lsqpack_dec_capture(&dec, cap, 0);
+    assert(-1 == s && ENOTSUP == errno);
+    lsqpack_dec_cleanup(&dec);
+    assert(0 == ftell(cap));
+    (void) fclose(cap);
+}
+#endif
+
+
 int
 main (void)
 {
@@ -1147,7 +2436,18 @@ main (void)
     }
 
     run_header_cancellation_test(&header_block_tests[0]);
+    test_hblock_storage(&header_block_tests[3]);
+    test_many_blocked(0);
+    test_many_blocked(1);
+    test_dec_stats();
+    test_dec_stream_queue(&header_block_tests[3]);
     test_enc_init();
+    test_logger(&header_block_tests[3]);
+    test_enc_stats();
+    test_enc_server();
+    test_enc_name_policy();
+    test_enc_freq_sketch();
+    test_prof();
     test_push_promise();
     test_discard_header(0);
     test_discard_header(1);
@@ -1165,6 +2465,10 @@ main (void)
     test_dec_header_too_short(0);
     test_dec_header_too_short(1);
     test_enc_risked_streams();
+    test_capture();
+#if LSQPACK_CAPTURE
+    test_capture_salt();
+#endif
 
     return 0;
 }
@@ -21,6 +21,6 @@ if [[ ! -f "$build_dir/CMakeCache.txt" ]]; then
         -DLSQPACK_BIN=ON
 fi
 
-cmake --build "$build_dir" --target fuzz-decode -j "$build_jobs"
+cmake --build "$build_dir" --target fuzz-decode fuzz-decode-cost -j "$build_jobs"
 
 echo "$repo_dir/$build_dir/bin/fuzz-decode"
@@ -0,0 +1,99 @@
+#!/usr/bin/env bash
+#
+# Reduce a corpus to its slowest inputs.
+#
+# Every input is run through fuzz-decode-cost and ranked by decoder work per
+# byte.  The slowest ones are copied to the output directory.  With
+# MINIMIZE_TRIM=1, each kept input is then shrunk by removing byte ranges as
+# long as its work per byte does not go down.
+#
+# Usage: minimize_slow_inputs.sh OUTPUT_DIR INPUT_DIR...
+#
+# Environment:
+#   COST_TARGET     fuzz-decode-cost binary; defaults to the AFL build
+#   COST_ARGS       Target arguments, e.g. "-i preamble -t 4096 -s 100"
+#   MINIMIZE_KEEP   Number of inputs to keep; defaults to 50
+#   MINIMIZE_TRIM   Set to 1 to shrink the kept inputs
+set -euo pipefail
+
+repo_dir=$(CDPATH= cd -- "$(dirname -- "$0")/../.." && pwd)
+
+if (( $# < 2 )); then
+    echo "usage: $0 OUTPUT_DIR INPUT_DIR..." >&2
+    exit 1
+fi
+out_dir=$1
+shift
+
+target=${COST_TARGET:-"$repo_dir/build-afl/bin/fuzz-decode-cost"}
+if [[ ! -x "$target" ]]; then
+    echo "target is not executable: $target" >&2
+    echo "run tools/afl/build_decode_target.sh first or set COST_TARGET" >&2
+    exit 1
+fi
+read -ra target_args <<<"${COST_ARGS:-}"
+keep=${MINIMIZE_KEEP:-50}
+
+# Print work per byte of a file, or 0 if it cannot be decoded
+cost()
+{
+    "$target" "${target_args[@]}" -v -f "$1" 2>/dev/null \
+        | awk '/^total:/ { sub("per_byte=", "", $4); print $4; found = 1 }
+               END { if (!found) print 0 }'
+}
+
+work_dir=$(mktemp -d)
+trap 'rm -rf "$work_dir"' EXIT
+
+# Rank by cost; identical inputs are only counted once
+declare -A seen
+for dir in "$@"; do
+    for file in "$dir"/*; do
+        [[ -f "$file" && -s "$file" ]] || continue
+        sum=$(cksum <"$file")
+        [[ -z "${seen[$sum]:-}" ]] || continue
+        seen[$sum]=1
+        printf '%s\t%s\n' "$(cost "$file")" "$file"
+    done
+done | sort -t $'\t' -k1,1gr | head -n "$keep" >"$work_dir/ranked"
+
+mkdir -p "$out_dir"
+n=0
+while IFS=$'\t' read -r per_byte file; do
+    dst=$(printf '%s/slow_%03u,cost_%s' "$out_dir" "$n" "$per_byte")
+    cp "$file" "$dst"
+    echo "$per_byte $file -> $dst"
+    n=$((n + 1))
+done <"$work_dir/ranked"
+
+if [[ "${MINIMIZE_TRIM:-0}" != 1 ]]; then
+    exit 0
+fi
+
+# Remove ranges of halving size from each file while the cost holds
+for file in "$out_dir"/slow_*; do
+    best=$(cost "$file")
+    size=$(stat -c %s "$file")
+    chunk=$((size / 2))
+    while (( chunk > 0 )); do
+        off=0
+        while (( off < size )); do
+            {
+                head -c "$off" "$file"
+                tail -c +$((off + chunk + 1)) "$file"
+            } >"$work_dir/candidate"
+            new=$(cost "$work_dir/candidate")
+            if [[ -s "$work_dir/candidate" ]] \
+                    && awk -v a="$new" -v b="$best" 'BEGIN { exit !(a >= b) }'
+            then
+                cp "$work_dir/candidate" "$file"
+                best=$new
+                size=$(stat -c %s "$file")
+            else
+                off=$((off + chunk))
+            fi
+        done
+        chunk=$((chunk / 2))
+    done
+    echo "trimmed $file to $size bytes, cost $best"
+done
@@ -119,6 +119,11 @@ for ((i = 0; i < AFL_JOBS; ++i)); do
     if (( i > 0 && i % 2 == 1 )); then
         target_args+=(-H)
     fi
+    # E.g. AFL_TARGET=build-afl/bin/fuzz-decode-cost AFL_TARGET_ARGS="-w 20"
+    if [[ -n "${AFL_TARGET_ARGS:-}" ]]; then
+        read -ra extra_args <<<"$AFL_TARGET_ARGS"
+        target_args+=("${extra_args[@]}")
+    fi
 
     cmd=(afl-fuzz "${afl_opts[@]}" -- "$target" "${target_args[@]}")
     log="$log_dir/$name.log"
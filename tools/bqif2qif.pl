@@ -0,0 +1,53 @@
+#!/usr/bin/env perl
+#
+# bqif2qif.pl -- convert BQIF file to QIF
+#
+# Each header list is printed followed by an empty line.  See bin/bqif.h for
+# the layout.
+#
+# Usage: bqif2qif.pl [file] [--output FILE]
+
+use strict;
+use warnings;
+
+use Getopt::Long;
+
+my $output;
+GetOptions("output=s" => \$output);
+
+if (defined($output)) {
+    open STDOUT, ">", $output or die "cannot open $output for writing: $!";
+}
+binmode STDOUT;
+binmode STDIN;
+
+my $buf = do { local $/; <> };
+die "empty input\n" unless defined $buf;
+
+my ($magic, $version, $n_lists, $reserved) = unpack "a4VVV", $buf;
+die "not a BQIF file\n" unless defined $reserved and $magic eq "BQIF";
+die "unsupported BQIF version $version\n" unless $version == 1;
+die "truncated index\n" if length($buf) < 16 + 8 * ($n_lists + 1);
+
+for my $list (0 .. $n_lists - 1) {
+    my ($lo, $hi, $next_lo, $next_hi)
+                                = unpack "VVVV", substr $buf, 16 + 8 * $list;
+    my $off = $lo + $hi * 2**32;
+    my $end = $next_lo + $next_hi * 2**32;
+    die "bad offset of header list $list\n"
+        if $off + 4 > $end or $end > length $buf;
+    my $n_fields = unpack "V", substr $buf, $off, 4;
+    $off += 4;
+    while ($n_fields-- > 0) {
+        die "header list $list is truncated\n" if $off + 4 > $end;
+        my ($name_len, $val_len) = unpack "vv", substr $buf, $off, 4;
+        $off += 4;
+        die "header list $list is truncated\n"
+                                        if $off + $name_len + $val_len > $end;
+        print substr($buf, $off, $name_len), "\t",
+              substr($buf, $off + $name_len, $val_len), "\n";
+        $off += $name_len + $val_len;
+    }
+    die "garbage at the end of header list $list\n" if $off != $end;
+    print "\n";
+}
@@ -0,0 +1,56 @@
+#!/usr/bin/env perl
+#
+# qif2bqif.pl -- convert QIF file to BQIF
+#
+# BQIF is the binary form of QIF that interop-encode and the benchmarks can
+# use in place, without parsing text.  See bin/bqif.h for the layout.
+# Comments and annotations are dropped.
+#
+# Usage: qif2bqif.pl [files] [--output FILE]
+
+use strict;
+use warnings;
+
+use Getopt::Long;
+
+my $output;
+GetOptions("output=s" => \$output);
+
+if (defined($output)) {
+    open STDOUT, ">", $output or die "cannot open $output for writing: $!";
+}
+binmode STDOUT;
+
+my (@lists, @fields);
+while (<>) {
+    chomp;
+    if ($_ eq '') {
+        push @lists, [ @fields ] if @fields;
+        @fields = ();
+        next;
+    }
+    next if /^#/;
+    my ($name, $value) = split /\t/, $_, 2;
+    die "no TAB on line $.\n" unless defined $value;
+    die "name or value too long on line $.\n"
+        if length($name) > 0xFFFF or length($value) > 0xFFFF;
+    push @fields, [ $name, $value ];
+}
+push @lists, [ @fields ] if @fields;
+
+my @bodies = map {
+    pack("V", scalar @$_) . join "", map {
+        pack("vv", length($$_[0]), length($$_[1])) . $$_[0] . $$_[1]
+    } @$_
+} @lists;
+
+# 64-bit offsets are written as two 32-bit halves, so that this works with
+# Perl built without 64-bit integers.
+my $off = 16 + 8 * (@bodies + 1);
+my $index = '';
+for (@bodies, '') {
+    $index .= pack("VV", $off % 2**32, int($off / 2**32));
+    $off += length;
+}
+
+print "BQIF", pack("VVV", 1, scalar @bodies, 0), $index, @bodies;